@@ -24,6 +24,20 @@ constexpr uint32_t LFS_DISK_VERSION = 0x00020000;
 constexpr uint32_t LFS_DISK_VERSION_MAJOR = (0xffff & (LFS_DISK_VERSION >> 16));
 constexpr uint32_t LFS_DISK_VERSION_MINOR = (0xffff & (LFS_DISK_VERSION >>  0));
 
+// Version of images that may hold LFS_TYPE_EXTSTRUCT files, so that v2.0
+// drivers refuse them instead of taking the extent lists, holes included,
+// for something else. Formats with the extent layout write it, others are
+// raised to it before their first extent list is committed.
+constexpr uint32_t LFS_DISK_VERSION_EXTENTS = 0x00020001;
+constexpr uint32_t LFS_DISK_VERSION_EXTENTS_MINOR = (0xffff & (LFS_DISK_VERSION_EXTENTS >> 0));
+
+// Version written while the superblock references a free map, past the
+// v2.1 of other drivers so that they refuse the image instead of changing
+// it and leaving a stale map behind. Dropping the map goes back to the
+// version the image had without it.
+constexpr uint32_t LFS_DISK_VERSION_FREE_MAP = 0x00020002;
+constexpr uint32_t LFS_DISK_VERSION_FREE_MAP_MINOR = (0xffff & (LFS_DISK_VERSION_FREE_MAP >> 0));
+
 
 /// Definitions ///
 
@@ -57,9 +71,16 @@ constexpr uint64_t LFS_FILE_MAX = 0x7fffffffffffffff;
 // no real benefit to using a smaller LFS_ATTR_MAX. Limited to <= 1022.
 constexpr uint64_t LFS_ATTR_MAX = 1022;
 
+// Maximum number of regions handed to read_batch at once, larger file reads
+// are split into batches of this many. Bounds the stack used to build one.
+constexpr uint32_t LFS_READ_BATCH_MAX = 16;
+
 // some constants used throughout the code
 constexpr lfs_block_t LFS_BLOCK_NULL = ((lfs_block_t)-1);
 constexpr lfs_block_t LFS_BLOCK_INLINE = ((lfs_block_t)-2);
+constexpr lfs_size_t LFS_DENTRY_NULL = ((lfs_size_t)-1);
+constexpr uint32_t LFS_TAG_RECORD_NULL = ((uint32_t)-1);
+constexpr uint32_t LFS_COMPACT_NULL = ((uint32_t)-1);
 
 enum {
     LFS_OK_RELOCATED = 1,
@@ -118,6 +139,7 @@ enum lfs_type {
     LFS_TYPE_DIRSTRUCT    = 0x200,  //
     LFS_TYPE_CTZSTRUCT    = 0x202,  //
     LFS_TYPE_INLINESTRUCT = 0x201,  //
+    LFS_TYPE_EXTSTRUCT    = 0x203,  //
     LFS_TYPE_CREATE       = 0x401,  //
     LFS_TYPE_DELETE       = 0x4ff,  //
     LFS_TYPE_SOFTTAIL     = 0x600,  //
@@ -144,6 +166,23 @@ enum lfs_open_flags {
     LFS_F_READING = 0x040000, // File has been read since last flush
     LFS_F_ERRED = 0x080000, // An error occurred during write
     LFS_F_INLINE = 0x100000, // Currently inlined in directory entry
+    LFS_F_EXTENT = 0x200000, // Data is described by an extent list
+    LFS_F_BATCHSYNC = 0x400000, // Synced in a batch, committed by lfs_batch_end
+    LFS_F_BATCHHELD = 0x800000, // Closed in a batch, held until lfs_batch_end
+};
+
+// File data layouts
+enum lfs_file_layout {
+    LFS_LAYOUT_CTZ = 0,     // Skip-list with pointers at the head of each block
+    LFS_LAYOUT_EXTENT = 1,  // List of contiguous block ranges in the metadata
+};
+
+// Checks of programmed data against what was programmed
+enum lfs_verify_mode {
+    LFS_VERIFY_ALWAYS = 0,  // Read every program back and compare it
+    LFS_VERIFY_NEVER = 1,   // Trust the device, programs can't fail silently
+    LFS_VERIFY_SAMPLED = 2, // Read back one in verify_interval programs
+    LFS_VERIFY_CRC = 3,     // Compare crcs, with the device's crc when it has one
 };
 
 // File seek flags
@@ -164,12 +203,28 @@ struct lfs_fs_parent_match_t;
 struct lfs_info;
 struct lfs_user_attribute_t;
 struct lfs_file_config_t;
+struct lfs_iovec_t;
+struct lfs_bd_request_t;
 struct lfs_cache_t;
+struct lfs_read_slot_t;
+struct lfs_reader_t;
 struct lfs_metadata_dir_t;
 struct lfs_metadata_list_t;
+struct lfs_dentry_t;
+struct lfs_tag_record_t;
+struct lfs_tag_index_t;
+struct lfs_compact_record_t;
+struct lfs_compact_table_t;
 struct lfs_dir_t;
 struct lfs_ctz_t;
+struct lfs_index_cache_t;
+struct lfs_extent_t;
+struct lfs_extent_list_t;
+struct lfs_readahead_span_t;
+struct lfs_readahead_t;
 struct lfs_file_t;
+struct lfs_tx_entry_t;
+struct lfs_tx_t;
 struct lfs_superblock_t;
 struct lfs_gstate_t;
 struct lfs_free_t;
@@ -292,6 +347,168 @@ struct lfs_config_t {
     // can help bound the metadata compaction time. Must be <= block_size.
     // Defaults to block_size when zero.
     lfs_size_t metadata_max;
+
+    // Optional upper limit on RAM in bytes used to cache the block index of
+    // open CTZ files. Each open file keeps a table mapping ctz block indices
+    // to block addresses, so seeks and reads don't have to walk the skip-list
+    // from the file's head. The budget is shared by all open files, the least
+    // recently used table is evicted first. Disabled when zero.
+    lfs_size_t index_cache_size;
+
+    // Layout of files once they outgrow their inline limit. Files keep the
+    // layout they were written with, so existing CTZ files can still be read
+    // and appended to with extents selected. Defaults to LFS_LAYOUT_CTZ.
+    lfs_file_layout file_layout;
+
+    // Optional number of read cache slots, each cache_size in bytes. The read
+    // cache shared by metadata operations and file copies then keeps that many
+    // regions at once, the least recently used is replaced first. Defaults
+    // to a single slot, the read_buffer, when zero.
+    lfs_size_t read_cache_count;
+
+    // Optional number of read cache slots kept for metadata pairs. Reads of
+    // file data never replace these, and metadata never replaces the rest.
+    // Must be less than read_cache_count. When zero, any slot may hold either.
+    lfs_size_t read_cache_metadata;
+
+    // Optionally track free blocks of the whole device in one RAM bitmap, a
+    // bit per block, instead of a lookahead_size window of it. The bitmap is
+    // built with one traversal of the filesystem and then only rebuilt once
+    // allocation has gone through every block in it, where the lookahead
+    // needs a traversal for every window. lookahead_buffer is unused when
+    // set, the bitmap is allocated and grown with the filesystem.
+    bool free_map;
+
+    // Optional number of private read caches, each cache_size in bytes, for
+    // operations holding lock_shared. These never touch the shared read
+    // cache, each takes a private one for its duration and an operation
+    // that finds all of them taken waits for lock instead. Shared locking
+    // is disabled when zero.
+    lfs_size_t reader_count;
+
+    // Optional growth policy of devices that grow through allocate_block,
+    // see lfs_fs_growsize. Each growth adds grow_percent of the current
+    // block count but at least grow_min blocks, so a device grown in
+    // proportion to its size needs few superblock commits to reach a large
+    // size. Defaults to fixed steps of 10 blocks when both are zero.
+    lfs_size_t grow_min;
+    lfs_size_t grow_percent;
+
+    // Optional percentage of the device in use at which the allocator calls
+    // allocate_block ahead of running out of space, rather than once a full
+    // pass over the device has found nothing free. Checked whenever the
+    // allocation window covers the whole device, which is always the case
+    // with free_map, and acted on at the start of the next operation that
+    // creates, removes or renames an entry. Disabled when zero.
+    lfs_size_t grow_watermark;
+
+    // How programs of file data and metadata commits are checked, see
+    // lfs_verify_mode. Defaults to LFS_VERIFY_ALWAYS, reading every program
+    // back. Devices whose programs can't fail silently, such as RAM, can
+    // skip the check or only check a sample of programs.
+    lfs_verify_mode verify;
+
+    // Optional number of programs per one checked with LFS_VERIFY_SAMPLED.
+    // Defaults to 16 when zero.
+    lfs_size_t verify_interval;
+
+    // Optional upper limit in bytes on how far a file reads ahead of
+    // sequential reads. A file reading on from where its last read ended
+    // reads a window of the blocks ahead with one batch into a buffer of
+    // this size, the window doubling with every read-ahead until it reaches
+    // this size and dropping back after a seek. Reads larger than the window
+    // go straight to the device. Disabled when zero.
+    lfs_size_t readahead_size;
+
+    // Optional number of entries in the path lookup cache. Every name a
+    // path lookup resolves is kept with the directory it was looked up in
+    // and the metadata pair it was found in, so a path whose directories
+    // are cached only fetches the pair of its last name, and a name found
+    // missing is not searched for again. An entry is dropped once its pair
+    // is committed to. Each entry takes about name_max_length + 160 bytes.
+    // Disabled when zero.
+    lfs_size_t dentry_cache_size;
+
+    // Optional number of metadata blocks whose tags are indexed at once.
+    // Fetching a metadata pair records the latest tag of each type and id
+    // in its log, and commits appended to the log add theirs, so getting a
+    // name, struct or attribute of an entry is a lookup rather than a walk
+    // back through the log. An index takes about 12 bytes per tag in the
+    // log, the least recently used is replaced first. Disabled when zero.
+    lfs_size_t tag_index_count;
+
+    // Optional table compaction of metadata pairs. Compacting works out
+    // which tags of the log are still live in one backward pass over a table
+    // of the tags and the entries they belong to, where otherwise every tag
+    // is checked against the rest of the log, which is quadratic in the
+    // length of the log. The table takes about 24 bytes per tag while a pair
+    // is compacted, the nested traversal is used when it can't be allocated.
+    // What is written is the same either way.
+    bool compact_table;
+
+    // Optional size in bytes a metadata log has to grow past for lfs_fs_gc
+    // to compact its pair ahead of time, so the commit that would find the
+    // pair full doesn't have to. Defaults to 7/8 of the metadata block when
+    // zero, -1 leaves compaction to the commits that need it.
+    lfs_size_t compact_thresh;
+
+    // Optional number of metadata commits that share one device sync. A
+    // commit flushes what it programmed, but only every sync_group-th one
+    // calls sync, the ones in between are made durable by it or by
+    // lfs_fs_sync. littlefs already counts on programs reaching the device
+    // in order, so a power loss loses the commits since the last sync and
+    // nothing before them. Every commit syncs when zero or one, -1 leaves
+    // syncing to lfs_fs_sync, lfs_batch_end and lfs_unmount.
+    lfs_size_t sync_group;
+
+    // Optional, copy a region of one block into another block. The
+    // destination must have previously been erased, the regions never
+    // overlap. When NULL, data is moved through the caches instead.
+    // Negative error codes are propagated to the user.
+    // May return LFS_ERR_CORRUPT if the destination block should be
+    // considered bad.
+    int (*copy)(const lfs_config_t* c, lfs_block_t block, lfs_off_t offset,
+        lfs_block_t src_block, lfs_off_t src_offset, lfs_size_t size);
+
+    // Optional, borrow a pointer to size bytes at an offset in a block of a
+    // device that is mapped into memory. Reads are then copied and crcs
+    // computed straight out of it, skipping read and the read caches. The
+    // pointer has to stay valid until the device is next grown with
+    // allocate_block, the region never crosses an erase_size boundary.
+    // Returning NULL falls back to read for that region.
+    const void* (*map)(const lfs_config_t* c, lfs_block_t block,
+        lfs_off_t offset, lfs_size_t size);
+
+    // Optional, read several regions at once and return once all of them
+    // have completed, so a device with a submission queue can have them in
+    // flight together. Regions follow the same rules as read and never
+    // cross an erase_size boundary. Used for reads of several blocks of a
+    // file and both blocks of a metadata pair, when NULL these are read
+    // one at a time with read. Negative error codes are propagated to the
+    // user.
+    int (*read_batch)(const lfs_config_t* c, const lfs_bd_request_t* requests,
+        lfs_size_t count);
+
+    // Optional, crc a region of a block as the device holds it, continuing
+    // from *crc. Used by LFS_VERIFY_CRC to check programs without reading
+    // them back, when NULL the region is read and crced instead. Regions
+    // never cross an erase_size boundary. Negative error codes are
+    // propagated to the user.
+    int (*crc)(const lfs_config_t* c, lfs_block_t block, lfs_off_t offset,
+        lfs_size_t size, uint32_t* crc);
+
+    // Optional, lock the underlying block device shared with other readers.
+    // lfs_file_read, lfs_stat, lfs_dir_read and lfs_get_attribute then take
+    // this instead of lock, so they run alongside each other but never
+    // alongside an operation holding lock. Reads of a file with writes still
+    // to flush take lock, and a file or directory handle may still only be
+    // used by one thread at a time. Requires reader_count, every operation
+    // takes lock when NULL. Negative error codes are propagated to the user.
+    int (*lock_shared)(const lfs_config_t* c);
+
+    // Optional, unlock the shared lock taken with lock_shared. Negative
+    // error codes are propagated to the user.
+    int (*unlock_shared)(const lfs_config_t* c);
 };
 
 // operations on attributes in attribute lists
@@ -411,6 +628,16 @@ struct lfs_fsinfo {
 
     // Upper limit on the size of custom attributes in bytes.
     lfs_size_t attr_max;
+
+    // Number of lookups in the read cache since mount that found their data
+    // cached, and that had to go to the block device.
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+
+    // Number of names since mount that path lookups found in the path
+    // lookup cache, and that had to be searched for in their directory.
+    uint64_t dentry_hits;
+    uint64_t dentry_misses;
 };
 
 
@@ -428,6 +655,26 @@ struct lfs_user_attribute_t {
     lfs_size_t size;
 };
 
+// Buffer of a vectored read or write, see lfs_file_readv and lfs_file_writev
+struct lfs_iovec_t {
+    // Pointer to the buffer, only read from by lfs_file_writev
+    void* buffer;
+
+    // Size of the buffer in bytes
+    lfs_size_t size;
+};
+
+// Region of a block read as part of a batch, see lfs_config_t::read_batch
+struct lfs_bd_request_t {
+    // Block and offset in it to read from
+    lfs_block_t block;
+    lfs_off_t offset;
+
+    // Buffer to read into and its size in bytes
+    void* buffer;
+    lfs_size_t size;
+};
+
 // Optional configuration provided during lfs_file_opencfg
 struct lfs_file_config_t {
 
@@ -479,6 +726,42 @@ struct lfs_cache_t {
 
 };
 
+// Extra slot of the shared read cache
+struct lfs_read_slot_t {
+
+    /*
+        cache of the slot, unused for slot 0 which is lfs_t::read_cache
+    */
+    lfs_cache_t cache;
+
+    /*
+        last use, the least recently used slot is replaced first
+    */
+    uint32_t tick;
+
+};
+
+// private read cache of an operation holding the shared lock
+struct lfs_reader_t {
+
+    /*
+        cache used in place of the shared read cache
+    */
+    lfs_cache_t cache;
+
+    /*
+        nonzero while an operation holds it, only changed atomically
+    */
+    volatile uint32_t busy;
+
+    /*
+        hits and misses of the cache, counted with the shared read cache's
+    */
+    uint64_t hits;
+    uint64_t misses;
+
+};
+
 //Discrabes metadata entry
 struct lfs_metadata_dir_t {
 
@@ -518,12 +801,279 @@ struct lfs_metadata_dir_t {
 
 };
 
+// tag in the log of an indexed metadata block
+struct lfs_tag_record_t {
+
+    /*
+        tag as written, its id is the one the entry had then
+    */
+    lfs_tag_t tag;
+
+    /*
+        offset of the tag in the block
+    */
+    lfs_off_t offset;
+
+    /*
+        next newest record of the same id, LFS_TAG_RECORD_NULL at the end
+    */
+    uint32_t next;
+
+};
+
+// latest tag of each type and id in the log of a metadata block
+struct lfs_tag_index_t {
+
+    /*
+        block, revision, end of the log and etag there the index is of,
+        block is LFS_BLOCK_NULL while unused and offset zero while building
+    */
+    lfs_block_t block;
+    uint32_t revision_count;
+    lfs_off_t offset;
+    uint32_t etag;
+
+    /*
+        newest record of each id, numbered as after the last commit
+    */
+    uint32_t* ids;
+    uint32_t id_count;
+    uint32_t id_capacity;
+
+    /*
+        records of the tags, those from applied on wait for the crc of
+        their commit
+    */
+    lfs_tag_record_t* records;
+    uint32_t record_count;
+    uint32_t record_capacity;
+    uint32_t applied;
+
+    /*
+        last use, the least recently used index is replaced first
+    */
+    uint32_t tick;
+
+};
+
+// tag of a log or attribute list being compacted
+struct lfs_compact_record_t {
+
+    /*
+        tag as traversed, tags of the log carry the disk bit
+    */
+    lfs_tag_t tag;
+
+    /*
+        entry the tag belongs to, LFS_COMPACT_NULL for tags without an id
+    */
+    uint32_t entry;
+
+    /*
+        data of an attribute, for a tag of the log the offset of its data
+        and for a move the index of the table of the log it moves from
+    */
+    const void* buffer;
+    lfs_off_t offset;
+
+};
+
+// live tags of a log and attribute list, with the ids they end up at
+struct lfs_compact_table_t {
+
+    /*
+        block the log is read from
+    */
+    lfs_block_t block;
+
+    /*
+        live tags in the order they are written out
+    */
+    lfs_compact_record_t* records;
+    uint32_t record_count;
+    uint32_t record_capacity;
+
+    /*
+        entry at each id, as after the last tag
+    */
+    uint32_t* ids;
+    uint32_t id_count;
+    uint32_t id_capacity;
+
+    /*
+        id each entry ends up at, LFS_COMPACT_NULL once it is deleted
+    */
+    uint32_t* entries;
+    uint32_t entry_count;
+    uint32_t entry_capacity;
+
+    /*
+        tables of the logs moved from
+    */
+    lfs_compact_table_t* moves;
+    uint32_t move_count;
+
+};
+
+// name cached by the path lookup cache
+struct lfs_dentry_t {
+
+    /*
+        head pair of the directory the name was looked up in
+    */
+    lfs_block_t parent[2];
+
+    /*
+        pair the name was found in as fetched, for a missing name the last
+        pair of the directory, where it would be created
+    */
+    lfs_metadata_dir_t dir;
+
+    /*
+        head pair of the directory the name is, null until it is looked into
+    */
+    lfs_block_t child[2];
+
+    /*
+        tag of the name, LFS_ERR_NOENT when it is missing
+    */
+    lfs_stag_t tag;
+
+    /*
+        id of the name in dir, or where it would be inserted
+    */
+    uint16_t id;
+
+    /*
+        length of name, zero while the entry is unused
+    */
+    uint16_t size;
+
+    /*
+        hash of parent and name, next entry in the same bucket
+    */
+    uint32_t hash;
+    lfs_size_t next;
+
+    /*
+        flush epoch and stamps of the pairs of dir and parent it was found
+        under, it is stale once any has changed
+    */
+    uint32_t epoch;
+    uint32_t commits;
+    uint32_t erases;
+
+    /*
+        used since the clock hand last passed, kept over the next eviction
+    */
+    bool referenced;
+
+    /*
+        name_max_length bytes following the entries
+    */
+    char* name;
+
+};
+
 
 struct lfs_ctz_t {
     lfs_block_t head;
     lfs_size_t size;
 };
 
+// cached ctz block index of an open file
+struct lfs_index_cache_t {
+
+    /*
+        block of every (1 << shift)'th ctz index, LFS_BLOCK_NULL if unknown
+    */
+    lfs_block_t* blocks;
+
+    /*
+        number of entries in blocks
+    */
+    lfs_size_t count;
+
+    /*
+        log2 of the ctz index distance between entries
+    */
+    uint8_t shift;
+
+    /*
+        last use, oldest table is evicted first
+    */
+    uint32_t tick;
+
+    /*
+        lookups that started from a cached block, and that had to walk
+        the skip-list from the head
+    */
+    uint64_t hits;
+    uint64_t misses;
+};
+
+// contiguous range of blocks holding file data, or a hole of a sparse file
+// with LFS_BLOCK_NULL as start
+struct lfs_extent_t {
+    lfs_block_t start;
+    lfs_size_t count;
+};
+
+struct lfs_extent_list_t {
+
+    /*
+        extents in file order
+    */
+    lfs_extent_t* extents;
+
+    /*
+        number of extents
+    */
+    lfs_size_t count;
+
+    /*
+        number of allocated extents
+    */
+    lfs_size_t capacity;
+
+    /*
+        extent of the last lookup and its first block index
+    */
+    lfs_size_t hint;
+    lfs_off_t hint_index;
+};
+
+// file data held in a read-ahead buffer
+struct lfs_readahead_span_t {
+    lfs_off_t pos;
+    lfs_size_t size;
+    lfs_size_t offset;
+};
+
+struct lfs_readahead_t {
+
+    /*
+        readahead_size bytes, allocated on the first read-ahead
+    */
+    uint8_t* buffer;
+
+    /*
+        spans of the file in buffer, one per block read
+    */
+    lfs_readahead_span_t spans[LFS_READ_BATCH_MAX];
+    lfs_size_t count;
+
+    /*
+        bytes read ahead by the last read-ahead, 0 after random access
+    */
+    lfs_size_t window;
+
+    /*
+        file position the last read ended at
+    */
+    lfs_off_t next;
+};
+
 // littlefs directory type
 
 struct lfs_metadata_list_t {
@@ -568,6 +1118,9 @@ struct lfs_file_t :
         LFS_F_READING
         LFS_F_ERRED
         LFS_F_INLINE
+        LFS_F_EXTENT
+        LFS_F_BATCHSYNC
+        LFS_F_BATCHHELD
     */
     uint32_t flags;
 
@@ -591,12 +1144,48 @@ struct lfs_file_t :
     */
     lfs_cache_t cache;
 
+    /*
+        ctz block index cache
+    */
+    lfs_index_cache_t index;
+
+    /*
+        extents of the flushed file, LFS_F_EXTENT only
+    */
+    lfs_extent_list_t extents;
+
+    /*
+        extents of the file being written, LFS_F_EXTENT only
+    */
+    lfs_extent_list_t wextents;
+
+    /*
+        data read ahead of sequential reads
+    */
+    lfs_readahead_t readahead;
+
+    /*
+        blocks set aside by lfs_file_fallocate, the file's writes take
+        them before allocating any
+    */
+    lfs_extent_t reserved;
+
     /*
         root config
     */
     const lfs_file_config_t* cfg;
 };
 
+// littlefs transaction, see lfs_tx_begin
+struct lfs_tx_t {
+
+    // operations queued, one for each path, in the order the paths were
+    // first given
+    lfs_tx_entry_t* entries;
+    lfs_tx_entry_t* last;
+    lfs_size_t count;
+};
+
 struct lfs_superblock_t {
 
     uint32_t version;
@@ -605,6 +1194,13 @@ struct lfs_superblock_t {
     lfs_size_t name_max_length;
     lfs_size_t file_max_size;
     lfs_size_t attr_max_size;
+
+    // free map checkpointed at the last unmount, zero size when there is
+    // none. The reference is dropped before anything else is committed, so
+    // a map that is referenced is always up to date
+    lfs_block_t free_map_head;
+    lfs_size_t free_map_size;
+    lfs_block_t free_map_offset;
 };
 
 struct lfs_gstate_t {
@@ -621,6 +1217,13 @@ struct lfs_free_t {
     lfs_block_t i;
     lfs_block_t ack;
     uint64_t* buffer;
+    lfs_block_t capacity; /*blocks the buffer has room for when it is a free map*/
+    lfs_ctz_t map; /*free map referenced from the superblock, zero size when there is none*/
+    bool releasing; /*the reference to map is being dropped*/
+    bool grow; /*the last window over the whole device found it past grow_watermark*/
+    lfs_block_t want; /*run lfs_alloc_range is growing the device for, a growth is at least this*/
+    bool growing; /*allocate_block is called from an allocation, a commit may be under way*/
+    bool grown; /*the superblock is still to be told of a growth*/
 
 };
 
@@ -631,6 +1234,21 @@ struct lfs_t {
     lfs_cache_t read_cache;
     lfs_cache_t write_cache;
 
+    // slots of the shared read cache when there is more than one, the
+    // metadata pair fetched last and the cache's hit counters
+    lfs_read_slot_t* read_slots;
+    lfs_size_t read_last;
+    lfs_block_t read_pair[2];
+    uint32_t read_tick;
+    uint64_t read_hits;
+    uint64_t read_misses;
+
+    // programs seen by LFS_VERIFY_SAMPLED
+    uint32_t verify_tick;
+
+    // private read caches of operations holding the shared lock
+    lfs_reader_t* readers;
+
     lfs_block_t root[2];
 
     // affected metadata list
@@ -644,6 +1262,43 @@ struct lfs_t {
 
     lfs_free_t free;
 
+    // path lookup cache, its hash buckets, the stamps of blocks committed
+    // to and compacted, the clock hand evicting it, the epoch and gstate
+    // its entries were found under and its hit counters
+    lfs_dentry_t* dentries;
+    lfs_size_t* dentry_buckets;
+    uint32_t* dentry_commits;
+    uint32_t* dentry_erases;
+    lfs_size_t dentry_mask;
+    lfs_size_t dentry_hand;
+    uint32_t dentry_epoch;
+    lfs_gstate_t dentry_gstate;
+    uint64_t dentry_hits;
+    uint64_t dentry_misses;
+
+    // tag indexes of metadata blocks, their clock and the lookups that
+    // found an index of the log and that had to build one
+    lfs_tag_index_t* tag_indexes;
+    uint32_t tag_index_tick;
+    uint64_t tag_index_hits;
+    uint64_t tag_index_misses;
+
+    // commits to metadata so far, and the metadata pair lfs_fs_gcstep goes
+    // on from with the count it was taken at, a commit since may have
+    // moved it
+    uint32_t commit_stamp;
+    lfs_block_t gc_pair[2];
+    uint32_t gc_stamp;
+
+    // commits made since the last device sync, and how deep the open
+    // batches are nested
+    lfs_size_t sync_pending;
+    uint32_t batch_depth;
+
+    // bytes used by and clock of the file index caches
+    lfs_size_t index_cache_used;
+    uint32_t index_cache_tick;
+
     lfs_config_t* cfg;
 
     lfs_size_t erase_size;
@@ -653,6 +1308,10 @@ struct lfs_t {
     lfs_size_t name_max_length;
     lfs_size_t file_max_size;
     lfs_size_t attr_max_size;
+
+    // on-disk version the image needs without a free map, raised by
+    // lfs_fs_raiseversion
+    uint32_t disk_version;
 };
 
 
@@ -663,7 +1322,16 @@ struct lfs_t {
 int lfs_alloc_lookahead(void* p, lfs_block_t block);
 void lfs_alloc_ack(lfs_t* lfs);
 void lfs_alloc_drop(lfs_t* lfs);
+int lfs_alloc_window(lfs_t* lfs, lfs_block_t* window);
+int lfs_alloc_load(lfs_t* lfs, lfs_block_t offset);
+int lfs_alloc_checkpoint(lfs_t* lfs);
+int lfs_alloc_release(lfs_t* lfs);
+void lfs_alloc_growahead(lfs_t* lfs);
 int lfs_alloc(lfs_t* lfs, lfs_block_t* block);
+int lfs_alloc_range(lfs_t* lfs, lfs_size_t count, lfs_extent_t* range);
+int lfs_alloc_take(lfs_t* lfs, lfs_extent_t* range, lfs_block_t* block);
+void lfs_alloc_unreserve(lfs_t* lfs, lfs_extent_t* range);
+int lfs_alloc_fill(lfs_t* lfs);
 
 //device
 int lfs_bd_read(lfs_t* lfs,
@@ -674,13 +1342,32 @@ int lfs_bd_cmp(lfs_t* lfs,
     const lfs_cache_t* write_cache, lfs_cache_t* read_cache, lfs_size_t hint,
     lfs_block_t block, lfs_off_t offset,
     const void* buffer, lfs_size_t size);
+int lfs_bd_crc(lfs_t* lfs,
+    const lfs_cache_t* write_cache, lfs_cache_t* read_cache, lfs_size_t hint,
+    lfs_block_t block, lfs_off_t offset, lfs_size_t size, uint32_t* crc);
+const uint8_t* lfs_bd_map(lfs_t* lfs, lfs_block_t block, lfs_off_t offset, lfs_size_t size);
+int lfs_bd_readbatch(lfs_t* lfs, const lfs_bd_request_t* requests, lfs_size_t count);
+int lfs_bd_prefetch(lfs_t* lfs, const lfs_block_t* blocks, lfs_size_t count, lfs_size_t hint);
+bool lfs_bd_verifying(lfs_t* lfs);
+int lfs_bd_verifycrc(lfs_t* lfs, lfs_cache_t* read_cache, lfs_size_t hint,
+    lfs_block_t block, lfs_off_t offset, lfs_size_t size, uint32_t* crc);
 int lfs_bd_flush(lfs_t* lfs, lfs_cache_t* write_cache, lfs_cache_t* read_cache, bool validate);
 int lfs_bd_sync(lfs_t* lfs, lfs_cache_t* write_cache, lfs_cache_t* read_cache, bool validate);
+int lfs_bd_groupsync(lfs_t* lfs, lfs_cache_t* write_cache, lfs_cache_t* read_cache);
+int lfs_bd_syncpending(lfs_t* lfs);
 int lfs_bd_write(lfs_t* lfs,
     lfs_cache_t* write_cache, lfs_cache_t* read_cache, bool validate,
     lfs_block_t block, lfs_off_t offset,
     const void* buffer, lfs_size_t size);
+int lfs_bd_copy(lfs_t* lfs,
+    lfs_cache_t* write_cache, lfs_cache_t* read_cache, bool validate,
+    lfs_block_t block, lfs_off_t offset,
+    const lfs_cache_t* src_cache, lfs_block_t src_block, lfs_off_t src_offset,
+    lfs_size_t size);
 int lfs_bd_erase(lfs_t* lfs, lfs_block_t block);
+lfs_reader_t* lfs_reader_begin(lfs_t* lfs);
+void lfs_reader_end(lfs_t* lfs, lfs_reader_t* reader);
+lfs_reader_t* lfs_reader_current(lfs_t* lfs);
 
 //metadata
 lfs_stag_t lfs_dir_getslice(lfs_t* lfs, const lfs_metadata_dir_t* dir,
@@ -707,6 +1394,30 @@ int lfs_dir_getgstate(lfs_t* lfs, const lfs_metadata_dir_t* dir, lfs_gstate_t* g
 int lfs_dir_getinfo(lfs_t* lfs, lfs_metadata_dir_t* dir, uint16_t id, lfs_info* info);
 int lfs_dir_find_match(void* data, lfs_tag_t tag, const void* buffer);
 lfs_stag_t lfs_dir_find(lfs_t* lfs, lfs_metadata_dir_t* dir, const char** path, uint16_t* id);
+void lfs_dentry_drop(lfs_t* lfs, const lfs_block_t pair[2], bool erased);
+void lfs_dentry_flush(lfs_t* lfs);
+
+//metadata tag index
+lfs_tag_index_t* lfs_tag_index_begin(lfs_t* lfs, const lfs_metadata_dir_t* dir);
+bool lfs_tag_index_push(lfs_t* lfs, lfs_tag_index_t* index, lfs_tag_t tag, lfs_off_t offset);
+bool lfs_tag_index_apply(lfs_t* lfs, lfs_tag_index_t* index);
+void lfs_tag_index_finish(lfs_t* lfs, lfs_tag_index_t* index, const lfs_metadata_dir_t* dir);
+void lfs_tag_index_extend(lfs_t* lfs, const lfs_metadata_dir_t* dir, lfs_off_t offset, uint32_t etag);
+void lfs_tag_index_drop(lfs_t* lfs, lfs_block_t block);
+int lfs_tag_index_build(lfs_t* lfs, lfs_tag_index_t* index, const lfs_metadata_dir_t* dir);
+void lfs_tag_index_clear(lfs_tag_index_t* index);
+void lfs_tag_index_release(lfs_t* lfs);
+lfs_tag_index_t* lfs_tag_index_find(lfs_t* lfs, const lfs_metadata_dir_t* dir, lfs_tag_t gmask, lfs_tag_t gtag);
+lfs_stag_t lfs_tag_index_get(const lfs_tag_index_t* index, lfs_tag_t gmask, lfs_tag_t gtag, lfs_off_t* offset);
+
+//metadata compaction table
+int lfs_compact_table_build(lfs_t* lfs, lfs_compact_table_t* table,
+    const lfs_metadata_dir_t* dir, const lfs_metadata_attribute_t* attrs, int attrcount,
+    lfs_tag_t tmask, lfs_tag_t ttag);
+int lfs_compact_table_traverse(lfs_t* lfs, const lfs_compact_table_t* table,
+    uint16_t begin, uint16_t end, int16_t diff,
+    int (*cb)(void* data, lfs_tag_t tag, const void* buffer), void* data);
+void lfs_compact_table_release(lfs_compact_table_t* table);
 
 
 //commit
@@ -717,13 +1428,13 @@ int lfs_dir_alloc(lfs_t* lfs, lfs_metadata_dir_t* dir);
 int lfs_dir_drop(lfs_t* lfs, lfs_metadata_dir_t* dir, lfs_metadata_dir_t* tail);
 int lfs_dir_split(lfs_t* lfs,
     lfs_metadata_dir_t* dir, const lfs_metadata_attribute_t* attrs, int attrcount,
-    lfs_metadata_dir_t* source, uint16_t split, uint16_t end);
+    lfs_metadata_dir_t* source, uint16_t split, uint16_t end, const lfs_compact_table_t* table);
 int lfs_dir_commit_size(void* p, lfs_tag_t tag, const void* buffer);
 int lfs_dir_commit_commit(void* p, lfs_tag_t tag, const void* buffer);
 bool lfs_dir_needs_relocation(lfs_t* lfs, lfs_metadata_dir_t* dir);
 int lfs_dir_compact(lfs_t* lfs,
     lfs_metadata_dir_t* dir, const lfs_metadata_attribute_t* attrs, int attrcount,
-    lfs_metadata_dir_t* source, uint16_t begin, uint16_t end);
+    lfs_metadata_dir_t* source, uint16_t begin, uint16_t end, const lfs_compact_table_t* table);
 int lfs_dir_splittingcompact(lfs_t* lfs, lfs_metadata_dir_t* dir,
     const lfs_metadata_attribute_t* attrs, int attrcount,
     lfs_metadata_dir_t* source, uint16_t begin, uint16_t end);
@@ -737,25 +1448,49 @@ int lfs_dir_rawcreate(lfs_t* lfs, const char* path);
 int lfs_dir_rawopen(lfs_t* lfs, lfs_dir_t* dir, const char* path);
 int lfs_dir_rawclose(lfs_t* lfs, lfs_dir_t* dir);
 int lfs_dir_rawread(lfs_t* lfs, lfs_dir_t* dir, lfs_info* info);
+lfs_ssize_t lfs_dir_rawreadbatch(lfs_t* lfs, lfs_dir_t* dir, lfs_info* info, lfs_size_t count);
 int lfs_dir_rawseek(lfs_t* lfs, lfs_dir_t* dir, lfs_off_t offset);
 lfs_soff_t lfs_dir_rawtell(lfs_t* lfs, lfs_dir_t* dir);
 int lfs_dir_rawrewind(lfs_t* lfs, lfs_dir_t* dir);
 
 //file index
 int lfs_ctz_index(lfs_t* lfs, lfs_off_t* offset);
+void lfs_index_cache_drop(lfs_t* lfs, lfs_index_cache_t* index, lfs_off_t from);
+void lfs_index_cache_release(lfs_t* lfs, lfs_index_cache_t* index);
 int lfs_ctz_find(lfs_t* lfs,
-    const lfs_cache_t* write_cache, lfs_cache_t* read_cache,
+    const lfs_cache_t* write_cache, lfs_cache_t* read_cache, lfs_index_cache_t* index,
     lfs_block_t head, lfs_size_t size,
     lfs_size_t pos, lfs_block_t* block, lfs_off_t* offset);
 int lfs_ctz_extend(lfs_t* lfs,
-    lfs_cache_t* write_cache, lfs_cache_t* read_cache,
-    lfs_block_t head, lfs_size_t size,
+    lfs_cache_t* write_cache, lfs_cache_t* read_cache, lfs_index_cache_t* index,
+    lfs_extent_t* reserved, lfs_block_t head, lfs_size_t size,
     lfs_block_t* block, lfs_off_t* offset);
 int lfs_ctz_traverse(lfs_t* lfs,
     const lfs_cache_t* write_cache, lfs_cache_t* read_cache,
     lfs_block_t head, lfs_size_t size,
     int (*cb)(void*, lfs_block_t), void* data);
 
+//file extents
+void lfs_extent_release(lfs_extent_list_t* list);
+int lfs_extent_append(lfs_extent_list_t* list, lfs_block_t block);
+int lfs_extent_hole(lfs_extent_list_t* list, lfs_size_t count);
+int lfs_extent_splice(lfs_extent_list_t* dst, const lfs_extent_list_t* src, lfs_size_t index);
+void lfs_extent_pop(lfs_extent_list_t* list);
+void lfs_extent_truncate(lfs_extent_list_t* list, lfs_size_t blocks);
+int lfs_extent_copy(lfs_extent_list_t* dst, const lfs_extent_list_t* src, lfs_size_t blocks);
+int lfs_extent_find(lfs_extent_list_t* list, lfs_off_t index, lfs_block_t* block);
+int lfs_extent_extend(lfs_t* lfs,
+    lfs_cache_t* write_cache, lfs_cache_t* read_cache, lfs_extent_list_t* list,
+    lfs_extent_t* reserved, lfs_block_t head, lfs_size_t size,
+    lfs_block_t* block, lfs_off_t* offset);
+int lfs_extent_traverse(lfs_t* lfs, const lfs_extent_list_t* list,
+    int (*cb)(void*, lfs_block_t), void* data);
+int lfs_extent_fetch(lfs_t* lfs, const lfs_metadata_dir_t* dir, uint16_t id, lfs_extent_list_t* list);
+int lfs_extent_disk_traverse(lfs_t* lfs, const lfs_metadata_dir_t* dir, uint16_t id,
+    int (*cb)(void*, lfs_block_t), void* data);
+int lfs_extent_store(lfs_t* lfs, const lfs_extent_list_t* list, lfs_size_t size,
+    void* buffer, lfs_size_t* bsize);
+
 //file
 int lfs_file_rawopencfg(lfs_t* lfs, lfs_file_t* file, const char* path, int flags, const lfs_file_config_t* cfg);
 int lfs_file_rawopen(lfs_t* lfs, lfs_file_t* file, const char* path, int flags);
@@ -764,16 +1499,39 @@ int lfs_file_relocate(lfs_t* lfs, lfs_file_t* file);
 int lfs_file_outline(lfs_t* lfs, lfs_file_t* file);
 int lfs_file_flush(lfs_t* lfs, lfs_file_t* file);
 int lfs_file_rawsync(lfs_t* lfs, lfs_file_t* file);
+int lfs_file_commitstruct(lfs_t* lfs, lfs_file_t* file,
+    uint16_t* type, const void** buffer, lfs_size_t* size, lfs_ctz_t* ctz, uint8_t* extents);
 lfs_ssize_t lfs_file_flushedread(lfs_t* lfs, lfs_file_t* file, void* buffer, lfs_size_t size);
 lfs_ssize_t lfs_file_rawread(lfs_t* lfs, lfs_file_t* file, void* buffer, lfs_size_t size);
+lfs_ssize_t lfs_file_rawreadv(lfs_t* lfs, lfs_file_t* file, const lfs_iovec_t* iov, lfs_size_t count);
 lfs_ssize_t lfs_file_flushedwrite(lfs_t* lfs, lfs_file_t* file, const void* buffer, lfs_size_t size);
+lfs_ssize_t lfs_file_flushedwritev(lfs_t* lfs, lfs_file_t* file, const lfs_iovec_t* iov, lfs_size_t count);
 lfs_ssize_t lfs_file_rawwrite(lfs_t* lfs, lfs_file_t* file, const void* buffer, lfs_size_t size);
+lfs_ssize_t lfs_file_rawwritev(lfs_t* lfs, lfs_file_t* file, const lfs_iovec_t* iov, lfs_size_t count);
 lfs_soff_t lfs_file_rawseek(lfs_t* lfs, lfs_file_t* file, lfs_soff_t offset, int whence);
 lfs_soff_t lfs_file_rawtruncate(lfs_t* lfs, lfs_file_t* file, lfs_off_t size);
+int lfs_file_rawfallocate(lfs_t* lfs, lfs_file_t* file, lfs_off_t offset, lfs_off_t size);
 lfs_soff_t lfs_file_rawtell(lfs_t* lfs, lfs_file_t* file);
 lfs_soff_t lfs_file_rawrewind(lfs_t* lfs, lfs_file_t* file);
 lfs_soff_t lfs_file_rawsize(lfs_t* lfs, lfs_file_t* file);
 
+//batch
+int lfs_batch_rawbegin(lfs_t* lfs);
+int lfs_batch_rawend(lfs_t* lfs);
+int lfs_batch_defer(lfs_t* lfs, lfs_file_t* file);
+int lfs_batch_hold(lfs_t* lfs, lfs_file_t* file);
+int lfs_batch_settle(lfs_t* lfs, const lfs_block_t pair[2], uint16_t id);
+int lfs_batch_flush(lfs_t* lfs);
+
+//transaction
+int lfs_tx_rawbegin(lfs_t* lfs, lfs_tx_t* tx);
+int lfs_tx_rawwrite(lfs_t* lfs, lfs_tx_t* tx, const char* path, const void* buffer, lfs_size_t size);
+int lfs_tx_raw_set_attribute(lfs_t* lfs, lfs_tx_t* tx, const char* path,
+    uint8_t type, const void* buffer, lfs_size_t size);
+int lfs_tx_rawremove(lfs_t* lfs, lfs_tx_t* tx, const char* path);
+int lfs_tx_rawcommit(lfs_t* lfs, lfs_tx_t* tx);
+int lfs_tx_rawabort(lfs_t* lfs, lfs_tx_t* tx);
+
 //general
 int lfs_raw_stat(lfs_t* lfs, const char* path, lfs_info* info);
 int lfs_raw_remove(lfs_t* lfs, const char* path);
@@ -800,6 +1558,9 @@ int lfs_fs_size_count(void* p, lfs_block_t block);
 lfs_ssize_t lfs_fs_rawsize(lfs_t* lfs);
 int lfs_fs_rawstat(lfs_t* lfs, struct lfs_fsinfo* fsinfo);
 int lfs_fs_rawgrow(lfs_t* lfs, lfs_size_t block_count);
+int lfs_fs_raiseversion(lfs_t* lfs, uint32_t version);
+int lfs_fs_rawgcstep(lfs_t* lfs);
+int lfs_fs_rawgc(lfs_t* lfs);
 
 
 
@@ -827,7 +1588,8 @@ int lfs_mount(lfs_t* lfs, lfs_config_t* config);
 
 // Unmounts a littlefs
 //
-// Does nothing besides releasing any allocated resources.
+// Releases any allocated resources, after writing out the free map when
+// free_map is configured.
 // Returns a negative error code on failure.
 int lfs_unmount(lfs_t* lfs);
 
@@ -941,6 +1703,22 @@ lfs_ssize_t lfs_file_read(lfs_t* lfs, lfs_file_t* file, void* buffer, lfs_size_t
 // Returns the number of bytes written, or a negative error code on failure.
 lfs_ssize_t lfs_file_write(lfs_t* lfs, lfs_file_t* file, const void* buffer, lfs_size_t size);
 
+// Read data from file into several buffers
+//
+// Fills the buffers in order as one lfs_file_read of their total size would,
+// under a single lock. Stops early at the end of the file.
+// Returns the number of bytes read, or a negative error code on failure.
+lfs_ssize_t lfs_file_readv(lfs_t* lfs, lfs_file_t* file, const lfs_iovec_t* iov, lfs_size_t count);
+
+// Write data to file from several buffers
+//
+// Writes the buffers in order as one lfs_file_write of their total size
+// would, under a single lock. Buffers smaller than a block are gathered into
+// the file's cache and programmed together.
+//
+// Returns the number of bytes written, or a negative error code on failure.
+lfs_ssize_t lfs_file_writev(lfs_t* lfs, lfs_file_t* file, const lfs_iovec_t* iov, lfs_size_t count);
+
 // Change the position of the file
 //
 // The change in position is determined by the offset and whence flag.
@@ -952,6 +1730,15 @@ lfs_soff_t lfs_file_seek(lfs_t* lfs, lfs_file_t* file, lfs_soff_t offset, int wh
 // Returns a negative error code on failure.
 lfs_soff_t lfs_file_truncate(lfs_t* lfs, lfs_file_t* file, lfs_off_t size);
 
+// Set aside a contiguous run of blocks for size bytes of the file from
+// offset, so the writes that follow take them rather than allocating one
+// block at a time in between other writers. The size of the file doesn't
+// change. What the writes haven't taken is given back on truncate or close.
+// Without a free map at most a lookahead window of blocks is set aside.
+//
+// Returns a negative error code on failure.
+int lfs_file_fallocate(lfs_t* lfs, lfs_file_t* file, lfs_off_t offset, lfs_off_t size);
+
 // Return the position of the file
 //
 // Equivalent to lfs_file_seek(lfs, file, 0, LFS_SEEK_CUR)
@@ -997,6 +1784,15 @@ int lfs_dir_close(lfs_t* lfs, lfs_dir_t* dir);
 // or a negative error code on failure.
 int lfs_dir_read(lfs_t* lfs, lfs_dir_t* dir, struct lfs_info* info);
 
+// Read up to count entries in the directory
+//
+// Fills out the info structures as lfs_dir_read would, one after another.
+// The log of each metadata pair is read once for all of its entries, where
+// lfs_dir_read looks up each entry by walking back through the log.
+// Returns the number of entries read, 0 at the end of directory,
+// or a negative error code on failure.
+lfs_ssize_t lfs_dir_readbatch(lfs_t* lfs, lfs_dir_t* dir, struct lfs_info* info, lfs_size_t count);
+
 // Change the position of the directory
 //
 // The new off must be a value previous returned from tell and specifies
@@ -1045,9 +1841,136 @@ lfs_ssize_t lfs_fs_size(lfs_t* lfs);
 int lfs_fs_traverse(lfs_t* lfs, int (*cb)(void*, lfs_block_t), void* data);
 
 // Grows the filesystem to a new size, updating the superblock with the new
-// block count.
+// block count. Called from within allocate_block the superblock is updated at
+// the start of the next operation or at unmount, a mount with allocate_block
+// takes a block_count larger than the superblock's as such a growth.
 //
 // Note: This is irreversible.
 //
 // Returns a negative error code on failure.
-int lfs_fs_grow(lfs_t* lfs, lfs_size_t block_count);
\ No newline at end of file
+int lfs_fs_grow(lfs_t* lfs, lfs_size_t block_count);
+
+// Returns the block count allocate_block should grow the device to, by the
+// grow_min and grow_percent policy of the configuration. Meant to be called
+// from within allocate_block, where the filesystem is already locked, so it
+// takes no lock itself.
+lfs_size_t lfs_fs_growsize(lfs_t* lfs);
+
+// Writes out the free map, when free_map is configured, and references it
+// from the superblock like lfs_unmount does. The next mount can then use it
+// instead of traversing the filesystem if nothing is committed in between.
+// Nothing is written when the device is too full to take the map.
+//
+// Returns a negative error code on failure.
+int lfs_fs_checkpoint(lfs_t* lfs);
+
+// Does janitorial work ahead of the operations that would otherwise have to:
+// finishes interrupted moves and removals, compacts the metadata pairs whose
+// logs have grown past compact_thresh, and finds the blocks in use of the
+// next lookahead window when the current one is used up.
+//
+// Returns a negative error code on failure.
+int lfs_fs_gc(lfs_t* lfs);
+
+// Does a bounded part of lfs_fs_gc, compacting at most one metadata pair,
+// for a caller that wants to give the lock up in between. Steps go on from
+// where the last one stopped, and start over from the root once metadata is
+// committed to in between.
+//
+// Returns a positive value while there is more to do, zero once the
+// filesystem is clean, or a negative error code on failure.
+int lfs_fs_gcstep(lfs_t* lfs);
+
+// Syncs the device if metadata has been committed since it was last synced,
+// making the commits sync_group or an open batch held back durable.
+//
+// Returns a negative error code on failure.
+int lfs_fs_sync(lfs_t* lfs);
+
+// Opens a sync batch. Until the matching lfs_batch_end, syncing or closing
+// a file writes its data out but holds back the commit of its new contents
+// and attributes, and no commit syncs the device. Other changes, creating,
+// removing or renaming entries and setting attributes, are committed as
+// they are made. Batches nest, only the outermost end counts.
+// lfs_stat and lfs_getattr see a held back file as last committed, opening
+// it sees it as synced.
+//
+// A batch saves commits and syncs, it is not a transaction, see lfs_tx_begin
+// for one. Nothing makes its changes atomic as a whole, see lfs_batch_end.
+//
+// Returns a negative error code on failure.
+int lfs_batch_begin(lfs_t* lfs);
+
+// Ends a sync batch. The held back files are committed, one commit for the
+// files of a metadata pair, or as many of them as fit in half of a metadata
+// block, and the device is synced once for the whole batch. Each file is
+// committed atomically on its own, a power loss leaves it with either all
+// of what it was given in the batch or none of it. Across files, pairs and
+// the changes committed as they were made there is no such guarantee, a
+// power loss may leave any part of the batch on disk, entries created in
+// it may be left empty.
+//
+// Returns a negative error code on failure.
+int lfs_batch_end(lfs_t* lfs);
+
+// Starts a transaction. Writing whole files, setting attributes and removing
+// files are queued on it, to be committed together by lfs_tx_commit, and
+// are not seen by anything else until then, lfs_stat and reading see the
+// files as they were. Operations on the same path are merged, the later
+// ones win. Paths are checked as they are queued, a missing parent or a
+// directory where a file is written or removed fails right away.
+//
+// The data of a written file goes out to the device as it is queued and
+// its blocks are in use until the transaction is committed or aborted. One
+// of the two has to be called before lfs_unmount.
+//
+// Returns a negative error code on failure.
+int lfs_tx_begin(lfs_t* lfs, lfs_tx_t* tx);
+
+// Queues writing a file with the contents of buffer, replacing what it held,
+// and creating it if it doesn't exist. Its attributes are kept unless it
+// was removed earlier in the transaction.
+//
+// Returns a negative error code on failure.
+int lfs_tx_write(lfs_t* lfs, lfs_tx_t* tx, const char* path,
+    const void* buffer, lfs_size_t size);
+
+// Queues setting a custom attribute of a file or directory, see
+// lfs_set_attribute. The entry has to exist or be written by the
+// transaction.
+//
+// Returns a negative error code on failure.
+int lfs_tx_set_attribute(lfs_t* lfs, lfs_tx_t* tx, const char* path,
+    uint8_t type, const void* buffer, lfs_size_t size);
+
+// Queues removing a file, along with what the transaction queued for it.
+// Directories can't be removed in a transaction.
+//
+// Returns a negative error code on failure.
+int lfs_tx_remove(lfs_t* lfs, lfs_tx_t* tx, const char* path);
+
+// Commits a transaction and syncs the device once, or leaves the sync to an
+// open batch. Every entry is looked up first, a transaction that can't be
+// made fails before anything is committed.
+//
+// The operations whose entries share a metadata pair are committed with
+// one commit, atomically, a power loss leaves either all of them or none.
+// A transaction on the files of one directory that hasn't been split over
+// several pairs is atomic as a whole. Across pairs it is not, each pair is
+// committed in turn and a power loss, or an error, may leave the pairs
+// committed before it. A pair only takes more than one commit when the
+// names created in it run out of ids.
+//
+// A large commit usually compacts its pair, which is much cheaper with
+// compact_table set in the config.
+//
+// The transaction is done with either way, it can be started again.
+//
+// Returns a negative error code on failure.
+int lfs_tx_commit(lfs_t* lfs, lfs_tx_t* tx);
+
+// Drops a transaction without committing any of it, giving back the blocks
+// its files were written to.
+//
+// Returns a negative error code on failure.
+int lfs_tx_abort(lfs_t* lfs, lfs_tx_t* tx);
\ No newline at end of file
@@ -244,6 +244,12 @@ constexpr uint32_t lfs_ctz32(uint32_t a) {
 
 inline uint64_t lfs_ctz64(uint64_t a) {
 
+#if !defined(LFS_NO_INTRINSICS)
+    if (a) {
+        return __builtin_ctzll(a);
+    }
+#endif
+
     uint64_t result = 0;
 
     for (result = 0; result < 64; result++) {
@@ -504,6 +510,9 @@ constexpr void lfs_superblock_fromle64(lfs_superblock_t* superblock) {
     superblock->name_max_length = lfs_fromle64(superblock->name_max_length);
     superblock->file_max_size = lfs_fromle64(superblock->file_max_size);
     superblock->attr_max_size = lfs_fromle64(superblock->attr_max_size);
+    superblock->free_map_head = lfs_fromle64(superblock->free_map_head);
+    superblock->free_map_size = lfs_fromle64(superblock->free_map_size);
+    superblock->free_map_offset = lfs_fromle64(superblock->free_map_offset);
 }
 
 constexpr void lfs_superblock_tole64(lfs_superblock_t* superblock) {
@@ -513,6 +522,9 @@ constexpr void lfs_superblock_tole64(lfs_superblock_t* superblock) {
     superblock->name_max_length = lfs_tole64(superblock->name_max_length);
     superblock->file_max_size = lfs_tole64(superblock->file_max_size);
     superblock->attr_max_size = lfs_tole64(superblock->attr_max_size);
+    superblock->free_map_head = lfs_tole64(superblock->free_map_head);
+    superblock->free_map_size = lfs_tole64(superblock->free_map_size);
+    superblock->free_map_offset = lfs_tole64(superblock->free_map_offset);
 }
 
 constexpr bool lfs_mlist_isopen(lfs_metadata_list_t* head, lfs_metadata_list_t* node) {
@@ -545,26 +557,9 @@ constexpr void lfs_mlist_append(lfs_t* lfs, lfs_metadata_list_t* metadata_list)
     lfs->metadata_list = metadata_list;
 }
 
-// Software CRC implementation with small lookup table
-constexpr uint32_t lfs_crc(uint32_t crc, const void* buffer, size_t size) {
-
-    const uint32_t rtable[16] = {
-        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
-        0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
-        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
-        0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
-    };
-
-    const uint8_t* data = (const uint8_t *)buffer;
-
-    for (size_t i = 0; i < size; i++) {
-
-        crc = (crc >> 4) ^ rtable[(crc ^ (data[i] >> 0)) & 0xf];
-        crc = (crc >> 4) ^ rtable[(crc ^ (data[i] >> 4)) & 0xf];
-    }
-
-    return crc;
-}
+// CRC-32 with polynomial 0x04c11db7, table driven or using carry-less
+// multiplication where the cpu has it, see lfs_crc.cpp
+uint32_t lfs_crc(uint32_t crc, const void* buffer, size_t size);
 
 constexpr void lfs_cache_drop(lfs_t* lfs, lfs_cache_t* read_cache) {
     // do not zero, cheaper if cache is readonly or only going to be
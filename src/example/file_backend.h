@@ -1,5 +1,30 @@
 #pragma once
 
+#if !defined(_MSC_VER)
+#include <errno.h>
+
+// stdio spellings of the MSVC calls used below
+#define _fseeki64 fseeko
+#define _ftelli64 ftello
+#define __debugbreak() ((void)0)
+
+static int _wfopen_s(FILE** file, const wchar_t* path, const wchar_t* mode) {
+
+    char name[4096];
+    char flags[16];
+
+    *file = nullptr;
+
+    if (wcstombs(name, path, sizeof(name)) >= sizeof(name) ||
+        wcstombs(flags, mode, sizeof(flags)) >= sizeof(flags)) {
+        return EINVAL;
+    }
+
+    *file = fopen(name, flags);
+
+    return *file ? 0 : errno;
+}
+#endif
 
 struct vfs_file_context : fs::lfsVFS::VFSContext {
 
@@ -32,6 +57,15 @@ static int vfs_file_allocate_file_size(lfs_config_t* config, size_t blocks) {
     return result == 1 ? LFS_ERR_OK : LFS_ERR_NOSPC;
 }
 
+static lfs_size_t vfs_file_image_blocks(lfs_config_t* config) {
+
+    vfs_file_context* context = (vfs_file_context*)(config->context);
+
+    _fseeki64(context->_file_fs.get(), 0, SEEK_END);
+
+    return _ftelli64(context->_file_fs.get()) / config->block_size;
+}
+
 static int vfs_file_block_device_read(const lfs_config_t* config, lfs_block_t block,
     lfs_off_t off, void* buffer, lfs_size_t size) {
 
@@ -83,12 +117,18 @@ static int vfs_file_allocate_block(lfs_config_t* config) {
 
     config->on_grow = true;
 
-    int i = vfs_file_allocate_file_size(config, config->block_count + 10);
-    lfs_fs_grow((lfs_t*)context->_lfs_handle.get(), config->block_count + 10);
+    lfs_t* lfs = (lfs_t*)context->_lfs_handle.get();
+    lfs_size_t block_count = lfs_fs_growsize(lfs);
+
+    int err = vfs_file_allocate_file_size(config, block_count);
+
+    if (!err) {
+        err = lfs_fs_grow(lfs, block_count);
+    }
 
     config->on_grow = false;
 
-    return LFS_ERR_OK;
+    return err;
 }
 
 static int vfs_file_block_device_sync(const lfs_config_t* config) {
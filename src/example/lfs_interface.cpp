@@ -1,8 +1,17 @@
 #include "lfs_interface.h"
 
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <algorithm>
+#include <condition_variable>
+
 
 #include "file_backend.h"
 #include "memory_backend.h"
+#include "posix_backend.h"
+#include "mmap_backend.h"
+#include "uring_backend.h"
 
 
 using namespace fs;
@@ -34,6 +43,208 @@ static ErrorCode lfsToHxErrorCode(int err) {
     }
 }
 
+struct lfsVFS::VFSGuard {
+    // the filesystem, taken by littlefs through the lock callbacks, shared
+    // by reads that have a read cache of their own. A device growing itself
+    // from allocate_block calls back in with it held, so the thread holding
+    // it exclusively takes it again
+    std::shared_mutex lock;
+    std::atomic<std::thread::id> owner;
+    uint32_t depth = 0;
+
+    // littlefs has called the lock, a library built without LFS_THREADSAFE
+    // never does and the threads would run into each other
+    bool locked = false;
+
+    // the state below, held for no longer than it takes to update it and
+    // to sync for a group
+    std::mutex mutex;
+    std::condition_variable wake;
+
+    // time of the last operation, and whether one has changed the
+    // filesystem since the gc last found it clean
+    std::chrono::steady_clock::time_point used;
+    bool dirty = true;
+    bool stop = false;
+
+    // group commit, operations under way are counted so a group doesn't
+    // wait for nobody. Operations waiting on a device sync take tickets in
+    // turn, a sync covers every ticket taken before it
+    std::condition_variable synced;
+    std::atomic<uint32_t> busy{ 0 };
+    std::chrono::microseconds window{ 0 };
+    size_t group = 0;
+    uint64_t requested = 0;
+    uint64_t done = 0;
+    bool syncing = false;
+
+    // tickets of the last group whose sync failed
+    uint64_t failed_first = 1;
+    uint64_t failed_last = 0;
+    int failed_err = LFS_ERR_OK;
+
+    // batches open, and sync_group of the config before group commit
+    uint32_t batches = 0;
+    lfs_size_t sync_group = 0;
+};
+
+static lfsVFS::VFSGuard* vfs_guard(const lfs_config_t* config) {
+    return ((lfsVFS::VFSContext*)config->context)->_guard;
+}
+
+static int vfs_lock(const lfs_config_t* config) {
+
+    lfsVFS::VFSGuard* guard = vfs_guard(config);
+
+    if (guard->owner.load() != std::this_thread::get_id()) {
+        guard->lock.lock();
+        guard->owner = std::this_thread::get_id();
+    }
+
+    guard->depth += 1;
+    guard->locked = true;
+
+    return LFS_ERR_OK;
+}
+
+static int vfs_unlock(const lfs_config_t* config) {
+
+    lfsVFS::VFSGuard* guard = vfs_guard(config);
+
+    if (--guard->depth == 0) {
+        guard->owner = std::thread::id();
+        guard->lock.unlock();
+    }
+
+    return LFS_ERR_OK;
+}
+
+static int vfs_lock_shared(const lfs_config_t* config) {
+    vfs_guard(config)->lock.lock_shared();
+    return LFS_ERR_OK;
+}
+
+static int vfs_unlock_shared(const lfs_config_t* config) {
+    vfs_guard(config)->lock.unlock_shared();
+    return LFS_ERR_OK;
+}
+
+// The mount has to have taken the lock, lfsVFS is shared between threads
+// and runs gc and group commits from threads of its own
+static int vfs_check_locked(const lfs_config_t* config) {
+
+    return vfs_guard(config)->locked ? LFS_ERR_OK : LFS_ERR_INVAL;
+}
+
+// Counts an operation under way, littlefs locks the filesystem for it
+struct VFSOperation {
+    lfsVFS::VFSGuard* _guard;
+    bool _modifies;
+    bool _busy;
+
+    VFSOperation(const std::shared_ptr<lfsVFS::VFSGuard>& guard, bool modifies)
+        : _guard(guard.get())
+        , _modifies(modifies)
+        , _busy(true) {
+
+        _guard->busy += 1;
+    }
+
+    ~VFSOperation() {
+
+        leave();
+
+        std::unique_lock<std::mutex> lock(_guard->mutex);
+
+        bool wake = _modifies && !_guard->dirty;
+
+        _guard->used = std::chrono::steady_clock::now();
+        _guard->dirty = _guard->dirty || _modifies;
+
+        lock.unlock();
+
+        if (wake) {
+            _guard->wake.notify_one();
+        }
+    }
+
+    // Done with the filesystem, a group waiting for it to finish may go
+    void leave() {
+
+        if (_busy) {
+            _busy = false;
+
+            if (--_guard->busy == 0) {
+                std::lock_guard<std::mutex> lock(_guard->mutex);
+                _guard->synced.notify_all();
+            }
+        }
+    }
+
+    // Waits for the changes made so far to be on the device. Without group
+    // commit, or in a batch, they already are or will be at its
+    // commit. Otherwise the first to wait leads the group and syncs for it.
+    int waitSynced(lfs_t* lfs) {
+
+        leave();
+
+        std::unique_lock<std::mutex> lock(_guard->mutex);
+
+        if (!_guard->group || _guard->batches) {
+            return LFS_ERR_OK;
+        }
+
+        uint64_t ticket = ++_guard->requested;
+
+        if (_guard->requested - _guard->done >= _guard->group) {
+            _guard->synced.notify_all();
+        }
+
+        while (_guard->done < ticket) {
+
+            if (_guard->syncing) {
+                _guard->synced.wait(lock);
+                continue;
+            }
+
+            // let the operations under way join, until the group is full
+            _guard->syncing = true;
+
+            auto deadline = std::chrono::steady_clock::now() + _guard->window;
+
+            while (_guard->busy > 0 && _guard->requested - _guard->done < _guard->group &&
+                std::chrono::steady_clock::now() < deadline) {
+                _guard->synced.wait_until(lock, deadline);
+            }
+
+            // a batch may have synced in the meantime
+            uint64_t last = _guard->requested;
+
+            if (last > _guard->done) {
+
+                int err = lfs_fs_sync(lfs);
+
+                if (err) {
+                    _guard->failed_first = _guard->done + 1;
+                    _guard->failed_last = last;
+                    _guard->failed_err = err;
+                }
+
+                _guard->done = last;
+            }
+
+            _guard->syncing = false;
+            _guard->synced.notify_all();
+        }
+
+        if (ticket >= _guard->failed_first && ticket <= _guard->failed_last) {
+            return _guard->failed_err;
+        }
+
+        return LFS_ERR_OK;
+    }
+};
+
 lfsVFS::lfsVFS(
     std::shared_ptr<lfs_t> lfs_handle,
     std::shared_ptr<lfs_config_t> lfs_config,
@@ -42,35 +253,282 @@ lfsVFS::lfsVFS(
     _lfs_handle = lfs_handle;
     _lfs_config = lfs_config;
     _lfs_context = lfs_context;
+    _guard = std::make_shared<VFSGuard>();
+    _lfs_context->_guard = _guard.get();
 }
 
 lfsVFS::~lfsVFS() {
+    stopBackgroundGC();
+
+    VFSOperation op(_guard, true);
     lfs_unmount(_lfs_handle.get());
 }
 
+ErrorCode lfsVFS::gc() {
+
+    VFSOperation op(_guard, false);
+
+    int err = lfs_fs_gc(_lfs_handle.get());
+
+    if (err == LFS_ERR_OK) {
+        {
+            std::lock_guard<std::mutex> lock(_guard->mutex);
+            _guard->dirty = false;
+        }
+
+        // compactions may be waiting on a group that isn't coming
+        err = lfs_fs_sync(_lfs_handle.get());
+    }
+
+    return lfsToHxErrorCode(err);
+}
+
+void lfsVFS::startBackgroundGC(std::chrono::milliseconds idle) {
+
+    if (_gc_thread.joinable()) {
+        return;
+    }
+
+    _guard->stop = false;
+    _gc_thread = std::thread(&lfsVFS::backgroundGC, this, idle);
+}
+
+void lfsVFS::stopBackgroundGC() {
+
+    if (!_gc_thread.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_guard->mutex);
+        _guard->stop = true;
+    }
+
+    _guard->wake.notify_one();
+    _gc_thread.join();
+}
+
+void lfsVFS::backgroundGC(std::chrono::milliseconds idle) {
+
+    std::unique_lock<std::mutex> lock(_guard->mutex);
+
+    while (!_guard->stop) {
+
+        // nothing has changed since the filesystem was last found clean
+        if (!_guard->dirty) {
+            _guard->wake.wait(lock);
+            continue;
+        }
+
+        // let a burst of operations finish first
+        auto ready = _guard->used + idle;
+
+        if (std::chrono::steady_clock::now() < ready) {
+            _guard->wake.wait_until(lock, ready);
+            continue;
+        }
+
+        // the step takes the filesystem like any other operation, so the
+        // state is let go of for it. An operation changing the filesystem
+        // meanwhile marks it dirty again
+        _guard->dirty = false;
+        lock.unlock();
+
+        int res = lfs_fs_gcstep(_lfs_handle.get());
+
+        // clean, or failing, either way wait for the next change, the
+        // compactions are synced rather than left for the next group
+        if (res <= 0) {
+            lfs_fs_sync(_lfs_handle.get());
+        }
+
+        // operations waiting get in between steps
+        std::this_thread::yield();
+        lock.lock();
+
+        if (res > 0) {
+            _guard->dirty = true;
+        }
+    }
+}
+
+void lfsVFS::startGroupCommit(std::chrono::microseconds window, size_t group) {
+
+    // the config changes under the filesystem lock, no operation is reading it
+    std::lock_guard<std::mutex> lock(_guard->mutex);
+    std::lock_guard<std::shared_mutex> fs(_guard->lock);
+
+    if (!_guard->group) {
+        _guard->sync_group = _lfs_config->sync_group;
+    }
+
+    _guard->window = window;
+    _guard->group = std::max(group, (size_t)1);
+
+    // commits leave the device syncs to the groups
+    _lfs_config->sync_group = (lfs_size_t)-1;
+}
+
+void lfsVFS::stopGroupCommit() {
+
+    std::lock_guard<std::mutex> lock(_guard->mutex);
+
+    if (!_guard->group) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::shared_mutex> fs(_guard->lock);
+
+        _lfs_config->sync_group = _guard->sync_group;
+        _guard->group = 0;
+    }
+
+    // the group under way, if any, finds itself synced
+    lfs_fs_sync(_lfs_handle.get());
+
+    _guard->done = _guard->requested;
+    _guard->synced.notify_all();
+}
+
+ErrorCode lfsVFS::beginBatch() {
+
+    VFSOperation op(_guard, false);
+
+    int err = lfs_batch_begin(_lfs_handle.get());
+
+    if (err == LFS_ERR_OK) {
+        std::lock_guard<std::mutex> lock(_guard->mutex);
+        _guard->batches += 1;
+    }
+
+    return lfsToHxErrorCode(err);
+}
+
+ErrorCode lfsVFS::endBatch() {
+
+    VFSOperation op(_guard, true);
+
+    int err = lfs_batch_end(_lfs_handle.get());
+
+    std::lock_guard<std::mutex> lock(_guard->mutex);
+
+    _guard->batches -= 1;
+
+    // the outermost end synced the device for everyone waiting
+    if (err == LFS_ERR_OK && !_guard->batches) {
+        _guard->done = _guard->requested;
+        _guard->synced.notify_all();
+    }
+
+    return lfsToHxErrorCode(err);
+}
+
+ErrorCode lfsVFS::beginTransaction(lfs_tx_t& tx) {
+
+    VFSOperation op(_guard, false);
+
+    return lfsToHxErrorCode(lfs_tx_begin(_lfs_handle.get(), &tx));
+}
+
+ErrorCode lfsVFS::writeFile(lfs_tx_t& tx, const std::string& path, const void* data, size_t size) {
+
+    VFSOperation op(_guard, true);
+
+    return lfsToHxErrorCode(lfs_tx_write(_lfs_handle.get(), &tx, path.c_str(), data, size));
+}
+
+ErrorCode lfsVFS::setAttribute(lfs_tx_t& tx, const std::string& path, uint8_t type, const void* data, size_t size) {
+
+    VFSOperation op(_guard, true);
+
+    return lfsToHxErrorCode(lfs_tx_set_attribute(_lfs_handle.get(), &tx, path.c_str(), type, data, size));
+}
+
+ErrorCode lfsVFS::deleteFile(lfs_tx_t& tx, const std::string& path) {
+
+    VFSOperation op(_guard, true);
+
+    return lfsToHxErrorCode(lfs_tx_remove(_lfs_handle.get(), &tx, path.c_str()));
+}
+
+ErrorCode lfsVFS::commitTransaction(lfs_tx_t& tx) {
+
+    VFSOperation op(_guard, true);
+
+    int err = lfs_tx_commit(_lfs_handle.get(), &tx);
+
+    if (err == LFS_ERR_OK) {
+        err = op.waitSynced(_lfs_handle.get());
+    }
+
+    return lfsToHxErrorCode(err);
+}
+
+ErrorCode lfsVFS::abortTransaction(lfs_tx_t& tx) {
+
+    VFSOperation op(_guard, false);
+
+    return lfsToHxErrorCode(lfs_tx_abort(_lfs_handle.get(), &tx));
+}
+
 struct VFSFileObject
     : public IFileObject {
     std::shared_ptr<lfs_t> _lfs_handle;
+    std::shared_ptr<lfsVFS::VFSGuard> _guard;
     lfs_file_t _file_handle;
+    bool _writable;
 
-    VFSFileObject(std::shared_ptr<lfs_t> lfs_handle)
+    // littlefs takes a handle from one thread at a time, reads of other
+    // handles go on alongside
+    std::mutex _mutex;
+
+    VFSFileObject(std::shared_ptr<lfs_t> lfs_handle, std::shared_ptr<lfsVFS::VFSGuard> guard)
         : _lfs_handle(lfs_handle)
-        , _file_handle({}) {}
+        , _guard(guard)
+        , _file_handle({})
+        , _writable(false) {}
 
     ~VFSFileObject() {
-        lfs_file_close(_lfs_handle.get(), &_file_handle);
+        VFSOperation op(_guard, true);
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (lfs_file_close(_lfs_handle.get(), &_file_handle) == LFS_ERR_OK && _writable) {
+            op.waitSynced(_lfs_handle.get());
+        }
     }
 
 public:
     int64_t read(void* data, uint64_t size) override {
+        VFSOperation op(_guard, false);
+        std::lock_guard<std::mutex> lock(_mutex);
         return lfs_file_read(_lfs_handle.get(), &_file_handle, data, size);
     }
     int64_t write(const void* data, uint64_t size) override {
+        VFSOperation op(_guard, true);
+        std::lock_guard<std::mutex> lock(_mutex);
         return lfs_file_write(_lfs_handle.get(), &_file_handle, data, size);
     }
+    int64_t readv(const lfs_iovec_t* iov, size_t count) override {
+        VFSOperation op(_guard, false);
+        std::lock_guard<std::mutex> lock(_mutex);
+        return lfs_file_readv(_lfs_handle.get(), &_file_handle, iov, count);
+    }
+    int64_t writev(const lfs_iovec_t* iov, size_t count) override {
+        VFSOperation op(_guard, true);
+        std::lock_guard<std::mutex> lock(_mutex);
+        return lfs_file_writev(_lfs_handle.get(), &_file_handle, iov, count);
+    }
     int64_t truncate(uint64_t size) override {
+        VFSOperation op(_guard, true);
+        std::lock_guard<std::mutex> lock(_mutex);
         return lfs_file_truncate(_lfs_handle.get(), &_file_handle, size);
     }
+    int64_t fallocate(uint64_t offset, uint64_t size) override {
+        VFSOperation op(_guard, true);
+        std::lock_guard<std::mutex> lock(_mutex);
+        return lfs_file_fallocate(_lfs_handle.get(), &_file_handle, offset, size);
+    }
     int64_t seek(uint64_t offset, SeekType type) override {
 
         int whence = 0;
@@ -87,16 +545,28 @@ public:
         }
         }
 
+        VFSOperation op(_guard, false);
+
+        std::lock_guard<std::mutex> lock(_mutex);
         return lfs_file_seek(_lfs_handle.get(), &_file_handle, offset, whence);
     }
     int64_t tell() override {
+        VFSOperation op(_guard, false);
+        std::lock_guard<std::mutex> lock(_mutex);
         return lfs_file_tell(_lfs_handle.get(), &_file_handle);
     }
     int64_t size() override {
+        VFSOperation op(_guard, false);
+        std::lock_guard<std::mutex> lock(_mutex);
         return lfs_file_size(_lfs_handle.get(), &_file_handle);
     }
     void flush() override {
+        VFSOperation op(_guard, true);
+        std::lock_guard<std::mutex> lock(_mutex);
 
+        if (lfs_file_sync(_lfs_handle.get(), &_file_handle) == LFS_ERR_OK && _writable) {
+            op.waitSynced(_lfs_handle.get());
+        }
     }
 
 };
@@ -105,6 +575,8 @@ std::vector<Entry> lfsVFS::dir(const std::string& path) {
 
     std::vector<Entry> entries;
 
+    VFSOperation op(_guard, false);
+
     lfs_dir_t dir;
 
     int err = lfs_dir_open(_lfs_handle.get(), &dir, path.c_str());
@@ -113,33 +585,39 @@ std::vector<Entry> lfsVFS::dir(const std::string& path) {
         return entries;
     }
 
-    struct lfs_info info;
+    // each metadata pair is read once for all of its entries
+    std::vector<struct lfs_info> infos(64);
 
     while (true) {
 
-        int res = lfs_dir_read(_lfs_handle.get(), &dir, &info);
-
-        if (res < 0) {
-            break;
-        }
+        lfs_ssize_t res = lfs_dir_readbatch(_lfs_handle.get(), &dir, infos.data(), (lfs_size_t)infos.size());
 
-        switch (info.type) {
-        case LFS_TYPE_REG: {
-            entries.push_back(FileEntry(info.name, info.size));
+        if (res <= 0) {
             break;
         }
 
-        case LFS_TYPE_DIR: {
+        for (lfs_ssize_t i = 0; i < res; i++) {
 
-            if (std::string(info.name) == "." ||
-                std::string(info.name) == "..") {
+            const struct lfs_info& info = infos[i];
 
-                continue;
+            switch (info.type) {
+            case LFS_TYPE_REG: {
+                entries.push_back(FileEntry(info.name, info.size));
+                break;
             }
 
-            entries.push_back(DirectoryEntry(info.name, info.size));
-            break;
-        }
+            case LFS_TYPE_DIR: {
+
+                if (std::string(info.name) == "." ||
+                    std::string(info.name) == "..") {
+
+                    continue;
+                }
+
+                entries.push_back(DirectoryEntry(info.name, info.size));
+                break;
+            }
+            }
         }
     }
 
@@ -158,7 +636,9 @@ ErrorCode lfsVFS::openFile(std::shared_ptr<IFileObject>& handle, const std::stri
     if (flags & kFileTruncate) { lfs_flags |= LFS_O_TRUNC; }
     if (flags & kFileAppend) { lfs_flags |= LFS_O_APPEND; }
 
-    std::shared_ptr<IFileObject> file_handle(new VFSFileObject(_lfs_handle));
+    std::shared_ptr<IFileObject> file_handle(new VFSFileObject(_lfs_handle, _guard));
+
+    VFSOperation op(_guard, (lfs_flags & ~LFS_O_RDONLY) != 0);
 
     int err = lfs_file_open(
         _lfs_handle.get(),
@@ -171,6 +651,8 @@ ErrorCode lfsVFS::openFile(std::shared_ptr<IFileObject>& handle, const std::stri
         return lfsToHxErrorCode(err);
     }
 
+    static_cast<VFSFileObject*>(file_handle.get())->_writable = (lfs_flags & ~LFS_O_RDONLY) != 0;
+
     handle = file_handle;
 
     return lfsToHxErrorCode(err);
@@ -180,6 +662,8 @@ ErrorCode lfsVFS::existsFile(const std::string& path) {
 
     lfs_file_t _file_handle;
 
+    VFSOperation op(_guard, false);
+
     int err = lfs_file_open(
         _lfs_handle.get(),
         &_file_handle,
@@ -195,11 +679,27 @@ ErrorCode lfsVFS::existsFile(const std::string& path) {
 }
 
 ErrorCode lfsVFS::deleteFile(const std::string& path) {
-    return lfsToHxErrorCode(lfs_remove(_lfs_handle.get(), path.c_str()));
+    VFSOperation op(_guard, true);
+
+    int err = lfs_remove(_lfs_handle.get(), path.c_str());
+
+    if (err == LFS_ERR_OK) {
+        err = op.waitSynced(_lfs_handle.get());
+    }
+
+    return lfsToHxErrorCode(err);
 }
 
 ErrorCode lfsVFS::deleteDirectory(const std::string& path) {
-    return lfsToHxErrorCode(lfs_remove(_lfs_handle.get(), path.c_str()));
+    VFSOperation op(_guard, true);
+
+    int err = lfs_remove(_lfs_handle.get(), path.c_str());
+
+    if (err == LFS_ERR_OK) {
+        err = op.waitSynced(_lfs_handle.get());
+    }
+
+    return lfsToHxErrorCode(err);
 }
 
 ErrorCode fs::openVFS(const std::wstring& path, std::shared_ptr< IFileSystemDevice>& filesystem, lfsVFS::Backend backend) {
@@ -232,6 +732,53 @@ ErrorCode fs::openVFS(const std::wstring& path, std::shared_ptr< IFileSystemDevi
     else if (backend == lfsVFS::Backend::kMemoryBackend) {
         fs_context = std::shared_ptr< lfsVFS::VFSContext>(new vfs_memory_context(fs_handle));
     }
+#if defined(__linux__)
+    else if (backend == lfsVFS::Backend::kMemoryHugepageBackend) {
+        fs_context = std::shared_ptr< lfsVFS::VFSContext>(new vfs_memory_context(fs_handle, true));
+    }
+#endif
+#if !defined(_WIN32)
+    else if (backend == lfsVFS::Backend::kPosixBackend ||
+        backend == lfsVFS::Backend::kPosixDirectBackend) {
+
+        bool direct = (backend == lfsVFS::Backend::kPosixDirectBackend);
+        int fd = vfs_posix_open(path, O_RDWR, direct);
+
+        if (fd < 0) {
+            return ErrorCode::kCodeFileNotFound;
+        }
+
+        fs_context = std::shared_ptr< lfsVFS::VFSContext>(
+            new vfs_posix_context(
+                fs_handle,
+                fd,
+                direct
+            )
+        );
+    }
+    else if (backend == lfsVFS::Backend::kMmapBackend) {
+
+        int fd = vfs_posix_open(path, O_RDWR, false);
+
+        if (fd < 0) {
+            return ErrorCode::kCodeFileNotFound;
+        }
+
+        fs_context = std::shared_ptr< lfsVFS::VFSContext>(new vfs_mmap_context(fs_handle, fd));
+    }
+#endif
+#if defined(__linux__)
+    else if (backend == lfsVFS::Backend::kUringBackend) {
+
+        int fd = vfs_posix_open(path, O_RDWR, false);
+
+        if (fd < 0) {
+            return ErrorCode::kCodeFileNotFound;
+        }
+
+        fs_context = std::shared_ptr< lfsVFS::VFSContext>(new vfs_uring_context(fs_handle, fd));
+    }
+#endif
     else {
         return ErrorCode::kCodeObjectNotCompatible;
     }
@@ -264,18 +811,58 @@ ErrorCode fs::openVFS(const std::wstring& path, std::shared_ptr< IFileSystemDevi
             config->erase = vfs_file_block_device_erase;
             config->sync = vfs_file_block_device_sync;
             config->allocate_block = vfs_file_allocate_block;
-            config->lock = 0;
-            config->unlock = 0;
+            config->lock = vfs_lock;
+            config->unlock = vfs_unlock;
         }
-        else if (backend == lfsVFS::Backend::kMemoryBackend) {
+        else if (backend == lfsVFS::Backend::kMemoryBackend ||
+            backend == lfsVFS::Backend::kMemoryHugepageBackend) {
             config->read = vfs_memory_block_device_read;
+            config->map = vfs_memory_block_device_map;
             config->write = vfs_memory_block_device_prog;
+            config->copy = vfs_memory_block_device_copy;
+            config->crc = vfs_memory_block_device_crc;
             config->erase = vfs_memory_block_device_erase;
             config->sync = vfs_memory_block_device_sync;
             config->allocate_block = vfs_memory_allocate_block;
-            config->lock = 0;
-            config->unlock = 0;
+            config->lock = vfs_lock;
+            config->unlock = vfs_unlock;
+        }
+#if !defined(_WIN32)
+        else if (backend == lfsVFS::Backend::kPosixBackend ||
+            backend == lfsVFS::Backend::kPosixDirectBackend) {
+            config->read = vfs_posix_block_device_read;
+            config->write = vfs_posix_block_device_prog;
+            config->erase = vfs_posix_block_device_erase;
+            config->sync = vfs_posix_block_device_sync;
+            config->allocate_block = vfs_posix_allocate_block;
+            config->lock = vfs_lock;
+            config->unlock = vfs_unlock;
+        }
+        else if (backend == lfsVFS::Backend::kMmapBackend) {
+            config->read = vfs_mmap_block_device_read;
+            config->map = vfs_mmap_block_device_map;
+            config->write = vfs_mmap_block_device_prog;
+            config->copy = vfs_mmap_block_device_copy;
+            config->crc = vfs_mmap_block_device_crc;
+            config->erase = vfs_mmap_block_device_erase;
+            config->sync = vfs_mmap_block_device_sync;
+            config->allocate_block = vfs_mmap_allocate_block;
+            config->lock = vfs_lock;
+            config->unlock = vfs_unlock;
         }
+#endif
+#if defined(__linux__)
+        else if (backend == lfsVFS::Backend::kUringBackend) {
+            config->read = vfs_posix_block_device_read;
+            config->read_batch = vfs_uring_block_device_read_batch;
+            config->write = vfs_posix_block_device_prog;
+            config->erase = vfs_posix_block_device_erase;
+            config->sync = vfs_posix_block_device_sync;
+            config->allocate_block = vfs_posix_allocate_block;
+            config->lock = vfs_lock;
+            config->unlock = vfs_unlock;
+        }
+#endif
 
         // block device configuration
         config->read_size = 1;
@@ -287,28 +874,86 @@ ErrorCode fs::openVFS(const std::wstring& path, std::shared_ptr< IFileSystemDevi
         config->lookahead_size = config->block_size;
         config->block_cycles = -1;
         config->file_max_size = 0x7fffffffffffffff;
+        config->index_cache_size = (1024 * 64);
+        config->dentry_cache_size = 1024;
+        config->tag_index_count = 8;
+        config->compact_table = true;
+        config->grow_min = 16;
+        config->grow_percent = 25;
+        config->grow_watermark = 90;
+        config->verify = LFS_VERIFY_SAMPLED;
+        config->verify_interval = 64;
         config->on_grow = false;
+
+        // reads run alongside each other, each with a read cache of its own
+        config->lock_shared = vfs_lock_shared;
+        config->unlock_shared = vfs_unlock_shared;
+        config->reader_count = 4;
+
+        // the image is in memory, programs are checked in place
+        if (config->crc) {
+            config->verify = LFS_VERIFY_CRC;
+        }
+
+        // whole-block caches already read as far ahead as a device without
+        // batches gets, with batches the blocks ahead are read together
+        if (config->read_batch) {
+            config->readahead_size = (1024 * 512);
+        }
+
+#if !defined(_WIN32)
+        if (backend == lfsVFS::Backend::kPosixDirectBackend) {
+
+            // whole sectors only, so the bounce buffer is rarely needed
+            config->read_size = vfs_posix_direct_alignment;
+            config->write_size = vfs_posix_direct_alignment;
+        }
+#endif
     }
 
-    //setup context
+    //setup context, the image has grown since it was created
     if (backend == lfsVFS::Backend::kFileBackend) {
 
         vfs_file_context* context = (vfs_file_context*)fs_context.get();
         lfs_config_t* config = fs_config.get();
 
         context->_lfs_handle = fs_handle;
+        config->block_count = vfs_file_image_blocks(config);
     }
-    else if (backend == lfsVFS::Backend::kMemoryBackend) {
+    else if (backend == lfsVFS::Backend::kMemoryBackend ||
+        backend == lfsVFS::Backend::kMemoryHugepageBackend) {
 
         vfs_memory_context* context = (vfs_memory_context*)fs_context.get();
         lfs_config_t* config = fs_config.get();
 
         context->_lfs_handle = fs_handle;
     }
+#if !defined(_WIN32)
+    else if (backend == lfsVFS::Backend::kMmapBackend) {
+
+        vfs_mmap_context* context = (vfs_mmap_context*)fs_context.get();
+        lfs_config_t* config = fs_config.get();
+
+        context->_lfs_handle = fs_handle;
+        config->block_count = vfs_mmap_image_blocks(config);
+    }
+    else {
+
+        vfs_posix_context* context = (vfs_posix_context*)fs_context.get();
+        lfs_config_t* config = fs_config.get();
+
+        context->_lfs_handle = fs_handle;
+        config->block_count = vfs_posix_image_blocks(config);
+    }
+#endif
 
     {
         int err = lfs_mount(fs_handle.get(),fs_config.get());
 
+        if (!err) {
+            err = vfs_check_locked(fs_config.get());
+        }
+
         if (err) {
 
             return lfsToHxErrorCode(err);
@@ -349,6 +994,53 @@ ErrorCode fs::createVFS(const std::wstring& path, std::shared_ptr< IFileSystemDe
     else if (backend == lfsVFS::Backend::kMemoryBackend) {
         fs_context = std::shared_ptr< lfsVFS::VFSContext>(new vfs_memory_context(fs_handle));
     }
+#if defined(__linux__)
+    else if (backend == lfsVFS::Backend::kMemoryHugepageBackend) {
+        fs_context = std::shared_ptr< lfsVFS::VFSContext>(new vfs_memory_context(fs_handle, true));
+    }
+#endif
+#if !defined(_WIN32)
+    else if (backend == lfsVFS::Backend::kPosixBackend ||
+        backend == lfsVFS::Backend::kPosixDirectBackend) {
+
+        bool direct = (backend == lfsVFS::Backend::kPosixDirectBackend);
+        int fd = vfs_posix_open(path, O_RDWR | O_CREAT | O_TRUNC, direct);
+
+        if (fd < 0) {
+            return ErrorCode::kCodeFileNotFound;
+        }
+
+        fs_context = std::shared_ptr< lfsVFS::VFSContext>(
+            new vfs_posix_context(
+                fs_handle,
+                fd,
+                direct
+            )
+        );
+    }
+    else if (backend == lfsVFS::Backend::kMmapBackend) {
+
+        int fd = vfs_posix_open(path, O_RDWR | O_CREAT | O_TRUNC, false);
+
+        if (fd < 0) {
+            return ErrorCode::kCodeFileNotFound;
+        }
+
+        fs_context = std::shared_ptr< lfsVFS::VFSContext>(new vfs_mmap_context(fs_handle, fd));
+    }
+#endif
+#if defined(__linux__)
+    else if (backend == lfsVFS::Backend::kUringBackend) {
+
+        int fd = vfs_posix_open(path, O_RDWR | O_CREAT | O_TRUNC, false);
+
+        if (fd < 0) {
+            return ErrorCode::kCodeFileNotFound;
+        }
+
+        fs_context = std::shared_ptr< lfsVFS::VFSContext>(new vfs_uring_context(fs_handle, fd));
+    }
+#endif
     else {
         return ErrorCode::kCodeObjectNotCompatible;
     }
@@ -381,18 +1073,58 @@ ErrorCode fs::createVFS(const std::wstring& path, std::shared_ptr< IFileSystemDe
             config->erase = vfs_file_block_device_erase;
             config->sync = vfs_file_block_device_sync;
             config->allocate_block = vfs_file_allocate_block;
-            config->lock = 0;
-            config->unlock = 0;
+            config->lock = vfs_lock;
+            config->unlock = vfs_unlock;
         }
-        else if (backend == lfsVFS::Backend::kMemoryBackend) {
+        else if (backend == lfsVFS::Backend::kMemoryBackend ||
+            backend == lfsVFS::Backend::kMemoryHugepageBackend) {
             config->read = vfs_memory_block_device_read;
+            config->map = vfs_memory_block_device_map;
             config->write = vfs_memory_block_device_prog;
+            config->copy = vfs_memory_block_device_copy;
+            config->crc = vfs_memory_block_device_crc;
             config->erase = vfs_memory_block_device_erase;
             config->sync = vfs_memory_block_device_sync;
             config->allocate_block = vfs_memory_allocate_block;
-            config->lock = 0;
-            config->unlock = 0;
+            config->lock = vfs_lock;
+            config->unlock = vfs_unlock;
+        }
+#if !defined(_WIN32)
+        else if (backend == lfsVFS::Backend::kPosixBackend ||
+            backend == lfsVFS::Backend::kPosixDirectBackend) {
+            config->read = vfs_posix_block_device_read;
+            config->write = vfs_posix_block_device_prog;
+            config->erase = vfs_posix_block_device_erase;
+            config->sync = vfs_posix_block_device_sync;
+            config->allocate_block = vfs_posix_allocate_block;
+            config->lock = vfs_lock;
+            config->unlock = vfs_unlock;
+        }
+        else if (backend == lfsVFS::Backend::kMmapBackend) {
+            config->read = vfs_mmap_block_device_read;
+            config->map = vfs_mmap_block_device_map;
+            config->write = vfs_mmap_block_device_prog;
+            config->copy = vfs_mmap_block_device_copy;
+            config->crc = vfs_mmap_block_device_crc;
+            config->erase = vfs_mmap_block_device_erase;
+            config->sync = vfs_mmap_block_device_sync;
+            config->allocate_block = vfs_mmap_allocate_block;
+            config->lock = vfs_lock;
+            config->unlock = vfs_unlock;
+        }
+#endif
+#if defined(__linux__)
+        else if (backend == lfsVFS::Backend::kUringBackend) {
+            config->read = vfs_posix_block_device_read;
+            config->read_batch = vfs_uring_block_device_read_batch;
+            config->write = vfs_posix_block_device_prog;
+            config->erase = vfs_posix_block_device_erase;
+            config->sync = vfs_posix_block_device_sync;
+            config->allocate_block = vfs_posix_allocate_block;
+            config->lock = vfs_lock;
+            config->unlock = vfs_unlock;
         }
+#endif
 
         // block device configuration
         config->read_size = 1;
@@ -404,7 +1136,41 @@ ErrorCode fs::createVFS(const std::wstring& path, std::shared_ptr< IFileSystemDe
         config->lookahead_size = config->block_size;
         config->block_cycles = -1;
         config->file_max_size = 0x7fffffffffffffff;
+        config->index_cache_size = (1024 * 64);
+        config->dentry_cache_size = 1024;
+        config->tag_index_count = 8;
+        config->compact_table = true;
+        config->grow_min = 16;
+        config->grow_percent = 25;
+        config->grow_watermark = 90;
+        config->verify = LFS_VERIFY_SAMPLED;
+        config->verify_interval = 64;
         config->on_grow = false;
+
+        // reads run alongside each other, each with a read cache of its own
+        config->lock_shared = vfs_lock_shared;
+        config->unlock_shared = vfs_unlock_shared;
+        config->reader_count = 4;
+
+        // the image is in memory, programs are checked in place
+        if (config->crc) {
+            config->verify = LFS_VERIFY_CRC;
+        }
+
+        // whole-block caches already read as far ahead as a device without
+        // batches gets, with batches the blocks ahead are read together
+        if (config->read_batch) {
+            config->readahead_size = (1024 * 512);
+        }
+
+#if !defined(_WIN32)
+        if (backend == lfsVFS::Backend::kPosixDirectBackend) {
+
+            // whole sectors only, so the bounce buffer is rarely needed
+            config->read_size = vfs_posix_direct_alignment;
+            config->write_size = vfs_posix_direct_alignment;
+        }
+#endif
     }
 
     //setup context
@@ -417,7 +1183,8 @@ ErrorCode fs::createVFS(const std::wstring& path, std::shared_ptr< IFileSystemDe
 
         vfs_file_allocate_file_size(config, 2);
     }
-    else if (backend == lfsVFS::Backend::kMemoryBackend) {
+    else if (backend == lfsVFS::Backend::kMemoryBackend ||
+        backend == lfsVFS::Backend::kMemoryHugepageBackend) {
 
         vfs_memory_context* context = (vfs_memory_context*)fs_context.get();
         lfs_config_t* config = fs_config.get();
@@ -426,6 +1193,26 @@ ErrorCode fs::createVFS(const std::wstring& path, std::shared_ptr< IFileSystemDe
 
         vfs_memory_allocate_file_size(config, 2);
     }
+#if !defined(_WIN32)
+    else if (backend == lfsVFS::Backend::kMmapBackend) {
+
+        vfs_mmap_context* context = (vfs_mmap_context*)fs_context.get();
+        lfs_config_t* config = fs_config.get();
+
+        context->_lfs_handle = fs_handle;
+
+        vfs_mmap_allocate_file_size(config, 2);
+    }
+    else {
+
+        vfs_posix_context* context = (vfs_posix_context*)fs_context.get();
+        lfs_config_t* config = fs_config.get();
+
+        context->_lfs_handle = fs_handle;
+
+        vfs_posix_allocate_file_size(config, 2);
+    }
+#endif
 
     {
         int err = lfs_format(fs_handle.get(), fs_config.get());
@@ -437,6 +1224,10 @@ ErrorCode fs::createVFS(const std::wstring& path, std::shared_ptr< IFileSystemDe
 
         err = lfs_mount(fs_handle.get(),fs_config.get());
 
+        if (!err) {
+            err = vfs_check_locked(fs_config.get());
+        }
+
         if (err) {
 
             return lfsToHxErrorCode(err);
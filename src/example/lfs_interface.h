@@ -3,6 +3,8 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <chrono>
+#include <thread>
 
 #include "lfs.h"
 
@@ -80,8 +82,11 @@ namespace fs {
     public:
         virtual int64_t read(void* data, uint64_t size) = 0;
         virtual int64_t write(const void* data, uint64_t size) = 0;
+        virtual int64_t readv(const lfs_iovec_t* iov, size_t count) = 0;
+        virtual int64_t writev(const lfs_iovec_t* iov, size_t count) = 0;
 
         virtual int64_t truncate(uint64_t size) = 0;
+        virtual int64_t fallocate(uint64_t offset, uint64_t size) = 0;
         virtual int64_t seek(uint64_t offset, SeekType type) = 0;
         virtual int64_t tell() = 0;
         virtual int64_t size() = 0;
@@ -106,15 +111,31 @@ namespace fs {
 
         enum Backend {
             kMemoryBackend,
-            kFileBackend
+            kFileBackend,
+            kPosixBackend,          // pread/pwrite on the image, not on Windows
+            kPosixDirectBackend,    // same with O_DIRECT, bypassing the page cache
+            kMmapBackend,           // image mapped into memory, not on Windows
+            kUringBackend,          // pread/pwrite with batched reads through io_uring, Linux only
+            kMemoryHugepageBackend  // memory with pages carved from a hugepage arena, Linux only
         };
 
-        struct VFSContext {};
+        // Locks the filesystem for littlefs through the lock callbacks of the
+        // config, reads shared and everything else exclusive, and tells the
+        // background gc when it was last used
+        struct VFSGuard;
+
+        struct VFSContext {
+            VFSGuard* _guard = nullptr;
+        };
 
     private:
         std::shared_ptr<lfs_t> _lfs_handle;
         std::shared_ptr<lfs_config_t> _lfs_config;
         std::shared_ptr<VFSContext> _lfs_context;
+        std::shared_ptr<VFSGuard> _guard;
+        std::thread _gc_thread;
+
+        void backgroundGC(std::chrono::milliseconds idle);
 
     public:
         lfsVFS(
@@ -130,8 +151,46 @@ namespace fs {
         ErrorCode existsFile(const std::string& path) override;
         ErrorCode deleteFile(const std::string& path) override;
         ErrorCode deleteDirectory(const std::string& path) override;
+
+        // Compacts metadata past compact_thresh and fills the lookahead, see
+        // lfs_fs_gc
+        ErrorCode gc();
+
+        // Runs lfs_fs_gc a step at a time in a thread of its own once no
+        // operation has been made for idle, so operations seldom find a
+        // metadata pair full. An operation waits for at most the step under
+        // way, reads of other threads go on between the steps.
+        void startBackgroundGC(std::chrono::milliseconds idle);
+        void stopBackgroundGC();
+
+        // Lets file closes, flushes and deletes share device syncs instead of
+        // syncing one commit each. The first of them to finish waits for up to
+        // window, or until group of them are waiting or no other operation is
+        // under way, then syncs the device once for all of them. Each returns
+        // once its own changes are on the device.
+        void startGroupCommit(std::chrono::microseconds window, size_t group);
+        void stopGroupCommit();
+
+        // Files closed or flushed between the two are committed together at
+        // endBatch, with one sync, see lfs_batch_begin. Not atomic as a
+        // whole, batches cover the operations of every thread and may nest.
+        ErrorCode beginBatch();
+        ErrorCode endBatch();
+
+        // Whole files written, attributes set and files deleted between the
+        // two are committed together at commitTransaction, with one sync, see
+        // lfs_tx_begin. Atomic for the files of one metadata pair. The
+        // transaction belongs to the thread that began it.
+        ErrorCode beginTransaction(lfs_tx_t& tx);
+        ErrorCode writeFile(lfs_tx_t& tx, const std::string& path, const void* data, size_t size);
+        ErrorCode setAttribute(lfs_tx_t& tx, const std::string& path, uint8_t type, const void* data, size_t size);
+        ErrorCode deleteFile(lfs_tx_t& tx, const std::string& path);
+        ErrorCode commitTransaction(lfs_tx_t& tx);
+        ErrorCode abortTransaction(lfs_tx_t& tx);
     };
 
+    // Both fail with kCodeObjectNotCompatible when littlefs was built
+    // without LFS_THREADSAFE, lfsVFS relies on its lock callbacks
     ErrorCode openVFS(
         const std::wstring& path,
         std::shared_ptr< IFileSystemDevice>& filesystem,
@@ -1,20 +1,133 @@
 #pragma once
 
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+// Image kept in memory as one page per block behind a page table. A page is
+// allocated on the first write to its block, blocks never written read as
+// erased without taking any memory, and growing the image only extends the
+// table. With the hugepage arena pages are carved out of large slabs backed
+// by transparent hugepages, which cuts TLB misses on big images, Linux only.
+static const uint8_t vfs_memory_erased = 0xff;
+static const size_t vfs_memory_slab_size = (32 * 1024 * 1024);
+
 struct vfs_memory_context : fs::lfsVFS::VFSContext {
 
     std::shared_ptr<void> _lfs_handle;
-    std::vector<uint8_t> mem_fs;
 
-    vfs_memory_context(std::shared_ptr<void> lfs_handle)
-        : _lfs_handle(lfs_handle) {}
+    // page of each block, null until the block is first written
+    std::vector<uint8_t*> _pages;
+
+    // what a block that was never written reads and maps as
+    std::vector<uint8_t> _erased;
+
+    // slabs of the hugepage arena and how much of the last one is carved
+    bool _hugepages;
+    std::vector<std::pair<uint8_t*, size_t>> _slabs;
+    size_t _slab_used;
+
+    // pages allocated so far
+    size_t _used;
+
+    vfs_memory_context(std::shared_ptr<void> lfs_handle, bool hugepages = false)
+        : _lfs_handle(lfs_handle)
+        , _hugepages(hugepages)
+        , _slab_used(0)
+        , _used(0) {}
 
+    ~vfs_memory_context() {
+
+        if (!_hugepages) {
+
+            for (uint8_t* page : _pages) {
+                free(page);
+            }
+        }
+
+#if defined(__linux__)
+        for (auto& slab : _slabs) {
+            munmap(slab.first, slab.second);
+        }
+#endif
+    }
 };
 
+// Carve a page out of the arena, a new slab is mapped when the last is full
+static uint8_t* vfs_memory_arena_page(vfs_memory_context* context, size_t page_size) {
+
+#if defined(__linux__)
+    if (context->_slabs.empty() || context->_slab_used + page_size > context->_slabs.back().second) {
+
+        size_t size = std::max(vfs_memory_slab_size, page_size) / page_size * page_size;
+
+        void* slab = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+        if (slab == MAP_FAILED) {
+            return nullptr;
+        }
+
+#if defined(MADV_HUGEPAGE)
+        // only a hint, without transparent hugepages the slab is still usable
+        madvise(slab, size, MADV_HUGEPAGE);
+#endif
+
+        context->_slabs.push_back(std::make_pair((uint8_t*)slab, size));
+        context->_slab_used = 0;
+    }
+
+    uint8_t* page = context->_slabs.back().first + context->_slab_used;
+    context->_slab_used += page_size;
+
+    return page;
+#else
+    return nullptr;
+#endif
+}
+
+// Page of a block to write into, allocated erased on first use
+static uint8_t* vfs_memory_page(const lfs_config_t* config, lfs_block_t block) {
+
+    vfs_memory_context* context = (vfs_memory_context*)(config->context);
+
+    uint8_t* page = context->_pages[block];
+
+    if (page) {
+        return page;
+    }
+
+    if (context->_hugepages) {
+        page = vfs_memory_arena_page(context, config->block_size);
+    }
+    else {
+        page = (uint8_t*)malloc(config->block_size);
+    }
+
+    if (!page) {
+        return nullptr;
+    }
+
+    memset(page, vfs_memory_erased, config->block_size);
+
+    context->_pages[block] = page;
+    context->_used += 1;
+
+    return page;
+}
+
 static int vfs_memory_allocate_file_size(lfs_config_t* config, size_t blocks) {
 
     vfs_memory_context* context = (vfs_memory_context*)(config->context);
 
-    context->mem_fs.resize((config->block_size * blocks));
+    if (context->_erased.size() != config->block_size) {
+        context->_erased.assign(config->block_size, vfs_memory_erased);
+    }
+
+    // only the table grows, pages already written stay where they are
+    if (context->_pages.size() < blocks) {
+        context->_pages.resize(blocks, nullptr);
+    }
 
     return LFS_ERR_OK;
 }
@@ -24,17 +137,82 @@ static int vfs_memory_block_device_read(const lfs_config_t* config, lfs_block_t
 
     vfs_memory_context* context = (vfs_memory_context*)(config->context);
 
-    memcpy(buffer, &context->mem_fs[config->block_size * block + off], size);
+    const uint8_t* page = context->_pages[block];
+
+    if (!page) {
+        memset(buffer, vfs_memory_erased, size);
+        return LFS_ERR_OK;
+    }
+
+    memcpy(buffer, &page[off], size);
 
     return LFS_ERR_OK;
 }
 
+static const void* vfs_memory_block_device_map(const lfs_config_t* config, lfs_block_t block,
+    lfs_off_t off, lfs_size_t size) {
+
+    vfs_memory_context* context = (vfs_memory_context*)(config->context);
+
+    const uint8_t* page = context->_pages[block];
+
+    if (!page) {
+        return &context->_erased[off];
+    }
+
+    return &page[off];
+}
+
 static int vfs_memory_block_device_prog(const lfs_config_t* config, lfs_block_t block,
     lfs_off_t off, const void* buffer, lfs_size_t size) {
 
+    uint8_t* page = vfs_memory_page(config, block);
+
+    if (!page) {
+        return LFS_ERR_NOMEM;
+    }
+
+    memcpy(&page[off], buffer, size);
+
+    return LFS_ERR_OK;
+}
+
+static int vfs_memory_block_device_copy(const lfs_config_t* config, lfs_block_t block,
+    lfs_off_t off, lfs_block_t src_block, lfs_off_t src_off, lfs_size_t size) {
+
+    vfs_memory_context* context = (vfs_memory_context*)(config->context);
+
+    const uint8_t* src = context->_pages[src_block];
+
+    // erased onto a block that was never written changes nothing
+    if (!src && !context->_pages[block]) {
+        return LFS_ERR_OK;
+    }
+
+    uint8_t* page = vfs_memory_page(config, block);
+
+    if (!page) {
+        return LFS_ERR_NOMEM;
+    }
+
+    if (!src) {
+        memset(&page[off], vfs_memory_erased, size);
+    }
+    else {
+        memmove(&page[off], &src[src_off], size);
+    }
+
+    return LFS_ERR_OK;
+}
+
+static int vfs_memory_block_device_crc(const lfs_config_t* config, lfs_block_t block,
+    lfs_off_t off, lfs_size_t size, uint32_t* crc) {
+
     vfs_memory_context* context = (vfs_memory_context*)(config->context);
 
-    memcpy(&context->mem_fs[config->block_size * block + off], buffer, size);
+    const uint8_t* page = context->_pages[block];
+
+    *crc = lfs_crc(*crc, page ? &page[off] : &context->_erased[off], size);
 
     return LFS_ERR_OK;
 }
@@ -53,12 +231,18 @@ static int vfs_memory_allocate_block(lfs_config_t* config) {
 
     config->on_grow = true;
 
-    int i = vfs_memory_allocate_file_size(config, config->block_count + 10);
-    lfs_fs_grow((lfs_t*)context->_lfs_handle.get(), config->block_count + 10);
+    lfs_t* lfs = (lfs_t*)context->_lfs_handle.get();
+    lfs_size_t block_count = lfs_fs_growsize(lfs);
+
+    int err = vfs_memory_allocate_file_size(config, block_count);
+
+    if (!err) {
+        err = lfs_fs_grow(lfs, block_count);
+    }
 
     config->on_grow = false;
 
-    return LFS_ERR_OK;
+    return err;
 }
 
 static int vfs_memory_block_device_sync(const lfs_config_t* config) {
@@ -0,0 +1,186 @@
+#pragma once
+
+#if !defined(_WIN32)
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Image file mapped into memory, reads and writes are plain copies and lfs
+// borrows pointers into the mapping through the map hook, so metadata is
+// scanned and crced in place rather than through the read cache. Opened
+// with vfs_posix_open, the fd stays open to grow the image.
+struct vfs_mmap_context : fs::lfsVFS::VFSContext {
+
+    std::shared_ptr<void> _lfs_handle;
+    int _fd;
+    uint8_t* _data;
+    size_t _size;
+
+    vfs_mmap_context(std::shared_ptr<void> lfs_handle, int fd)
+        : _lfs_handle(lfs_handle)
+        , _fd(fd)
+        , _data(nullptr)
+        , _size(0) {}
+
+    ~vfs_mmap_context() {
+
+        if (_data) {
+            munmap(_data, _size);
+        }
+
+        close(_fd);
+    }
+};
+
+static int vfs_mmap_remap(vfs_mmap_context* context, size_t size) {
+
+    void* data = MAP_FAILED;
+
+    if (!context->_data) {
+        data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, context->_fd, 0);
+    }
+    else {
+#if defined(MREMAP_MAYMOVE)
+        data = mremap(context->_data, context->_size, size, MREMAP_MAYMOVE);
+#else
+        data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, context->_fd, 0);
+
+        if (data != MAP_FAILED) {
+            munmap(context->_data, context->_size);
+        }
+#endif
+    }
+
+    if (data == MAP_FAILED) {
+        return LFS_ERR_NOMEM;
+    }
+
+    context->_data = (uint8_t*)data;
+    context->_size = size;
+
+    return LFS_ERR_OK;
+}
+
+// Map the image as it is, returns its size in blocks
+static lfs_size_t vfs_mmap_image_blocks(lfs_config_t* config) {
+
+    vfs_mmap_context* context = (vfs_mmap_context*)(config->context);
+
+    struct stat st;
+
+    if (fstat(context->_fd, &st) != 0 || st.st_size == 0 ||
+        vfs_mmap_remap(context, (size_t)st.st_size) != LFS_ERR_OK) {
+        return 0;
+    }
+
+    return st.st_size / config->block_size;
+}
+
+static int vfs_mmap_allocate_file_size(lfs_config_t* config, size_t blocks) {
+
+    vfs_mmap_context* context = (vfs_mmap_context*)(config->context);
+
+    size_t size = (size_t)config->block_size * blocks;
+
+    if (ftruncate(context->_fd, (off_t)size) != 0) {
+        return LFS_ERR_NOSPC;
+    }
+
+    return vfs_mmap_remap(context, size);
+}
+
+static int vfs_mmap_block_device_read(const lfs_config_t* config, lfs_block_t block,
+    lfs_off_t off, void* buffer, lfs_size_t size) {
+
+    vfs_mmap_context* context = (vfs_mmap_context*)(config->context);
+
+    // nothing mapped, the image was empty
+    if (!context->_data) {
+        return LFS_ERR_IO;
+    }
+
+    memcpy(buffer, &context->_data[config->block_size * block + off], size);
+
+    return LFS_ERR_OK;
+}
+
+static const void* vfs_mmap_block_device_map(const lfs_config_t* config, lfs_block_t block,
+    lfs_off_t off, lfs_size_t size) {
+
+    vfs_mmap_context* context = (vfs_mmap_context*)(config->context);
+
+    if (!context->_data) {
+        return nullptr;
+    }
+
+    return &context->_data[config->block_size * block + off];
+}
+
+static int vfs_mmap_block_device_prog(const lfs_config_t* config, lfs_block_t block,
+    lfs_off_t off, const void* buffer, lfs_size_t size) {
+
+    vfs_mmap_context* context = (vfs_mmap_context*)(config->context);
+
+    memcpy(&context->_data[config->block_size * block + off], buffer, size);
+
+    return LFS_ERR_OK;
+}
+
+static int vfs_mmap_block_device_copy(const lfs_config_t* config, lfs_block_t block,
+    lfs_off_t off, lfs_block_t src_block, lfs_off_t src_off, lfs_size_t size) {
+
+    vfs_mmap_context* context = (vfs_mmap_context*)(config->context);
+
+    memmove(&context->_data[config->block_size * block + off],
+        &context->_data[config->block_size * src_block + src_off], size);
+
+    return LFS_ERR_OK;
+}
+
+static int vfs_mmap_block_device_crc(const lfs_config_t* config, lfs_block_t block,
+    lfs_off_t off, lfs_size_t size, uint32_t* crc) {
+
+    vfs_mmap_context* context = (vfs_mmap_context*)(config->context);
+
+    *crc = lfs_crc(*crc, &context->_data[config->block_size * block + off], size);
+
+    return LFS_ERR_OK;
+}
+
+static int vfs_mmap_block_device_erase(const lfs_config_t* config, lfs_block_t block) {
+    return LFS_ERR_OK;
+}
+
+static int vfs_mmap_allocate_block(lfs_config_t* config) {
+
+    vfs_mmap_context* context = (vfs_mmap_context*)(config->context);
+
+    if (config->on_grow) {
+        return LFS_ERR_NOSPC;
+    }
+
+    config->on_grow = true;
+
+    lfs_t* lfs = (lfs_t*)context->_lfs_handle.get();
+    lfs_size_t block_count = lfs_fs_growsize(lfs);
+
+    // the mapping may move, nothing borrowed from it outlives this call
+    int err = vfs_mmap_allocate_file_size(config, block_count);
+
+    if (!err) {
+        err = lfs_fs_grow(lfs, block_count);
+    }
+
+    config->on_grow = false;
+
+    return err;
+}
+
+static int vfs_mmap_block_device_sync(const lfs_config_t* config) {
+
+    vfs_mmap_context* context = (vfs_mmap_context*)(config->context);
+
+    return msync(context->_data, context->_size, MS_SYNC) == 0 ? LFS_ERR_OK : LFS_ERR_IO;
+}
+
+#endif
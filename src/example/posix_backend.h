@@ -0,0 +1,262 @@
+#pragma once
+
+#if !defined(_WIN32)
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+// Image file accessed with pread/pwrite, there is no shared file position so
+// concurrent reads don't serialize on it. With O_DIRECT the page cache is
+// bypassed, transfers then have to be aligned in offset, size and memory,
+// anything that isn't goes through an aligned bounce buffer.
+static const size_t vfs_posix_direct_alignment = 4096;
+
+struct vfs_posix_context : fs::lfsVFS::VFSContext {
+
+    std::shared_ptr<void> _lfs_handle;
+    int _fd;
+    bool _direct;
+
+    vfs_posix_context(std::shared_ptr<void> lfs_handle, int fd, bool direct)
+        : _lfs_handle(lfs_handle)
+        , _fd(fd)
+        , _direct(direct) {}
+
+    ~vfs_posix_context() {
+        close(_fd);
+    }
+};
+
+static int vfs_posix_open(const std::wstring& path, int flags, bool direct) {
+
+    std::string name(path.size() * MB_CUR_MAX + 1, '\0');
+    size_t size = wcstombs(&name[0], path.c_str(), name.size());
+
+    if (size == (size_t)-1) {
+        return -1;
+    }
+
+    name.resize(size);
+
+#ifdef O_DIRECT
+    if (direct) {
+        flags |= O_DIRECT;
+    }
+#else
+    if (direct) {
+        errno = EINVAL;
+        return -1;
+    }
+#endif
+
+    return open(name.c_str(), flags | O_CLOEXEC, 0644);
+}
+
+// Bounce buffer of this thread for unaligned direct transfers
+static uint8_t* vfs_posix_bounce(size_t size) {
+
+    static thread_local std::unique_ptr<uint8_t, decltype(&free)> buffer(nullptr, &free);
+    static thread_local size_t capacity = 0;
+
+    if (capacity < size) {
+
+        void* p = nullptr;
+
+        if (posix_memalign(&p, vfs_posix_direct_alignment, size) != 0) {
+            return nullptr;
+        }
+
+        buffer.reset((uint8_t*)p);
+        capacity = size;
+    }
+
+    return buffer.get();
+}
+
+static bool vfs_posix_aligned(const void* buffer, off_t offset, size_t size) {
+
+    return (uintptr_t)buffer % vfs_posix_direct_alignment == 0 &&
+        offset % vfs_posix_direct_alignment == 0 &&
+        size % vfs_posix_direct_alignment == 0;
+}
+
+static int vfs_posix_pread(int fd, void* buffer, size_t size, off_t offset) {
+
+    uint8_t* data = (uint8_t*)buffer;
+
+    while (size > 0) {
+
+        ssize_t res = pread(fd, data, size, offset);
+
+        if (res < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (res <= 0) {
+            return LFS_ERR_IO;
+        }
+
+        data += res;
+        offset += res;
+        size -= res;
+    }
+
+    return LFS_ERR_OK;
+}
+
+static int vfs_posix_pwrite(int fd, const void* buffer, size_t size, off_t offset) {
+
+    const uint8_t* data = (const uint8_t*)buffer;
+
+    while (size > 0) {
+
+        ssize_t res = pwrite(fd, data, size, offset);
+
+        if (res < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (res <= 0) {
+            return LFS_ERR_IO;
+        }
+
+        data += res;
+        offset += res;
+        size -= res;
+    }
+
+    return LFS_ERR_OK;
+}
+
+static int vfs_posix_allocate_file_size(lfs_config_t* config, size_t blocks) {
+
+    vfs_posix_context* context = (vfs_posix_context*)(config->context);
+
+    off_t size = (off_t)config->block_size * blocks;
+
+    // reserve the space up front where the filesystem supports it, so
+    // writes into the image can't fail for lack of space later
+    int err = posix_fallocate(context->_fd, 0, size);
+
+    if (err == EOPNOTSUPP || err == EINVAL) {
+        err = ftruncate(context->_fd, size) == 0 ? 0 : errno;
+    }
+
+    return err == 0 ? LFS_ERR_OK : LFS_ERR_NOSPC;
+}
+
+static lfs_size_t vfs_posix_image_blocks(lfs_config_t* config) {
+
+    vfs_posix_context* context = (vfs_posix_context*)(config->context);
+
+    off_t size = lseek(context->_fd, 0, SEEK_END);
+
+    return size < 0 ? 0 : size / config->block_size;
+}
+
+static int vfs_posix_block_device_read(const lfs_config_t* config, lfs_block_t block,
+    lfs_off_t off, void* buffer, lfs_size_t size) {
+
+    vfs_posix_context* context = (vfs_posix_context*)(config->context);
+
+    off_t offset = (off_t)config->block_size * block + off;
+
+    if (!context->_direct || vfs_posix_aligned(buffer, offset, size)) {
+        return vfs_posix_pread(context->_fd, buffer, size, offset);
+    }
+
+    off_t start = offset - offset % vfs_posix_direct_alignment;
+    size_t span = ((offset + size - start) + vfs_posix_direct_alignment - 1) /
+        vfs_posix_direct_alignment * vfs_posix_direct_alignment;
+
+    uint8_t* bounce = vfs_posix_bounce(span);
+
+    if (!bounce) {
+        return LFS_ERR_NOMEM;
+    }
+
+    int err = vfs_posix_pread(context->_fd, bounce, span, start);
+
+    if (err) {
+        return err;
+    }
+
+    memcpy(buffer, &bounce[offset - start], size);
+
+    return LFS_ERR_OK;
+}
+
+static int vfs_posix_block_device_prog(const lfs_config_t* config, lfs_block_t block,
+    lfs_off_t off, const void* buffer, lfs_size_t size) {
+
+    vfs_posix_context* context = (vfs_posix_context*)(config->context);
+
+    off_t offset = (off_t)config->block_size * block + off;
+
+    if (!context->_direct || vfs_posix_aligned(buffer, offset, size)) {
+        return vfs_posix_pwrite(context->_fd, buffer, size, offset);
+    }
+
+    off_t start = offset - offset % vfs_posix_direct_alignment;
+    size_t span = ((offset + size - start) + vfs_posix_direct_alignment - 1) /
+        vfs_posix_direct_alignment * vfs_posix_direct_alignment;
+
+    uint8_t* bounce = vfs_posix_bounce(span);
+
+    if (!bounce) {
+        return LFS_ERR_NOMEM;
+    }
+
+    // partial sectors at either end keep what is already on disk
+    if (start != offset || span != size) {
+
+        int err = vfs_posix_pread(context->_fd, bounce, span, start);
+
+        if (err) {
+            return err;
+        }
+    }
+
+    memcpy(&bounce[offset - start], buffer, size);
+
+    return vfs_posix_pwrite(context->_fd, bounce, span, start);
+}
+
+static int vfs_posix_block_device_erase(const lfs_config_t* config, lfs_block_t block) {
+    return LFS_ERR_OK;
+}
+
+static int vfs_posix_allocate_block(lfs_config_t* config) {
+
+    vfs_posix_context* context = (vfs_posix_context*)(config->context);
+
+    if (config->on_grow) {
+        return LFS_ERR_NOSPC;
+    }
+
+    config->on_grow = true;
+
+    lfs_t* lfs = (lfs_t*)context->_lfs_handle.get();
+    lfs_size_t block_count = lfs_fs_growsize(lfs);
+
+    int err = vfs_posix_allocate_file_size(config, block_count);
+
+    if (!err) {
+        err = lfs_fs_grow(lfs, block_count);
+    }
+
+    config->on_grow = false;
+
+    return err;
+}
+
+static int vfs_posix_block_device_sync(const lfs_config_t* config) {
+
+    vfs_posix_context* context = (vfs_posix_context*)(config->context);
+
+    // file data only, the size is already settled by allocate_file_size
+    return fdatasync(context->_fd) == 0 ? LFS_ERR_OK : LFS_ERR_IO;
+}
+
+#endif
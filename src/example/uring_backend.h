@@ -0,0 +1,270 @@
+#pragma once
+
+#if defined(__linux__)
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+// pread/pwrite image backend whose batched reads go through an io_uring, so
+// every block of a batch is in flight at once. Talks to the kernel through
+// the raw syscalls, there is no liburing dependency. Where the ring can't
+// be set up (old kernel, seccomp) batches are read one region at a time.
+static const unsigned vfs_uring_entries = 2 * LFS_READ_BATCH_MAX;
+
+struct vfs_uring_context : vfs_posix_context {
+
+    int _ring;
+
+    // submission queue
+    unsigned* _sq_head;
+    unsigned* _sq_tail;
+    unsigned* _sq_mask;
+    unsigned* _sq_array;
+    io_uring_sqe* _sqes;
+
+    // completion queue
+    unsigned* _cq_head;
+    unsigned* _cq_tail;
+    unsigned* _cq_mask;
+    io_uring_cqe* _cqes;
+
+    void* _sq_ring;
+    size_t _sq_ring_size;
+    void* _cq_ring;
+    size_t _cq_ring_size;
+    size_t _sqes_size;
+
+    // batches submitted and regions in them, to see the queue depth reached
+    uint64_t _batches;
+    uint64_t _requests;
+
+    vfs_uring_context(std::shared_ptr<void> lfs_handle, int fd)
+        : vfs_posix_context(lfs_handle, fd, false)
+        , _ring(-1)
+        , _sqes(nullptr)
+        , _sq_ring(MAP_FAILED)
+        , _sq_ring_size(0)
+        , _cq_ring(MAP_FAILED)
+        , _cq_ring_size(0)
+        , _sqes_size(0)
+        , _batches(0)
+        , _requests(0) {
+
+        setup();
+    }
+
+    ~vfs_uring_context() {
+
+        if (_sqes) {
+            munmap(_sqes, _sqes_size);
+        }
+
+        if (_cq_ring != MAP_FAILED && _cq_ring != _sq_ring) {
+            munmap(_cq_ring, _cq_ring_size);
+        }
+
+        if (_sq_ring != MAP_FAILED) {
+            munmap(_sq_ring, _sq_ring_size);
+        }
+
+        if (_ring >= 0) {
+            close(_ring);
+        }
+    }
+
+private:
+    void setup() {
+
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+
+        _ring = (int)syscall(__NR_io_uring_setup, vfs_uring_entries, &params);
+
+        if (_ring < 0) {
+            return;
+        }
+
+        _sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        _cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+        // newer kernels share one mapping for both rings
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            _sq_ring_size = std::max(_sq_ring_size, _cq_ring_size);
+            _cq_ring_size = _sq_ring_size;
+        }
+
+        _sq_ring = mmap(nullptr, _sq_ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_SQ_RING);
+
+        if (_sq_ring == MAP_FAILED) {
+            return teardown();
+        }
+
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            _cq_ring = _sq_ring;
+        }
+        else {
+            _cq_ring = mmap(nullptr, _cq_ring_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_CQ_RING);
+
+            if (_cq_ring == MAP_FAILED) {
+                return teardown();
+            }
+        }
+
+        _sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+        void* sqes = mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_SQES);
+
+        if (sqes == MAP_FAILED) {
+            return teardown();
+        }
+
+        _sqes = (io_uring_sqe*)sqes;
+
+        uint8_t* sq = (uint8_t*)_sq_ring;
+        uint8_t* cq = (uint8_t*)_cq_ring;
+
+        _sq_head = (unsigned*)(sq + params.sq_off.head);
+        _sq_tail = (unsigned*)(sq + params.sq_off.tail);
+        _sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+        _sq_array = (unsigned*)(sq + params.sq_off.array);
+
+        _cq_head = (unsigned*)(cq + params.cq_off.head);
+        _cq_tail = (unsigned*)(cq + params.cq_off.tail);
+        _cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+        _cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+    }
+
+    void teardown() {
+
+        if (_cq_ring != MAP_FAILED && _cq_ring != _sq_ring) {
+            munmap(_cq_ring, _cq_ring_size);
+        }
+
+        if (_sq_ring != MAP_FAILED) {
+            munmap(_sq_ring, _sq_ring_size);
+        }
+
+        _sq_ring = MAP_FAILED;
+        _cq_ring = MAP_FAILED;
+
+        close(_ring);
+        _ring = -1;
+    }
+};
+
+static int vfs_uring_block_device_read_batch(const lfs_config_t* config,
+    const lfs_bd_request_t* requests, lfs_size_t count) {
+
+    vfs_uring_context* context = (vfs_uring_context*)(config->context);
+
+    if (context->_ring < 0) {
+
+        for (lfs_size_t i = 0; i < count; i++) {
+
+            int err = vfs_posix_block_device_read(config,
+                requests[i].block, requests[i].offset, requests[i].buffer, requests[i].size);
+
+            if (err) {
+                return err;
+            }
+        }
+
+        return LFS_ERR_OK;
+    }
+
+    LFS_ASSERT(count <= vfs_uring_entries);
+
+    // the iovecs have to stay put until the reads complete
+    iovec iov[vfs_uring_entries];
+    unsigned tail = *context->_sq_tail;
+
+    for (lfs_size_t i = 0; i < count; i++) {
+
+        unsigned index = tail & *context->_sq_mask;
+        io_uring_sqe* sqe = &context->_sqes[index];
+
+        iov[i].iov_base = requests[i].buffer;
+        iov[i].iov_len = requests[i].size;
+
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READV;
+        sqe->fd = context->_fd;
+        sqe->off = (uint64_t)config->block_size * requests[i].block + requests[i].offset;
+        sqe->addr = (uint64_t)(uintptr_t)&iov[i];
+        sqe->len = 1;
+        sqe->user_data = i;
+
+        context->_sq_array[index] = index;
+        tail += 1;
+    }
+
+    __atomic_store_n(context->_sq_tail, tail, __ATOMIC_RELEASE);
+
+    context->_batches += 1;
+    context->_requests += count;
+
+    int err = LFS_ERR_OK;
+    lfs_size_t submit = count;
+    lfs_size_t pending = count;
+
+    // every completion has to be reaped before returning, even after an
+    // error, the kernel may still be writing into the buffers
+    while (pending > 0) {
+
+        int res = (int)syscall(__NR_io_uring_enter, context->_ring,
+            submit, pending, IORING_ENTER_GETEVENTS, nullptr, 0);
+
+        if (res < 0) {
+
+            if (errno == EINTR) {
+                continue;
+            }
+
+            // nothing more will complete if nothing was submitted, take
+            // the entries back out of the queue
+            if (submit == count) {
+                __atomic_store_n(context->_sq_tail, tail - count, __ATOMIC_RELEASE);
+                return LFS_ERR_IO;
+            }
+
+            err = LFS_ERR_IO;
+        }
+        else {
+            submit -= std::min<lfs_size_t>(submit, res);
+        }
+
+        unsigned head = *context->_cq_head;
+        unsigned end = __atomic_load_n(context->_cq_tail, __ATOMIC_ACQUIRE);
+
+        for (; head != end; head++) {
+
+            io_uring_cqe* cqe = &context->_cqes[head & *context->_cq_mask];
+            const lfs_bd_request_t* request = &requests[cqe->user_data];
+
+            if (cqe->res < 0) {
+                err = LFS_ERR_IO;
+            }
+            else if ((lfs_size_t)cqe->res < request->size && !err) {
+
+                // finish a short read synchronously
+                err = vfs_posix_pread(context->_fd,
+                    (uint8_t*)request->buffer + cqe->res,
+                    request->size - cqe->res,
+                    (off_t)config->block_size * request->block + request->offset + cqe->res);
+            }
+
+            pending -= 1;
+        }
+
+        __atomic_store_n(context->_cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return err;
+}
+
+#endif
@@ -27,63 +27,635 @@ void lfs_alloc_drop(lfs_t* lfs) {
 
     lfs->free.size = 0;
     lfs->free.i = 0;
+    lfs->free.grow = false;
     lfs_alloc_ack(lfs);
 }
 
+// size the allocation window, with a free map this is the whole device and
+// the map is grown along with it
+int lfs_alloc_window(lfs_t* lfs, lfs_block_t* window) {
+
+    if (!lfs->cfg->free_map) {
+
+        *window = 8 * lfs->cfg->lookahead_size;
+        return LFS_ERR_OK;
+    }
+
+    if (lfs->free.capacity < lfs->block_count) {
+
+        lfs_block_t capacity = lfs_alignup(lfs->block_count, 64);
+        uint64_t* buffer = (uint64_t*)realloc(lfs->free.buffer, capacity / 8);
+
+        if (!buffer) {
+
+            return LFS_ERR_NOMEM;
+        }
+
+        lfs->free.buffer = buffer;
+        lfs->free.capacity = capacity;
+    }
+
+    *window = lfs->free.capacity;
+    return LFS_ERR_OK;
+}
+
+// skip used blocks in the window a word of the bitmap at a time, stopping at
+// the next free block or the end of the window
+static void lfs_alloc_skip(lfs_t* lfs) {
+
+    while (lfs->free.i != lfs->free.size) {
+
+        uint64_t word = ~lfs->free.buffer[lfs->free.i / 64] >> (lfs->free.i % 64);
+        lfs_block_t diff = 64 - (lfs->free.i % 64);
+
+        if (word) {
+
+            diff = lfs_ctz64(word);
+        }
+
+        diff = lfs_min(diff, lfs->free.size - lfs->free.i);
+        lfs->free.i += diff;
+        lfs->free.ack -= diff;
+
+        if (word) {
+
+            return;
+        }
+    }
+}
+
+// grow the device ahead of running out of space. Positions in the window
+// map to blocks modulo the block count, so the window is first cut short
+// where it wraps around, it then means the same blocks before and after,
+// and allocations made by the growth's own commit use it as is. The growth
+// commits the superblock, so it is only made between operations, never from
+// an allocation in the middle of another commit.
+void lfs_alloc_growahead(lfs_t* lfs) {
+
+    if (!lfs->free.grow || !lfs->cfg->allocate_block) {
+
+        return;
+    }
+
+    lfs_block_t end = lfs->block_count - lfs->free.offset;
+
+    if (lfs->free.i > end) {
+
+        // already past the wrap, wait for the next window
+        return;
+    }
+
+    lfs->free.grow = false;
+    lfs->free.size = lfs_min(lfs->free.size, end);
+
+    lfs_block_t count = lfs->block_count;
+
+    if (lfs->cfg->allocate_block((lfs_config_t*)lfs->cfg) == LFS_ERR_OK) {
+
+        // the new blocks are still to be looked at
+        lfs->free.ack = lfs_min(lfs->free.ack + (lfs->block_count - count), lfs->block_count);
+    }
+}
+
+// every block has been looked at since the last ack, grow the device if it
+// can be. Blocks handed out since the last ack aren't committed yet and look
+// free to a scan, so only the new blocks are looked at until the next ack.
+static int lfs_alloc_more(lfs_t* lfs) {
+
+    if (!lfs->cfg->allocate_block) {
+
+        LFS_ERROR("No more free space %"PRIu32, lfs->free.i + lfs->free.offset);
+        return LFS_ERR_NOSPC;
+    }
+
+    lfs_block_t count = lfs->block_count;
+
+    lfs->free.growing = true;
+    int err = lfs->cfg->allocate_block((lfs_config_t*)lfs->cfg);
+    lfs->free.growing = false;
+
+    if (err) {
+
+        if (err == LFS_ERR_NOSPC) {
+
+            LFS_ERROR("No more free space %"PRIu32, lfs->free.i + lfs->free.offset);
+        }
+
+        return err;
+    }
+
+    if (lfs->block_count == count) {
+
+        LFS_ERROR("No more free space %"PRIu32, lfs->free.i + lfs->free.offset);
+        return LFS_ERR_NOSPC;
+    }
+
+    // the next window starts with the new blocks, they are free
+    lfs->free.offset = count;
+    lfs->free.size = 0;
+    lfs->free.i = 0;
+    lfs->free.ack = lfs->block_count - count;
+
+    return LFS_ERR_OK;
+}
+
+// move the window on past what has been looked at and find the blocks in
+// use in it
+static int lfs_alloc_scan(lfs_t* lfs) {
+
+    lfs_block_t window = 0;
+    int err = lfs_alloc_window(lfs, &window);
+
+    if (err) {
+
+        lfs_alloc_drop(lfs);
+        return err;
+    }
+
+    lfs->free.offset = (lfs->free.offset + lfs->free.size) % lfs->block_count;
+    lfs->free.size = lfs_min(window, lfs->free.ack);
+    lfs->free.i = 0;
+
+    // find mask of free blocks from tree
+    memset(lfs->free.buffer, 0, lfs_alignup(lfs->free.size, 64) / 8);
+
+    err = lfs_fs_rawtraverse(lfs, lfs_alloc_lookahead, lfs, true);
+
+    if (err) {
+
+        lfs_alloc_drop(lfs);
+        return err;
+    }
+
+    // a window over the whole device tells how full it is
+    if (lfs->cfg->grow_watermark && lfs->free.size == lfs->block_count) {
+
+        uint64_t used = 0;
+
+        for (lfs_block_t j = 0; j < lfs_alignup(lfs->free.size, 64) / 64; j++) {
+
+            used += lfs_popc64(lfs->free.buffer[j]);
+        }
+
+        lfs->free.grow = (used * 100 >= (uint64_t)lfs->cfg->grow_watermark * lfs->block_count);
+    }
+
+    return LFS_ERR_OK;
+}
+
 int lfs_alloc(lfs_t* lfs, lfs_block_t* block) {
 
     while (true) {
 
-        while (lfs->free.i != lfs->free.size) {
+        lfs_alloc_skip(lfs);
 
-            lfs_block_t offset = lfs->free.i;
+        if (lfs->free.i != lfs->free.size) {
+
+            // found a free block, mark it so a checkpointed free map
+            // doesn't hand it out again
+            *block = (lfs->free.offset + lfs->free.i) % lfs->block_count;
+            lfs->free.buffer[lfs->free.i / 64] |= (uint64_t)1U << (lfs->free.i % 64);
             lfs->free.i += 1;
             lfs->free.ack -= 1;
 
-            if (!(lfs->free.buffer[offset / 64] & ((uint64_t)1U << (offset % 64)))) {
-                // found a free block
-                *block = (lfs->free.offset + offset) % lfs->block_count;
+            // eagerly find next offset so an alloc ack can
+            // discredit old lookahead blocks
+            lfs_alloc_skip(lfs);
+
+            return LFS_ERR_OK;
+        }
 
-                // eagerly find next offset so an alloc ack can
-                // discredit old lookahead blocks
-                while (lfs->free.i != lfs->free.size &&
-                    (lfs->free.buffer[lfs->free.i / 64] & ((uint64_t)1U << (lfs->free.i % 64)))) {
+        // check if we have looked at all blocks since last ack
+        if (lfs->free.ack == 0) {
 
-                    lfs->free.i += 1;
-                    lfs->free.ack -= 1;
-                }
+            int err = lfs_alloc_more(lfs);
 
-                return LFS_ERR_OK;
+            if (err) {
+
+                return err;
             }
+
+            return lfs_alloc(lfs, block);
         }
 
-        // check if we have looked at all blocks since last ack
+        int err = lfs_alloc_scan(lfs);
+
+        if (err) {
+
+            return err;
+        }
+    }
+}
+
+// set aside a run of count contiguous blocks in one pass over the windows,
+// growing the device by at least the run when none is free. The run can't
+// wrap around the end of the device, and without a free map is cut down to
+// what a lookahead window holds.
+int lfs_alloc_range(lfs_t* lfs, lfs_size_t count, lfs_extent_t* range) {
+
+    LFS_ASSERT(count > 0);
+
+    if (!lfs->cfg->free_map) {
+
+        count = lfs_min(count, 8 * lfs->cfg->lookahead_size);
+    }
+
+    while (true) {
+
+        lfs_block_t run = 0;
+        lfs_block_t j = lfs->free.i;
+
+        while (j < lfs->free.size && run < count) {
+
+            if (j % 64 == 0 && lfs->free.buffer[j / 64] == ~(uint64_t)0) {
+
+                // a whole word in use
+                run = 0;
+                j += 64;
+                continue;
+            }
+
+            if (lfs->free.buffer[j / 64] & ((uint64_t)1U << (j % 64))) {
+
+                run = 0;
+            }
+            else if ((lfs->free.offset + j) % lfs->block_count == 0) {
+
+                // the device wrapped around
+                run = 1;
+            }
+            else {
+
+                run += 1;
+            }
+
+            j += 1;
+        }
+
+        if (run == count) {
+
+            // mark the run the same as allocated blocks
+            for (lfs_block_t k = j - count; k < j; k++) {
+
+                lfs->free.buffer[k / 64] |= (uint64_t)1U << (k % 64);
+            }
+
+            range->start = (lfs->free.offset + j - count) % lfs->block_count;
+            range->count = count;
+            return LFS_ERR_OK;
+        }
+
+        // the rest of the window has been looked at
+        lfs->free.ack -= lfs->free.size - lfs->free.i;
+        lfs->free.i = lfs->free.size;
+
         if (lfs->free.ack == 0) {
 
-            if (!lfs->cfg->allocate_block ||
-                lfs->cfg->allocate_block((lfs_config_t*)lfs->cfg) == LFS_ERR_NOSPC) {
+            lfs->free.want = count;
+            int err = lfs_alloc_more(lfs);
+            lfs->free.want = 0;
 
-                LFS_ERROR("No more free space %"PRIu32, lfs->free.i + lfs->free.offset);
-                return LFS_ERR_NOSPC;
+            if (err) {
+
+                return err;
             }
+        }
 
-            lfs_alloc_ack(lfs);
-            return lfs_alloc(lfs, block);
+        int err = lfs_alloc_scan(lfs);
+
+        if (err) {
+
+            return err;
+        }
+    }
+}
+
+// take the next block of a run set aside by lfs_alloc_range, allocating
+// one the usual way once the run is used up
+int lfs_alloc_take(lfs_t* lfs, lfs_extent_t* range, lfs_block_t* block) {
+
+    if (!range || range->count == 0) {
+
+        return lfs_alloc(lfs, block);
+    }
+
+    *block = range->start;
+    range->start += 1;
+    range->count -= 1;
+    return LFS_ERR_OK;
+}
+
+/// Free map checkpoints ///
+static int lfs_alloc_unmark(void* p, lfs_block_t block) {
+
+    lfs_t* lfs = (lfs_t*)p;
+    lfs_block_t offset = ((block - lfs->free.offset) + lfs->block_count) % lfs->block_count;
+
+    if (offset < lfs->free.size) {
+
+        lfs->free.buffer[offset / 64] &= ~((uint64_t)1U << (offset % 64));
+    }
+
+    return LFS_ERR_OK;
+}
+
+// give back what is left of a run set aside by lfs_alloc_range, nothing
+// refers to those blocks so they are free as soon as the window forgets them
+void lfs_alloc_unreserve(lfs_t* lfs, lfs_extent_t* range) {
+
+    for (lfs_size_t j = 0; j < range->count; j++) {
+
+        lfs_alloc_unmark(lfs, range->start + j);
+    }
+
+    range->count = 0;
+}
+
+// find the blocks in use of the next window once the current one has no
+// free block left, rather than in the allocation that runs into it. When
+// every block has been looked at since the last ack that allocation grows
+// the device instead, which is left to it.
+int lfs_alloc_fill(lfs_t* lfs) {
+
+    lfs_alloc_skip(lfs);
+
+    if (lfs->free.i != lfs->free.size || lfs->free.ack == 0) {
+
+        return LFS_ERR_OK;
+    }
+
+    return lfs_alloc_scan(lfs);
+}
+
+// point the superblock at a free map, or at none with a zero size
+static int lfs_alloc_commitmap(lfs_t* lfs, const lfs_ctz_t* map, lfs_block_t offset) {
+
+    lfs_metadata_dir_t root;
+    int err = lfs_dir_fetch(lfs, &root, lfs->root);
+
+    if (err) {
+
+        return err;
+    }
+
+    lfs_superblock_t superblock;
+    lfs_stag_t tag = lfs_dir_get(lfs, &root, LFS_MKTAG(LFS_TYPE_MOVESTATE, 0x3ff, 0),
+        LFS_MKTAG(LFS_TYPE_INLINESTRUCT, 0, sizeof(superblock)), &superblock);
+
+    if (tag < 0) {
+
+        return tag;
+    }
+
+    lfs_superblock_fromle64(&superblock);
+
+    // older drivers would not drop the reference before changing anything,
+    // so only an image without a map is left to them, at the version its
+    // files need
+    superblock.version = map->size
+        ? lfs_max(lfs->disk_version, LFS_DISK_VERSION_FREE_MAP)
+        : lfs->disk_version;
+
+    superblock.free_map_head = map->head;
+    superblock.free_map_size = map->size;
+    superblock.free_map_offset = offset;
+
+    lfs_superblock_tole64(&superblock);
+
+    lfs_metadata_attribute_t attr[] = {
+        { LFS_MKTAG(LFS_TYPE_INLINESTRUCT, 0, sizeof(superblock)), &superblock }
+    };
+
+    return lfs_dir_commit(lfs, &root, attr, _countof(attr));
+}
+
+// load the free map referenced from the superblock as the allocation window
+int lfs_alloc_load(lfs_t* lfs, lfs_block_t offset) {
+
+    if (!lfs->cfg->free_map || offset >= lfs->block_count ||
+        lfs->free.map.size != lfs_alignup(lfs->block_count, 64) / 8) {
+
+        return LFS_ERR_OK;
+    }
+
+    lfs_block_t window = 0;
+    int err = lfs_alloc_window(lfs, &window);
+
+    if (err) {
+
+        return err;
+    }
+
+    uint8_t* data = (uint8_t*)lfs->free.buffer;
+    lfs_size_t pos = 0;
+
+    while (pos < lfs->free.map.size) {
+
+        lfs_block_t block;
+        lfs_off_t off;
+
+        err = lfs_ctz_find(lfs, NULL, &lfs->read_cache, NULL,
+            lfs->free.map.head, lfs->free.map.size, pos, &block, &off);
+
+        if (err) {
+
+            return err;
+        }
+
+        lfs_size_t diff = lfs_min(lfs->free.map.size - pos, lfs->block_size - off);
+
+        err = lfs_bd_read(lfs, NULL, &lfs->read_cache, diff, block, off, &data[pos], diff);
+
+        if (err) {
+
+            return err;
+        }
+
+        pos += diff;
+    }
+
+    for (lfs_block_t i = 0; i < lfs->free.map.size / 8; i++) {
+
+        lfs->free.buffer[i] = lfs_fromle64(lfs->free.buffer[i]);
+    }
+
+    lfs->free.offset = offset;
+    lfs->free.size = lfs->block_count;
+    lfs->free.i = 0;
+    lfs_alloc_ack(lfs);
+
+    // the map's own blocks were allocated after parts of it were written
+    return lfs_ctz_traverse(lfs, NULL, &lfs->read_cache,
+        lfs->free.map.head, lfs->free.map.size, lfs_alloc_lookahead, lfs);
+}
+
+// drop the superblock's reference to the free map before anything else is
+// committed, as the map is out of date after that. Called before operations
+// capture any metadata pairs, as this commits to the root pair.
+int lfs_alloc_release(lfs_t* lfs) {
+
+    if (!lfs->free.map.size || lfs->free.releasing) {
+
+        return LFS_ERR_OK;
+    }
+
+    // the map's blocks stay in use until the commit is done
+    const lfs_ctz_t none = { 0, 0 };
+
+    lfs->free.releasing = true;
+    int err = lfs_alloc_commitmap(lfs, &none, 0);
+    lfs->free.releasing = false;
+
+    if (err) {
+
+        return err;
+    }
+
+    lfs_ctz_t map = lfs->free.map;
+    lfs->free.map = none;
+
+    return lfs_ctz_traverse(lfs, NULL, &lfs->read_cache, map.head, map.size, lfs_alloc_unmark, lfs);
+}
+
+// check the window has at least count blocks left to allocate
+static bool lfs_alloc_left(lfs_t* lfs, lfs_block_t count) {
+
+    for (lfs_block_t j = lfs->free.i; j < lfs->free.size && count; j++) {
+
+        if (!(lfs->free.buffer[j / 64] & ((uint64_t)1U << (j % 64)))) {
+
+            count -= 1;
         }
+    }
+
+    return count == 0;
+}
 
-        lfs->free.offset = (lfs->free.offset + lfs->free.size) % lfs->block_count;
-        lfs->free.size = lfs_min(16 * lfs->cfg->lookahead_size, lfs->free.ack);
-        lfs->free.i = 0;
+// write the free map out and reference it from the superblock, so the next
+// mount doesn't have to traverse the filesystem to build it. Skipped when
+// the device is too full to write the map out of one window.
+int lfs_alloc_checkpoint(lfs_t* lfs) {
 
-        // find mask of free blocks from tree
-        memset(lfs->free.buffer, 0, lfs->cfg->lookahead_size);
-        
-        int err = lfs_fs_rawtraverse(lfs, lfs_alloc_lookahead, lfs, true);
+    // a referenced map is still up to date
+    if (!lfs->cfg->free_map || lfs->free.map.size) {
+
+        return LFS_ERR_OK;
+    }
+
+    lfs_size_t size = lfs_alignup(lfs->block_count, 64) / 8;
+    lfs_block_t count = lfs->block_count;
+
+    // the map's own blocks are allocated while it is written, a window used
+    // up on the way would be rescanned smaller than the device and leave the
+    // rest of the map unknown
+    lfs_off_t last = size - 1;
+    lfs_block_t needed = lfs_ctz_index(lfs, &last) + 1;
+
+    // the map is written out of a fresh window over the whole device. The
+    // current one still marks blocks freed since it was scanned as in use,
+    // and a mount loading them from the map could never hand them out again
+    // before running out of space.
+    lfs_block_t window = 0;
+    int err = lfs_alloc_window(lfs, &window);
+
+    if (err) {
+
+        lfs_alloc_drop(lfs);
+        return err;
+    }
+
+    lfs->free.offset = (lfs->free.offset + lfs->free.size) % lfs->block_count;
+    lfs->free.size = lfs->block_count;
+    lfs->free.i = 0;
+    lfs_alloc_ack(lfs);
+
+    memset(lfs->free.buffer, 0, lfs_alignup(lfs->free.size, 64) / 8);
+
+    err = lfs_fs_rawtraverse(lfs, lfs_alloc_lookahead, lfs, true);
+
+    if (err) {
+
+        lfs_alloc_drop(lfs);
+        return err;
+    }
+
+    if (!lfs_alloc_left(lfs, needed)) {
+
+        return LFS_ERR_OK;
+    }
+
+    lfs_ctz_t map = { 0, 0 };
+    lfs_block_t block = LFS_BLOCK_NULL;
+    lfs_off_t off = lfs->block_size;
+
+    while (map.size < size) {
+
+        if (off == lfs->block_size) {
+
+            err = lfs_ctz_extend(lfs, &lfs->write_cache, &lfs->read_cache, NULL, NULL,
+                block, map.size, &block, &off);
+
+            if (err) {
+
+                return err;
+            }
+
+            map.head = block;
+        }
+
+        // the map is kept little-endian on disk, blocks can end mid-word
+        uint64_t chunk[32];
+        lfs_size_t skip = map.size % 8;
+        lfs_size_t diff = lfs_min(lfs_min(size - map.size, lfs->block_size - off), sizeof(chunk) - 8);
+
+        for (lfs_size_t j = 0; j < (skip + diff + 7) / 8; j++) {
+
+            chunk[j] = lfs_tole64(lfs->free.buffer[map.size / 8 + j]);
+        }
+
+        err = lfs_bd_write(lfs, &lfs->write_cache, &lfs->read_cache, true,
+            block, off, (uint8_t*)chunk + skip, diff);
 
         if (err) {
-        
-            lfs_alloc_drop(lfs);
+
             return err;
         }
+
+        off += diff;
+        map.size += diff;
+    }
+
+    err = lfs_bd_flush(lfs, &lfs->write_cache, &lfs->read_cache, true);
+
+    if (err) {
+
+        return err;
+    }
+
+    // bad blocks may still have used the window up, nothing refers to the
+    // blocks written so far
+    if (lfs->free.size != lfs->block_count || lfs->block_count != count) {
+
+        return LFS_ERR_OK;
+    }
+
+    lfs_block_t i = lfs->free.i;
+    lfs_block_t offset = lfs->free.offset;
+
+    err = lfs_alloc_commitmap(lfs, &map, lfs->free.offset);
+
+    if (err) {
+
+        return err;
     }
-}
\ No newline at end of file
+
+    lfs->free.map = map;
+
+    // blocks allocated by the commit itself are missing from the map
+    if (lfs->free.i != i || lfs->free.offset != offset) {
+
+        return lfs_alloc_release(lfs);
+    }
+
+    return LFS_ERR_OK;
+}
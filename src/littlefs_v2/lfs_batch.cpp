@@ -0,0 +1,377 @@
+#include "lfs.h"
+
+/// Sync batches ///
+
+// A file closed in a batch is held on the list of open files by a copy,
+// so its blocks stay in use and its id follows the commits made up to
+// lfs_batch_end. The copy's attributes and inline data follow it in the same
+// allocation, the caller's buffers are gone by then.
+struct lfs_batch_file_t {
+
+    lfs_file_t file;
+    lfs_file_config_t cfg;
+};
+
+int lfs_batch_rawbegin(lfs_t* lfs) {
+
+    lfs->batch_depth += 1;
+
+    return LFS_ERR_OK;
+}
+
+// Let go of a file whose commit is done with, the copy of a closed one is
+// freed
+static void lfs_batch_drop(lfs_t* lfs, lfs_file_t* file) {
+
+    file->flags &= ~LFS_F_BATCHSYNC;
+
+    if (file->flags & LFS_F_BATCHHELD) {
+
+        lfs_mlist_remove(lfs, (lfs_metadata_list_t*)file);
+        lfs_extent_release(&file->extents);
+        free(file);
+    }
+}
+
+static bool lfs_batch_match(const lfs_file_t* entry, const lfs_block_t pair[2]) {
+
+    return entry->type == LFS_TYPE_REG && (entry->flags & LFS_F_BATCHSYNC) &&
+        lfs_pair_cmp(entry->metadata.pair, pair) == 0;
+}
+
+// Most a file can add to a commit, its struct and its attributes with their
+// tags
+static lfs_size_t lfs_batch_cost(const lfs_file_t* file) {
+
+    lfs_size_t size = sizeof(lfs_tag_t) + ((file->flags & LFS_F_INLINE) ? file->ctz.size :
+        (file->flags & LFS_F_EXTENT) ? 0x3fe : sizeof(lfs_ctz_t));
+
+    for (lfs_size_t i = 0; i < file->cfg->attr_count; i++) {
+
+        size += sizeof(lfs_tag_t) + file->cfg->attrs[i].size;
+    }
+
+    return size;
+}
+
+// Commit the files held back on the metadata pair of a file, the file first
+// and as many of the others as fit in half of a metadata block with it. A
+// larger commit would only be split up again by compaction. Without the
+// memory to gather them only the file itself is committed.
+static int lfs_batch_endpair(lfs_t* lfs, lfs_file_t* file) {
+
+    lfs_block_t pair[2] = { file->metadata.pair[0], file->metadata.pair[1] };
+
+    lfs_size_t budget = ((lfs->cfg->metadata_max ?
+        lfs->cfg->metadata_max : lfs->block_size) / 2);
+    lfs_size_t cost = lfs_batch_cost(file);
+    lfs_size_t count = 1;
+    lfs_size_t extent_count = (file->flags & LFS_F_EXTENT) ? 1 : 0;
+
+    for (lfs_file_t* entry = (lfs_file_t*)lfs->metadata_list; entry; entry = (lfs_file_t*)entry->next) {
+
+        if (entry != file && lfs_batch_match(entry, pair) && cost + lfs_batch_cost(entry) <= budget) {
+
+            cost += lfs_batch_cost(entry);
+            count += 1;
+            extent_count += (entry->flags & LFS_F_EXTENT) ? 1 : 0;
+        }
+    }
+
+    // the files, their attributes and the room to build their structs in
+    lfs_file_t* one[1] = { file };
+    lfs_metadata_attribute_t oneattrs[2];
+    lfs_ctz_t onectz;
+    uint8_t oneextents[0x3fe];
+
+    lfs_file_t** files = (lfs_file_t**)malloc(count * (sizeof(lfs_file_t*) +
+        2 * sizeof(lfs_metadata_attribute_t) + sizeof(lfs_ctz_t)) + extent_count * 0x3fe);
+
+    lfs_metadata_attribute_t* attrs = oneattrs;
+    lfs_ctz_t* ctzs = &onectz;
+    uint8_t* extents = oneextents;
+
+    if (files) {
+
+        attrs = (lfs_metadata_attribute_t*)&files[count];
+        ctzs = (lfs_ctz_t*)&attrs[2 * count];
+        extents = (uint8_t*)&ctzs[count];
+
+        files[0] = file;
+        cost = lfs_batch_cost(file);
+
+        lfs_size_t n = 1;
+
+        for (lfs_file_t* entry = (lfs_file_t*)lfs->metadata_list; entry && n < count; entry = (lfs_file_t*)entry->next) {
+
+            if (entry != file && lfs_batch_match(entry, pair) && cost + lfs_batch_cost(entry) <= budget) {
+
+                cost += lfs_batch_cost(entry);
+                files[n] = entry;
+                n += 1;
+            }
+        }
+    }
+    else {
+
+        count = 1;
+    }
+
+    lfs_file_t** batch = files ? files : one;
+    int err = LFS_ERR_OK;
+    int attrcount = 0;
+
+    // a file removed in the meantime has nothing left to commit to
+    if (lfs_pair_isnull(pair)) {
+
+        goto done;
+    }
+
+    err = lfs_alloc_release(lfs);
+
+    if (err) {
+
+        goto done;
+    }
+
+    // the superblock is raised before the ids of the entries are taken, the
+    // commit could move them
+    if (extent_count) {
+
+        err = lfs_fs_raiseversion(lfs, LFS_DISK_VERSION_EXTENTS);
+
+        if (err) {
+
+            goto done;
+        }
+    }
+
+    for (lfs_size_t i = 0; i < count; i++) {
+
+        lfs_file_t* entry = batch[i];
+
+        // it's not safe to do anything if the file errored since
+        if (entry->flags & LFS_F_ERRED) {
+
+            continue;
+        }
+
+        // a file still open takes in what it was given since it was synced
+        err = lfs_file_flush(lfs, entry);
+
+        if (err) {
+
+            goto done;
+        }
+
+        uint16_t type;
+        const void* buffer;
+        lfs_size_t size;
+
+        err = lfs_file_commitstruct(lfs, entry, &type, &buffer, &size, &ctzs[i], extents);
+
+        if (err) {
+
+            goto done;
+        }
+
+        if (entry->flags & LFS_F_EXTENT) {
+
+            extents += 0x3fe;
+        }
+
+        attrs[attrcount + 0] = { LFS_MKTAG(type, entry->id, size), buffer };
+        attrs[attrcount + 1] = { LFS_MKTAG(LFS_FROM_USERATTRS, entry->id, entry->cfg->attr_count), entry->cfg->attrs };
+        attrcount += 2;
+    }
+
+    if (attrcount) {
+
+        err = lfs_dir_commit(lfs, &file->metadata, attrs, attrcount);
+    }
+
+done:
+    for (lfs_size_t i = 0; i < count; i++) {
+
+        if (err) {
+
+            batch[i]->flags |= LFS_F_ERRED;
+        }
+        else if (!(batch[i]->flags & LFS_F_ERRED)) {
+
+            batch[i]->flags &= ~LFS_F_DIRTY;
+        }
+
+        lfs_batch_drop(lfs, batch[i]);
+    }
+
+    free(files);
+
+    return err;
+}
+
+// Commit every file held back, without syncing the device
+int lfs_batch_flush(lfs_t* lfs) {
+
+    int err = LFS_ERR_OK;
+
+    while (true) {
+
+        lfs_file_t* file = NULL;
+
+        for (lfs_file_t* entry = (lfs_file_t*)lfs->metadata_list; entry; entry = (lfs_file_t*)entry->next) {
+
+            if (entry->type == LFS_TYPE_REG && (entry->flags & LFS_F_BATCHSYNC)) {
+
+                file = entry;
+                break;
+            }
+        }
+
+        if (!file) {
+
+            return err;
+        }
+
+        // go on with the other pairs after a failure, the files it hit are
+        // let go of either way
+        int res = lfs_batch_endpair(lfs, file);
+
+        err = err ? err : res;
+    }
+}
+
+int lfs_batch_rawend(lfs_t* lfs) {
+
+    LFS_ASSERT(lfs->batch_depth > 0);
+
+    if (lfs->batch_depth > 1) {
+
+        lfs->batch_depth -= 1;
+        return LFS_ERR_OK;
+    }
+
+    int err = lfs_batch_flush(lfs);
+
+    lfs->batch_depth = 0;
+
+    int res = lfs_bd_syncpending(lfs);
+
+    return err ? err : res;
+}
+
+// Hold back the commit of a synced file for the batch. Another handle
+// of the file synced before it in the batch is committed first, the
+// last sync wins as it would without one.
+int lfs_batch_defer(lfs_t* lfs, lfs_file_t* file) {
+
+    for (lfs_file_t* entry = (lfs_file_t*)lfs->metadata_list; entry; entry = (lfs_file_t*)entry->next) {
+
+        if (entry != file && lfs_batch_match(entry, file->metadata.pair) && entry->id == file->id) {
+
+            int err = lfs_batch_endpair(lfs, entry);
+
+            if (err) {
+
+                return err;
+            }
+
+            break;
+        }
+    }
+
+    if (file->flags & LFS_F_DIRTY) {
+
+        file->flags |= LFS_F_BATCHSYNC;
+    }
+
+    return LFS_ERR_OK;
+}
+
+// Take over a file closed in a batch. Without the memory for a copy
+// it is committed on the spot.
+int lfs_batch_hold(lfs_t* lfs, lfs_file_t* file) {
+
+    lfs_size_t size = sizeof(lfs_batch_file_t) + file->cfg->attr_count * sizeof(lfs_user_attribute_t);
+
+    for (lfs_size_t i = 0; i < file->cfg->attr_count; i++) {
+
+        size += file->cfg->attrs[i].size;
+    }
+
+    if (file->flags & LFS_F_INLINE) {
+
+        size += file->ctz.size;
+    }
+
+    lfs_batch_file_t* held = (lfs_batch_file_t*)malloc(size);
+
+    if (!held) {
+
+        return lfs_batch_endpair(lfs, file);
+    }
+
+    held->file = *file;
+    held->file.flags |= LFS_F_BATCHHELD;
+    held->file.cfg = &held->cfg;
+    held->file.index = { 0 };
+    held->file.wextents = { 0 };
+    held->file.readahead = { 0 };
+    held->file.reserved = { 0 };
+
+    held->cfg.buffer = NULL;
+    held->cfg.attrs = (lfs_user_attribute_t*)(held + 1);
+    held->cfg.attr_count = file->cfg->attr_count;
+
+    uint8_t* data = (uint8_t*)&held->cfg.attrs[held->cfg.attr_count];
+
+    for (lfs_size_t i = 0; i < file->cfg->attr_count; i++) {
+
+        held->cfg.attrs[i].type = file->cfg->attrs[i].type;
+        held->cfg.attrs[i].buffer = data;
+        held->cfg.attrs[i].size = file->cfg->attrs[i].size;
+
+        memcpy(data, file->cfg->attrs[i].buffer, file->cfg->attrs[i].size);
+        data += file->cfg->attrs[i].size;
+    }
+
+    // only what is inlined of the cache is kept
+    held->file.cache.buffer = NULL;
+
+    if (file->flags & LFS_F_INLINE) {
+
+        held->file.cache.buffer = data;
+        memcpy(data, file->cache.buffer, file->ctz.size);
+    }
+
+    // the extents go with the copy
+    file->extents = { 0 };
+    file->flags &= ~LFS_F_BATCHSYNC;
+
+    lfs_mlist_append(lfs, (lfs_metadata_list_t*)&held->file);
+
+    return LFS_ERR_OK;
+}
+
+// Commit what is held back for an entry ahead of an operation that needs it
+// on disk. Returns 1 if there was something, so the caller looks the entry
+// up again.
+int lfs_batch_settle(lfs_t* lfs, const lfs_block_t pair[2], uint16_t id) {
+
+    if (!lfs->batch_depth) {
+
+        return 0;
+    }
+
+    for (lfs_file_t* entry = (lfs_file_t*)lfs->metadata_list; entry; entry = (lfs_file_t*)entry->next) {
+
+        if (lfs_batch_match(entry, pair) && entry->id == id) {
+
+            int err = lfs_batch_endpair(lfs, entry);
+
+            return err ? err : 1;
+        }
+    }
+
+    return 0;
+}
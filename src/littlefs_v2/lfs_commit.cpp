@@ -54,19 +54,24 @@ int lfs_dir_commit_attribute(lfs_t* lfs, lfs_commit_t* commit, lfs_tag_t tag, co
         // from disk
         const lfs_disk_offset_t* disk = (const lfs_disk_offset_t *)buffer;
 
-        for (lfs_off_t i = 0; i < dsize - sizeof(tag); i++) {
+        lfs_size_t diff = 0;
+
+        for (lfs_off_t i = 0; i < dsize - sizeof(tag); i += diff) {
 
             // rely on caching to make this efficient
-            uint8_t dat;
+            uint8_t dat[256];
+
+            diff = lfs_min(dsize - sizeof(tag) - i, sizeof(dat));
+
             err = lfs_bd_read(lfs,
                 NULL, &lfs->read_cache, dsize - sizeof(tag) - i,
-                disk->block, disk->offset + i, &dat, 1);
+                disk->block, disk->offset + i, &dat, diff);
 
             if (err) {
                 return err;
             }
 
-            err = lfs_dir_commit_write(lfs, commit, &dat, 1);
+            err = lfs_dir_commit_write(lfs, commit, &dat, diff);
 
             if (err) {
                 return err;
@@ -137,14 +142,18 @@ int lfs_dir_commit_crc(lfs_t* lfs, lfs_commit_t* commit) {
         commit->crc = 0xffffffff; // reset crc for next "commit"
     }
 
-    // flush buffers
-    int err = lfs_bd_sync(lfs, &lfs->write_cache, &lfs->read_cache, false);
+    // flush buffers, the device may be synced with later commits
+    int err = lfs_bd_groupsync(lfs, &lfs->write_cache, &lfs->read_cache);
 
     if (err) {
         return err;
     }
 
     // successful commit, check checksums to make sure
+    if (!lfs_bd_verifying(lfs)) {
+        return LFS_ERR_OK;
+    }
+
     lfs_off_t offset = commit->begin;
     lfs_off_t noff = off1;
 
@@ -152,25 +161,27 @@ int lfs_dir_commit_crc(lfs_t* lfs, lfs_commit_t* commit) {
 
         uint32_t crc = 0xffffffff;
 
-        for (lfs_off_t i = offset; i < noff + sizeof(uint32_t); i++) {
+        err = lfs_bd_verifycrc(lfs,
+            &lfs->read_cache, noff + sizeof(uint32_t) - offset,
+            commit->block, offset, noff - offset, &crc);
 
-            // check against written crc, may catch blocks that
-            // become readonly and match our commit size exactly
-            if (i == off1 && crc != crc1) {
-                return LFS_ERR_CORRUPT;
-            }
+        if (err) {
+            return err;
+        }
 
-            // leave it up to caching to make this efficient
-            uint8_t dat;
-            err = lfs_bd_read(lfs,
-                NULL, &lfs->read_cache, noff + sizeof(uint32_t) - i,
-                commit->block, i, &dat, 1);
+        // check against written crc, may catch blocks that
+        // become readonly and match our commit size exactly
+        if (noff == off1 && crc != crc1) {
+            return LFS_ERR_CORRUPT;
+        }
 
-            if (err) {
-                return err;
-            }
+        // crc the stored crc too, which brings a match down to zero
+        err = lfs_bd_verifycrc(lfs,
+            &lfs->read_cache, sizeof(uint32_t),
+            commit->block, noff, sizeof(uint32_t), &crc);
 
-            crc = lfs_crc(crc, &dat, 1);
+        if (err) {
+            return err;
         }
 
         // detected write error?
@@ -266,7 +277,7 @@ int lfs_dir_drop(lfs_t* lfs, lfs_metadata_dir_t* dir, lfs_metadata_dir_t* tail)
 
 int lfs_dir_split(lfs_t* lfs,
     lfs_metadata_dir_t* dir, const lfs_metadata_attribute_t* attrs, int attrcount,
-    lfs_metadata_dir_t* source, uint16_t split, uint16_t end) {
+    lfs_metadata_dir_t* source, uint16_t split, uint16_t end, const lfs_compact_table_t* table) {
 
     // create tail metadata pair
     lfs_metadata_dir_t tail{};
@@ -281,7 +292,7 @@ int lfs_dir_split(lfs_t* lfs,
     tail.tail[1] = dir->tail[1];
 
     // note we don't care about LFS_OK_RELOCATED
-    int res = lfs_dir_compact(lfs, &tail, attrs, attrcount, source, split, end);
+    int res = lfs_dir_compact(lfs, &tail, attrs, attrcount, source, split, end, table);
 
     if (res < 0) {
         return res;
@@ -327,7 +338,7 @@ bool lfs_dir_needs_relocation(lfs_t* lfs, lfs_metadata_dir_t* dir) {
 
 int lfs_dir_compact(lfs_t* lfs,
     lfs_metadata_dir_t* dir, const lfs_metadata_attribute_t* attrs, int attrcount,
-    lfs_metadata_dir_t* source, uint16_t begin, uint16_t end) {
+    lfs_metadata_dir_t* source, uint16_t begin, uint16_t end, const lfs_compact_table_t* table) {
 
     // save some state in case block is bad
     bool relocated = false;
@@ -358,6 +369,10 @@ int lfs_dir_compact(lfs_t* lfs,
                 (lfs->cfg->metadata_max ? lfs->cfg->metadata_max : lfs->block_size) - sizeof(lfs_block_t[2]),
             };
 
+            // the pair may have held another directory before
+            lfs_dentry_drop(lfs, dir->pair, true);
+            lfs_tag_index_drop(lfs, dir->pair[1]);
+
             // erase block to write to
             int err = lfs_bd_erase(lfs, dir->pair[1]);
 
@@ -390,12 +405,21 @@ int lfs_dir_compact(lfs_t* lfs,
 
             lfs_dir_commit_commit_t _commit{lfs, &commit };
 
-            err = lfs_dir_traverse(lfs,
-                source, 0, 0xffffffff, attrs, attrcount,
-                LFS_MKTAG(LFS_TYPE_SPLICE, 0x3ff, 0),
-                LFS_MKTAG(LFS_TYPE_NAME, 0, 0),
-                begin, end, -begin,
-                lfs_dir_commit_commit, &_commit);
+            if (table) {
+
+                err = lfs_compact_table_traverse(lfs, table,
+                    begin, end, -begin,
+                    lfs_dir_commit_commit, &_commit);
+            }
+            else {
+
+                err = lfs_dir_traverse(lfs,
+                    source, 0, 0xffffffff, attrs, attrcount,
+                    LFS_MKTAG(LFS_TYPE_SPLICE, 0x3ff, 0),
+                    LFS_MKTAG(LFS_TYPE_NAME, 0, 0),
+                    begin, end, -begin,
+                    lfs_dir_commit_commit, &_commit);
+            }
 
             if (err) {
 
@@ -527,9 +551,9 @@ int lfs_dir_compact(lfs_t* lfs,
     return relocated ? LFS_OK_RELOCATED : 0;
 }
 
-int lfs_dir_splittingcompact(lfs_t* lfs, lfs_metadata_dir_t* dir,
+static int lfs_dir_splittingcompact_table(lfs_t* lfs, lfs_metadata_dir_t* dir,
     const lfs_metadata_attribute_t* attrs, int attrcount,
-    lfs_metadata_dir_t* source, uint16_t begin, uint16_t end) {
+    lfs_metadata_dir_t* source, uint16_t begin, uint16_t end, const lfs_compact_table_t* table) {
 
     while (true) {
 
@@ -544,12 +568,23 @@ int lfs_dir_splittingcompact(lfs_t* lfs, lfs_metadata_dir_t* dir,
         while (end - split > 1) {
 
             lfs_size_t size = 0;
-            int err = lfs_dir_traverse(lfs,
-                source, 0, 0xffffffff, 
-                attrs, attrcount,
-                LFS_MKTAG(LFS_TYPE_SPLICE, 0x3ff, 0), LFS_MKTAG(LFS_TYPE_NAME, 0, 0),
-                split, end, int16_t(0 - split),
-                lfs_dir_commit_size, &size);
+            int err;
+
+            if (table) {
+
+                err = lfs_compact_table_traverse(lfs, table,
+                    split, end, int16_t(0 - split),
+                    lfs_dir_commit_size, &size);
+            }
+            else {
+
+                err = lfs_dir_traverse(lfs,
+                    source, 0, 0xffffffff, 
+                    attrs, attrcount,
+                    LFS_MKTAG(LFS_TYPE_SPLICE, 0x3ff, 0), LFS_MKTAG(LFS_TYPE_NAME, 0, 0),
+                    split, end, int16_t(0 - split),
+                    lfs_dir_commit_size, &size);
+            }
 
             if (err) {
 
@@ -588,7 +623,7 @@ int lfs_dir_splittingcompact(lfs_t* lfs, lfs_metadata_dir_t* dir,
         }
 
         // split into two metadata pairs and continue
-        int err = lfs_dir_split(lfs, dir, attrs, attrcount, source, split, end);
+        int err = lfs_dir_split(lfs, dir, attrs, attrcount, source, split, end, table);
 
         if (err && err != LFS_ERR_NOSPC) {
 
@@ -629,7 +664,7 @@ int lfs_dir_splittingcompact(lfs_t* lfs, lfs_metadata_dir_t* dir,
 
             LFS_DEBUG("Expanding superblock at revision_count %"PRIu32, dir->revision_count);
 
-            int err = lfs_dir_split(lfs, dir, attrs, attrcount, source, begin, end);
+            int err = lfs_dir_split(lfs, dir, attrs, attrcount, source, begin, end, table);
 
             if (err && err != LFS_ERR_NOSPC) {
 
@@ -649,7 +684,40 @@ int lfs_dir_splittingcompact(lfs_t* lfs, lfs_metadata_dir_t* dir,
         }
     }
 
-    return lfs_dir_compact(lfs, dir, attrs, attrcount, source, begin, end);
+    return lfs_dir_compact(lfs, dir, attrs, attrcount, source, begin, end, table);
+}
+
+int lfs_dir_splittingcompact(lfs_t* lfs, lfs_metadata_dir_t* dir,
+    const lfs_metadata_attribute_t* attrs, int attrcount,
+    lfs_metadata_dir_t* source, uint16_t begin, uint16_t end) {
+
+    if (!lfs->cfg->compact_table) {
+
+        return lfs_dir_splittingcompact_table(lfs, dir, attrs, attrcount, source, begin, end, NULL);
+    }
+
+    // work out the live tags once, for sizing the splits and writing them
+    // out, without the memory for it fall back to the nested traversal
+    lfs_compact_table_t table;
+
+    int err = lfs_compact_table_build(lfs, &table, source, attrs, attrcount,
+        LFS_MKTAG(LFS_TYPE_SPLICE, 0x3ff, 0), LFS_MKTAG(LFS_TYPE_NAME, 0, 0));
+
+    if (err == LFS_ERR_NOMEM) {
+
+        return lfs_dir_splittingcompact_table(lfs, dir, attrs, attrcount, source, begin, end, NULL);
+    }
+
+    if (err) {
+
+        return err;
+    }
+
+    err = lfs_dir_splittingcompact_table(lfs, dir, attrs, attrcount, source, begin, end, &table);
+
+    lfs_compact_table_release(&table);
+
+    return err;
 }
 
 int lfs_dir_relocating_commit(lfs_t* lfs, lfs_metadata_dir_t* dir,
@@ -657,6 +725,12 @@ int lfs_dir_relocating_commit(lfs_t* lfs, lfs_metadata_dir_t* dir,
 
     int state = 0;
 
+    // names found in the pair may change, or go with it when it is dropped
+    lfs_dentry_drop(lfs, dir->pair, false);
+
+    // pairs may move or go, a gc step can't go on from where it stopped
+    lfs->commit_stamp += 1;
+
     // calculate changes to the directory
     bool hasdelete = false;
 
@@ -683,10 +757,10 @@ int lfs_dir_relocating_commit(lfs_t* lfs, lfs_metadata_dir_t* dir,
         }
     }
 
-    // should we actually drop the directory block?
-    if (hasdelete && dir->count == 0) {
-
-        LFS_ASSERT(pdir);
+    // should we actually drop the directory block? A pending move fixed
+    // while relocating is committed without a pdir, a pair it empties is
+    // kept like the empty head of a directory
+    if (hasdelete && dir->count == 0 && pdir) {
 
         int err = lfs_fs_pred(lfs, dir->pair, pdir);
 
@@ -702,7 +776,9 @@ int lfs_dir_relocating_commit(lfs_t* lfs, lfs_metadata_dir_t* dir,
         }
     }
 
-    if (dir->erased) {
+    // a pair past the entries a compaction leaves in one is split up, small
+    // creates would otherwise run out of ids before the block is full
+    if (dir->erased && dir->count < 0xff) {
 
         // try to commit
         lfs_commit_t commit = {
@@ -788,8 +864,15 @@ int lfs_dir_relocating_commit(lfs_t* lfs, lfs_metadata_dir_t* dir,
 
         // successful commit, update dir
         LFS_ASSERT(commit.offset % lfs->cfg->write_size == 0);
+        lfs_off_t offset = dir->offset;
+        uint32_t etag = dir->etag;
+
         dir->offset = commit.offset;
         dir->etag = commit.ptag;
+
+        // bring the index of the log up to date with the commit
+        lfs_tag_index_extend(lfs, dir, offset, etag);
+
         // and update gstate
         lfs->gdisk = lfs->gstate;
         lfs->gdelta = { 0 };
@@ -831,8 +914,13 @@ fixmlist:;
 
                     if (lfs_tag_type3(attrs[i].tag) == LFS_TYPE_DELETE && entry->id == lfs_tag_id(attrs[i].tag)) {
 
-                        entry->metadata.pair[0] = LFS_BLOCK_NULL;
-                        entry->metadata.pair[1] = LFS_BLOCK_NULL;
+                        // the id of a directory is where it reads next, the
+                        // entry after the deleted one moves into it
+                        if (entry->type != LFS_TYPE_DIR) {
+
+                            entry->metadata.pair[0] = LFS_BLOCK_NULL;
+                            entry->metadata.pair[1] = LFS_BLOCK_NULL;
+                        }
                     }
                     else if (lfs_tag_type3(attrs[i].tag) == LFS_TYPE_DELETE && entry->id > lfs_tag_id(attrs[i].tag)) {
 
@@ -855,7 +943,9 @@ fixmlist:;
                 }
             }
 
-            while (entry->id >= entry->metadata.count && entry->metadata.split) {
+            // a deleted entry stays dropped rather than following the split
+            while (!lfs_pair_isnull(entry->metadata.pair) &&
+                entry->id >= entry->metadata.count && entry->metadata.split) {
 
                 // we split and id is on tail now
                 entry->id -= entry->metadata.count;
@@ -0,0 +1,303 @@
+#include "lfs.h"
+
+// CRC-32 with the polynomial 0x04c11db7, bit reflected, no final xor. All
+// implementations below produce the same result as the small nibble table
+// version, which is kept as the reference and for LFS_NO_CRC_TABLES builds
+// where 16KiB of tables is too much.
+
+#if !defined(LFS_NO_INTRINSICS) && !defined(LFS_NO_CRC_TABLES) && \
+    (defined(_M_X64) || defined(__x86_64__))
+#define LFS_CRC_PCLMUL 1
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define LFS_CRC_TARGET
+#else
+#include <cpuid.h>
+#define LFS_CRC_TARGET __attribute__((target("sse4.1,pclmul")))
+#endif
+
+#include <immintrin.h>
+#endif
+
+/// Portable implementations ///
+static uint32_t lfs_crc_nibble(uint32_t crc, const uint8_t* data, size_t size) {
+
+    static const uint32_t rtable[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+        0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+        0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+    };
+
+    for (size_t i = 0; i < size; i++) {
+
+        crc = (crc >> 4) ^ rtable[(crc ^ (data[i] >> 0)) & 0xf];
+        crc = (crc >> 4) ^ rtable[(crc ^ (data[i] >> 4)) & 0xf];
+    }
+
+    return crc;
+}
+
+#ifndef LFS_NO_CRC_TABLES
+// table[0] is the usual byte table, table[k] advances a byte through k more
+// zero bytes, so sixteen bytes can be folded in with independent lookups
+struct lfs_crc_tables_t {
+
+    uint32_t table[16][256];
+
+    constexpr lfs_crc_tables_t() : table() {
+
+        for (uint32_t i = 0; i < 256; i++) {
+
+            uint32_t crc = i;
+
+            for (int j = 0; j < 8; j++) {
+
+                crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+            }
+
+            table[0][i] = crc;
+        }
+
+        for (uint32_t i = 0; i < 256; i++) {
+
+            for (int k = 1; k < 16; k++) {
+
+                table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xff];
+            }
+        }
+    }
+};
+
+static constexpr lfs_crc_tables_t lfs_crc_tables;
+
+static inline uint32_t lfs_crc_load32(const uint8_t* data) {
+
+    return (uint32_t)data[0] | ((uint32_t)data[1] << 8) |
+        ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static uint32_t lfs_crc_slice16(uint32_t crc, const uint8_t* data, size_t size) {
+
+    const uint32_t(*t)[256] = lfs_crc_tables.table;
+
+    while (size >= 16) {
+
+        uint32_t w0 = crc ^ lfs_crc_load32(data + 0);
+        uint32_t w1 = lfs_crc_load32(data + 4);
+        uint32_t w2 = lfs_crc_load32(data + 8);
+        uint32_t w3 = lfs_crc_load32(data + 12);
+
+        crc = t[15][w0 & 0xff] ^ t[14][(w0 >> 8) & 0xff] ^
+            t[13][(w0 >> 16) & 0xff] ^ t[12][w0 >> 24] ^
+            t[11][w1 & 0xff] ^ t[10][(w1 >> 8) & 0xff] ^
+            t[9][(w1 >> 16) & 0xff] ^ t[8][w1 >> 24] ^
+            t[7][w2 & 0xff] ^ t[6][(w2 >> 8) & 0xff] ^
+            t[5][(w2 >> 16) & 0xff] ^ t[4][w2 >> 24] ^
+            t[3][w3 & 0xff] ^ t[2][(w3 >> 8) & 0xff] ^
+            t[1][(w3 >> 16) & 0xff] ^ t[0][w3 >> 24];
+
+        data += 16;
+        size -= 16;
+    }
+
+    while (size > 0) {
+
+        crc = (crc >> 8) ^ t[0][(crc ^ *data) & 0xff];
+
+        data += 1;
+        size -= 1;
+    }
+
+    return crc;
+}
+#endif
+
+/// Carry-less multiplication, x86-64 ///
+#ifdef LFS_CRC_PCLMUL
+// Folds 64 bytes at a time with PCLMULQDQ, then reduces down to 32 bits
+// with Barrett reduction. This follows Intel's "Fast CRC Computation for
+// Generic Polynomials Using PCLMULQDQ Instruction", the constants are the
+// bit-reflected ones from the end of the paper, as also used by zlib.
+// size must be at least 64 and a multiple of 16.
+LFS_CRC_TARGET
+static uint32_t lfs_crc_pclmul(uint32_t crc, const uint8_t* data, size_t size) {
+
+    alignas(16) static const uint64_t k1k2[2] = { 0x0154442bd4, 0x01c6e41596 };
+    alignas(16) static const uint64_t k3k4[2] = { 0x01751997d0, 0x00ccaa009e };
+    alignas(16) static const uint64_t k5k0[2] = { 0x0163cd6124, 0x0000000000 };
+    alignas(16) static const uint64_t poly[2] = { 0x01db710641, 0x01f7011641 };
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    x1 = _mm_loadu_si128((const __m128i*)(data + 0x00));
+    x2 = _mm_loadu_si128((const __m128i*)(data + 0x10));
+    x3 = _mm_loadu_si128((const __m128i*)(data + 0x20));
+    x4 = _mm_loadu_si128((const __m128i*)(data + 0x30));
+
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+    x0 = _mm_load_si128((const __m128i*)k1k2);
+
+    data += 64;
+    size -= 64;
+
+    // fold four lanes in parallel
+    while (size >= 64) {
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*)(data + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*)(data + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*)(data + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*)(data + 0x30)));
+
+        data += 64;
+        size -= 64;
+    }
+
+    // fold the lanes into one
+    x0 = _mm_load_si128((const __m128i*)k3k4);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    // fold what's left 16 bytes at a time
+    while (size >= 16) {
+
+        x2 = _mm_loadu_si128((const __m128i*)data);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+        data += 16;
+        size -= 16;
+    }
+
+    // fold 128 bits to 64 bits
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x0 = _mm_loadl_epi64((const __m128i*)k5k0);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduce to 32 bits
+    x0 = _mm_load_si128((const __m128i*)poly);
+
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+static bool lfs_crc_cpu_has_pclmul(void) {
+
+    // PCLMULQDQ is ecx bit 1, SSE4.1 is ecx bit 19 of leaf 1
+#if defined(_MSC_VER)
+    int info[4] = { 0 };
+    __cpuid(info, 1);
+    uint32_t ecx = (uint32_t)info[2];
+#else
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+#endif
+
+    return (ecx & (1u << 1)) && (ecx & (1u << 19));
+}
+#endif
+
+/// Selection ///
+#ifndef LFS_NO_CRC_TABLES
+// Checks the faster implementations against the reference once, on first
+// use, and picks the one to use on this cpu
+static bool lfs_crc_init(void) {
+
+    uint8_t data[256];
+
+    for (size_t i = 0; i < sizeof(data); i++) {
+
+        data[i] = (uint8_t)(i * 167 + 13);
+    }
+
+    for (size_t size = 0; size <= sizeof(data); size += 1) {
+
+        LFS_ASSERT(lfs_crc_slice16(0xffffffff, data, size) ==
+            lfs_crc_nibble(0xffffffff, data, size));
+    }
+
+#ifdef LFS_CRC_PCLMUL
+    if (lfs_crc_cpu_has_pclmul()) {
+
+        for (size_t size = 64; size <= sizeof(data); size += 16) {
+
+            if (lfs_crc_pclmul(0xffffffff, data, size) !=
+                lfs_crc_nibble(0xffffffff, data, size)) {
+
+                LFS_ASSERT(false);
+                return false;
+            }
+        }
+
+        return true;
+    }
+#endif
+
+    return false;
+}
+#endif
+
+uint32_t lfs_crc(uint32_t crc, const void* buffer, size_t size) {
+
+    const uint8_t* data = (const uint8_t*)buffer;
+
+#ifdef LFS_NO_CRC_TABLES
+    return lfs_crc_nibble(crc, data, size);
+#else
+    static const bool pclmul = lfs_crc_init();
+
+#ifdef LFS_CRC_PCLMUL
+    if (size >= 64 && pclmul) {
+
+        size_t diff = size & ~(size_t)15;
+        crc = lfs_crc_pclmul(crc, data, diff);
+
+        data += diff;
+        size -= diff;
+    }
+#else
+    (void)pclmul;
+#endif
+
+    return lfs_crc_slice16(crc, data, size);
+#endif
+}
@@ -1,5 +1,184 @@
 #include "lfs.h"
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/// Private read caches of shared lock holders ///
+// the reader of the operation this thread is running under the shared lock
+static thread_local lfs_reader_t* lfs_reader_active = NULL;
+
+static bool lfs_reader_tryclaim(lfs_reader_t* reader) {
+
+#if defined(_MSC_VER)
+    return _InterlockedCompareExchange((volatile long*)&reader->busy, 1, 0) == 0;
+#else
+    uint32_t expected = 0;
+    return __atomic_compare_exchange_n(&reader->busy, &expected, 1, false,
+        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+#endif
+}
+
+static void lfs_reader_unclaim(lfs_reader_t* reader) {
+
+#if defined(_MSC_VER)
+    _InterlockedExchange((volatile long*)&reader->busy, 0);
+#else
+    __atomic_store_n(&reader->busy, 0, __ATOMIC_RELEASE);
+#endif
+}
+
+// Take a free private read cache for an operation under the shared lock,
+// NULL if there is none and the operation has to take the exclusive lock
+lfs_reader_t* lfs_reader_begin(lfs_t* lfs) {
+
+    if (!lfs->readers) {
+
+        return NULL;
+    }
+
+    for (lfs_size_t i = 0; i < lfs->cfg->reader_count; i++) {
+
+        if (lfs_reader_tryclaim(&lfs->readers[i])) {
+
+            lfs_reader_active = &lfs->readers[i];
+            return &lfs->readers[i];
+        }
+    }
+
+    return NULL;
+}
+
+void lfs_reader_end(lfs_t* lfs, lfs_reader_t* reader) {
+
+    (void)lfs;
+
+    lfs_reader_active = NULL;
+    lfs_reader_unclaim(reader);
+}
+
+// The private read cache of the running operation, NULL when it holds the
+// exclusive lock and may change any state of the filesystem
+lfs_reader_t* lfs_reader_current(lfs_t* lfs) {
+
+    lfs_reader_t* reader = lfs_reader_active;
+
+    if (reader && lfs->readers &&
+        reader >= lfs->readers && reader < lfs->readers + lfs->cfg->reader_count) {
+
+        return reader;
+    }
+
+    return NULL;
+}
+
+/// Shared read cache slots ///
+static lfs_cache_t* lfs_bd_slot_cache(lfs_t* lfs, lfs_size_t i) {
+
+    return (i == 0) ? &lfs->read_cache : &lfs->read_slots[i].cache;
+}
+
+// Forget what the extra slots and private caches hold of a block that is
+// about to change, the first slot is lfs_t::read_cache which callers drop
+// themselves as before. Only called under the exclusive lock, so no reader
+// is using its cache.
+static void lfs_bd_slot_invalidate(lfs_t* lfs, lfs_block_t block) {
+
+    if (lfs->readers) {
+
+        for (lfs_size_t i = 0; i < lfs->cfg->reader_count; i++) {
+
+            if (lfs->readers[i].cache.block == block) {
+
+                lfs_cache_drop(lfs, &lfs->readers[i].cache);
+            }
+        }
+    }
+
+    if (!lfs->read_slots) {
+
+        return;
+    }
+
+    for (lfs_size_t i = 1; i < lfs->cfg->read_cache_count; i++) {
+
+        if (lfs->read_slots[i].cache.block == block) {
+
+            lfs_cache_drop(lfs, &lfs->read_slots[i].cache);
+        }
+    }
+}
+
+// Find the slot of the shared read cache holding an offset, or else the slot
+// to load it into
+static lfs_cache_t* lfs_bd_slot(lfs_t* lfs, lfs_block_t block, lfs_off_t offset) {
+
+    if (!lfs->read_slots) {
+
+        return &lfs->read_cache;
+    }
+
+    // most reads continue where the last one left off
+    lfs_cache_t* cache = lfs_bd_slot_cache(lfs, lfs->read_last);
+
+    if (cache->block == block &&
+        offset >= cache->offset && offset < cache->offset + cache->size) {
+
+        return cache;
+    }
+
+    lfs_size_t count = lfs->cfg->read_cache_count;
+
+    for (lfs_size_t i = 0; i < count; i++) {
+
+        cache = lfs_bd_slot_cache(lfs, i);
+
+        if (cache->block == block &&
+            offset >= cache->offset && offset < cache->offset + cache->size) {
+
+            lfs->read_slots[i].tick = ++lfs->read_tick;
+            lfs->read_last = i;
+            return cache;
+        }
+    }
+
+    // metadata pairs and data blocks replace only their own slots
+    lfs_size_t start = 0;
+    lfs_size_t end = count;
+
+    if (lfs->cfg->read_cache_metadata) {
+
+        if (block == lfs->read_pair[0] || block == lfs->read_pair[1]) {
+
+            end = lfs->cfg->read_cache_metadata;
+        }
+        else {
+
+            start = lfs->cfg->read_cache_metadata;
+        }
+    }
+
+    lfs_size_t victim = start;
+
+    for (lfs_size_t i = start; i < end; i++) {
+
+        if (lfs_bd_slot_cache(lfs, i)->block == LFS_BLOCK_NULL) {
+
+            victim = i;
+            break;
+        }
+
+        if ((int32_t)(lfs->read_slots[i].tick - lfs->read_slots[victim].tick) < 0) {
+
+            victim = i;
+        }
+    }
+
+    lfs->read_slots[victim].tick = ++lfs->read_tick;
+    lfs->read_last = victim;
+    return lfs_bd_slot_cache(lfs, victim);
+}
+
 /// Mapping from logical to physical erase size ///
 
 static int lfs_bd_rawread(lfs_t* lfs, lfs_block_t block, lfs_off_t off, void* buffer, lfs_size_t size) {
@@ -43,12 +222,39 @@ static int lfs_bd_rawread(lfs_t* lfs, lfs_block_t block, lfs_off_t off, void* bu
     return LFS_ERR_OK;
 }
 
+// Borrow a region of a mapped device, clipped to the erase unit it starts
+// in. NULL when the device isn't mapped and the region has to be read.
+static const uint8_t* lfs_bd_rawmap(lfs_t* lfs, lfs_block_t block, lfs_off_t off, lfs_size_t* size) {
+
+    if (!lfs->cfg->map) {
+
+        return NULL;
+    }
+
+    // adjust to physical erase size
+    block = (block * (lfs->block_size / lfs->erase_size)) + (off / lfs->erase_size);
+    off = off % lfs->erase_size;
+
+    lfs_size_t diff = lfs_min(*size, lfs->erase_size - off);
+
+    const uint8_t* mapped = (const uint8_t*)lfs->cfg->map(lfs->cfg, block, off, diff);
+
+    if (mapped) {
+
+        *size = diff;
+    }
+
+    return mapped;
+}
+
 static int lfs_bd_rawprog(lfs_t* lfs, lfs_block_t block, lfs_off_t off, void* buffer, lfs_size_t size) {
 
     LFS_ASSERT(block < lfs->block_count);
     LFS_ASSERT(off + size <= lfs->block_size);
     LFS_ASSERT(size % lfs->cfg->write_size == 0);
 
+    lfs_bd_slot_invalidate(lfs, block);
+
     // adjust to physical erase size
     block = (block * (lfs->block_size / lfs->erase_size)) + (off / lfs->erase_size);
     off = off % lfs->erase_size;
@@ -83,6 +289,95 @@ static int lfs_bd_rawprog(lfs_t* lfs, lfs_block_t block, lfs_off_t off, void* bu
     return LFS_ERR_OK;
 }
 
+static int lfs_bd_rawcopy(lfs_t* lfs, lfs_block_t block, lfs_off_t off,
+    lfs_block_t src_block, lfs_off_t src_off, lfs_size_t size) {
+
+    LFS_ASSERT(block < lfs->block_count && src_block < lfs->block_count);
+    LFS_ASSERT(off + size <= lfs->block_size && src_off + size <= lfs->block_size);
+    LFS_ASSERT(size % lfs->cfg->write_size == 0);
+
+    lfs_bd_slot_invalidate(lfs, block);
+
+    // adjust to physical erase size
+    block = (block * (lfs->block_size / lfs->erase_size)) + (off / lfs->erase_size);
+    off = off % lfs->erase_size;
+    src_block = (src_block * (lfs->block_size / lfs->erase_size)) + (src_off / lfs->erase_size);
+    src_off = src_off % lfs->erase_size;
+
+    // copy in chunks that don't cross an erase_size boundary on either side
+    while (size > 0) {
+
+        lfs_size_t delta = lfs_min(size,
+            lfs_min(lfs->erase_size - off, lfs->erase_size - src_off));
+
+        int err = lfs->cfg->copy(lfs->cfg, block, off, src_block, src_off, delta);
+
+        LFS_ASSERT(err <= 0);
+
+        if (err) {
+
+            return err;
+        }
+
+        off += delta;
+
+        if (off == lfs->erase_size) {
+
+            block += 1;
+            off = 0;
+        }
+
+        src_off += delta;
+
+        if (src_off == lfs->erase_size) {
+
+            src_block += 1;
+            src_off = 0;
+        }
+
+        size -= delta;
+    }
+
+    return LFS_ERR_OK;
+}
+
+static int lfs_bd_rawcrc(lfs_t* lfs, lfs_block_t block, lfs_off_t off, lfs_size_t size, uint32_t* crc) {
+
+    LFS_ASSERT(block < lfs->block_count);
+    LFS_ASSERT(off + size <= lfs->block_size);
+
+    // adjust to physical erase size
+    block = (block * (lfs->block_size / lfs->erase_size)) + (off / lfs->erase_size);
+    off = off % lfs->erase_size;
+
+    // crc in erase_size chunks
+    while (size > 0) {
+
+        lfs_size_t delta = lfs_min(size, lfs->erase_size - off);
+
+        int err = lfs->cfg->crc(lfs->cfg, block, off, delta, crc);
+
+        LFS_ASSERT(err <= 0);
+
+        if (err) {
+
+            return err;
+        }
+
+        off += delta;
+
+        if (off == lfs->erase_size) {
+
+            block += 1;
+            off = 0;
+        }
+
+        size -= delta;
+    }
+
+    return LFS_ERR_OK;
+}
+
 int lfs_bd_read(lfs_t* lfs,
     const lfs_cache_t* write_cache, lfs_cache_t* read_cache, lfs_size_t hint,
     lfs_block_t block, lfs_off_t offset,
@@ -95,6 +390,15 @@ int lfs_bd_read(lfs_t* lfs,
         return LFS_ERR_CORRUPT;
     }
 
+    bool shared = (read_cache == &lfs->read_cache);
+    bool loaded = false;
+
+    // under the shared lock the shared cache belongs to nobody, the
+    // operation's private one stands in for it
+    lfs_reader_t* reader = shared ? lfs_reader_current(lfs) : NULL;
+    uint64_t* hits = reader ? &reader->hits : &lfs->read_hits;
+    uint64_t* misses = reader ? &reader->misses : &lfs->read_misses;
+
     while (size > 0) {
 
         lfs_size_t diff = size;
@@ -117,13 +421,37 @@ int lfs_bd_read(lfs_t* lfs,
             diff = lfs_min(diff, write_cache->offset - offset);
         }
 
-        if (block == read_cache->block && offset < read_cache->offset + read_cache->size) {
+        // a mapped device is read in place, no cache needed
+        const uint8_t* mapped = lfs_bd_rawmap(lfs, block, offset, &diff);
+
+        if (mapped) {
+
+            memcpy(data, mapped, diff);
+
+            data += diff;
+            offset += diff;
+            size -= diff;
+            continue;
+        }
+
+        // the shared read cache may have several slots
+        lfs_cache_t* rcache = reader ? &reader->cache :
+            shared ? lfs_bd_slot(lfs, block, offset) : read_cache;
+
+        if (block == rcache->block && offset < rcache->offset + rcache->size) {
+
+            if (offset >= rcache->offset) {
 
-            if (offset >= read_cache->offset) {
+                if (shared && !loaded) {
+
+                    *hits += 1;
+                }
+
+                loaded = false;
 
                 // is already in read_cache?
-                diff = lfs_min(diff, read_cache->size - (offset - read_cache->offset));
-                memcpy(data, &read_cache->buffer[offset - read_cache->offset], diff);
+                diff = lfs_min(diff, rcache->size - (offset - rcache->offset));
+                memcpy(data, &rcache->buffer[offset - rcache->offset], diff);
 
                 data += diff;
                 offset += diff;
@@ -132,7 +460,7 @@ int lfs_bd_read(lfs_t* lfs,
             }
 
             // read_cache takes priority
-            diff = lfs_min(diff, read_cache->offset - offset);
+            diff = lfs_min(diff, rcache->offset - offset);
         }
 
         if (size >= hint && offset % lfs->cfg->read_size == 0 && size >= lfs->cfg->read_size) {
@@ -140,6 +468,11 @@ int lfs_bd_read(lfs_t* lfs,
             // bypass cache?
             diff = lfs_aligndown(diff, lfs->cfg->read_size);
 
+            if (shared) {
+
+                *misses += 1;
+            }
+
             int err = lfs_bd_rawread(lfs, block, offset, data, diff);
 
             if (err) {
@@ -152,15 +485,22 @@ int lfs_bd_read(lfs_t* lfs,
             continue;
         }
 
+        if (shared) {
+
+            *misses += 1;
+        }
+
+        loaded = true;
+
         // load to cache, first condition can no longer fail
-        read_cache->block = block;
-        read_cache->offset = lfs_aligndown(offset, lfs->cfg->read_size);
-        read_cache->size = lfs_min(
-                            lfs_min(lfs_alignup(offset + hint, lfs->cfg->read_size), lfs->block_size) - read_cache->offset, 
+        rcache->block = block;
+        rcache->offset = lfs_aligndown(offset, lfs->cfg->read_size);
+        rcache->size = lfs_min(
+                            lfs_min(lfs_alignup(offset + hint, lfs->cfg->read_size), lfs->block_size) - rcache->offset, 
                             lfs->cfg->cache_size
                         );
 
-        int err = lfs_bd_rawread(lfs, read_cache->block, read_cache->offset, read_cache->buffer, read_cache->size);
+        int err = lfs_bd_rawread(lfs, rcache->block, rcache->offset, rcache->buffer, rcache->size);
 
         LFS_ASSERT(err <= 0);
 
@@ -205,76 +545,469 @@ int lfs_bd_cmp(lfs_t* lfs,
     return LFS_CMP_EQ;
 }
 
-int lfs_bd_flush(lfs_t* lfs, lfs_cache_t* write_cache, lfs_cache_t* read_cache, bool validate) {
-
-    if (write_cache->block != LFS_BLOCK_NULL && write_cache->block != LFS_BLOCK_INLINE) {
+// Crc a region on disk, reading it out of the caches in as large spans as
+// they hold rather than copying it out first
+int lfs_bd_crc(lfs_t* lfs,
+    const lfs_cache_t* write_cache, lfs_cache_t* read_cache, lfs_size_t hint,
+    lfs_block_t block, lfs_off_t offset, lfs_size_t size, uint32_t* crc) {
 
-        lfs_size_t diff = lfs_alignup(write_cache->size, lfs->cfg->write_size);
+    if (block >= lfs->block_count || offset + size > lfs->block_size) {
 
-        int err = lfs_bd_rawprog(lfs, write_cache->block, write_cache->offset, write_cache->buffer, diff);
+        return LFS_ERR_CORRUPT;
+    }
 
-        LFS_ASSERT(err <= 0);
+    bool shared = (read_cache == &lfs->read_cache);
+    bool loaded = false;
 
-        if (err) {
-            return err;
-        }
+    // under the shared lock the shared cache belongs to nobody, the
+    // operation's private one stands in for it
+    lfs_reader_t* reader = shared ? lfs_reader_current(lfs) : NULL;
+    uint64_t* hits = reader ? &reader->hits : &lfs->read_hits;
+    uint64_t* misses = reader ? &reader->misses : &lfs->read_misses;
 
-        if (validate) {
+    while (size > 0) {
 
-            // check data on disk
-            lfs_cache_drop(lfs, read_cache);
+        lfs_size_t diff = size;
 
-            int res = lfs_bd_cmp(lfs, NULL, read_cache, diff, write_cache->block, write_cache->offset, write_cache->buffer, diff);
+        if (write_cache && block == write_cache->block && offset < write_cache->offset + write_cache->size) {
 
-            if (res < 0) {
-                return res;
-            }
+            if (offset >= write_cache->offset) {
 
-            if (res != LFS_CMP_EQ) {
+                // is already in write_cache?
+                diff = lfs_min(diff, write_cache->size - (offset - write_cache->offset));
+                *crc = lfs_crc(*crc, &write_cache->buffer[offset - write_cache->offset], diff);
 
-                return LFS_ERR_CORRUPT;
+                offset += diff;
+                size -= diff;
+                continue;
             }
+
+            // write_cache takes priority
+            diff = lfs_min(diff, write_cache->offset - offset);
         }
 
-        lfs_cache_zero(lfs, write_cache);
-    }
+        // a mapped device is crced in place, no cache needed
+        const uint8_t* mapped = lfs_bd_rawmap(lfs, block, offset, &diff);
 
-    return LFS_ERR_OK;
-}
+        if (mapped) {
 
-int lfs_bd_sync(lfs_t* lfs, lfs_cache_t* write_cache, lfs_cache_t* read_cache, bool validate) {
+            *crc = lfs_crc(*crc, mapped, diff);
 
-    lfs_cache_drop(lfs, read_cache);
+            offset += diff;
+            size -= diff;
+            continue;
+        }
 
-    int err = lfs_bd_flush(lfs, write_cache, read_cache, validate);
+        // the shared read cache may have several slots
+        lfs_cache_t* rcache = reader ? &reader->cache :
+            shared ? lfs_bd_slot(lfs, block, offset) : read_cache;
 
-    if (err) {
+        if (block == rcache->block && offset < rcache->offset + rcache->size) {
 
-        return err;
-    }
+            if (offset >= rcache->offset) {
 
-    err = lfs->cfg->sync(lfs->cfg);
-    LFS_ASSERT(err <= 0);
-    return err;
-}
+                if (shared && !loaded) {
 
-int lfs_bd_write(lfs_t* lfs,
-    lfs_cache_t* write_cache, lfs_cache_t* read_cache, bool validate,
-    lfs_block_t block, lfs_off_t offset,
-    const void* buffer, lfs_size_t size) {
+                    *hits += 1;
+                }
 
-    const uint8_t* data = (const uint8_t *)buffer;
-    LFS_ASSERT(block == LFS_BLOCK_INLINE || block < lfs->block_count);
-    LFS_ASSERT(offset + size <= lfs->block_size);
+                loaded = false;
 
-    while (size > 0) {
+                // is already in read_cache?
+                diff = lfs_min(diff, rcache->size - (offset - rcache->offset));
+                *crc = lfs_crc(*crc, &rcache->buffer[offset - rcache->offset], diff);
 
-        if (block == write_cache->block &&
-            offset >= write_cache->offset &&
-            offset < write_cache->offset + lfs->cfg->cache_size) {
+                offset += diff;
+                size -= diff;
+                continue;
+            }
 
-            // already fits in write_cache?
-            lfs_size_t diff = lfs_min(size, lfs->cfg->cache_size - (offset - write_cache->offset));
+            // read_cache takes priority
+            diff = lfs_min(diff, rcache->offset - offset);
+        }
+
+        if (shared) {
+
+            *misses += 1;
+        }
+
+        loaded = true;
+
+        // load to cache, there is no buffer to bypass it into
+        rcache->block = block;
+        rcache->offset = lfs_aligndown(offset, lfs->cfg->read_size);
+        rcache->size = lfs_min(
+                            lfs_min(lfs_alignup(offset + lfs_max(hint, diff), lfs->cfg->read_size), lfs->block_size) - rcache->offset,
+                            lfs->cfg->cache_size
+                        );
+
+        int err = lfs_bd_rawread(lfs, rcache->block, rcache->offset, rcache->buffer, rcache->size);
+
+        LFS_ASSERT(err <= 0);
+
+        if (err) {
+
+            return err;
+        }
+    }
+
+    return LFS_ERR_OK;
+}
+
+// Borrow a whole region of a mapped device, NULL when the device isn't
+// mapped or the region can't be borrowed in one piece
+const uint8_t* lfs_bd_map(lfs_t* lfs, lfs_block_t block, lfs_off_t offset, lfs_size_t size) {
+
+    if (block >= lfs->block_count || offset + size > lfs->block_size) {
+
+        return NULL;
+    }
+
+    lfs_size_t diff = size;
+    const uint8_t* mapped = lfs_bd_rawmap(lfs, block, offset, &diff);
+
+    return (diff == size) ? mapped : NULL;
+}
+
+// Submit regions already adjusted to physical erase size
+static int lfs_bd_rawreadbatch(lfs_t* lfs, const lfs_bd_request_t* requests, lfs_size_t count) {
+
+    if (lfs->cfg->read_batch) {
+
+        int err = lfs->cfg->read_batch(lfs->cfg, requests, count);
+
+        LFS_ASSERT(err <= 0);
+
+        return err;
+    }
+
+    // devices without batches read one region at a time
+    for (lfs_size_t i = 0; i < count; i++) {
+
+        int err = lfs->cfg->read(lfs->cfg,
+            requests[i].block, requests[i].offset, requests[i].buffer, requests[i].size);
+
+        LFS_ASSERT(err <= 0);
+
+        if (err) {
+
+            return err;
+        }
+    }
+
+    return LFS_ERR_OK;
+}
+
+// Read several regions straight into their buffers, bypassing the caches.
+// Regions have to be read_size aligned, they are split at erase_size
+// boundaries and submitted LFS_READ_BATCH_MAX at a time.
+int lfs_bd_readbatch(lfs_t* lfs, const lfs_bd_request_t* requests, lfs_size_t count) {
+
+    lfs_bd_request_t batch[LFS_READ_BATCH_MAX];
+    lfs_size_t n = 0;
+
+    for (lfs_size_t i = 0; i < count; i++) {
+
+        lfs_block_t block = requests[i].block;
+        lfs_off_t off = requests[i].offset;
+        uint8_t* buffer = (uint8_t*)requests[i].buffer;
+        lfs_size_t size = requests[i].size;
+
+        if (block >= lfs->block_count || off + size > lfs->block_size) {
+
+            return LFS_ERR_CORRUPT;
+        }
+
+        LFS_ASSERT(off % lfs->cfg->read_size == 0);
+        LFS_ASSERT(size % lfs->cfg->read_size == 0);
+
+        // adjust to physical erase size
+        block = (block * (lfs->block_size / lfs->erase_size)) + (off / lfs->erase_size);
+        off = off % lfs->erase_size;
+
+        while (size > 0) {
+
+            if (n == LFS_READ_BATCH_MAX) {
+
+                int err = lfs_bd_rawreadbatch(lfs, batch, n);
+
+                if (err) {
+
+                    return err;
+                }
+
+                n = 0;
+            }
+
+            lfs_size_t delta = lfs_min(size, lfs->erase_size - off);
+
+            batch[n].block = block;
+            batch[n].offset = off;
+            batch[n].buffer = buffer;
+            batch[n].size = delta;
+            n += 1;
+
+            buffer += delta;
+            size -= delta;
+            off += delta;
+
+            if (off == lfs->erase_size) {
+
+                block += 1;
+                off = 0;
+            }
+        }
+    }
+
+    return (n > 0) ? lfs_bd_rawreadbatch(lfs, batch, n) : LFS_ERR_OK;
+}
+
+// Load the start of several blocks into the shared read cache with one
+// batch, leaving out those it already holds. Each needs a slot the others
+// don't replace, so nothing is loaded when the device doesn't take
+// batches, under the shared lock, or with too few slots.
+int lfs_bd_prefetch(lfs_t* lfs, const lfs_block_t* blocks, lfs_size_t count, lfs_size_t hint) {
+
+    if (!lfs->cfg->read_batch || !lfs->read_slots || lfs_reader_current(lfs)) {
+
+        return LFS_ERR_OK;
+    }
+
+    lfs_size_t slots = lfs->cfg->read_cache_count;
+
+    if (lfs->cfg->read_cache_metadata) {
+
+        slots = lfs_min(lfs->cfg->read_cache_metadata, slots - lfs->cfg->read_cache_metadata);
+    }
+
+    if (count > slots || count > LFS_READ_BATCH_MAX) {
+
+        return LFS_ERR_OK;
+    }
+
+    lfs_bd_request_t batch[LFS_READ_BATCH_MAX];
+    lfs_cache_t* loaded[LFS_READ_BATCH_MAX];
+    lfs_size_t n = 0;
+
+    for (lfs_size_t i = 0; i < count; i++) {
+
+        // out of range blocks are left for the read that follows to report
+        if (blocks[i] >= lfs->block_count) {
+
+            continue;
+        }
+
+        lfs_cache_t* rcache = lfs_bd_slot(lfs, blocks[i], 0);
+
+        if (rcache->block == blocks[i] && rcache->offset == 0) {
+
+            continue;
+        }
+
+        lfs->read_misses += 1;
+
+        rcache->block = blocks[i];
+        rcache->offset = 0;
+        rcache->size = lfs_min(
+                            lfs_min(lfs_alignup(hint, lfs->cfg->read_size), lfs->block_size),
+                            lfs->cfg->cache_size
+                        );
+
+        batch[n].block = rcache->block;
+        batch[n].offset = rcache->offset;
+        batch[n].buffer = rcache->buffer;
+        batch[n].size = rcache->size;
+        loaded[n] = rcache;
+        n += 1;
+    }
+
+    if (n == 0) {
+
+        return LFS_ERR_OK;
+    }
+
+    int err = lfs_bd_readbatch(lfs, batch, n);
+
+    if (err) {
+
+        for (lfs_size_t i = 0; i < n; i++) {
+
+            lfs_cache_drop(lfs, loaded[i]);
+        }
+    }
+
+    return err;
+}
+
+/// Verification of programs ///
+// Whether the program about to be checked should be, LFS_VERIFY_SAMPLED
+// checks every verify_interval-th one
+bool lfs_bd_verifying(lfs_t* lfs) {
+
+    switch (lfs->cfg->verify) {
+
+    case LFS_VERIFY_NEVER:
+        return false;
+
+    case LFS_VERIFY_SAMPLED: {
+
+        lfs_size_t interval = lfs->cfg->verify_interval ? lfs->cfg->verify_interval : 16;
+        return lfs->verify_tick++ % interval == 0;
+    }
+
+    default:
+        return true;
+    }
+}
+
+// Crc a region just programmed, with LFS_VERIFY_CRC the device's own crc
+// is used when it has one rather than reading the region back
+int lfs_bd_verifycrc(lfs_t* lfs, lfs_cache_t* read_cache, lfs_size_t hint,
+    lfs_block_t block, lfs_off_t offset, lfs_size_t size, uint32_t* crc) {
+
+    if (lfs->cfg->verify == LFS_VERIFY_CRC && lfs->cfg->crc) {
+
+        return lfs_bd_rawcrc(lfs, block, offset, size, crc);
+    }
+
+    return lfs_bd_crc(lfs, NULL, read_cache, hint, block, offset, size, crc);
+}
+
+// Check a region just programmed against the buffer it came from
+static int lfs_bd_verify(lfs_t* lfs, lfs_cache_t* read_cache,
+    lfs_block_t block, lfs_off_t offset, const void* buffer, lfs_size_t size) {
+
+    lfs_cache_drop(lfs, read_cache);
+
+    if (lfs->cfg->verify == LFS_VERIFY_CRC) {
+
+        uint32_t crc = 0xffffffff;
+
+        int err = lfs_bd_verifycrc(lfs, read_cache, size, block, offset, size, &crc);
+
+        if (err) {
+            return err;
+        }
+
+        return crc == lfs_crc(0xffffffff, buffer, size) ? LFS_ERR_OK : LFS_ERR_CORRUPT;
+    }
+
+    int res = lfs_bd_cmp(lfs, NULL, read_cache, size, block, offset, buffer, size);
+
+    if (res < 0) {
+        return res;
+    }
+
+    return res == LFS_CMP_EQ ? LFS_ERR_OK : LFS_ERR_CORRUPT;
+}
+
+int lfs_bd_flush(lfs_t* lfs, lfs_cache_t* write_cache, lfs_cache_t* read_cache, bool validate) {
+
+    if (write_cache->block != LFS_BLOCK_NULL && write_cache->block != LFS_BLOCK_INLINE) {
+
+        lfs_size_t diff = lfs_alignup(write_cache->size, lfs->cfg->write_size);
+
+        int err = lfs_bd_rawprog(lfs, write_cache->block, write_cache->offset, write_cache->buffer, diff);
+
+        LFS_ASSERT(err <= 0);
+
+        if (err) {
+            return err;
+        }
+
+        if (validate && lfs_bd_verifying(lfs)) {
+
+            // check data on disk
+            err = lfs_bd_verify(lfs, read_cache, write_cache->block, write_cache->offset, write_cache->buffer, diff);
+
+            if (err) {
+                return err;
+            }
+        }
+
+        lfs_cache_zero(lfs, write_cache);
+    }
+
+    return LFS_ERR_OK;
+}
+
+int lfs_bd_sync(lfs_t* lfs, lfs_cache_t* write_cache, lfs_cache_t* read_cache, bool validate) {
+
+    lfs_cache_drop(lfs, read_cache);
+
+    int err = lfs_bd_flush(lfs, write_cache, read_cache, validate);
+
+    if (err) {
+
+        return err;
+    }
+
+    err = lfs->cfg->sync(lfs->cfg);
+    LFS_ASSERT(err <= 0);
+    return err;
+}
+
+// Flush a commit that has been written out. The device sync is left to a
+// later commit of its group, or to lfs_bd_syncpending, while a batch
+// is open or the group isn't full
+int lfs_bd_groupsync(lfs_t* lfs, lfs_cache_t* write_cache, lfs_cache_t* read_cache) {
+
+    lfs->sync_pending += 1;
+
+    if (lfs->batch_depth == 0 && lfs->sync_pending >= lfs->cfg->sync_group) {
+
+        int err = lfs_bd_sync(lfs, write_cache, read_cache, false);
+
+        if (err) {
+
+            return err;
+        }
+
+        lfs->sync_pending = 0;
+        return LFS_ERR_OK;
+    }
+
+    lfs_cache_drop(lfs, read_cache);
+
+    return lfs_bd_flush(lfs, write_cache, read_cache, false);
+}
+
+// Sync the device if commits have been left waiting on it
+int lfs_bd_syncpending(lfs_t* lfs) {
+
+    if (lfs->sync_pending == 0) {
+
+        return LFS_ERR_OK;
+    }
+
+    int err = lfs_bd_sync(lfs, &lfs->write_cache, &lfs->read_cache, false);
+
+    if (err) {
+
+        return err;
+    }
+
+    lfs->sync_pending = 0;
+    return LFS_ERR_OK;
+}
+
+int lfs_bd_write(lfs_t* lfs,
+    lfs_cache_t* write_cache, lfs_cache_t* read_cache, bool validate,
+    lfs_block_t block, lfs_off_t offset,
+    const void* buffer, lfs_size_t size) {
+
+    const uint8_t* data = (const uint8_t *)buffer;
+    LFS_ASSERT(block == LFS_BLOCK_INLINE || block < lfs->block_count);
+    LFS_ASSERT(offset + size <= lfs->block_size);
+
+    while (size > 0) {
+
+        if (block == write_cache->block &&
+            offset >= write_cache->offset &&
+            offset < write_cache->offset + lfs->cfg->cache_size) {
+
+            // already fits in write_cache?
+            lfs_size_t diff = lfs_min(size, lfs->cfg->cache_size - (offset - write_cache->offset));
 
             memcpy(&write_cache->buffer[offset - write_cache->offset], data, diff);
 
@@ -311,10 +1044,212 @@ int lfs_bd_write(lfs_t* lfs,
     return LFS_ERR_OK;
 }
 
+// Copy a region from one block to another, the source is read through
+// src_cache and read_cache, the destination is programmed through write_cache
+// as in lfs_bd_write. Aligned regions are handed to the device's copy if any
+int lfs_bd_copy(lfs_t* lfs,
+    lfs_cache_t* write_cache, lfs_cache_t* read_cache, bool validate,
+    lfs_block_t block, lfs_off_t offset,
+    const lfs_cache_t* src_cache, lfs_block_t src_block, lfs_off_t src_offset,
+    lfs_size_t size) {
+
+    LFS_ASSERT(block < lfs->block_count);
+    LFS_ASSERT(offset + size <= lfs->block_size);
+    LFS_ASSERT(src_block != block);
+
+    if (src_block == LFS_BLOCK_NULL) {
+
+        // a hole of a sparse file, there is nothing to copy but zeros
+        static const uint8_t zeros[256] = { 0 };
+
+        while (size > 0) {
+
+            lfs_size_t diff = lfs_min(size, sizeof(zeros));
+
+            int err = lfs_bd_write(lfs, write_cache, read_cache, validate, block, offset, zeros, diff);
+
+            if (err) {
+
+                return err;
+            }
+
+            offset += diff;
+            size -= diff;
+        }
+
+        return LFS_ERR_OK;
+    }
+
+    if (src_block >= lfs->block_count || src_offset + size > lfs->block_size) {
+
+        // not a bad destination, relocating wouldn't help
+        return LFS_ERR_IO;
+    }
+
+    while (size > 0) {
+
+        // the device copy has to end on a cache boundary, so the
+        // write_cache picks up where it left off and still fills up exactly
+        // at the end of the block
+        lfs_off_t end = lfs_aligndown(offset + size, lfs->cfg->cache_size);
+
+        if (lfs->cfg->copy && end > offset &&
+            offset % lfs->cfg->write_size == 0 &&
+            src_offset % lfs->cfg->read_size == 0 &&
+            !(src_cache && src_cache->block == src_block)) {
+
+            // write out what leads up to us, it ends exactly where we start
+            if (write_cache->block == block &&
+                write_cache->offset + write_cache->size == offset) {
+
+                int err = lfs_bd_flush(lfs, write_cache, read_cache, validate);
+
+                if (err) {
+
+                    return err;
+                }
+            }
+
+            if (write_cache->block == LFS_BLOCK_NULL) {
+
+                // let the device move it
+                lfs_size_t diff = end - offset;
+
+                if (read_cache->block == block) {
+
+                    lfs_cache_drop(lfs, read_cache);
+                }
+
+                int err = lfs_bd_rawcopy(lfs, block, offset, src_block, src_offset, diff);
+
+                if (err) {
+
+                    return err;
+                }
+
+                bool verify = validate && lfs_bd_verifying(lfs);
+
+                if (verify && lfs->cfg->verify == LFS_VERIFY_CRC) {
+
+                    // crc both sides instead of comparing them
+                    uint32_t crc = 0xffffffff;
+                    uint32_t src_crc = 0xffffffff;
+
+                    err = lfs_bd_crc(lfs,
+                        NULL, read_cache, diff,
+                        src_block, src_offset, diff, &src_crc);
+
+                    if (err) {
+
+                        return err;
+                    }
+
+                    err = lfs_bd_verifycrc(lfs, read_cache, diff, block, offset, diff, &crc);
+
+                    if (err) {
+
+                        return err;
+                    }
+
+                    if (crc != src_crc) {
+
+                        return LFS_ERR_CORRUPT;
+                    }
+                }
+                else if (verify) {
+
+                    // check data on disk, the write_cache is empty so use it
+                    // to hold the source
+                    for (lfs_off_t idx = 0; idx < diff; idx += lfs->cfg->cache_size) {
+
+                        lfs_size_t delta = lfs_min(diff - idx, lfs->cfg->cache_size);
+
+                        err = lfs_bd_read(lfs,
+                            NULL, read_cache, delta,
+                            src_block, src_offset + idx, write_cache->buffer, delta);
+
+                        if (err) {
+
+                            lfs_cache_zero(lfs, write_cache);
+                            return err;
+                        }
+
+                        int res = lfs_bd_cmp(lfs,
+                            NULL, read_cache, delta,
+                            block, offset + idx, write_cache->buffer, delta);
+
+                        if (res != LFS_CMP_EQ) {
+
+                            lfs_cache_zero(lfs, write_cache);
+                            return res < 0 ? res : LFS_ERR_CORRUPT;
+                        }
+                    }
+
+                    lfs_cache_zero(lfs, write_cache);
+                }
+
+                offset += diff;
+                src_offset += diff;
+                size -= diff;
+                continue;
+            }
+        }
+
+        if (block == write_cache->block &&
+            offset >= write_cache->offset &&
+            offset < write_cache->offset + lfs->cfg->cache_size) {
+
+            // read straight into the write_cache
+            lfs_size_t diff = lfs_min(size, lfs->cfg->cache_size - (offset - write_cache->offset));
+
+            int err = lfs_bd_read(lfs,
+                src_cache, read_cache, diff,
+                src_block, src_offset, &write_cache->buffer[offset - write_cache->offset], diff);
+
+            if (err) {
+
+                return err;
+            }
+
+            offset += diff;
+            src_offset += diff;
+            size -= diff;
+
+            write_cache->size = lfs_max(write_cache->size, offset - write_cache->offset);
+
+            if (write_cache->size == lfs->cfg->cache_size) {
+
+                // eagerly flush out write_cache if we fill up
+                err = lfs_bd_flush(lfs, write_cache, read_cache, validate);
+
+                if (err) {
+
+                    return err;
+                }
+            }
+
+            continue;
+        }
+
+        // write_cache must have been flushed, either by programming and
+        // entire block or manually flushing the write_cache
+        LFS_ASSERT(write_cache->block == LFS_BLOCK_NULL);
+
+        // prepare write_cache, first condition can no longer fail
+        write_cache->block = block;
+        write_cache->offset = lfs_aligndown(offset, lfs->cfg->write_size);
+        write_cache->size = 0;
+    }
+
+    return LFS_ERR_OK;
+}
+
 int lfs_bd_erase(lfs_t* lfs, lfs_block_t block) {
 
     LFS_ASSERT(block < lfs->block_count);
 
+    lfs_bd_slot_invalidate(lfs, block);
+
     // adjust to physical erase size
     block = block * (lfs->block_size / lfs->erase_size);
 
@@ -261,6 +261,161 @@ int lfs_dir_rawread(lfs_t* lfs, lfs_dir_t* dir, struct lfs_info* info) {
     return LFS_ERR_OK;
 }
 
+// Fill out the info of an entry from the index of its metadata pair, as
+// lfs_dir_getinfo does by looking up the name and struct in the log
+static int lfs_dir_getindexinfo(lfs_t* lfs, const lfs_metadata_dir_t* dir,
+    const lfs_tag_index_t* index, uint16_t id, struct lfs_info* info) {
+
+    lfs_off_t offset;
+    lfs_stag_t tag = lfs_tag_index_get(index,
+        LFS_MKTAG(0x780, 0x3ff, 0),
+        LFS_MKTAG(LFS_TYPE_NAME, id, 0), &offset);
+
+    if (tag < 0 || lfs_tag_isdelete(tag)) {
+        return LFS_ERR_NOENT;
+    }
+
+    memset(info, 0, sizeof(*info));
+    info->type = (uint8_t)lfs_tag_type3(tag);
+
+    lfs_size_t size = lfs_min(lfs_tag_size(tag), lfs->name_max_length);
+
+    int err = lfs_bd_read(lfs, NULL, &lfs->read_cache, size,
+        dir->pair[0], offset + sizeof(lfs_tag_t), info->name, size);
+
+    if (err) {
+        return err;
+    }
+
+    tag = lfs_tag_index_get(index,
+        LFS_MKTAG(LFS_TYPE_GLOBALS, 0x3ff, 0),
+        LFS_MKTAG(LFS_TYPE_STRUCT, id, 0), &offset);
+
+    if (tag < 0 || lfs_tag_isdelete(tag)) {
+        return LFS_ERR_NOENT;
+    }
+
+    if (lfs_tag_type3(tag) == LFS_TYPE_CTZSTRUCT || lfs_tag_type3(tag) == LFS_TYPE_EXTSTRUCT) {
+
+        lfs_ctz_t ctz = { 0 };
+        size = lfs_min(lfs_tag_size(tag), sizeof(ctz));
+
+        err = lfs_bd_read(lfs, NULL, &lfs->read_cache, size,
+            dir->pair[0], offset + sizeof(lfs_tag_t), &ctz, size);
+
+        if (err) {
+            return err;
+        }
+
+        lfs_ctz_fromle64(&ctz);
+        info->size = ctz.size;
+    }
+    else if (lfs_tag_type3(tag) == LFS_TYPE_INLINESTRUCT) {
+
+        info->size = lfs_tag_size(tag);
+    }
+
+    return LFS_ERR_OK;
+}
+
+lfs_ssize_t lfs_dir_rawreadbatch(lfs_t* lfs, lfs_dir_t* dir, struct lfs_info* info, lfs_size_t count) {
+
+    lfs_size_t read = 0;
+
+    // special offsets for '.' and '..'
+    while (read < count && dir->pos < 2) {
+
+        memset(&info[read], 0, sizeof(info[read]));
+        info[read].type = LFS_TYPE_DIR;
+        strcpy_s(info[read].name, sizeof(info[read].name), (dir->pos == 0) ? "." : "..");
+        dir->pos += 1;
+        read += 1;
+    }
+
+    // the pair is indexed once, by the shared index if it has one, its
+    // entries are then read straight from where their tags are
+    lfs_tag_index_t local = { 0 };
+    const lfs_tag_index_t* index = NULL;
+    int err = LFS_ERR_OK;
+
+    while (read < count) {
+
+        if (dir->id == dir->metadata.count) {
+
+            //has splited next block
+            if (!dir->metadata.split) {
+
+                break;
+            }
+
+            //get next block
+            err = lfs_dir_fetch(lfs, &dir->metadata, dir->metadata.tail);
+
+            if (err) {
+
+                break;
+            }
+
+            dir->id = 0;
+            index = NULL;
+        }
+
+        if (!index) {
+
+            index = lfs_tag_index_find(lfs, &dir->metadata,
+                LFS_MKTAG(0x780, 0x3ff, 0), LFS_MKTAG(LFS_TYPE_NAME, 0, 0));
+
+            if (!index) {
+
+                err = lfs_tag_index_build(lfs, &local, &dir->metadata);
+
+                if (err) {
+
+                    break;
+                }
+
+                index = &local;
+            }
+        }
+
+        // ids past a pending move are one further along in the log
+        uint16_t id = dir->id;
+
+        if (lfs_gstate_hasmovehere(&lfs->gdisk, dir->metadata.pair) &&
+            lfs_tag_id(lfs->gdisk.tag) <= id) {
+
+            id += 1;
+        }
+
+        err = lfs_dir_getindexinfo(lfs, &dir->metadata, index, id, &info[read]);
+
+        if (err && err != LFS_ERR_NOENT) {
+
+            break;
+        }
+
+        dir->id += 1;
+
+        if (err != LFS_ERR_NOENT) {
+
+            dir->pos += 1;
+            read += 1;
+        }
+
+        err = LFS_ERR_OK;
+    }
+
+    lfs_tag_index_clear(&local);
+
+    // entries read so far are kept, the error comes up again on the next call
+    if (err && read == 0) {
+
+        return err;
+    }
+
+    return read;
+}
+
 //seek by indexes in directory
 int lfs_dir_rawseek(lfs_t* lfs, lfs_dir_t* dir, lfs_off_t offset) {
 
@@ -23,8 +23,14 @@ int lfs_file_rawopencfg(lfs_t* lfs, lfs_file_t* file,
     file->pos = 0;
     file->offset = 0;
     file->cache.buffer = NULL;
+    file->index = { 0 };
+    file->extents = { 0 };
+    file->wextents = { 0 };
+    file->readahead = { 0 };
+    file->reserved = { 0 };
 
     // allocate entry for file if it doesn't exist
+    const char* name = path;
     lfs_stag_t tag = lfs_dir_find(lfs, &file->metadata, &path, &file->id);
 
     if (tag < 0 && !(tag == LFS_ERR_NOENT && file->id != 0x3ff)) {
@@ -33,6 +39,29 @@ int lfs_file_rawopencfg(lfs_t* lfs, lfs_file_t* file,
         goto cleanup;
     }
 
+    // what a batch holds back for the file is committed first, so
+    // it is what gets opened
+    if (tag >= 0) {
+
+        err = lfs_batch_settle(lfs, file->metadata.pair, file->id);
+
+        if (err < 0) {
+            goto cleanup;
+        }
+
+        if (err > 0) {
+
+            path = name;
+            tag = lfs_dir_find(lfs, &file->metadata, &path, &file->id);
+
+            if (tag < 0) {
+
+                err = tag;
+                goto cleanup;
+            }
+        }
+    }
+
     // get id, add to list of mdirs to catch update changes
     file->type = LFS_TYPE_REG;
     lfs_mlist_append(lfs, (lfs_metadata_list_t*)file);
@@ -176,6 +205,17 @@ int lfs_file_rawopencfg(lfs_t* lfs, lfs_file_t* file,
             }
         }
     }
+    else if (lfs_tag_type3(tag) == LFS_TYPE_EXTSTRUCT) {
+
+        // load the extent list
+        file->flags |= LFS_F_EXTENT;
+
+        err = lfs_extent_fetch(lfs, &file->metadata, file->id, &file->extents);
+
+        if (err) {
+            goto cleanup;
+        }
+    }
 
     return LFS_ERR_OK;
 
@@ -199,6 +239,15 @@ int lfs_file_rawclose(lfs_t* lfs, lfs_file_t* file) {
 
     int err = lfs_file_rawsync(lfs, file);
 
+    // a file a batch holds back is handed over to it
+    if (!err && (file->flags & LFS_F_BATCHSYNC)) {
+
+        err = lfs_batch_hold(lfs, file);
+    }
+
+    // give back blocks set aside and never written
+    lfs_alloc_unreserve(lfs, &file->reserved);
+
     // remove from list of mdirs
     lfs_mlist_remove(lfs, (lfs_metadata_list_t*)file);
 
@@ -207,6 +256,11 @@ int lfs_file_rawclose(lfs_t* lfs, lfs_file_t* file) {
         free(file->cache.buffer);
     }
 
+    lfs_index_cache_release(lfs, &file->index);
+    lfs_extent_release(&file->extents);
+    lfs_extent_release(&file->wextents);
+    free(file->readahead.buffer);
+
     return err;
 }
 
@@ -216,7 +270,7 @@ int lfs_file_relocate(lfs_t* lfs, lfs_file_t* file) {
 
         // just relocate what exists into new block
         lfs_block_t nblock;
-        int err = lfs_alloc(lfs, &nblock);
+        int err = lfs_alloc_take(lfs, &file->reserved, &nblock);
 
         if (err) {
 
@@ -235,12 +289,13 @@ int lfs_file_relocate(lfs_t* lfs, lfs_file_t* file) {
             return err;
         }
 
-        // either read from dirty cache or disk
-        for (lfs_off_t i = 0; i < file->offset; i++) {
+        if (file->flags & LFS_F_INLINE) {
 
-            uint8_t data;
+            // inline files are at most a cache in size, a byte at a time
+            // is fine here
+            for (lfs_off_t i = 0; i < file->offset; i++) {
 
-            if (file->flags & LFS_F_INLINE) {
+                uint8_t data;
 
                 err = lfs_dir_getread(lfs, &file->metadata,
                     // note we evict inline files before they can be dirty
@@ -252,22 +307,28 @@ int lfs_file_relocate(lfs_t* lfs, lfs_file_t* file) {
 
                     return err;
                 }
-            }
-            else {
 
-                err = lfs_bd_read(lfs,
-                    &file->cache, &lfs->read_cache, file->offset - i,
-                    file->block, i, &data, 1);
+                err = lfs_bd_write(lfs,
+                    &lfs->write_cache, &lfs->read_cache, true,
+                    nblock, i, &data, 1);
 
                 if (err) {
 
+                    if (err == LFS_ERR_CORRUPT) {
+
+                        goto relocate;
+                    }
+
                     return err;
                 }
             }
+        }
+        else {
 
-            err = lfs_bd_write(lfs,
+            // either read from dirty cache or disk
+            err = lfs_bd_copy(lfs,
                 &lfs->write_cache, &lfs->read_cache, true,
-                nblock, i, &data, 1);
+                nblock, 0, &file->cache, file->block, 0, file->offset);
 
             if (err) {
 
@@ -287,6 +348,30 @@ int lfs_file_relocate(lfs_t* lfs, lfs_file_t* file) {
         file->cache.size = lfs->write_cache.size;
         lfs_cache_zero(lfs, &lfs->write_cache);
 
+        // replace the block we were writing
+        if (file->flags & LFS_F_EXTENT) {
+
+            lfs_extent_pop(&file->wextents);
+
+            err = lfs_extent_append(&file->wextents, nblock);
+
+            if (err) {
+
+                return err;
+            }
+        }
+
+        // the block we replaced may be in the index
+        if (file->pos > 0) {
+
+            lfs_off_t noff = file->pos - 1;
+            lfs_index_cache_drop(lfs, &file->index, lfs_ctz_index(lfs, &noff));
+        }
+        else {
+
+            lfs_index_cache_drop(lfs, &file->index, 0);
+        }
+
         file->block = nblock;
         file->flags |= LFS_F_WRITING;
         return LFS_ERR_OK;
@@ -311,6 +396,22 @@ int lfs_file_outline(lfs_t* lfs, lfs_file_t* file) {
     }
 
     file->flags &= ~LFS_F_INLINE;
+
+    if (lfs->cfg->file_layout == LFS_LAYOUT_EXTENT) {
+
+        // the new block is the first extent
+        file->wextents.count = 0;
+
+        err = lfs_extent_append(&file->wextents, file->block);
+
+        if (err) {
+
+            return err;
+        }
+
+        file->flags |= LFS_F_EXTENT;
+    }
+
     return LFS_ERR_OK;
 }
 
@@ -330,13 +431,17 @@ int lfs_file_flush(lfs_t* lfs, lfs_file_t* file) {
 
         lfs_off_t pos = file->pos;
 
+        // what was read ahead may have been written over
+        file->readahead.count = 0;
+
         if (!(file->flags & LFS_F_INLINE)) {
 
             // copy over anything after current branch
             lfs_file_t orig{};
             orig.ctz.head = file->ctz.head;
             orig.ctz.size = file->ctz.size;
-            orig.flags = LFS_O_RDONLY;
+            orig.flags = LFS_O_RDONLY | (file->flags & LFS_F_EXTENT);
+            orig.extents = file->extents;
             orig.pos = file->pos;
             orig.cache = lfs->read_cache;
 
@@ -344,21 +449,81 @@ int lfs_file_flush(lfs_t* lfs, lfs_file_t* file) {
 
             while (file->pos < file->ctz.size) {
 
-                // copy over a byte at a time, leave it up to caching
-                // to make this efficient
-                uint8_t data;
-                lfs_ssize_t res = lfs_file_flushedread(lfs, &orig, &data, 1);
+                if ((file->flags & LFS_F_EXTENT) &&
+                    (file->flags & LFS_F_WRITING) && file->offset == lfs->block_size) {
 
-                if (res < 0) {
+                    // every block from here on is unchanged, share them
+                    // rather than copy them, holes stay holes
+                    int err = lfs_extent_splice(&file->wextents, &orig.extents,
+                        file->pos / lfs->block_size);
 
-                    return res;
+                    if (err) {
+                        return err;
+                    }
+
+                    file->pos = file->ctz.size;
+                    break;
                 }
 
-                res = lfs_file_flushedwrite(lfs, file, &data, 1);
+                if ((file->flags & LFS_F_WRITING) && file->offset < lfs->block_size &&
+                    (orig.flags & LFS_F_READING) && orig.offset < lfs->block_size) {
 
-                if (res < 0) {
+                    // both sides sit in a block, copy as much as they have
+                    // room for in one go
+                    lfs_size_t diff = lfs_min(file->ctz.size - file->pos,
+                        lfs_min(lfs->block_size - file->offset, lfs->block_size - orig.offset));
 
-                    return res;
+                    while (true) {
+
+                        int err = lfs_bd_copy(lfs,
+                            &file->cache, &lfs->read_cache, true,
+                            file->block, file->offset, NULL, orig.block, orig.offset, diff);
+
+                        if (err) {
+
+                            if (err == LFS_ERR_CORRUPT) {
+                                goto relocate_copy;
+                            }
+
+                            file->flags |= LFS_F_ERRED;
+                            return err;
+                        }
+
+                        break;
+
+                    relocate_copy:
+                        LFS_DEBUG("Bad block at 0x%"PRIx32, file->block);
+                        err = lfs_file_relocate(lfs, file);
+                        if (err) {
+                            file->flags |= LFS_F_ERRED;
+                            return err;
+                        }
+                    }
+
+                    file->pos += diff;
+                    file->offset += diff;
+                    orig.pos += diff;
+                    orig.offset += diff;
+                    lfs_alloc_ack(lfs);
+                }
+                else {
+
+                    // step onto the next block a byte at a time, leave it up
+                    // to caching to make this efficient
+                    uint8_t data;
+                    lfs_ssize_t res = lfs_file_flushedread(lfs, &orig, &data, 1);
+
+                    if (res < 0) {
+
+                        return res;
+                    }
+
+                    res = lfs_file_flushedwrite(lfs, file, &data, 1);
+
+                    if (res < 0) {
+
+                        return res;
+                    }
                 }
 
                 // keep our reference to the read_cache in sync
@@ -399,6 +564,14 @@ int lfs_file_flush(lfs_t* lfs, lfs_file_t* file) {
         // actual file updates
         file->ctz.head = file->block;
         file->ctz.size = file->pos;
+
+        if (file->flags & LFS_F_EXTENT) {
+
+            lfs_extent_list_t extents = file->extents;
+            file->extents = file->wextents;
+            file->wextents = extents;
+        }
+
         file->flags &= ~LFS_F_WRITING;
         file->flags |= LFS_F_DIRTY;
 
@@ -408,6 +581,54 @@ int lfs_file_flush(lfs_t* lfs, lfs_file_t* file) {
     return LFS_ERR_OK;
 }
 
+// Work out the struct a flushed file is committed to its entry with, ctz
+// and extents are scratch space for it to be built in
+int lfs_file_commitstruct(lfs_t* lfs, lfs_file_t* file,
+    uint16_t* type, const void** buffer, lfs_size_t* size, lfs_ctz_t* ctz, uint8_t* extents) {
+
+    if (file->flags & LFS_F_INLINE) {
+
+        // inline the whole file
+        *type = LFS_TYPE_INLINESTRUCT;
+        *buffer = file->cache.buffer;
+        *size = file->ctz.size;
+    }
+    else if (file->flags & LFS_F_EXTENT) {
+
+        // update the extent list, it spills into table blocks if it
+        // doesn't fit in the entry
+        *type = LFS_TYPE_EXTSTRUCT;
+
+        // drivers without extents have to refuse the image first, before
+        // the blocks of a spilled list are allocated
+        int err = lfs_fs_raiseversion(lfs, LFS_DISK_VERSION_EXTENTS);
+
+        if (err) {
+            return err;
+        }
+
+        err = lfs_extent_store(lfs, &file->extents, file->ctz.size, extents, size);
+
+        if (err) {
+            return err;
+        }
+
+        *buffer = extents;
+    }
+    else {
+
+        // update the ctz reference
+        *type = LFS_TYPE_CTZSTRUCT;
+        // copy ctz so alloc will work during a relocate
+        *ctz = file->ctz;
+        lfs_ctz_tole64(ctz);
+        *buffer = ctz;
+        *size = sizeof(*ctz);
+    }
+
+    return LFS_ERR_OK;
+}
+
 int lfs_file_rawsync(lfs_t* lfs, lfs_file_t* file) {
 
     if (file->flags & LFS_F_ERRED) {
@@ -425,28 +646,38 @@ int lfs_file_rawsync(lfs_t* lfs, lfs_file_t* file) {
 
     if ((file->flags & LFS_F_DIRTY) && !lfs_pair_isnull(file->metadata.pair)) {
 
+        // an open batch commits the file along with the others
+        if (lfs->batch_depth) {
+
+            err = lfs_batch_defer(lfs, file);
+
+            if (err) {
+                file->flags |= LFS_F_ERRED;
+            }
+
+            return err;
+        }
+
+        err = lfs_alloc_release(lfs);
+
+        if (err) {
+
+            file->flags |= LFS_F_ERRED;
+            return err;
+        }
+
         // update dir entry
         uint16_t type;
         const void* buffer;
         lfs_size_t size;
         lfs_ctz_t ctz;
+        uint8_t extents[0x3fe];
 
-        if (file->flags & LFS_F_INLINE) {
-
-            // inline the whole file
-            type = LFS_TYPE_INLINESTRUCT;
-            buffer = file->cache.buffer;
-            size = file->ctz.size;
-        }
-        else {
+        err = lfs_file_commitstruct(lfs, file, &type, &buffer, &size, &ctz, extents);
 
-            // update the ctz reference
-            type = LFS_TYPE_CTZSTRUCT;
-            // copy ctz so alloc will work during a relocate
-            ctz = file->ctz;
-            lfs_ctz_tole64(&ctz);
-            buffer = &ctz;
-            size = sizeof(ctz);
+        if (err) {
+            file->flags |= LFS_F_ERRED;
+            return err;
         }
 
         // commit file data and attributes
@@ -462,199 +693,366 @@ int lfs_file_rawsync(lfs_t* lfs, lfs_file_t* file) {
             return err;
         }
 
-        file->flags &= ~LFS_F_DIRTY;
+        file->flags &= ~(LFS_F_DIRTY | LFS_F_BATCHSYNC);
     }
 
     return LFS_ERR_OK;
 }
 
-lfs_ssize_t lfs_file_flushedread(lfs_t* lfs, lfs_file_t* file, void* buffer, lfs_size_t size) {
-
-    uint8_t* data = (uint8_t*)buffer;
-    lfs_size_t nsize = size;
-
-    if (file->pos >= file->ctz.size) {
-        // eof if past end
-        return LFS_ERR_OK;
-    }
-
-    size = lfs_min(size, file->ctz.size - file->pos);
-    nsize = size;
-
-    while (nsize > 0) {
+// Read the blocks ahead of the file position with one batch, straight into
+// the buffer. Returns how much was read, 0 when fewer than two blocks could
+// go in the batch and the reads are left to the usual path.
+static lfs_ssize_t lfs_file_batchread(lfs_t* lfs, lfs_file_t* file, uint8_t* data, lfs_size_t size) {
 
-        // check if we need a new block
-        if (!(file->flags & LFS_F_READING) || file->offset == lfs->block_size) {
+    lfs_bd_request_t batch[LFS_READ_BATCH_MAX];
+    lfs_size_t count = 0;
+    lfs_size_t done = 0;
+    lfs_size_t pos = file->pos;
+    lfs_block_t block = LFS_BLOCK_NULL;
+    lfs_off_t offset = 0;
 
-            if (!(file->flags & LFS_F_INLINE)) {
+    while (done < size && count < LFS_READ_BATCH_MAX) {
 
-                int err = lfs_ctz_find(lfs, NULL, &file->cache,
-                    file->ctz.head, file->ctz.size,
-                    file->pos, &file->block, &file->offset);
+        if (file->flags & LFS_F_EXTENT) {
 
-                if (err) {
-                    return err;
-                }
-            }
-            else {
+            int err = lfs_extent_find(&file->extents, pos / lfs->block_size, &block);
 
-                file->block = LFS_BLOCK_INLINE;
-                file->offset = file->pos;
+            if (err) {
+                return err;
             }
 
-            file->flags |= LFS_F_READING;
+            offset = pos % lfs->block_size;
         }
+        else {
 
-        // read as much as we can in current block
-        lfs_size_t diff = lfs_min(nsize, lfs->block_size - file->offset);
-
-        if (file->flags & LFS_F_INLINE) {
-
-            int err = lfs_dir_getread(lfs, &file->metadata,
-                NULL, &file->cache, lfs->block_size,
-                LFS_MKTAG(0xfff, 0x1ff, 0),
-                LFS_MKTAG(LFS_TYPE_INLINESTRUCT, file->id, 0),
-                file->offset, data, diff);
+            int err = lfs_ctz_find(lfs, NULL, &file->cache,
+                lfs_mlist_isopen(lfs->metadata_list, file) ? &file->index : NULL,
+                file->ctz.head, file->ctz.size,
+                pos, &block, &offset);
 
             if (err) {
                 return err;
             }
         }
-        else {
 
-            int err = lfs_bd_read(lfs,
-                NULL, &file->cache, lfs->block_size,
-                file->block, file->offset, data, diff);
+        lfs_size_t diff = lfs_min(size - done, lfs->block_size - offset);
 
-            if (err) {
-                return err;
-            }
+        // only whole read units can go around the file's cache
+        if (offset % lfs->cfg->read_size != 0 || diff % lfs->cfg->read_size != 0) {
+            break;
         }
 
-        file->pos += diff;
-        file->offset += diff;
-        data += diff;
-        nsize -= diff;
-    }
+        if (block == LFS_BLOCK_NULL) {
 
-    return size;
-}
+            // a hole, nothing on disk to read
+            memset(data + done, 0, diff);
+        }
+        else {
 
-lfs_ssize_t lfs_file_rawread(lfs_t* lfs, lfs_file_t* file, void* buffer, lfs_size_t size) {
+            batch[count].block = block;
+            batch[count].offset = offset;
+            batch[count].buffer = data + done;
+            batch[count].size = diff;
+            count += 1;
+        }
 
-    LFS_ASSERT((file->flags & LFS_O_RDONLY) == LFS_O_RDONLY);
+        pos += diff;
+        offset += diff;
+        done += diff;
+    }
 
-    if (file->flags & LFS_F_WRITING) {
+    if (count < 2) {
 
-        // flush out any writes
-        int err = lfs_file_flush(lfs, file);
+        return 0;
+    }
 
-        if (err) {
+    int err = lfs_bd_readbatch(lfs, batch, count);
 
-            return err;
-        }
+    if (err) {
+        return err;
     }
 
-    return lfs_file_flushedread(lfs, file, buffer, size);
+    file->pos = pos;
+    file->block = block;
+    file->offset = offset;
+    file->flags |= LFS_F_READING;
+
+    return done;
 }
 
-lfs_ssize_t lfs_file_flushedwrite(lfs_t* lfs, lfs_file_t* file, const void* buffer, lfs_size_t size) {
+// Read the window ahead of the file position into the read-ahead buffer
+// with one batch, a span per block. Nothing is read ahead when there is no
+// buffer for it, it's only an optimization.
+static int lfs_file_readahead_fill(lfs_t* lfs, lfs_file_t* file) {
 
-    const uint8_t* data = (const uint8_t*)buffer;
-    lfs_size_t nsize = size;
+    lfs_readahead_t* readahead = &file->readahead;
 
-    if ((file->flags & LFS_F_INLINE) &&
+    if (!readahead->buffer) {
 
-        lfs_max(file->pos + nsize, file->ctz.size) >
-        lfs_min(0x3fe, lfs_min(
-            lfs->cfg->cache_size,
-            (lfs->cfg->metadata_max ?
-                lfs->cfg->metadata_max : lfs->block_size) / sizeof(lfs_block_t[2])))) {
+        // temporary handles, such as the one used to copy the tail of a
+        // file during a flush, are never closed to free a buffer
+        if (!lfs_mlist_isopen(lfs->metadata_list, file)) {
+            return LFS_ERR_OK;
+        }
 
-        // inline file doesn't fit anymore
-        int err = lfs_file_outline(lfs, file);
-        if (err) {
+        readahead->buffer = (uint8_t*)malloc(lfs->cfg->readahead_size);
 
-            file->flags |= LFS_F_ERRED;
-            return err;
+        if (!readahead->buffer) {
+            return LFS_ERR_OK;
         }
     }
 
-    while (nsize > 0) {
+    lfs_bd_request_t batch[LFS_READ_BATCH_MAX];
+    lfs_size_t requests = 0;
+    lfs_size_t count = 0;
+    lfs_size_t used = 0;
+    lfs_off_t pos = file->pos;
+    lfs_off_t end = lfs_min(file->ctz.size, file->pos + readahead->window);
 
-        // check if we need a new block
-        if (!(file->flags & LFS_F_WRITING) ||
+    readahead->count = 0;
 
-            file->offset == lfs->block_size) {
+    while (pos < end && count < LFS_READ_BATCH_MAX) {
 
-            if (!(file->flags & LFS_F_INLINE)) {
+        lfs_block_t block;
+        lfs_off_t offset;
 
-                if (!(file->flags & LFS_F_WRITING) && file->pos > 0) {
+        if (file->flags & LFS_F_EXTENT) {
 
-                    // find out which block we're extending from
-                    lfs_off_t _offset = 0;
+            int err = lfs_extent_find(&file->extents, pos / lfs->block_size, &block);
 
-                    int err = lfs_ctz_find(lfs, NULL, &file->cache,
-                        file->ctz.head, file->ctz.size,
-                        file->pos - 1, &file->block, &_offset);
+            if (err) {
+                return err;
+            }
 
-                    if (err) {
+            offset = pos % lfs->block_size;
+        }
+        else {
 
-                        file->flags |= LFS_F_ERRED;
-                        return err;
-                    }
+            int err = lfs_ctz_find(lfs, NULL, &file->cache, &file->index,
+                file->ctz.head, file->ctz.size,
+                pos, &block, &offset);
 
-                    // mark cache as dirty since we may have read data into it
-                    lfs_cache_zero(lfs, &file->cache);
-                }
+            if (err) {
+                return err;
+            }
+        }
 
-                // extend file with new blocks
-                lfs_alloc_ack(lfs);
+        // read whole read units, as much of them as the buffer has room for
+        lfs_off_t start = lfs_aligndown(offset, lfs->cfg->read_size);
+        lfs_off_t stop = lfs_alignup(offset + lfs_min(end - pos, lfs->block_size - offset), lfs->cfg->read_size);
 
-                int err = lfs_ctz_extend(lfs, &file->cache, &lfs->read_cache,
-                    file->block, file->pos,
-                    &file->block, &file->offset);
+        stop = lfs_min(stop, start + lfs_aligndown(lfs->cfg->readahead_size - used, lfs->cfg->read_size));
 
-                if (err) {
+        if (stop <= offset) {
+            break;
+        }
 
-                    file->flags |= LFS_F_ERRED;
+        lfs_size_t diff = lfs_min(end - pos, stop - offset);
+
+        if (block == LFS_BLOCK_NULL) {
+
+            // a hole, nothing on disk to read
+            memset(readahead->buffer + used, 0, stop - start);
+        }
+        else {
+
+            batch[requests].block = block;
+            batch[requests].offset = start;
+            batch[requests].buffer = readahead->buffer + used;
+            batch[requests].size = stop - start;
+            requests += 1;
+        }
+
+        readahead->spans[count].pos = pos;
+        readahead->spans[count].size = diff;
+        readahead->spans[count].offset = used + (offset - start);
+        count += 1;
+
+        used += stop - start;
+        pos += diff;
+    }
+
+    if (requests > 0) {
+
+        int err = lfs_bd_readbatch(lfs, batch, requests);
+
+        if (err) {
+            return err;
+        }
+    }
+
+    readahead->count = count;
+
+    return LFS_ERR_OK;
+}
+
+// Copy out what the read-ahead buffer holds at the file position, returns
+// how much that was
+static lfs_size_t lfs_file_readahead_get(lfs_file_t* file, uint8_t* data, lfs_size_t size) {
+
+    const lfs_readahead_t* readahead = &file->readahead;
+
+    for (lfs_size_t i = 0; i < readahead->count; i++) {
+
+        const lfs_readahead_span_t* span = &readahead->spans[i];
+
+        if (file->pos >= span->pos && file->pos < span->pos + span->size) {
+
+            lfs_size_t diff = lfs_min(size, span->pos + span->size - file->pos);
+
+            memcpy(data, &readahead->buffer[span->offset + (file->pos - span->pos)], diff);
+
+            return diff;
+        }
+    }
+
+    return 0;
+}
+
+lfs_ssize_t lfs_file_flushedread(lfs_t* lfs, lfs_file_t* file, void* buffer, lfs_size_t size) {
+
+    uint8_t* data = (uint8_t*)buffer;
+    lfs_size_t nsize = size;
+
+    if (file->pos >= file->ctz.size) {
+        // eof if past end
+        return LFS_ERR_OK;
+    }
+
+    size = lfs_min(size, file->ctz.size - file->pos);
+    nsize = size;
+
+    // a read on from where the last one ended keeps reading ahead, any
+    // other drops the window back
+    bool sequential = lfs->cfg->readahead_size &&
+        !(file->flags & LFS_F_INLINE) && file->pos == file->readahead.next;
+
+    if (!sequential) {
+
+        file->readahead.window = 0;
+    }
+
+    while (nsize > 0) {
+
+        if (file->readahead.count) {
+
+            lfs_size_t diff = lfs_file_readahead_get(file, data, nsize);
+
+            if (diff) {
+
+                // the block and offset no longer follow the position
+                file->flags &= ~LFS_F_READING;
+                file->pos += diff;
+                data += diff;
+                nsize -= diff;
+                continue;
+            }
+        }
+
+        if (sequential) {
+
+            lfs_size_t window = file->readahead.window ?
+                lfs_min(2 * file->readahead.window, lfs->cfg->readahead_size) :
+                lfs_min(2 * lfs->cfg->cache_size, lfs->cfg->readahead_size);
+
+            // reads as large as the window gain nothing from a copy
+            if (nsize < window) {
+
+                file->readahead.window = window;
+
+                int err = lfs_file_readahead_fill(lfs, file);
+
+                if (err) {
+                    return err;
+                }
+
+                if (file->readahead.count) {
+                    continue;
+                }
+            }
+        }
+
+        // check if we need a new block
+        if (!(file->flags & LFS_F_READING) || file->offset == lfs->block_size) {
+
+            // several blocks to go, a device taking batches reads them together
+            if (lfs->cfg->read_batch && !(file->flags & LFS_F_INLINE) && nsize > lfs->block_size) {
+
+                lfs_ssize_t res = lfs_file_batchread(lfs, file, data, nsize);
+
+                if (res < 0) {
+                    return res;
+                }
+
+                if (res > 0) {
+
+                    data += res;
+                    nsize -= res;
+                    continue;
+                }
+            }
+
+            if (file->flags & LFS_F_EXTENT) {
+
+                // extent blocks hold nothing but data
+                int err = lfs_extent_find(&file->extents,
+                    file->pos / lfs->block_size, &file->block);
+
+                if (err) {
+                    return err;
+                }
+
+                file->offset = file->pos % lfs->block_size;
+            }
+            else if (!(file->flags & LFS_F_INLINE)) {
+
+                // temporary handles, such as the one used to copy the
+                // tail of a file during a flush, don't own an index cache
+                int err = lfs_ctz_find(lfs, NULL, &file->cache,
+                    lfs_mlist_isopen(lfs->metadata_list, file) ? &file->index : NULL,
+                    file->ctz.head, file->ctz.size,
+                    file->pos, &file->block, &file->offset);
+
+                if (err) {
                     return err;
                 }
             }
             else {
+
                 file->block = LFS_BLOCK_INLINE;
                 file->offset = file->pos;
             }
 
-            file->flags |= LFS_F_WRITING;
+            file->flags |= LFS_F_READING;
         }
 
-        // program as much as we can in current block
+        // read as much as we can in current block
         lfs_size_t diff = lfs_min(nsize, lfs->block_size - file->offset);
 
-        while (true) {
+        if (file->flags & LFS_F_INLINE) {
 
-            int err = lfs_bd_write(lfs, &file->cache, &lfs->read_cache, true,
-                file->block, file->offset, data, diff);
+            int err = lfs_dir_getread(lfs, &file->metadata,
+                NULL, &file->cache, lfs->block_size,
+                LFS_MKTAG(0xfff, 0x1ff, 0),
+                LFS_MKTAG(LFS_TYPE_INLINESTRUCT, file->id, 0),
+                file->offset, data, diff);
 
             if (err) {
-
-                if (err == LFS_ERR_CORRUPT) {
-
-                    goto relocate;
-                }
-
-                file->flags |= LFS_F_ERRED;
                 return err;
             }
+        }
+        else if (file->block == LFS_BLOCK_NULL) {
 
-            break;
+            // a hole, nothing on disk to read
+            memset(data, 0, diff);
+        }
+        else {
 
-        relocate:
-            err = lfs_file_relocate(lfs, file);
-            if (err) {
+            int err = lfs_bd_read(lfs,
+                NULL, &file->cache, lfs->block_size,
+                file->block, file->offset, data, diff);
 
-                file->flags |= LFS_F_ERRED;
+            if (err) {
                 return err;
             }
         }
@@ -663,6 +1061,250 @@ lfs_ssize_t lfs_file_flushedwrite(lfs_t* lfs, lfs_file_t* file, const void* buff
         file->offset += diff;
         data += diff;
         nsize -= diff;
+    }
+
+    file->readahead.next = file->pos;
+
+    return size;
+}
+
+lfs_ssize_t lfs_file_rawread(lfs_t* lfs, lfs_file_t* file, void* buffer, lfs_size_t size) {
+
+    LFS_ASSERT((file->flags & LFS_O_RDONLY) == LFS_O_RDONLY);
+
+    if (file->flags & LFS_F_WRITING) {
+
+        // flush out any writes
+        int err = lfs_file_flush(lfs, file);
+
+        if (err) {
+
+            return err;
+        }
+    }
+
+    return lfs_file_flushedread(lfs, file, buffer, size);
+}
+
+lfs_ssize_t lfs_file_rawreadv(lfs_t* lfs, lfs_file_t* file, const lfs_iovec_t* iov, lfs_size_t count) {
+
+    LFS_ASSERT((file->flags & LFS_O_RDONLY) == LFS_O_RDONLY);
+
+    if (file->flags & LFS_F_WRITING) {
+
+        // flush out any writes
+        int err = lfs_file_flush(lfs, file);
+
+        if (err) {
+
+            return err;
+        }
+    }
+
+    lfs_size_t size = 0;
+
+    for (lfs_size_t i = 0; i < count; i++) {
+
+        lfs_ssize_t res = lfs_file_flushedread(lfs, file, iov[i].buffer, iov[i].size);
+
+        if (res < 0) {
+
+            return res;
+        }
+
+        size += res;
+
+        if ((lfs_size_t)res < iov[i].size) {
+
+            // end of file
+            break;
+        }
+    }
+
+    return size;
+}
+
+lfs_ssize_t lfs_file_flushedwrite(lfs_t* lfs, lfs_file_t* file, const void* buffer, lfs_size_t size) {
+
+    lfs_iovec_t iov = { (void*)buffer, size };
+    return lfs_file_flushedwritev(lfs, file, &iov, 1);
+}
+
+lfs_ssize_t lfs_file_flushedwritev(lfs_t* lfs, lfs_file_t* file, const lfs_iovec_t* iov, lfs_size_t count) {
+
+    lfs_size_t size = 0;
+
+    for (lfs_size_t i = 0; i < count; i++) {
+
+        size += iov[i].size;
+    }
+
+    lfs_size_t nsize = size;
+
+    // buffer being written and how much of it is done
+    lfs_size_t index = 0;
+    lfs_size_t done = 0;
+
+    if ((file->flags & LFS_F_INLINE) &&
+
+        lfs_max(file->pos + nsize, file->ctz.size) >
+        lfs_min(0x3fe, lfs_min(
+            lfs->cfg->cache_size,
+            (lfs->cfg->metadata_max ?
+                lfs->cfg->metadata_max : lfs->block_size) / sizeof(lfs_block_t[2])))) {
+
+        // inline file doesn't fit anymore
+        int err = lfs_file_outline(lfs, file);
+        if (err) {
+
+            file->flags |= LFS_F_ERRED;
+            return err;
+        }
+    }
+
+    while (nsize > 0) {
+
+        // check if we need a new block, the end of a hole needs one too
+        if (!(file->flags & LFS_F_WRITING) ||
+
+            file->offset == lfs->block_size || file->block == LFS_BLOCK_NULL) {
+
+            if (file->flags & LFS_F_EXTENT) {
+
+                if (!(file->flags & LFS_F_WRITING)) {
+
+                    // find the incomplete block we're extending from
+                    file->block = LFS_BLOCK_NULL;
+
+                    if (file->pos % lfs->block_size != 0) {
+
+                        int err = lfs_extent_find(&file->extents,
+                            (file->pos - 1) / lfs->block_size, &file->block);
+
+                        if (err) {
+
+                            file->flags |= LFS_F_ERRED;
+                            return err;
+                        }
+                    }
+
+                    // keep every block up to and including that one
+                    int err = lfs_extent_copy(&file->wextents, &file->extents,
+                        (file->pos + lfs->block_size - 1) / lfs->block_size);
+
+                    if (err) {
+
+                        file->flags |= LFS_F_ERRED;
+                        return err;
+                    }
+
+                    // mark cache as dirty since we may have read data into it
+                    lfs_cache_zero(lfs, &file->cache);
+                }
+
+                // extend file with new blocks
+                lfs_alloc_ack(lfs);
+
+                int err = lfs_extent_extend(lfs, &file->cache, &lfs->read_cache, &file->wextents,
+                    &file->reserved, file->block, file->pos,
+                    &file->block, &file->offset);
+
+                if (err) {
+
+                    file->flags |= LFS_F_ERRED;
+                    return err;
+                }
+            }
+            else if (!(file->flags & LFS_F_INLINE)) {
+
+                if (!(file->flags & LFS_F_WRITING) && file->pos > 0) {
+
+                    // find out which block we're extending from
+                    lfs_off_t _offset = 0;
+
+                    int err = lfs_ctz_find(lfs, NULL, &file->cache, &file->index,
+                        file->ctz.head, file->ctz.size,
+                        file->pos - 1, &file->block, &_offset);
+
+                    if (err) {
+
+                        file->flags |= LFS_F_ERRED;
+                        return err;
+                    }
+
+                    // mark cache as dirty since we may have read data into it
+                    lfs_cache_zero(lfs, &file->cache);
+                }
+
+                // extend file with new blocks
+                lfs_alloc_ack(lfs);
+
+                int err = lfs_ctz_extend(lfs, &file->cache, &lfs->read_cache, &file->index,
+                    &file->reserved, file->block, file->pos,
+                    &file->block, &file->offset);
+
+                if (err) {
+
+                    file->flags |= LFS_F_ERRED;
+                    return err;
+                }
+            }
+            else {
+                file->block = LFS_BLOCK_INLINE;
+                file->offset = file->pos;
+            }
+
+            file->flags |= LFS_F_WRITING;
+        }
+
+        // program as much as we can in current block, gathering it from
+        // as many buffers as it takes
+        lfs_size_t diff = lfs_min(nsize, lfs->block_size - file->offset);
+
+        while (diff > 0) {
+
+            while (done == iov[index].size) {
+
+                index += 1;
+                done = 0;
+            }
+
+            const uint8_t* data = (const uint8_t*)iov[index].buffer + done;
+            lfs_size_t delta = lfs_min(diff, iov[index].size - done);
+
+            while (true) {
+
+                int err = lfs_bd_write(lfs, &file->cache, &lfs->read_cache, true,
+                    file->block, file->offset, data, delta);
+
+                if (err) {
+
+                    if (err == LFS_ERR_CORRUPT) {
+
+                        goto relocate;
+                    }
+
+                    file->flags |= LFS_F_ERRED;
+                    return err;
+                }
+
+                break;
+
+            relocate:
+                err = lfs_file_relocate(lfs, file);
+                if (err) {
+
+                    file->flags |= LFS_F_ERRED;
+                    return err;
+                }
+            }
+
+            file->pos += delta;
+            file->offset += delta;
+            done += delta;
+            diff -= delta;
+            nsize -= delta;
+        }
 
         lfs_alloc_ack(lfs);
     }
@@ -670,10 +1312,118 @@ lfs_ssize_t lfs_file_flushedwrite(lfs_t* lfs, lfs_file_t* file, const void* buff
     return size;
 }
 
+// Fill the file with zeros from its end up to size. An extent file leaves
+// whole blocks, and the rest of a block that already is one, as a hole that
+// takes no space and isn't written.
+static int lfs_file_fill(lfs_t* lfs, lfs_file_t* file, lfs_off_t size) {
+
+    static const uint8_t zeros[1024] = { 0 };
+
+    if (file->flags & LFS_F_READING) {
+
+        int err = lfs_file_flush(lfs, file);
+
+        if (err) {
+
+            return err;
+        }
+    }
+
+    while (file->pos < size) {
+
+        if ((file->flags & LFS_F_EXTENT) && !(file->flags & LFS_F_WRITING)) {
+
+            // see if the file ends in a hole or on a block boundary
+            lfs_block_t block = LFS_BLOCK_NULL;
+
+            if (file->pos % lfs->block_size != 0) {
+
+                int err = lfs_extent_find(&file->extents,
+                    (file->pos - 1) / lfs->block_size, &block);
+
+                if (err) {
+
+                    file->flags |= LFS_F_ERRED;
+                    return err;
+                }
+            }
+
+            if (block == LFS_BLOCK_NULL) {
+
+                // go on writing from there without touching a block
+                int err = lfs_extent_copy(&file->wextents, &file->extents,
+                    (file->pos + lfs->block_size - 1) / lfs->block_size);
+
+                if (err) {
+
+                    file->flags |= LFS_F_ERRED;
+                    return err;
+                }
+
+                lfs_cache_zero(lfs, &file->cache);
+
+                file->block = LFS_BLOCK_NULL;
+                file->offset = (file->pos + lfs->block_size - 1) % lfs->block_size + 1;
+                file->flags |= LFS_F_WRITING;
+            }
+        }
+
+        if ((file->flags & LFS_F_EXTENT) && (file->flags & LFS_F_WRITING) &&
+            (file->offset == lfs->block_size || file->block == LFS_BLOCK_NULL)) {
+
+            lfs_off_t start = lfs_alignup(file->pos, lfs->block_size);
+
+            if (size > start) {
+
+                int err = lfs_extent_hole(&file->wextents,
+                    (size - start + lfs->block_size - 1) / lfs->block_size);
+
+                if (err) {
+
+                    file->flags |= LFS_F_ERRED;
+                    return err;
+                }
+            }
+
+            file->block = LFS_BLOCK_NULL;
+            file->offset = (size - 1) % lfs->block_size + 1;
+            file->pos = size;
+            break;
+        }
+
+        // zeros up to the end of the block, an extent file goes on with a
+        // hole from there
+        lfs_size_t diff = lfs_min(lfs_min(size - file->pos, sizeof(zeros)),
+            lfs->block_size - file->pos % lfs->block_size);
+
+        lfs_ssize_t res = lfs_file_flushedwrite(lfs, file, zeros, diff);
+
+        if (res < 0) {
+
+            return (int)res;
+        }
+    }
+
+    return LFS_ERR_OK;
+}
+
 lfs_ssize_t lfs_file_rawwrite(lfs_t* lfs, lfs_file_t* file, const void* buffer, lfs_size_t size) {
 
+    lfs_iovec_t iov = { (void*)buffer, size };
+    return lfs_file_rawwritev(lfs, file, &iov, 1);
+}
+
+lfs_ssize_t lfs_file_rawwritev(lfs_t* lfs, lfs_file_t* file, const lfs_iovec_t* iov, lfs_size_t count) {
+
     LFS_ASSERT((file->flags & LFS_O_WRONLY) == LFS_O_WRONLY);
 
+    lfs_size_t size = 0;
+
+    for (lfs_size_t i = 0; i < count; i++) {
+
+        size += iov[i].size;
+    }
+
     if (file->flags & LFS_F_READING) {
         // drop any reads
         int err = lfs_file_flush(lfs, file);
@@ -700,19 +1450,15 @@ lfs_ssize_t lfs_file_rawwrite(lfs_t* lfs, lfs_file_t* file, const void* buffer,
         lfs_off_t pos = file->pos;
         file->pos = file->ctz.size;
 
-        while (file->pos < pos) {
+        int err = lfs_file_fill(lfs, file, pos);
 
-            uint8_t _buffer = 0;
-            lfs_ssize_t res = lfs_file_flushedwrite(lfs, file, &_buffer, 1);
-
-            if (res < 0) {
+        if (err) {
 
-                return res;
-            }
+            return err;
         }
     }
 
-    lfs_ssize_t nsize = lfs_file_flushedwrite(lfs, file, buffer, size);
+    lfs_ssize_t nsize = lfs_file_flushedwritev(lfs, file, iov, count);
 
     if (nsize < 0) {
 
@@ -770,11 +1516,29 @@ lfs_soff_t lfs_file_rawseek(lfs_t* lfs, lfs_file_t* file, lfs_soff_t offset, int
     if (!(file->flags & LFS_F_WRITING)) {
 
         lfs_off_t _noff = file->pos;
-        int oindex = lfs_ctz_index(lfs, &_noff);
+        lfs_off_t oindex;
         lfs_off_t noff = npos;
-        int nindex = lfs_ctz_index(lfs, &noff);
+        lfs_off_t nindex;
+
+        if (file->flags & LFS_F_EXTENT) {
+
+            oindex = file->pos / lfs->block_size;
+            nindex = npos / lfs->block_size;
+            noff = npos % lfs->block_size;
+        }
+        else {
+
+            oindex = lfs_ctz_index(lfs, &_noff);
+            nindex = lfs_ctz_index(lfs, &noff);
+        }
 
-        if (oindex == nindex
+        // the cache has to hold the block being read, which is behind the
+        // position once the block has been read to its end, or isn't
+        // there at all when the read went around the cache
+        if ((file->flags & LFS_F_READING)
+            && file->offset < lfs->block_size
+            && file->cache.block == file->block
+            && oindex == nindex
             && noff >= file->cache.offset
             && noff < file->cache.offset + file->cache.size) {
 
@@ -808,11 +1572,14 @@ lfs_soff_t lfs_file_rawtruncate(lfs_t* lfs, lfs_file_t* file, lfs_off_t size) {
     lfs_off_t pos = file->pos;
     lfs_off_t oldsize = lfs_file_rawsize(lfs, file);
 
+    // the size the blocks were set aside for is gone
+    lfs_alloc_unreserve(lfs, &file->reserved);
+
     if (size < oldsize) {
 
         if (size <= lfs_min(0x3fe, 
             lfs_min(lfs->cfg->cache_size,
-                        (lfs->cfg->metadata_max ? lfs->cfg->metadata_max : lfs->cfg->block_size) / 8))) {
+                        (lfs->cfg->metadata_max ? lfs->cfg->metadata_max : lfs->cfg->block_size) / sizeof(lfs_block_t[2])))) {
 
             // flush+seek to head
             lfs_soff_t res = lfs_file_rawseek(lfs, file, 0, LFS_SEEK_SET);
@@ -834,6 +1601,9 @@ lfs_soff_t lfs_file_rawtruncate(lfs_t* lfs, lfs_file_t* file, lfs_off_t size) {
             file->ctz.head = LFS_BLOCK_INLINE;
             file->ctz.size = size;
             file->flags |= LFS_F_DIRTY | LFS_F_READING | LFS_F_INLINE;
+            file->flags &= ~LFS_F_EXTENT;
+            file->extents.count = 0;
+            lfs_index_cache_release(lfs, &file->index);
             file->cache.block = file->ctz.head;
             file->cache.offset = 0;
             file->cache.size = lfs->cfg->cache_size;
@@ -850,21 +1620,41 @@ lfs_soff_t lfs_file_rawtruncate(lfs_t* lfs, lfs_file_t* file, lfs_off_t size) {
                 return err;
             }
 
-            // lookup new head in ctz skip list
-            lfs_off_t _offset = 0;
-            err = lfs_ctz_find(lfs, NULL, &file->cache,
-                file->ctz.head, file->ctz.size,
-                size - 1, &file->block, &_offset);
+            if (file->flags & LFS_F_EXTENT) {
 
-            if (err) {
+                // drop whole blocks past the new end
+                lfs_extent_truncate(&file->extents, (size + lfs->block_size - 1) / lfs->block_size);
 
-                return err;
+                err = lfs_extent_find(&file->extents, (size - 1) / lfs->block_size, &file->block);
+
+                if (err) {
+
+                    return err;
+                }
+            }
+            else {
+
+                // lookup new head in ctz skip list
+                lfs_off_t _offset = 0;
+                err = lfs_ctz_find(lfs, NULL, &file->cache, &file->index,
+                    file->ctz.head, file->ctz.size,
+                    size - 1, &file->block, &_offset);
+
+                if (err) {
+
+                    return err;
+                }
+
+                // blocks past the new end are no longer part of the file
+                _offset = size - 1;
+                lfs_index_cache_drop(lfs, &file->index, lfs_ctz_index(lfs, &_offset) + 1);
+
+                file->ctz.head = file->block;
             }
 
             // need to set pos/block/off consistently so seeking back to
             // the old position does not get confused
             file->pos = size;
-            file->ctz.head = file->block;
             file->ctz.size = size;
             file->flags |= LFS_F_DIRTY | LFS_F_READING;
         }
@@ -880,16 +1670,14 @@ lfs_soff_t lfs_file_rawtruncate(lfs_t* lfs, lfs_file_t* file, lfs_off_t size) {
         }
 
         // fill with zeros
-        while (file->pos < size) {
-
-            uint8_t _buffer = 0;
-            res = lfs_file_rawwrite(lfs, file, &_buffer, 1);
+        int err = lfs_file_fill(lfs, file, size);
 
-            if (res < 0) {
+        if (err) {
 
-                return res;
-            }
+            return err;
         }
+
+        file->flags &= ~LFS_F_ERRED;
     }
 
     // restore pos
@@ -903,6 +1691,42 @@ lfs_soff_t lfs_file_rawtruncate(lfs_t* lfs, lfs_file_t* file, lfs_off_t size) {
     return LFS_ERR_OK;
 }
 
+int lfs_file_rawfallocate(lfs_t* lfs, lfs_file_t* file, lfs_off_t offset, lfs_off_t size) {
+
+    LFS_ASSERT((file->flags & LFS_O_WRONLY) == LFS_O_WRONLY);
+
+    if (size == 0) {
+
+        return LFS_ERR_INVAL;
+    }
+
+    if (offset + size > lfs->file_max_size) {
+
+        return LFS_ERR_FBIG;
+    }
+
+    // blocks the range spans, an inline file takes on the layout in use
+    // once it grows out of its entry
+    lfs_off_t first = offset;
+    lfs_off_t last = offset + size - 1;
+    lfs_size_t count;
+
+    if ((file->flags & LFS_F_EXTENT) ||
+        ((file->flags & LFS_F_INLINE) && lfs->cfg->file_layout == LFS_LAYOUT_EXTENT)) {
+
+        count = last / lfs->block_size - first / lfs->block_size + 1;
+    }
+    else {
+
+        count = lfs_ctz_index(lfs, &last) - lfs_ctz_index(lfs, &first) + 1;
+    }
+
+    // a file has one run, what is left of an earlier one goes back first
+    lfs_alloc_unreserve(lfs, &file->reserved);
+
+    return lfs_alloc_range(lfs, count, &file->reserved);
+}
+
 lfs_soff_t lfs_file_rawtell(lfs_t* lfs, lfs_file_t* file) {
     (void)lfs;
     return file->pos;
@@ -0,0 +1,627 @@
+#include "lfs.h"
+
+/// File extent list operations ///
+
+// On disk an extent struct starts with the same {head, size} pair as a ctz
+// struct. The head is LFS_BLOCK_NULL when the extents follow inline, or the
+// first block of a chain of extent tables. Each table block holds a
+// {next, count} header followed by count extents. An extent starting at
+// LFS_BLOCK_NULL is a hole, its blocks were never written and read as zeros.
+
+static lfs_size_t lfs_extent_inline_max(lfs_t* lfs) {
+
+    // same metadata budget inline files get
+    lfs_size_t size = lfs_min(0x3fe,
+        (lfs->cfg->metadata_max ? lfs->cfg->metadata_max : lfs->block_size) / 8);
+
+    if (size < sizeof(lfs_ctz_t)) {
+
+        return 0;
+    }
+
+    return (size - sizeof(lfs_ctz_t)) / sizeof(lfs_extent_t);
+}
+
+static lfs_size_t lfs_extent_table_max(lfs_t* lfs) {
+
+    return (lfs->block_size - 2 * sizeof(uint64_t)) / sizeof(lfs_extent_t);
+}
+
+static int lfs_extent_reserve(lfs_extent_list_t* list, lfs_size_t count) {
+
+    if (count <= list->capacity) {
+
+        return LFS_ERR_OK;
+    }
+
+    lfs_size_t capacity = lfs_max(lfs_max(count, 2 * list->capacity), 4);
+    lfs_extent_t* extents = (lfs_extent_t*)realloc(list->extents, capacity * sizeof(lfs_extent_t));
+
+    if (!extents) {
+
+        return LFS_ERR_NOMEM;
+    }
+
+    list->extents = extents;
+    list->capacity = capacity;
+    return LFS_ERR_OK;
+}
+
+void lfs_extent_release(lfs_extent_list_t* list) {
+
+    free(list->extents);
+
+    list->extents = NULL;
+    list->count = 0;
+    list->capacity = 0;
+    list->hint = 0;
+    list->hint_index = 0;
+}
+
+// Add count blocks from start to the end of the list, a start of
+// LFS_BLOCK_NULL adds a hole
+static int lfs_extent_push(lfs_extent_list_t* list, lfs_block_t start, lfs_size_t count) {
+
+    // grow the last extent if the blocks are contiguous, or both are holes
+    if (list->count > 0) {
+
+        lfs_extent_t* last = &list->extents[list->count - 1];
+
+        if (start == LFS_BLOCK_NULL ?
+            last->start == LFS_BLOCK_NULL :
+            last->start != LFS_BLOCK_NULL && last->start + last->count == start) {
+
+            last->count += count;
+            return LFS_ERR_OK;
+        }
+    }
+
+    int err = lfs_extent_reserve(list, list->count + 1);
+
+    if (err) {
+
+        return err;
+    }
+
+    list->extents[list->count].start = start;
+    list->extents[list->count].count = count;
+    list->count += 1;
+    return LFS_ERR_OK;
+}
+
+int lfs_extent_append(lfs_extent_list_t* list, lfs_block_t block) {
+
+    return lfs_extent_push(list, block, 1);
+}
+
+int lfs_extent_hole(lfs_extent_list_t* list, lfs_size_t count) {
+
+    // blocks of a sparse file that were never written take no space, they
+    // read as zeros
+    return lfs_extent_push(list, LFS_BLOCK_NULL, count);
+}
+
+int lfs_extent_splice(lfs_extent_list_t* dst, const lfs_extent_list_t* src, lfs_size_t index) {
+
+    // add every block of src from index on
+    for (lfs_size_t i = 0; i < src->count; i++) {
+
+        lfs_extent_t extent = src->extents[i];
+
+        if (index >= extent.count) {
+
+            index -= extent.count;
+            continue;
+        }
+
+        if (extent.start != LFS_BLOCK_NULL) {
+
+            extent.start += index;
+        }
+
+        int err = lfs_extent_push(dst, extent.start, extent.count - index);
+
+        if (err) {
+
+            return err;
+        }
+
+        index = 0;
+    }
+
+    return LFS_ERR_OK;
+}
+
+void lfs_extent_pop(lfs_extent_list_t* list) {
+
+    LFS_ASSERT(list->count > 0);
+
+    // drop the last block
+    list->extents[list->count - 1].count -= 1;
+
+    if (list->extents[list->count - 1].count == 0) {
+
+        list->count -= 1;
+    }
+}
+
+void lfs_extent_truncate(lfs_extent_list_t* list, lfs_size_t blocks) {
+
+    // keep only the first blocks of the file
+    lfs_size_t i = 0;
+
+    while (i < list->count && blocks > 0) {
+
+        lfs_size_t diff = lfs_min(blocks, list->extents[i].count);
+
+        list->extents[i].count = diff;
+        blocks -= diff;
+        i += 1;
+    }
+
+    list->count = i;
+}
+
+int lfs_extent_copy(lfs_extent_list_t* dst, const lfs_extent_list_t* src, lfs_size_t blocks) {
+
+    int err = lfs_extent_reserve(dst, src->count);
+
+    if (err) {
+
+        return err;
+    }
+
+    if (src->count > 0) {
+
+        memcpy(dst->extents, src->extents, src->count * sizeof(lfs_extent_t));
+    }
+
+    dst->count = src->count;
+    dst->hint = 0;
+    dst->hint_index = 0;
+
+    lfs_extent_truncate(dst, blocks);
+    return LFS_ERR_OK;
+}
+
+int lfs_extent_find(lfs_extent_list_t* list, lfs_off_t index, lfs_block_t* block) {
+
+    // most lookups are sequential, start from the extent of the last lookup
+    lfs_size_t i = list->hint;
+    lfs_off_t base = list->hint_index;
+
+    if (i >= list->count || index < base) {
+
+        i = 0;
+        base = 0;
+    }
+
+    while (i < list->count) {
+
+        if (index < base + list->extents[i].count) {
+
+            list->hint = i;
+            list->hint_index = base;
+
+            // holes stay LFS_BLOCK_NULL
+            *block = list->extents[i].start == LFS_BLOCK_NULL ?
+                LFS_BLOCK_NULL : list->extents[i].start + (index - base);
+            return LFS_ERR_OK;
+        }
+
+        base += list->extents[i].count;
+        i += 1;
+    }
+
+    return LFS_ERR_CORRUPT;
+}
+
+int lfs_extent_extend(lfs_t* lfs,
+    lfs_cache_t* write_cache, lfs_cache_t* read_cache, lfs_extent_list_t* list,
+    lfs_extent_t* reserved, lfs_block_t head, lfs_size_t size,
+    lfs_block_t* block, lfs_off_t* offset) {
+
+    while (true) {
+
+        // go ahead and grab a block, the allocator hands out blocks in
+        // order so this usually grows the last extent, a reserved run
+        // always does
+        lfs_block_t nblock;
+        int err = lfs_alloc_take(lfs, reserved, &nblock);
+
+        if (err) {
+
+            return err;
+        }
+
+        {
+            err = lfs_bd_erase(lfs, nblock);
+
+            if (err) {
+
+                if (err == LFS_ERR_CORRUPT) {
+
+                    goto relocate;
+                }
+
+                return err;
+            }
+
+            lfs_off_t noff = size % lfs->block_size;
+
+            // just copy out the last block if it is incomplete, the copy
+            // replaces it, from a hole that copies zeros
+            if (noff != 0) {
+
+                err = lfs_bd_copy(lfs,
+                    write_cache, read_cache, true,
+                    nblock, 0, NULL, head, 0, noff);
+
+                if (err) {
+
+                    if (err == LFS_ERR_CORRUPT) {
+
+                        goto relocate;
+                    }
+
+                    return err;
+                }
+
+                lfs_extent_pop(list);
+            }
+
+            err = lfs_extent_append(list, nblock);
+
+            if (err) {
+
+                return err;
+            }
+
+            *block = nblock;
+            *offset = noff;
+            return LFS_ERR_OK;
+        }
+
+    relocate:
+        LFS_DEBUG("Bad block at 0x%"PRIx64, nblock);
+
+        // just clear cache and try a new block
+        lfs_cache_drop(lfs, write_cache);
+    }
+}
+
+int lfs_extent_traverse(lfs_t* lfs, const lfs_extent_list_t* list,
+    int (*cb)(void*, lfs_block_t), void* data) {
+
+    (void)lfs;
+
+    for (lfs_size_t i = 0; i < list->count; i++) {
+
+        // holes have no blocks
+        if (list->extents[i].start == LFS_BLOCK_NULL) {
+
+            continue;
+        }
+
+        for (lfs_size_t j = 0; j < list->extents[i].count; j++) {
+
+            int err = cb(data, list->extents[i].start + j);
+
+            if (err) {
+
+                return err;
+            }
+        }
+    }
+
+    return LFS_ERR_OK;
+}
+
+// walk the committed extents of an entry, cb gets every table block with a
+// NULL extent and every extent with LFS_BLOCK_NULL as table
+static int lfs_extent_walk(lfs_t* lfs, const lfs_metadata_dir_t* dir, uint16_t id,
+    int (*cb)(void* data, lfs_block_t table, const lfs_extent_t* extent), void* data) {
+
+    uint8_t buffer[0x3fe];
+    lfs_stag_t tag = lfs_dir_get(lfs, dir,
+        LFS_MKTAG(LFS_TYPE_GLOBALS, 0x3ff, 0),
+        LFS_MKTAG(LFS_TYPE_STRUCT, id, sizeof(buffer)), buffer);
+
+    if (tag < 0) {
+
+        return tag;
+    }
+
+    if (lfs_tag_size(tag) < sizeof(lfs_ctz_t)) {
+
+        return LFS_ERR_CORRUPT;
+    }
+
+    lfs_ctz_t head;
+    memcpy(&head, buffer, sizeof(head));
+    lfs_ctz_fromle64(&head);
+
+    if (head.head == LFS_BLOCK_NULL) {
+
+        // extents follow inline
+        lfs_size_t count = (lfs_tag_size(tag) - sizeof(head)) / sizeof(lfs_extent_t);
+
+        for (lfs_size_t i = 0; i < count; i++) {
+
+            lfs_extent_t extent;
+            memcpy(&extent, &buffer[sizeof(head) + i * sizeof(extent)], sizeof(extent));
+            extent.start = lfs_fromle64(extent.start);
+            extent.count = lfs_fromle64(extent.count);
+
+            int err = cb(data, LFS_BLOCK_NULL, &extent);
+
+            if (err) {
+
+                return err;
+            }
+        }
+
+        return LFS_ERR_OK;
+    }
+
+    lfs_block_t table = head.head;
+    lfs_block_t cycle = 0;
+
+    while (table != LFS_BLOCK_NULL) {
+
+        if (cycle >= lfs->block_count) {
+
+            // loop detected
+            return LFS_ERR_CORRUPT;
+        }
+
+        cycle += 1;
+
+        int err = cb(data, table, NULL);
+
+        if (err) {
+
+            return err;
+        }
+
+        uint64_t header[2];
+        err = lfs_bd_read(lfs,
+            NULL, &lfs->read_cache, lfs->block_size,
+            table, 0, &header, sizeof(header));
+
+        if (err) {
+
+            return err;
+        }
+
+        lfs_block_t next = lfs_fromle64(header[0]);
+        lfs_size_t count = lfs_fromle64(header[1]);
+
+        if (count > lfs_extent_table_max(lfs)) {
+
+            return LFS_ERR_CORRUPT;
+        }
+
+        for (lfs_size_t i = 0; i < count; i++) {
+
+            lfs_extent_t extent;
+            err = lfs_bd_read(lfs,
+                NULL, &lfs->read_cache, (count - i) * sizeof(extent),
+                table, sizeof(header) + i * sizeof(extent), &extent, sizeof(extent));
+
+            if (err) {
+
+                return err;
+            }
+
+            extent.start = lfs_fromle64(extent.start);
+            extent.count = lfs_fromle64(extent.count);
+
+            err = cb(data, LFS_BLOCK_NULL, &extent);
+
+            if (err) {
+
+                return err;
+            }
+        }
+
+        table = next;
+    }
+
+    return LFS_ERR_OK;
+}
+
+static int lfs_extent_fetch_cb(void* data, lfs_block_t table, const lfs_extent_t* extent) {
+
+    (void)table;
+    lfs_extent_list_t* list = (lfs_extent_list_t*)data;
+
+    if (!extent) {
+
+        return LFS_ERR_OK;
+    }
+
+    int err = lfs_extent_reserve(list, list->count + 1);
+
+    if (err) {
+
+        return err;
+    }
+
+    list->extents[list->count] = *extent;
+    list->count += 1;
+    return LFS_ERR_OK;
+}
+
+int lfs_extent_fetch(lfs_t* lfs, const lfs_metadata_dir_t* dir, uint16_t id, lfs_extent_list_t* list) {
+
+    list->count = 0;
+    list->hint = 0;
+    list->hint_index = 0;
+
+    return lfs_extent_walk(lfs, dir, id, lfs_extent_fetch_cb, list);
+}
+
+struct lfs_extent_traverse_t {
+
+    int (*cb)(void*, lfs_block_t);
+    void* data;
+};
+
+static int lfs_extent_disk_traverse_cb(void* data, lfs_block_t table, const lfs_extent_t* extent) {
+
+    lfs_extent_traverse_t* traverse = (lfs_extent_traverse_t*)data;
+
+    if (!extent) {
+
+        return traverse->cb(traverse->data, table);
+    }
+
+    // holes have no blocks
+    if (extent->start == LFS_BLOCK_NULL) {
+
+        return LFS_ERR_OK;
+    }
+
+    for (lfs_size_t j = 0; j < extent->count; j++) {
+
+        int err = traverse->cb(traverse->data, extent->start + j);
+
+        if (err) {
+
+            return err;
+        }
+    }
+
+    return LFS_ERR_OK;
+}
+
+int lfs_extent_disk_traverse(lfs_t* lfs, const lfs_metadata_dir_t* dir, uint16_t id,
+    int (*cb)(void*, lfs_block_t), void* data) {
+
+    lfs_extent_traverse_t traverse = { cb, data };
+    return lfs_extent_walk(lfs, dir, id, lfs_extent_disk_traverse_cb, &traverse);
+}
+
+int lfs_extent_store(lfs_t* lfs, const lfs_extent_list_t* list, lfs_size_t size,
+    void* buffer, lfs_size_t* bsize) {
+
+    uint8_t* data = (uint8_t*)buffer;
+    lfs_ctz_t head = { LFS_BLOCK_NULL, size };
+
+    if (list->count <= lfs_extent_inline_max(lfs)) {
+
+        // fits in the directory entry
+        for (lfs_size_t i = 0; i < list->count; i++) {
+
+            lfs_extent_t extent;
+            extent.start = lfs_tole64(list->extents[i].start);
+            extent.count = lfs_tole64(list->extents[i].count);
+            memcpy(&data[sizeof(head) + i * sizeof(extent)], &extent, sizeof(extent));
+        }
+
+        lfs_ctz_tole64(&head);
+        memcpy(data, &head, sizeof(head));
+
+        *bsize = sizeof(head) + list->count * sizeof(lfs_extent_t);
+        return LFS_ERR_OK;
+    }
+
+    // write out tables back to front so each one knows its successor
+    lfs_size_t max = lfs_extent_table_max(lfs);
+    lfs_size_t tables = (list->count + max - 1) / max;
+
+    for (lfs_size_t t = tables; t-- > 0;) {
+
+        lfs_size_t first = t * max;
+        lfs_size_t count = lfs_min(max, list->count - first);
+
+        while (true) {
+
+            lfs_block_t nblock;
+            int err = lfs_alloc(lfs, &nblock);
+
+            if (err) {
+
+                return err;
+            }
+
+            {
+                err = lfs_bd_erase(lfs, nblock);
+
+                if (err) {
+
+                    if (err == LFS_ERR_CORRUPT) {
+
+                        goto relocate;
+                    }
+
+                    return err;
+                }
+
+                uint64_t header[2] = { lfs_tole64(head.head), lfs_tole64(count) };
+                err = lfs_bd_write(lfs,
+                    &lfs->write_cache, &lfs->read_cache, true,
+                    nblock, 0, &header, sizeof(header));
+
+                if (err) {
+
+                    if (err == LFS_ERR_CORRUPT) {
+
+                        goto relocate;
+                    }
+
+                    return err;
+                }
+
+                for (lfs_size_t i = 0; i < count; i++) {
+
+                    lfs_extent_t extent;
+                    extent.start = lfs_tole64(list->extents[first + i].start);
+                    extent.count = lfs_tole64(list->extents[first + i].count);
+
+                    err = lfs_bd_write(lfs,
+                        &lfs->write_cache, &lfs->read_cache, true,
+                        nblock, sizeof(header) + i * sizeof(extent), &extent, sizeof(extent));
+
+                    if (err) {
+
+                        if (err == LFS_ERR_CORRUPT) {
+
+                            goto relocate;
+                        }
+
+                        return err;
+                    }
+                }
+
+                err = lfs_bd_flush(lfs, &lfs->write_cache, &lfs->read_cache, true);
+
+                if (err) {
+
+                    if (err == LFS_ERR_CORRUPT) {
+
+                        goto relocate;
+                    }
+
+                    return err;
+                }
+
+                head.head = nblock;
+                break;
+            }
+
+        relocate:
+            LFS_DEBUG("Bad block at 0x%"PRIx64, nblock);
+
+            // just clear cache and try a new block
+            lfs_cache_drop(lfs, &lfs->write_cache);
+        }
+    }
+
+    lfs_ctz_tole64(&head);
+    memcpy(data, &head, sizeof(head));
+
+    *bsize = sizeof(head);
+    return LFS_ERR_OK;
+}
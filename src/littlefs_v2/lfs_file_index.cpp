@@ -16,8 +16,140 @@ int lfs_ctz_index(lfs_t* lfs, lfs_off_t* offset) {
     return i;
 }
 
+/// File index cache operations ///
+void lfs_index_cache_drop(lfs_t* lfs, lfs_index_cache_t* index, lfs_off_t from) {
+
+    (void)lfs;
+
+    // forget every cached block at or above the given ctz index
+    lfs_off_t mask = ((lfs_off_t)1 << index->shift) - 1;
+
+    for (lfs_off_t i = (from + mask) >> index->shift; i < index->count; i++) {
+
+        index->blocks[i] = LFS_BLOCK_NULL;
+    }
+}
+
+void lfs_index_cache_release(lfs_t* lfs, lfs_index_cache_t* index) {
+
+    if (index->blocks) {
+
+        lfs->index_cache_used -= index->count * sizeof(lfs_block_t);
+        free(index->blocks);
+    }
+
+    index->blocks = NULL;
+    index->count = 0;
+    index->shift = 0;
+}
+
+static bool lfs_index_cache_reserve(lfs_t* lfs, lfs_index_cache_t* index, lfs_off_t last) {
+
+    // the budget and the other files' tables belong to the exclusive lock
+    // holder, readers under the shared lock only use the table they have
+    if (lfs_reader_current(lfs)) {
+
+        return index->blocks && (last >> index->shift) < index->count;
+    }
+
+    index->tick = ++lfs->index_cache_tick;
+
+    if (index->blocks && (last >> index->shift) < index->count) {
+
+        return true;
+    }
+
+    lfs_size_t limit = lfs->cfg->index_cache_size / sizeof(lfs_block_t);
+
+    if (limit == 0) {
+
+        return false;
+    }
+
+    // widen the stride until the table fits the budget, leave room to grow
+    uint8_t shift = index->shift;
+
+    while ((last >> shift) + 1 > limit) {
+
+        shift += 1;
+    }
+
+    lfs_size_t count = lfs_min(2 * ((last >> shift) + 1), limit);
+
+    // evict the least recently used tables of other files until we fit
+    while (lfs->index_cache_used - index->count * sizeof(lfs_block_t) +
+        count * sizeof(lfs_block_t) > lfs->cfg->index_cache_size) {
+
+        lfs_index_cache_t* lru = NULL;
+
+        for (lfs_metadata_list_t* p = lfs->metadata_list; p; p = p->next) {
+
+            if (p->type != LFS_TYPE_REG) {
+                continue;
+            }
+
+            lfs_index_cache_t* other = &((lfs_file_t*)p)->index;
+
+            if (other != index && other->blocks &&
+                (!lru || (int32_t)(other->tick - lru->tick) < 0)) {
+
+                lru = other;
+            }
+        }
+
+        if (!lru) {
+            break;
+        }
+
+        lfs_index_cache_release(lfs, lru);
+    }
+
+    lfs_block_t* blocks = (lfs_block_t*)malloc(count * sizeof(lfs_block_t));
+
+    if (!blocks) {
+
+        return false;
+    }
+
+    for (lfs_size_t i = 0; i < count; i++) {
+
+        blocks[i] = LFS_BLOCK_NULL;
+    }
+
+    // carry over what we already know
+    lfs_off_t mask = ((lfs_off_t)1 << shift) - 1;
+
+    for (lfs_size_t i = 0; i < index->count; i++) {
+
+        lfs_off_t idx = (lfs_off_t)i << index->shift;
+
+        if ((idx & mask) == 0 && (idx >> shift) < count) {
+
+            blocks[idx >> shift] = index->blocks[i];
+        }
+    }
+
+    lfs_index_cache_release(lfs, index);
+
+    index->blocks = blocks;
+    index->count = count;
+    index->shift = shift;
+    lfs->index_cache_used += count * sizeof(lfs_block_t);
+    return true;
+}
+
+static void lfs_index_cache_insert(lfs_index_cache_t* index, lfs_off_t idx, lfs_block_t block) {
+
+    lfs_off_t mask = ((lfs_off_t)1 << index->shift) - 1;
+
+    if ((idx & mask) == 0 && (idx >> index->shift) < index->count) {
+
+        index->blocks[idx >> index->shift] = block;
+    }
+}
+
 int lfs_ctz_find(lfs_t* lfs,
-    const lfs_cache_t* write_cache, lfs_cache_t* read_cache,
+    const lfs_cache_t* write_cache, lfs_cache_t* read_cache, lfs_index_cache_t* index,
     lfs_block_t head, lfs_size_t size,
     lfs_size_t pos, lfs_block_t* block, lfs_off_t* offset) {
 
@@ -32,6 +164,41 @@ int lfs_ctz_find(lfs_t* lfs,
     lfs_off_t current = lfs_ctz_index(lfs, &noff);
     lfs_off_t target = lfs_ctz_index(lfs, &pos);
 
+    if (index && lfs_index_cache_reserve(lfs, index, current)) {
+
+        lfs_index_cache_insert(index, current, head);
+
+        // start from the closest known block at or above the target, the
+        // scan is bounded, we are better off walking from the head than
+        // searching a mostly empty table
+        lfs_off_t mask = ((lfs_off_t)1 << index->shift) - 1;
+        lfs_off_t i = (target + mask) >> index->shift;
+        lfs_off_t end = lfs_min((current >> index->shift) + 1, i + 64);
+
+        for (; i < end; i++) {
+
+            if (index->blocks[i] != LFS_BLOCK_NULL) {
+
+                current = i << index->shift;
+                head = index->blocks[i];
+                break;
+            }
+        }
+
+        if (i < end) {
+
+            index->hits += 1;
+        }
+        else {
+
+            index->misses += 1;
+        }
+    }
+    else {
+
+        index = NULL;
+    }
+
     while (current > target) {
 
         lfs_size_t skip = lfs_min(lfs_npw2_64(current - target + 1) - 1, lfs_ctz64(current));
@@ -48,6 +215,11 @@ int lfs_ctz_find(lfs_t* lfs,
         }
 
         current -= (uint64_t)1 << skip;
+
+        if (index) {
+
+            lfs_index_cache_insert(index, current, head);
+        }
     }
 
     *block = head;
@@ -56,15 +228,15 @@ int lfs_ctz_find(lfs_t* lfs,
 }
 
 int lfs_ctz_extend(lfs_t* lfs,
-    lfs_cache_t* write_cache, lfs_cache_t* read_cache,
-    lfs_block_t head, lfs_size_t size,
+    lfs_cache_t* write_cache, lfs_cache_t* read_cache, lfs_index_cache_t* index,
+    lfs_extent_t* reserved, lfs_block_t head, lfs_size_t size,
     lfs_block_t* block, lfs_off_t* offset) {
 
     while (true) {
 
         // go ahead and grab a block
         lfs_block_t nblock;
-        int err = lfs_alloc(lfs, &nblock);
+        int err = lfs_alloc_take(lfs, reserved, &nblock);
 
         if (err) {
 
@@ -86,43 +258,42 @@ int lfs_ctz_extend(lfs_t* lfs,
 
             if (size == 0) {
 
+                if (index) {
+
+                    lfs_index_cache_drop(lfs, index, 0);
+                    lfs_index_cache_insert(index, 0, nblock);
+                }
+
                 *block = nblock;
                 *offset = 0;
                 return LFS_ERR_OK;
             }
 
             lfs_size_t noff = size - 1;
-            lfs_off_t index = lfs_ctz_index(lfs, &noff);
+            lfs_off_t current = lfs_ctz_index(lfs, &noff);
             noff = noff + 1;
 
             // just copy out the last block if it is incomplete
             if (noff != lfs->block_size) {
 
-                for (lfs_off_t idx = 0; idx < noff; idx++) {
+                err = lfs_bd_copy(lfs,
+                    write_cache, read_cache, true,
+                    nblock, 0, NULL, head, 0, noff);
 
-                    uint8_t data;
-                    err = lfs_bd_read(lfs,
-                        NULL, read_cache, noff - idx,
-                        head, idx, &data, 1);
+                if (err) {
 
-                    if (err) {
+                    if (err == LFS_ERR_CORRUPT) {
 
-                        return err;
+                        goto relocate;
                     }
 
-                    err = lfs_bd_write(lfs,
-                        write_cache, read_cache, true,
-                        nblock, idx, &data, 1);
-
-                    if (err) {
-
-                        if (err == LFS_ERR_CORRUPT) {
+                    return err;
+                }
 
-                            goto relocate;
-                        }
+                if (index) {
 
-                        return err;
-                    }
+                    lfs_index_cache_drop(lfs, index, current);
+                    lfs_index_cache_insert(index, current, nblock);
                 }
 
                 *block = nblock;
@@ -131,8 +302,8 @@ int lfs_ctz_extend(lfs_t* lfs,
             }
 
             // append block
-            index += 1;
-            lfs_size_t skips = lfs_ctz64(index) + 1;
+            current += 1;
+            lfs_size_t skips = lfs_ctz64(current) + 1;
             lfs_block_t nhead = head;
 
             for (lfs_off_t idx = 0; idx < skips; idx++) {
@@ -164,9 +335,20 @@ int lfs_ctz_extend(lfs_t* lfs,
                     if (err) {
                         return err;
                     }
+
+                    if (index) {
+
+                        lfs_index_cache_insert(index, current - ((lfs_off_t)2 << idx), nhead);
+                    }
                 }
             }
 
+            if (index) {
+
+                lfs_index_cache_drop(lfs, index, current);
+                lfs_index_cache_insert(index, current, nblock);
+            }
+
             *block = nblock;
             *offset = sizeof(uint64_t) * skips;
             return LFS_ERR_OK;
@@ -83,12 +83,111 @@ static int lfs_init(lfs_t* lfs, lfs_config_t* cfg) {
     lfs_cache_zero(lfs, &lfs->read_cache);
     lfs_cache_zero(lfs, &lfs->write_cache);
 
+    // setup extra read cache slots, slot 0 is read_cache itself so the slot
+    // buffers follow the slot array in one allocation
+    lfs->read_slots = NULL;
+    lfs->read_last = 0;
+    lfs->read_pair[0] = LFS_BLOCK_NULL;
+    lfs->read_pair[1] = LFS_BLOCK_NULL;
+    lfs->read_tick = 0;
+    lfs->read_hits = 0;
+    lfs->read_misses = 0;
+    lfs->verify_tick = 0;
+
+    LFS_ASSERT(lfs->cfg->read_cache_metadata == 0 ||
+        lfs->cfg->read_cache_metadata < lfs->cfg->read_cache_count);
+
+    if (lfs->cfg->read_cache_count > 1) {
+
+        lfs_size_t count = lfs->cfg->read_cache_count;
+
+        lfs->read_slots = (lfs_read_slot_t*)malloc(
+            sizeof(lfs_read_slot_t) * count + (count - 1) * lfs->cfg->cache_size);
+
+        if (!lfs->read_slots) {
+
+            err = LFS_ERR_NOMEM;
+            goto cleanup;
+        }
+
+        uint8_t* buffer = (uint8_t*)&lfs->read_slots[count];
+
+        for (lfs_size_t i = 0; i < count; i++) {
+
+            lfs->read_slots[i].tick = 0;
+            lfs->read_slots[i].cache.buffer = (i == 0) ? NULL : &buffer[(i - 1) * lfs->cfg->cache_size];
+
+            if (i != 0) {
+
+                lfs_cache_zero(lfs, &lfs->read_slots[i].cache);
+            }
+        }
+    }
+
+    // setup private read caches for the shared lock, buffers follow the
+    // array as with the slots
+    lfs->readers = NULL;
+
+    // set up below once the name limit is known
+    lfs->dentries = NULL;
+    lfs->tag_indexes = NULL;
+    lfs->tag_index_tick = 0;
+    lfs->tag_index_hits = 0;
+    lfs->tag_index_misses = 0;
+
+    // the first gc step starts from the root
+    lfs->commit_stamp = 0;
+    lfs->gc_pair[0] = LFS_BLOCK_NULL;
+    lfs->gc_pair[1] = LFS_BLOCK_NULL;
+    lfs->gc_stamp = lfs->commit_stamp - 1;
+
+    // nothing waits on a device sync yet
+    lfs->sync_pending = 0;
+    lfs->batch_depth = 0;
+
+    if (lfs->cfg->reader_count) {
+
+        lfs_size_t count = lfs->cfg->reader_count;
+
+        lfs->readers = (lfs_reader_t*)malloc(
+            (sizeof(lfs_reader_t) + lfs->cfg->cache_size) * count);
+
+        if (!lfs->readers) {
+
+            err = LFS_ERR_NOMEM;
+            goto cleanup;
+        }
+
+        uint8_t* buffer = (uint8_t*)&lfs->readers[count];
+
+        for (lfs_size_t i = 0; i < count; i++) {
+
+            lfs->readers[i].cache.buffer = &buffer[i * lfs->cfg->cache_size];
+            lfs->readers[i].busy = 0;
+            lfs->readers[i].hits = 0;
+            lfs->readers[i].misses = 0;
+            lfs_cache_zero(lfs, &lfs->readers[i].cache);
+        }
+    }
+
     // setup lookahead, must be multiple of 64-bits, 32-bit aligned
     LFS_ASSERT(lfs->cfg->lookahead_size > 0);
     LFS_ASSERT(lfs->cfg->lookahead_size % 8 == 0 &&
         (uintptr_t)lfs->cfg->lookahead_buffer % 4 == 0);
 
-    if (lfs->cfg->lookahead_buffer) {
+    lfs->free.capacity = 0;
+    lfs->free.map.head = 0;
+    lfs->free.map.size = 0;
+    lfs->free.releasing = false;
+    lfs->free.growing = false;
+    lfs->free.grown = false;
+
+    if (lfs->cfg->free_map) {
+
+        // allocated once the block count is known
+        lfs->free.buffer = NULL;
+    }
+    else if (lfs->cfg->lookahead_buffer) {
 
         lfs->free.buffer = (uint64_t*)lfs->cfg->lookahead_buffer;
 
@@ -128,6 +227,91 @@ static int lfs_init(lfs_t* lfs, lfs_config_t* cfg) {
 
     LFS_ASSERT(lfs->cfg->metadata_max <= lfs->cfg->block_size);
 
+    // setup path lookup cache, buckets, stamps and names follow the entries
+    // in one allocation, there are a power of two buckets and stamps, at
+    // least one of each per entry
+    lfs->dentry_buckets = NULL;
+    lfs->dentry_commits = NULL;
+    lfs->dentry_erases = NULL;
+    lfs->dentry_mask = 0;
+    lfs->dentry_hand = 0;
+    lfs->dentry_epoch = 0;
+    lfs->dentry_hits = 0;
+    lfs->dentry_misses = 0;
+
+    if (lfs->cfg->dentry_cache_size) {
+
+        lfs_size_t count = lfs->cfg->dentry_cache_size;
+        lfs_size_t buckets = 1;
+
+        while (buckets < count) {
+
+            buckets <<= 1;
+        }
+
+        lfs->dentries = (lfs_dentry_t*)malloc(
+            (sizeof(lfs_dentry_t) + lfs->name_max_length) * count +
+            (sizeof(lfs_size_t) + 2 * sizeof(uint32_t)) * buckets);
+
+        if (!lfs->dentries) {
+
+            err = LFS_ERR_NOMEM;
+            goto cleanup;
+        }
+
+        lfs->dentry_buckets = (lfs_size_t*)&lfs->dentries[count];
+        lfs->dentry_commits = (uint32_t*)&lfs->dentry_buckets[buckets];
+        lfs->dentry_erases = &lfs->dentry_commits[buckets];
+        lfs->dentry_mask = buckets - 1;
+
+        for (lfs_size_t i = 0; i < buckets; i++) {
+
+            lfs->dentry_buckets[i] = LFS_DENTRY_NULL;
+            lfs->dentry_commits[i] = 0;
+            lfs->dentry_erases[i] = 0;
+        }
+
+        char* names = (char*)&lfs->dentry_erases[buckets];
+
+        for (lfs_size_t i = 0; i < count; i++) {
+
+            lfs->dentries[i].name = &names[i * lfs->name_max_length];
+            lfs->dentries[i].size = 0;
+            lfs->dentries[i].referenced = false;
+        }
+    }
+
+    // setup tag indexes, their arrays grow with the logs they index
+    if (lfs->cfg->tag_index_count) {
+
+        lfs->tag_indexes = (lfs_tag_index_t*)malloc(
+            sizeof(lfs_tag_index_t) * lfs->cfg->tag_index_count);
+
+        if (!lfs->tag_indexes) {
+
+            err = LFS_ERR_NOMEM;
+            goto cleanup;
+        }
+
+        for (lfs_size_t i = 0; i < lfs->cfg->tag_index_count; i++) {
+
+            lfs_tag_index_t* index = &lfs->tag_indexes[i];
+
+            index->block = LFS_BLOCK_NULL;
+            index->revision_count = 0;
+            index->offset = 0;
+            index->etag = 0;
+            index->ids = NULL;
+            index->id_count = 0;
+            index->id_capacity = 0;
+            index->records = NULL;
+            index->record_count = 0;
+            index->record_capacity = 0;
+            index->applied = 0;
+            index->tick = 0;
+        }
+    }
+
     // setup default state
     lfs->root[0] = LFS_BLOCK_NULL;
     lfs->root[1] = LFS_BLOCK_NULL;
@@ -136,6 +320,9 @@ static int lfs_init(lfs_t* lfs, lfs_config_t* cfg) {
     lfs->gdisk = { 0 };
     lfs->gstate = { 0 };
     lfs->gdelta = { 0 };
+    lfs->dentry_gstate = { 0 };
+    lfs->index_cache_used = 0;
+    lfs->index_cache_tick = 0;
 
     return LFS_ERR_OK;
 
@@ -157,11 +344,22 @@ static int lfs_deinit(lfs_t* lfs) {
         free(lfs->write_cache.buffer);
     }
 
-    if (!lfs->cfg->lookahead_buffer) {
+    if (lfs->cfg->free_map || !lfs->cfg->lookahead_buffer) {
 
         free(lfs->free.buffer);
     }
 
+    free(lfs->read_slots);
+    lfs->read_slots = NULL;
+
+    free(lfs->readers);
+    lfs->readers = NULL;
+
+    free(lfs->dentries);
+    lfs->dentries = NULL;
+
+    lfs_tag_index_release(lfs);
+
     return LFS_ERR_OK;
 }
 
@@ -285,6 +483,7 @@ int lfs_raw_rename(lfs_t* lfs, const char* oldpath, const char* newpath) {
     }
 
     // find old entry
+    const char* oldname = oldpath;
     lfs_metadata_dir_t oldcwd;
     lfs_stag_t oldtag = lfs_dir_find(lfs, &oldcwd, &oldpath, NULL);
 
@@ -293,6 +492,25 @@ int lfs_raw_rename(lfs_t* lfs, const char* oldpath, const char* newpath) {
         return (oldtag < 0) ? (int)oldtag : LFS_ERR_INVAL;
     }
 
+    // a file a batch holds back is moved with what it was given
+    err = lfs_batch_settle(lfs, oldcwd.pair, lfs_tag_id(oldtag));
+
+    if (err < 0) {
+
+        return err;
+    }
+
+    if (err > 0) {
+
+        oldpath = oldname;
+        oldtag = lfs_dir_find(lfs, &oldcwd, &oldpath, NULL);
+
+        if (oldtag < 0) {
+
+            return (int)oldtag;
+        }
+    }
+
     // find new entry
     lfs_metadata_dir_t newcwd;
     uint16_t newid;
@@ -485,6 +703,14 @@ lfs_ssize_t lfs_raw_get_attribute(lfs_t* lfs, const char* path, uint8_t type, vo
 
 int lfs_commit_attribute(lfs_t* lfs, const char* path, uint8_t type, const void* buffer, lfs_size_t size) {
 
+    int err = lfs_alloc_release(lfs);
+
+    if (err) {
+
+        return err;
+    }
+
+    const char* name = path;
     lfs_metadata_dir_t cwd;
     lfs_stag_t tag = lfs_dir_find(lfs, &cwd, &path, NULL);
 
@@ -493,6 +719,25 @@ int lfs_commit_attribute(lfs_t* lfs, const char* path, uint8_t type, const void*
         return tag;
     }
 
+    // attributes a batch holds back for the file go first
+    err = lfs_batch_settle(lfs, cwd.pair, lfs_tag_id(tag));
+
+    if (err < 0) {
+
+        return err;
+    }
+
+    if (err > 0) {
+
+        path = name;
+        tag = lfs_dir_find(lfs, &cwd, &path, NULL);
+
+        if (tag < 0) {
+
+            return tag;
+        }
+    }
+
     uint16_t id = lfs_tag_id(tag);
 
     if (id == 0x3ff) {
@@ -500,7 +745,7 @@ int lfs_commit_attribute(lfs_t* lfs, const char* path, uint8_t type, const void*
         // special case for root
         id = 0;
 
-        int err = lfs_dir_fetch(lfs, &cwd, lfs->root);
+        err = lfs_dir_fetch(lfs, &cwd, lfs->root);
 
         if (err) {
             return err;
@@ -555,11 +800,20 @@ int lfs_raw_format(lfs_t* lfs, lfs_config_t* cfg) {
         LFS_ASSERT(sizeof(uint64_t) * lfs_npw2_64(0xffffffff / (lfs->block_size - 2 * sizeof(uint64_t))) <= lfs->block_size);
 
         // create free lookahead
-        memset(lfs->free.buffer, 0, lfs->cfg->lookahead_size);
+        lfs_block_t window = 0;
+        err = lfs_alloc_window(lfs, &window);
+
+        if (err) {
+
+            goto cleanup;
+        }
+
         lfs->free.offset = 0;
-        lfs->free.size = lfs_min(sizeof(lfs_block_t[2]) * lfs->cfg->lookahead_size, lfs->block_count); //recheck
+        lfs->free.size = lfs_min(window, lfs->block_count);
+        memset(lfs->free.buffer, 0, lfs_alignup(lfs->free.size, 64) / 8);
 
         lfs->free.i = 0;
+        lfs->free.grow = false;
         lfs_alloc_ack(lfs);
 
         // create root dir
@@ -573,7 +827,11 @@ int lfs_raw_format(lfs_t* lfs, lfs_config_t* cfg) {
 
         // write one superblock
         lfs_superblock_t superblock{};
-        superblock.version = LFS_DISK_VERSION;
+        // with extents from the start, files need not raise it later
+        lfs->disk_version = (lfs->cfg->file_layout == LFS_LAYOUT_EXTENT)
+            ? LFS_DISK_VERSION_EXTENTS : LFS_DISK_VERSION;
+
+        superblock.version = lfs->disk_version;
         superblock.block_size = lfs->block_size;
         superblock.block_count = lfs->block_count;
         superblock.name_max_length = lfs->name_max_length;
@@ -614,6 +872,9 @@ int lfs_raw_format(lfs_t* lfs, lfs_config_t* cfg) {
 
             goto cleanup;
         }
+
+        // the commits may have been left to share a sync
+        err = lfs_bd_syncpending(lfs);
     }
 
 cleanup:
@@ -633,6 +894,7 @@ int lfs_raw_mount(lfs_t* lfs, lfs_config_t* cfg) {
     // if block_size is unknown we need to search for it
     lfs->block_size = lfs->cfg->block_size;
     lfs_size_t block_size_limit = lfs->cfg->block_size;
+    lfs_block_t free_map_offset = 0;
 
     if (!lfs->block_size) {
 
@@ -744,15 +1006,25 @@ int lfs_raw_mount(lfs_t* lfs, lfs_config_t* cfg) {
 
                 if (superblock.block_count != lfs->block_count) {
 
-                    if (lfs->cfg->block_count
+                    // a device that grows may have grown past the count the
+                    // superblock was last told of, it is told again at the
+                    // next operation
+                    if (lfs->cfg->allocate_block && lfs->cfg->block_count
+                        && superblock.block_count < lfs->block_count) {
+
+                        lfs->free.grown = true;
+                    }
+                    else if (lfs->cfg->block_count
                         || superblock.block_count > lfs->block_count) {
 
                         LFS_ERROR("Invalid block count %"PRIu32, superblock.block_count);
                         err = LFS_ERR_INVAL;
                         goto cleanup;
                     }
+                    else {
 
-                    lfs->block_count = superblock.block_count;
+                        lfs->block_count = superblock.block_count;
+                    }
                 }
 
                 // check version
@@ -760,13 +1032,17 @@ int lfs_raw_mount(lfs_t* lfs, lfs_config_t* cfg) {
                 uint16_t minor_version = (0xffff & (superblock.version >> 0));
 
                 if ((major_version != LFS_DISK_VERSION_MAJOR ||
-                    minor_version > LFS_DISK_VERSION_MINOR)) {
+                    minor_version > LFS_DISK_VERSION_FREE_MAP_MINOR)) {
 
                     LFS_ERROR("Invalid version v%"PRIu16".%"PRIu16, major_version, minor_version);
                     err = LFS_ERR_INVAL;
                     goto cleanup;
                 }
 
+                // an image with a free map doesn't say whether it has
+                // extents, it is taken to have them
+                lfs->disk_version = lfs_min(superblock.version, LFS_DISK_VERSION_EXTENTS);
+
                 // check superblock configuration
                 if (superblock.name_max_length) {
 
@@ -802,6 +1078,11 @@ int lfs_raw_mount(lfs_t* lfs, lfs_config_t* cfg) {
                     lfs->attr_max_size = superblock.attr_max_size;
                 }
 
+                // free map checkpointed at the last unmount
+                lfs->free.map.head = superblock.free_map_head;
+                lfs->free.map.size = superblock.free_map_size;
+                free_map_offset = superblock.free_map_offset;
+
                 // update root
                 lfs->root[0] = dir.pair[0];
                 lfs->root[1] = dir.pair[1];
@@ -862,15 +1143,69 @@ int lfs_raw_mount(lfs_t* lfs, lfs_config_t* cfg) {
     lfs->free.offset = lfs->seed % lfs->block_count;
     lfs_alloc_drop(lfs);
 
+    // pick up the free map checkpointed at the last unmount, it is still
+    // referenced so nothing was committed after it was written
+    if (lfs->free.map.size) {
+
+        err = lfs_alloc_load(lfs, free_map_offset);
+
+        if (err) {
+
+            if (err != LFS_ERR_CORRUPT) {
+
+                goto cleanup;
+            }
+
+            lfs->free.offset = lfs->seed % lfs->block_count;
+            lfs_alloc_drop(lfs);
+        }
+    }
+
     return LFS_ERR_OK;
 
 cleanup:
-    lfs_raw_unmount(lfs);
+    lfs_deinit(lfs);
     return err;
 }
 
 int lfs_raw_unmount(lfs_t* lfs) {
-    return lfs_deinit(lfs);
+
+    // a batch left open is ended
+    int err = LFS_ERR_OK;
+
+    if (lfs->batch_depth) {
+
+        lfs->batch_depth = 1;
+        err = lfs_batch_rawend(lfs);
+    }
+
+    // tell the superblock of a growth made since the last operation
+    if (!err && lfs->free.grown) {
+
+        err = lfs_fs_rawgrow(lfs, lfs->block_count);
+    }
+
+    // checkpoint the free map so the next mount doesn't have to rebuild it,
+    // a device too full for the map is left to the next mount's traversal
+    if (!err) {
+
+        err = lfs_alloc_checkpoint(lfs);
+
+        if (err == LFS_ERR_NOSPC && !lfs->free.map.size) {
+
+            err = LFS_ERR_OK;
+        }
+    }
+
+    // and make what is left waiting on a sync durable
+    if (!err) {
+
+        err = lfs_bd_syncpending(lfs);
+    }
+
+    int res = lfs_deinit(lfs);
+
+    return err ? err : res;
 }
 
 
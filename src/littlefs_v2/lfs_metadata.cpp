@@ -2,6 +2,23 @@
 
 /// Metadata pair and directory operations ///
 
+// Read the data of a tag found at offset, what the tag doesn't fill is zeroed
+static int lfs_dir_getslice_read(lfs_t* lfs, const lfs_metadata_dir_t* dir,
+    lfs_tag_t tag, lfs_off_t offset, lfs_off_t goff, void* gbuffer, lfs_size_t gsize) {
+
+    lfs_size_t diff = lfs_min(lfs_tag_size(tag), gsize);
+
+    int err = lfs_bd_read(lfs, NULL, &lfs->read_cache, diff, dir->pair[0], offset + sizeof(tag) + goff, gbuffer, diff);
+
+    if (err) {
+        return err;
+    }
+
+    memset((uint8_t*)gbuffer + diff, 0, gsize - diff);
+
+    return LFS_ERR_OK;
+}
+
 lfs_stag_t lfs_dir_getslice(lfs_t* lfs, const lfs_metadata_dir_t* dir,
     lfs_tag_t gmask, lfs_tag_t gtag,
     lfs_off_t goff, void* gbuffer, lfs_size_t gsize) {
@@ -17,6 +34,26 @@ lfs_stag_t lfs_dir_getslice(lfs_t* lfs, const lfs_metadata_dir_t* dir,
         gdiff -= LFS_MKTAG(0, 1, 0);
     }
 
+    // an indexed log answers without walking it
+    const lfs_tag_index_t* index = lfs_tag_index_find(lfs, dir, gmask, gtag);
+
+    if (index) {
+
+        lfs_stag_t tag = lfs_tag_index_get(index, gmask, gtag - gdiff, &offset);
+
+        if (tag < 0 || lfs_tag_isdelete(tag)) {
+            return LFS_ERR_NOENT;
+        }
+
+        int err = lfs_dir_getslice_read(lfs, dir, tag, offset, goff, gbuffer, gsize);
+
+        if (err) {
+            return err;
+        }
+
+        return tag + gdiff;
+    }
+
     // iterate over dir block backwards (for faster lookups)
     while (offset >= sizeof(lfs_tag_t) + lfs_tag_dsize(ntag)) {
 
@@ -56,19 +93,12 @@ lfs_stag_t lfs_dir_getslice(lfs_t* lfs, const lfs_metadata_dir_t* dir,
                 return LFS_ERR_NOENT;
             }
 
-            lfs_size_t diff = lfs_min(lfs_tag_size(tag), gsize);
-
-            /*
-                
-            */
-            err = lfs_bd_read(lfs, NULL, &lfs->read_cache, diff, dir->pair[0], offset + sizeof(tag) + goff, gbuffer, diff);
+            err = lfs_dir_getslice_read(lfs, dir, tag, offset, goff, gbuffer, gsize);
 
             if (err) {
                 return err;
             }
 
-            memset((uint8_t*)gbuffer + diff, 0, gsize - diff);
-
             return tag + gdiff;
         }
     }
@@ -408,6 +438,44 @@ int lfs_dir_traverse(lfs_t* lfs,
     }
 }
 
+// Reads of a fetch, straight out of the block when the device lends it
+// in one piece, otherwise through the read cache
+static int lfs_dir_fetchread(lfs_t* lfs, const uint8_t* mapped,
+    lfs_block_t block, lfs_off_t offset, void* buffer, lfs_size_t size) {
+
+    if (!mapped) {
+
+        return lfs_bd_read(lfs, NULL, &lfs->read_cache, lfs->block_size, block, offset, buffer, size);
+    }
+
+    if (offset + size > lfs->block_size) {
+
+        return LFS_ERR_CORRUPT;
+    }
+
+    memcpy(buffer, &mapped[offset], size);
+
+    return LFS_ERR_OK;
+}
+
+static int lfs_dir_fetchcrc(lfs_t* lfs, const uint8_t* mapped,
+    lfs_block_t block, lfs_off_t offset, lfs_size_t size, uint32_t* crc) {
+
+    if (!mapped) {
+
+        return lfs_bd_crc(lfs, NULL, &lfs->read_cache, lfs->block_size, block, offset, size, crc);
+    }
+
+    if (offset + size > lfs->block_size) {
+
+        return LFS_ERR_CORRUPT;
+    }
+
+    *crc = lfs_crc(*crc, &mapped[offset], size);
+
+    return LFS_ERR_OK;
+}
+
 lfs_stag_t lfs_dir_fetchmatch(lfs_t* lfs,
     lfs_metadata_dir_t* dir, const lfs_block_t pair[2],
     lfs_tag_t fmask, lfs_tag_t ftag, uint16_t* id,
@@ -424,6 +492,22 @@ lfs_stag_t lfs_dir_fetchmatch(lfs_t* lfs,
         return LFS_ERR_CORRUPT;
     }
 
+    // reads of this pair go to the metadata slots of the read cache, which
+    // readers under the shared lock don't use
+    if (!lfs_reader_current(lfs)) {
+
+        lfs->read_pair[0] = pair[0];
+        lfs->read_pair[1] = pair[1];
+    }
+
+    // both revisions are needed, a device taking batches reads them together
+    int err = lfs_bd_prefetch(lfs, pair, 2, sizeof(uint32_t));
+
+    if (err) {
+
+        return err;
+    }
+
     // find the block with the most recent revision
     uint32_t revs[2] = { 0, 0 };
     int r = 0;
@@ -468,6 +552,12 @@ lfs_stag_t lfs_dir_fetchmatch(lfs_t* lfs,
         uint32_t crc = lfs_crc(0xffffffff, &dir->revision_count, sizeof(dir->revision_count));
         dir->revision_count = lfs_fromle32(dir->revision_count);
 
+        // scan the tags in place if the device is mapped
+        const uint8_t* mapped = lfs_bd_map(lfs, dir->pair[0], 0, lfs->block_size);
+
+        // index the tags on the way through
+        lfs_tag_index_t* index = lfs_tag_index_begin(lfs, dir);
+
         while (true) {
 
             // extract next tag
@@ -475,7 +565,7 @@ lfs_stag_t lfs_dir_fetchmatch(lfs_t* lfs,
             offset += lfs_tag_dsize(ptag);
 
             //some bug offset+size (recheck)
-            int err = lfs_bd_read(lfs, NULL, &lfs->read_cache, lfs->block_size, dir->pair[0], offset, &tag, sizeof(tag));
+            int err = lfs_dir_fetchread(lfs, mapped, dir->pair[0], offset, &tag, sizeof(tag));
 
             if (err) {
 
@@ -512,7 +602,7 @@ lfs_stag_t lfs_dir_fetchmatch(lfs_t* lfs,
 
                 // check the crc attr
                 uint32_t dcrc;
-                err = lfs_bd_read(lfs, NULL, &lfs->read_cache, lfs->block_size, dir->pair[0], offset + sizeof(tag), &dcrc, sizeof(dcrc));
+                err = lfs_dir_fetchread(lfs, mapped, dir->pair[0], offset + sizeof(tag), &dcrc, sizeof(dcrc));
 
                 if (err) {
 
@@ -539,8 +629,12 @@ lfs_stag_t lfs_dir_fetchmatch(lfs_t* lfs,
                 // toss our crc into the filesystem seed for
                 // pseudorandom numbers, note we use another crc here
                 // as a collection function because it is sufficiently
-                // random and convenient
-                lfs->seed = lfs_crc(lfs->seed, &crc, sizeof(crc));
+                // random and convenient, only the exclusive lock holder
+                // may change it
+                if (!lfs_reader_current(lfs)) {
+
+                    lfs->seed = lfs_crc(lfs->seed, &crc, sizeof(crc));
+                }
 
                 // update with what's found so far
                 besttag = tempbesttag;
@@ -551,29 +645,32 @@ lfs_stag_t lfs_dir_fetchmatch(lfs_t* lfs,
                 dir->tail[1] = temptail[1];
                 dir->split = tempsplit;
 
+                if (index && !lfs_tag_index_apply(lfs, index)) {
+                    index = NULL;
+                }
+
                 // reset crc
                 crc = 0xffffffff;
                 continue;
             }
 
             // crc the entry first, hopefully leaving it in the cache
-            for (lfs_off_t j = sizeof(tag); j < lfs_tag_dsize(tag); j++) {
-
-                uint8_t dat;
-                err = lfs_bd_read(lfs, NULL, &lfs->read_cache, lfs->block_size, dir->pair[0], offset + j, &dat, 1);
-
-                if (err) {
+            err = lfs_dir_fetchcrc(lfs, mapped,
+                dir->pair[0], offset + sizeof(tag), lfs_tag_dsize(tag) - sizeof(tag), &crc);
 
-                    if (err == LFS_ERR_CORRUPT) {
+            if (err) {
 
-                        dir->erased = false;
-                        break;
-                    }
+                if (err == LFS_ERR_CORRUPT) {
 
-                    return err;
+                    dir->erased = false;
+                    break;
                 }
 
-                crc = lfs_crc(crc, &dat, 1);
+                return err;
+            }
+
+            if (index && !lfs_tag_index_push(lfs, index, tag, offset)) {
+                index = NULL;
             }
 
             // directory modification tags?
@@ -604,8 +701,7 @@ lfs_stag_t lfs_dir_fetchmatch(lfs_t* lfs,
 
                 tempsplit = (lfs_tag_chunk(tag) & 1);
 
-                err = lfs_bd_read(lfs,
-                    NULL, &lfs->read_cache, lfs->block_size,
+                err = lfs_dir_fetchread(lfs, mapped,
                     dir->pair[0], offset + sizeof(tag), &temptail, sizeof(temptail));
 
                 if (err) {
@@ -659,6 +755,10 @@ lfs_stag_t lfs_dir_fetchmatch(lfs_t* lfs,
             }
         }
 
+        if (index) {
+            lfs_tag_index_finish(lfs, index, dir);
+        }
+
         // consider what we have good enough
         if (dir->offset > 0) {
 
@@ -770,7 +870,7 @@ int lfs_dir_getinfo(lfs_t* lfs, lfs_metadata_dir_t* dir, uint16_t id, struct lfs
 
     lfs_ctz_fromle64(&ctz);
 
-    if (lfs_tag_type3(tag) == LFS_TYPE_CTZSTRUCT) {
+    if (lfs_tag_type3(tag) == LFS_TYPE_CTZSTRUCT || lfs_tag_type3(tag) == LFS_TYPE_EXTSTRUCT) {
 
         info->size = ctz.size;
     }
@@ -808,6 +908,151 @@ int lfs_dir_find_match(void* data, lfs_tag_t tag, const void* buffer) {
     return LFS_CMP_EQ;
 }
 
+/// Path lookup cache ///
+
+// Entries are keyed by the head pair of the directory a name was looked up
+// in and the name, so the entries of a path chain through the child pairs
+// of its directories. An entry only depends on the pair it was found in,
+// names are created in the pair a lookup returns, so it is stale once that
+// pair is committed to. A directory's head pair is only rewritten from
+// scratch when it is compacted, the entries keyed by it are stale then too,
+// in case its blocks now hold another directory.
+//
+// Rather than searching the entries on every commit, each block hashes to
+// a stamp bumped when a pair with it is committed to or compacted, and an
+// entry keeps the stamps it was found under. Blocks sharing a stamp only
+// cost entries that were still good.
+static uint32_t lfs_dentry_stamp(const lfs_t* lfs, const uint32_t* stamps, const lfs_block_t pair[2]) {
+
+    return stamps[pair[0] & lfs->dentry_mask] + stamps[pair[1] & lfs->dentry_mask];
+}
+
+static bool lfs_dentry_isvalid(const lfs_t* lfs, const lfs_dentry_t* dentry) {
+
+    return dentry->epoch == lfs->dentry_epoch &&
+        dentry->commits == lfs_dentry_stamp(lfs, lfs->dentry_commits, dentry->dir.pair) &&
+        dentry->erases == lfs_dentry_stamp(lfs, lfs->dentry_erases, dentry->parent);
+}
+
+static uint32_t lfs_dentry_hash(const lfs_block_t parent[2], const char* name, lfs_size_t size) {
+
+    uint32_t hash = lfs_crc(0xffffffff, parent, sizeof(lfs_block_t[2]));
+
+    return lfs_crc(hash, name, size);
+}
+
+static void lfs_dentry_unlink(lfs_t* lfs, lfs_size_t i) {
+
+    lfs_dentry_t* dentry = &lfs->dentries[i];
+    lfs_size_t* link = &lfs->dentry_buckets[dentry->hash & lfs->dentry_mask];
+
+    while (*link != i) {
+
+        link = &lfs->dentries[*link].next;
+    }
+
+    *link = dentry->next;
+    dentry->size = 0;
+    dentry->referenced = false;
+}
+
+// Find the entry of a name, a stale one is unlinked on the way
+static lfs_dentry_t* lfs_dentry_lookup(lfs_t* lfs,
+    const lfs_block_t parent[2], const char* name, lfs_size_t size, uint32_t hash) {
+
+    lfs_size_t i = lfs->dentry_buckets[hash & lfs->dentry_mask];
+
+    while (i != LFS_DENTRY_NULL) {
+
+        lfs_dentry_t* dentry = &lfs->dentries[i];
+
+        if (dentry->hash == hash && dentry->size == size &&
+            dentry->parent[0] == parent[0] && dentry->parent[1] == parent[1] &&
+            memcmp(dentry->name, name, size) == 0) {
+
+            if (!lfs_dentry_isvalid(lfs, dentry)) {
+
+                lfs_dentry_unlink(lfs, i);
+                return NULL;
+            }
+
+            return dentry;
+        }
+
+        i = dentry->next;
+    }
+
+    return NULL;
+}
+
+// Take an entry for a name, evicting with a clock, an entry used since the
+// hand last passed it is kept for another round unless it is stale
+static lfs_dentry_t* lfs_dentry_insert(lfs_t* lfs,
+    const lfs_block_t parent[2], const char* name, lfs_size_t size, uint32_t hash) {
+
+    lfs_size_t count = lfs->cfg->dentry_cache_size;
+
+    while (true) {
+
+        lfs_size_t i = lfs->dentry_hand;
+        lfs_dentry_t* dentry = &lfs->dentries[i];
+
+        lfs->dentry_hand = (i + 1) % count;
+
+        if (dentry->size && dentry->referenced && lfs_dentry_isvalid(lfs, dentry)) {
+
+            dentry->referenced = false;
+            continue;
+        }
+
+        if (dentry->size) {
+
+            lfs_dentry_unlink(lfs, i);
+        }
+
+        dentry->parent[0] = parent[0];
+        dentry->parent[1] = parent[1];
+        dentry->child[0] = LFS_BLOCK_NULL;
+        dentry->child[1] = LFS_BLOCK_NULL;
+        dentry->size = (uint16_t)size;
+        dentry->hash = hash;
+        memcpy(dentry->name, name, size);
+
+        lfs_size_t* bucket = &lfs->dentry_buckets[hash & lfs->dentry_mask];
+        dentry->next = *bucket;
+        *bucket = i;
+
+        return dentry;
+    }
+}
+
+// Stale the entries found in a pair that is being committed to, and when
+// the pair is being rewritten from scratch the entries looked up in it
+void lfs_dentry_drop(lfs_t* lfs, const lfs_block_t pair[2], bool erased) {
+
+    if (!lfs->dentries) {
+
+        return;
+    }
+
+    for (int i = 0; i < 2; i++) {
+
+        lfs->dentry_commits[pair[i] & lfs->dentry_mask] += 1;
+
+        if (erased) {
+
+            lfs->dentry_erases[pair[i] & lfs->dentry_mask] += 1;
+        }
+    }
+}
+
+// Stale every entry
+void lfs_dentry_flush(lfs_t* lfs) {
+
+    lfs->dentry_epoch += 1;
+    lfs->dentry_gstate = lfs->gdisk;
+}
+
 lfs_stag_t lfs_dir_find(lfs_t* lfs, lfs_metadata_dir_t* dir, const char** path, uint16_t* id) {
 
     // we reduce path to a single name if we can find it
@@ -817,11 +1062,30 @@ lfs_stag_t lfs_dir_find(lfs_t* lfs, lfs_metadata_dir_t* dir, const char** path,
         *id = 0x3ff;
     }
 
+    // operations under the shared lock leave the path lookup cache alone
+    bool cached = lfs->dentries && !lfs_reader_current(lfs);
+
+    // a pending move hides names from lookups, entries found before it
+    // started or finished are stale
+    if (cached) {
+
+        lfs_gstate_t delta = lfs->dentry_gstate;
+        lfs_gstate_xor(&delta, &lfs->gdisk);
+
+        if (!lfs_gstate_iszero(&delta)) {
+
+            lfs_dentry_flush(lfs);
+        }
+    }
+
     // default to root dir
     lfs_stag_t tag = LFS_MKTAG(LFS_TYPE_DIR, 0x3ff, 0);
     dir->tail[0] = lfs->root[0];
     dir->tail[1] = lfs->root[1];
 
+    // cache entry of the last name, its child pair is filled in once read
+    lfs_dentry_t* dentry = NULL;
+
     while (true) {
     nextname:
         // skip slashes
@@ -883,7 +1147,12 @@ lfs_stag_t lfs_dir_find(lfs_t* lfs, lfs_metadata_dir_t* dir, const char** path,
         }
 
         // grab the entry data
-        if (lfs_tag_id(tag) != 0x3ff) {
+        if (dentry && !lfs_pair_isnull(dentry->child)) {
+
+            dir->tail[0] = dentry->child[0];
+            dir->tail[1] = dentry->child[1];
+        }
+        else if (lfs_tag_id(tag) != 0x3ff) {
 
             lfs_stag_t res = lfs_dir_get(lfs, dir, 
                 LFS_MKTAG(LFS_TYPE_GLOBALS, 0x3ff, 0),
@@ -895,9 +1164,56 @@ lfs_stag_t lfs_dir_find(lfs_t* lfs, lfs_metadata_dir_t* dir, const char** path,
             }
 
             lfs_pair_fromle64(dir->tail);
+
+            if (dentry) {
+
+                dentry->child[0] = dir->tail[0];
+                dentry->child[1] = dir->tail[1];
+            }
+        }
+
+        // are we last name?
+        bool last = (strchr(name, '/') == NULL);
+
+        // names too long to exist aren't worth an entry
+        const lfs_block_t parent[2] = { dir->tail[0], dir->tail[1] };
+        uint32_t hash = 0;
+        bool cacheable = cached && namelen <= lfs->name_max_length;
+
+        dentry = NULL;
+
+        if (cacheable) {
+
+            hash = lfs_dentry_hash(parent, name, namelen);
+            dentry = lfs_dentry_lookup(lfs, parent, name, namelen, hash);
+
+            if (dentry) {
+
+                lfs->dentry_hits += 1;
+                dentry->referenced = true;
+
+                *dir = dentry->dir;
+                tag = dentry->tag;
+
+                if (last && id) {
+                    *id = dentry->id;
+                }
+
+                if (tag < 0) {
+
+                    return tag;
+                }
+
+                name += namelen;
+                continue;
+            }
+
+            lfs->dentry_misses += 1;
         }
 
         // find entry matching name
+        uint16_t found = 0x3ff;
+
         while (true) {
 
             lfs_dir_find_match_t _pred = { lfs, name, namelen };
@@ -905,11 +1221,10 @@ lfs_stag_t lfs_dir_find(lfs_t* lfs, lfs_metadata_dir_t* dir, const char** path,
             tag = lfs_dir_fetchmatch(lfs, dir, dir->tail,
                 LFS_MKTAG(0x780, 0, 0),
                 LFS_MKTAG(LFS_TYPE_NAME, 0, namelen),
-                // are we last name?
-                (strchr(name, '/') == NULL) ? id : NULL,
+                &found,
                 lfs_dir_find_match, &_pred);
 
-            if (tag < 0) {
+            if (tag < 0 && tag != LFS_ERR_NOENT) {
 
                 return tag;
             }
@@ -920,10 +1235,32 @@ lfs_stag_t lfs_dir_find(lfs_t* lfs, lfs_metadata_dir_t* dir, const char** path,
 
             if (!dir->split) {
 
-                return LFS_ERR_NOENT;
+                tag = LFS_ERR_NOENT;
+                break;
             }
         }
 
+        if (last && id) {
+            *id = found;
+        }
+
+        // keep what was found, or that nothing was
+        if (cacheable) {
+
+            dentry = lfs_dentry_insert(lfs, parent, name, namelen, hash);
+            dentry->dir = *dir;
+            dentry->tag = tag;
+            dentry->id = found;
+            dentry->epoch = lfs->dentry_epoch;
+            dentry->commits = lfs_dentry_stamp(lfs, lfs->dentry_commits, dir->pair);
+            dentry->erases = lfs_dentry_stamp(lfs, lfs->dentry_erases, parent);
+        }
+
+        if (tag < 0) {
+
+            return tag;
+        }
+
         // to next name
         name += namelen;
     }
@@ -0,0 +1,505 @@
+#include "lfs.h"
+
+/// Metadata compaction table operations ///
+
+// Compacting a pair writes out every tag of its log and the attributes being
+// committed that no later tag replaces, at the id its entry ends up at.
+// lfs_dir_traverse finds these by checking each tag against everything after
+// it. The table instead follows the entries through the creates and deletes
+// of the log once, forwards, then walks the tags backwards keeping a set of
+// the types each entry has been given since, so a tag is live when its entry
+// is and its type isn't in the set. It keeps the rules of
+// lfs_dir_traverse_filter, so what is written is the same.
+
+// Set of the types given to entries later in the log
+struct lfs_compact_seen_t {
+
+    uint64_t* keys;
+    uint32_t mask;
+};
+
+static const uint64_t LFS_COMPACT_SEEN_EMPTY = ((uint64_t)-1);
+static const uint32_t LFS_COMPACT_CLASS_NULL = ((uint32_t)-1);
+
+static bool lfs_compact_reserve(void** array, uint32_t* capacity, uint32_t count, size_t size) {
+
+    if (count <= *capacity) {
+
+        return true;
+    }
+
+    uint32_t grown = lfs_max(lfs_max(2 * *capacity, count), (uint32_t)16);
+    void* buffer = realloc(*array, grown * size);
+
+    if (!buffer) {
+
+        return false;
+    }
+
+    *array = buffer;
+    *capacity = grown;
+
+    return true;
+}
+
+// Which later tags replace a tag, a name replaces any name and a struct any
+// struct, attributes only replace attributes of their type
+static uint32_t lfs_compact_class(lfs_tag_t tag) {
+
+    switch (lfs_tag_type1(tag)) {
+
+    case LFS_TYPE_NAME:
+        return 0x100;
+
+    case LFS_TYPE_STRUCT:
+        return 0x101;
+
+    case LFS_TYPE_USERATTR:
+        return lfs_tag_type3(tag) & 0xff;
+
+    default:
+        return LFS_COMPACT_CLASS_NULL;
+    }
+}
+
+static uint64_t* lfs_compact_seen_slot(lfs_compact_seen_t* seen, uint32_t entry, uint32_t cls) {
+
+    uint64_t key = ((uint64_t)entry << 9) | cls;
+    uint32_t i = (uint32_t)((key * 0x9e3779b97f4a7c15ULL) >> 32) & seen->mask;
+
+    while (seen->keys[i] != LFS_COMPACT_SEEN_EMPTY && seen->keys[i] != key) {
+
+        i = (i + 1) & seen->mask;
+    }
+
+    return &seen->keys[i];
+}
+
+static bool lfs_compact_seen_has(lfs_compact_seen_t* seen, uint32_t entry, uint32_t cls) {
+
+    return *lfs_compact_seen_slot(seen, entry, cls) != LFS_COMPACT_SEEN_EMPTY;
+}
+
+static void lfs_compact_seen_add(lfs_compact_seen_t* seen, uint32_t entry, uint32_t cls) {
+
+    *lfs_compact_seen_slot(seen, entry, cls) = ((uint64_t)entry << 9) | cls;
+}
+
+// New entry, alive until a delete says otherwise
+static bool lfs_compact_table_entry(lfs_compact_table_t* table, uint32_t* entry) {
+
+    if (!lfs_compact_reserve((void**)&table->entries, &table->entry_capacity,
+        table->entry_count + 1, sizeof(uint32_t))) {
+
+        return false;
+    }
+
+    table->entries[table->entry_count] = 0;
+    *entry = table->entry_count;
+    table->entry_count += 1;
+
+    return true;
+}
+
+// Give every id up to count an entry, tags may name ids no create made,
+// with room for one more id
+static bool lfs_compact_table_extend(lfs_compact_table_t* table, uint32_t count) {
+
+    if (!lfs_compact_reserve((void**)&table->ids, &table->id_capacity,
+        lfs_max(count, table->id_count) + 1, sizeof(uint32_t))) {
+
+        return false;
+    }
+
+    while (table->id_count < count) {
+
+        if (!lfs_compact_table_entry(table, &table->ids[table->id_count])) {
+
+            return false;
+        }
+
+        table->id_count += 1;
+    }
+
+    return true;
+}
+
+static bool lfs_compact_table_iscandidate(lfs_tag_t tag, lfs_tag_t tmask, lfs_tag_t ttag) {
+
+    lfs_tag_t mask = LFS_MKTAG(LFS_TYPE_MOVESTATE, 0, 0);
+
+    return lfs_tag_type3(tag) != LFS_FROM_NOOP && (mask & tmask & tag) == (mask & tmask & ttag);
+}
+
+static int lfs_compact_table_push(lfs_t* lfs, lfs_compact_table_t* table,
+    lfs_tag_t tag, const void* buffer, lfs_off_t offset,
+    lfs_tag_t tmask, lfs_tag_t ttag) {
+
+    // no-ops neither go out nor replace anything
+    if (lfs_tag_type3(tag) == LFS_FROM_NOOP) {
+
+        return LFS_ERR_OK;
+    }
+
+    uint32_t id = lfs_tag_id(tag);
+    uint32_t entry = LFS_COMPACT_NULL;
+
+    if (lfs_tag_type1(tag) == LFS_TYPE_SPLICE) {
+
+        if (lfs_tag_splice(tag) > 0) {
+
+            if (!lfs_compact_table_extend(table, id)) {
+
+                return LFS_ERR_NOMEM;
+            }
+
+            uint32_t created;
+
+            if (!lfs_compact_table_entry(table, &created)) {
+
+                return LFS_ERR_NOMEM;
+            }
+
+            memmove(&table->ids[id + 1], &table->ids[id],
+                (table->id_count - id) * sizeof(uint32_t));
+
+            table->ids[id] = created;
+            table->id_count += 1;
+        }
+        else if (lfs_tag_splice(tag) < 0 && id < table->id_count) {
+
+            table->entries[table->ids[id]] = LFS_COMPACT_NULL;
+
+            memmove(&table->ids[id], &table->ids[id + 1],
+                (table->id_count - id - 1) * sizeof(uint32_t));
+
+            table->id_count -= 1;
+        }
+    }
+    else if (id != 0x3ff) {
+
+        if (!lfs_compact_table_extend(table, id + 1)) {
+
+            return LFS_ERR_NOMEM;
+        }
+
+        entry = table->ids[id];
+    }
+
+    // a move that may go out brings the live tags of the log it moves from
+    if (lfs_tag_type3(tag) == LFS_FROM_MOVE && lfs_compact_table_iscandidate(tag, tmask, ttag)) {
+
+        lfs_compact_table_t* moves = (lfs_compact_table_t*)realloc(table->moves,
+            (table->move_count + 1) * sizeof(lfs_compact_table_t));
+
+        if (!moves) {
+
+            return LFS_ERR_NOMEM;
+        }
+
+        table->moves = moves;
+        offset = table->move_count;
+
+        int err = lfs_compact_table_build(lfs, &table->moves[table->move_count],
+            (const lfs_metadata_dir_t*)buffer, NULL, 0,
+            LFS_MKTAG(LFS_TYPE_TAIL, 0x3ff, 0), LFS_MKTAG(LFS_TYPE_STRUCT, 0, 0));
+
+        table->move_count += 1;
+
+        if (err) {
+
+            return err;
+        }
+    }
+
+    if (!lfs_compact_reserve((void**)&table->records, &table->record_capacity,
+        table->record_count + 1, sizeof(lfs_compact_record_t))) {
+
+        return LFS_ERR_NOMEM;
+    }
+
+    lfs_compact_record_t* record = &table->records[table->record_count];
+    record->tag = tag;
+    record->entry = entry;
+    record->buffer = buffer;
+    record->offset = offset;
+
+    table->record_count += 1;
+
+    return LFS_ERR_OK;
+}
+
+// Drop the tags that don't go out, walking back from the last
+static int lfs_compact_table_filter(lfs_compact_table_t* table, lfs_tag_t tmask, lfs_tag_t ttag) {
+
+    // room for a type of every tag and every attribute of a list
+    uint32_t count = table->record_count;
+
+    for (uint32_t i = 0; i < table->record_count; i++) {
+
+        if (lfs_tag_type3(table->records[i].tag) == LFS_FROM_USERATTRS) {
+
+            count += lfs_tag_size(table->records[i].tag);
+        }
+    }
+
+    uint32_t capacity = 16;
+
+    while (capacity < 2 * count) {
+
+        capacity *= 2;
+    }
+
+    lfs_compact_seen_t seen;
+    seen.keys = (uint64_t*)malloc(capacity * sizeof(uint64_t));
+    seen.mask = capacity - 1;
+
+    if (!seen.keys) {
+
+        return LFS_ERR_NOMEM;
+    }
+
+    memset(seen.keys, 0xff, capacity * sizeof(uint64_t));
+
+    // anything after a delete drops it
+    bool later = false;
+
+    for (uint32_t i = table->record_count; i-- > 0;) {
+
+        lfs_compact_record_t* record = &table->records[i];
+        lfs_tag_t tag = record->tag;
+        bool live = false;
+
+        if (lfs_tag_type3(tag) != LFS_FROM_NOOP && lfs_compact_table_iscandidate(tag, tmask, ttag)) {
+
+            uint32_t cls = lfs_compact_class(tag);
+
+            live = !(lfs_tag_isdelete(tag) && later);
+
+            if (live && record->entry != LFS_COMPACT_NULL) {
+
+                live = table->entries[record->entry] != LFS_COMPACT_NULL &&
+                    (cls == LFS_COMPACT_CLASS_NULL || !lfs_compact_seen_has(&seen, record->entry, cls));
+            }
+        }
+
+        // and it replaces what came before it
+        if (lfs_tag_type3(tag) == LFS_FROM_USERATTRS) {
+
+            const lfs_user_attribute_t* a = (const lfs_user_attribute_t*)record->buffer;
+
+            for (unsigned j = 0; j < lfs_tag_size(tag); j++) {
+
+                if (record->entry != LFS_COMPACT_NULL) {
+
+                    lfs_compact_seen_add(&seen, record->entry, a[j].type);
+                }
+
+                later = true;
+            }
+        }
+        else if (lfs_tag_type3(tag) != LFS_FROM_MOVE) {
+
+            uint32_t cls = lfs_compact_class(tag);
+
+            if (record->entry != LFS_COMPACT_NULL && cls != LFS_COMPACT_CLASS_NULL) {
+
+                lfs_compact_seen_add(&seen, record->entry, cls);
+            }
+
+            later = true;
+        }
+
+        if (!live) {
+
+            record->tag = LFS_MKTAG(LFS_FROM_NOOP, 0, 0);
+        }
+    }
+
+    free(seen.keys);
+
+    // keep the live tags in order
+    uint32_t kept = 0;
+
+    for (uint32_t i = 0; i < table->record_count; i++) {
+
+        if (lfs_tag_type3(table->records[i].tag) != LFS_FROM_NOOP) {
+
+            table->records[kept] = table->records[i];
+            kept += 1;
+        }
+    }
+
+    table->record_count = kept;
+
+    // ids the entries end up at
+    for (uint32_t i = 0; i < table->id_count; i++) {
+
+        table->entries[table->ids[i]] = i;
+    }
+
+    return LFS_ERR_OK;
+}
+
+// Table of the tags of a log, followed by a list of attributes, that go out
+// when compacted, tmask and ttag pick the tags as with lfs_dir_traverse
+int lfs_compact_table_build(lfs_t* lfs, lfs_compact_table_t* table,
+    const lfs_metadata_dir_t* dir, const lfs_metadata_attribute_t* attrs, int attrcount,
+    lfs_tag_t tmask, lfs_tag_t ttag) {
+
+    table->block = dir->pair[0];
+    table->records = NULL;
+    table->record_count = 0;
+    table->record_capacity = 0;
+    table->ids = NULL;
+    table->id_count = 0;
+    table->id_capacity = 0;
+    table->entries = NULL;
+    table->entry_count = 0;
+    table->entry_capacity = 0;
+    table->moves = NULL;
+    table->move_count = 0;
+
+    lfs_off_t offset = 0;
+    lfs_tag_t ptag = 0xffffffff;
+
+    while (true) {
+
+        lfs_tag_t tag;
+        const void* buffer = NULL;
+        lfs_off_t toff = 0;
+
+        if (offset + lfs_tag_dsize(ptag) < dir->offset) {
+
+            offset += lfs_tag_dsize(ptag);
+
+            int err = lfs_bd_read(lfs, NULL, &lfs->read_cache, dir->offset - offset,
+                dir->pair[0], offset, &tag, sizeof(tag));
+
+            if (err) {
+
+                lfs_compact_table_release(table);
+                return err;
+            }
+
+            tag = (lfs_frombe32(tag) ^ ptag) | 0x80000000;
+            ptag = tag;
+            toff = offset + sizeof(lfs_tag_t);
+        }
+        else if (attrcount > 0) {
+
+            tag = attrs[0].tag;
+            buffer = attrs[0].buffer;
+            attrs += 1;
+            attrcount -= 1;
+        }
+        else {
+
+            break;
+        }
+
+        int err = lfs_compact_table_push(lfs, table, tag, buffer, toff, tmask, ttag);
+
+        if (err) {
+
+            lfs_compact_table_release(table);
+            return err;
+        }
+    }
+
+    int err = lfs_compact_table_filter(table, tmask, ttag);
+
+    if (err) {
+
+        lfs_compact_table_release(table);
+        return err;
+    }
+
+    return LFS_ERR_OK;
+}
+
+// Hand the live tags whose entries end up in [begin, end) to cb, ids moved
+// by diff, in the order lfs_dir_traverse would
+int lfs_compact_table_traverse(lfs_t* lfs, const lfs_compact_table_t* table,
+    uint16_t begin, uint16_t end, int16_t diff,
+    int (*cb)(void* data, lfs_tag_t tag, const void* buffer), void* data) {
+
+    for (uint32_t i = 0; i < table->record_count; i++) {
+
+        const lfs_compact_record_t* record = &table->records[i];
+
+        uint32_t id = (record->entry != LFS_COMPACT_NULL)
+            ? table->entries[record->entry]
+            : lfs_tag_id(record->tag);
+
+        if (!(id >= begin && id < end)) {
+
+            continue;
+        }
+
+        lfs_tag_t tag = (record->tag & ~LFS_MKTAG(0, 0x3ff, 0)) | LFS_MKTAG(0, id, 0);
+
+        if (lfs_tag_type3(tag) == LFS_FROM_MOVE) {
+
+            uint16_t fromid = (uint16_t)lfs_tag_size(tag);
+
+            int res = lfs_compact_table_traverse(lfs, &table->moves[record->offset],
+                fromid, fromid + 1, (int16_t)(id - fromid + diff), cb, data);
+
+            if (res) {
+
+                return res;
+            }
+        }
+        else if (lfs_tag_type3(tag) == LFS_FROM_USERATTRS) {
+
+            const lfs_user_attribute_t* a = (const lfs_user_attribute_t*)record->buffer;
+
+            for (unsigned j = 0; j < lfs_tag_size(tag); j++) {
+
+                int res = cb(data, LFS_MKTAG(LFS_TYPE_USERATTR + a[j].type, id + diff, a[j].size), a[j].buffer);
+
+                if (res) {
+
+                    return res;
+                }
+            }
+        }
+        else {
+
+            lfs_disk_offset_t disk = { table->block, record->offset };
+
+            int res = cb(data, tag + LFS_MKTAG(0, diff, 0),
+                (tag & 0x80000000) ? (const void*)&disk : record->buffer);
+
+            if (res) {
+
+                return res;
+            }
+        }
+    }
+
+    return LFS_ERR_OK;
+}
+
+void lfs_compact_table_release(lfs_compact_table_t* table) {
+
+    for (uint32_t i = 0; i < table->move_count; i++) {
+
+        lfs_compact_table_release(&table->moves[i]);
+    }
+
+    free(table->moves);
+    free(table->records);
+    free(table->ids);
+    free(table->entries);
+
+    table->moves = NULL;
+    table->move_count = 0;
+    table->records = NULL;
+    table->record_count = 0;
+    table->ids = NULL;
+    table->id_count = 0;
+    table->entries = NULL;
+    table->entry_count = 0;
+}
@@ -0,0 +1,408 @@
+#include "lfs.h"
+
+/// Metadata tag index operations ///
+
+// An index holds a record of every tag in the log of a metadata block and,
+// for each id, a list of the newest record of each type. Splices renumber
+// the ids as they are applied, so an entry is looked up by its id as it is
+// after the last commit, the same id lfs_dir_getslice works out by walking
+// back through the log. Records of a commit are only applied once its crc
+// has been checked.
+static bool lfs_tag_index_reserve(void** array, uint32_t* capacity, uint32_t count, size_t size) {
+
+    if (count <= *capacity) {
+
+        return true;
+    }
+
+    uint32_t grown = lfs_max(lfs_max(2 * *capacity, count), (uint32_t)16);
+    void* buffer = realloc(*array, grown * size);
+
+    if (!buffer) {
+
+        return false;
+    }
+
+    *array = buffer;
+    *capacity = grown;
+
+    return true;
+}
+
+static void lfs_tag_index_reset(lfs_tag_index_t* index) {
+
+    index->block = LFS_BLOCK_NULL;
+    index->offset = 0;
+    index->id_count = 0;
+    index->record_count = 0;
+    index->applied = 0;
+}
+
+// Take the index of a block whose log is about to be scanned, the least
+// recently used one if the block has none
+lfs_tag_index_t* lfs_tag_index_begin(lfs_t* lfs, const lfs_metadata_dir_t* dir) {
+
+    // the indexes belong to the exclusive lock holder
+    if (!lfs->tag_indexes || lfs_reader_current(lfs)) {
+
+        return NULL;
+    }
+
+    lfs_tag_index_t* index = &lfs->tag_indexes[0];
+
+    for (lfs_size_t i = 0; i < lfs->cfg->tag_index_count; i++) {
+
+        lfs_tag_index_t* other = &lfs->tag_indexes[i];
+
+        if (other->block == dir->pair[0]) {
+
+            index = other;
+            break;
+        }
+
+        if ((int32_t)(other->tick - index->tick) < 0) {
+
+            index = other;
+        }
+    }
+
+    lfs_tag_index_reset(index);
+    index->block = dir->pair[0];
+    index->revision_count = dir->revision_count;
+    index->etag = 0;
+    index->tick = ++lfs->tag_index_tick;
+
+    return index;
+}
+
+// Record a tag of the commit being scanned
+bool lfs_tag_index_push(lfs_t* lfs, lfs_tag_index_t* index, lfs_tag_t tag, lfs_off_t offset) {
+
+    (void)lfs;
+
+    if (!lfs_tag_index_reserve((void**)&index->records, &index->record_capacity,
+        index->record_count + 1, sizeof(lfs_tag_record_t))) {
+
+        lfs_tag_index_reset(index);
+        return false;
+    }
+
+    lfs_tag_record_t* record = &index->records[index->record_count];
+    record->tag = tag;
+    record->offset = offset;
+    record->next = LFS_TAG_RECORD_NULL;
+
+    index->record_count += 1;
+
+    return true;
+}
+
+// Apply the records of a commit whose crc checked out
+bool lfs_tag_index_apply(lfs_t* lfs, lfs_tag_index_t* index) {
+
+    (void)lfs;
+
+    for (uint32_t i = index->applied; i < index->record_count; i++) {
+
+        lfs_tag_t tag = index->records[i].tag;
+        uint32_t id = lfs_tag_id(tag);
+
+        if (id == 0x3ff) {
+
+            continue;
+        }
+
+        // make room for every id up to this one, and one more for a create
+        uint32_t count = lfs_max(index->id_count, id + 1);
+
+        if (!lfs_tag_index_reserve((void**)&index->ids, &index->id_capacity,
+            count + 1, sizeof(uint32_t))) {
+
+            lfs_tag_index_reset(index);
+            return false;
+        }
+
+        while (index->id_count < id) {
+
+            index->ids[index->id_count] = LFS_TAG_RECORD_NULL;
+            index->id_count += 1;
+        }
+
+        if (lfs_tag_type1(tag) == LFS_TYPE_SPLICE) {
+
+            if (lfs_tag_splice(tag) > 0) {
+
+                memmove(&index->ids[id + 1], &index->ids[id],
+                    (index->id_count - id) * sizeof(uint32_t));
+
+                index->ids[id] = LFS_TAG_RECORD_NULL;
+                index->id_count += 1;
+            }
+            else if (lfs_tag_splice(tag) < 0 && id < index->id_count) {
+
+                memmove(&index->ids[id], &index->ids[id + 1],
+                    (index->id_count - id - 1) * sizeof(uint32_t));
+
+                index->id_count -= 1;
+            }
+
+            continue;
+        }
+
+        if (id == index->id_count) {
+
+            index->ids[id] = LFS_TAG_RECORD_NULL;
+            index->id_count += 1;
+        }
+
+        // a newer tag of a type replaces the older one
+        uint32_t* link = &index->ids[id];
+
+        while (*link != LFS_TAG_RECORD_NULL) {
+
+            lfs_tag_record_t* older = &index->records[*link];
+
+            if (lfs_tag_type3(older->tag) == lfs_tag_type3(tag)) {
+
+                *link = older->next;
+                break;
+            }
+
+            link = &older->next;
+        }
+
+        index->records[i].next = index->ids[id];
+        index->ids[id] = i;
+    }
+
+    index->applied = index->record_count;
+
+    return true;
+}
+
+// Settle an index on the log as the dir found it, records of a commit that
+// didn't check out are dropped
+void lfs_tag_index_finish(lfs_t* lfs, lfs_tag_index_t* index, const lfs_metadata_dir_t* dir) {
+
+    (void)lfs;
+
+    if (dir->offset == 0 || dir->pair[0] != index->block) {
+
+        lfs_tag_index_reset(index);
+        return;
+    }
+
+    index->record_count = index->applied;
+    index->revision_count = dir->revision_count;
+    index->offset = dir->offset;
+    index->etag = dir->etag;
+}
+
+// Read the tags of a log between two offsets into an index, the tags are
+// known good so their crcs aren't checked again
+static int lfs_tag_index_scan(lfs_t* lfs, lfs_tag_index_t* index,
+    lfs_off_t offset, lfs_off_t end, lfs_tag_t ptag) {
+
+    while (offset < end) {
+
+        lfs_tag_t tag;
+
+        int err = lfs_bd_read(lfs, NULL, &lfs->read_cache, end - offset,
+            index->block, offset, &tag, sizeof(tag));
+
+        if (err) {
+
+            return err;
+        }
+
+        tag = lfs_frombe32(tag) ^ ptag;
+
+        if (!lfs_tag_isvalid(tag)) {
+
+            return LFS_ERR_CORRUPT;
+        }
+
+        ptag = tag;
+
+        if (lfs_tag_type1(tag) == LFS_TYPE_CRC) {
+
+            ptag ^= (lfs_tag_t)(lfs_tag_chunk(tag) & 1U) << 31;
+        }
+        else if (!lfs_tag_index_push(lfs, index, tag, offset)) {
+
+            return LFS_ERR_NOMEM;
+        }
+
+        offset += lfs_tag_dsize(tag);
+    }
+
+    if (!lfs_tag_index_apply(lfs, index)) {
+
+        return LFS_ERR_NOMEM;
+    }
+
+    return LFS_ERR_OK;
+}
+
+// Add the tags of a commit appended to a log whose index is up to date
+void lfs_tag_index_extend(lfs_t* lfs, const lfs_metadata_dir_t* dir, lfs_off_t offset, uint32_t etag) {
+
+    if (!lfs->tag_indexes) {
+
+        return;
+    }
+
+    for (lfs_size_t i = 0; i < lfs->cfg->tag_index_count; i++) {
+
+        lfs_tag_index_t* index = &lfs->tag_indexes[i];
+
+        if (index->block == dir->pair[0] && index->revision_count == dir->revision_count &&
+            index->offset == offset && index->etag == etag) {
+
+            index->offset = 0;
+
+            if (lfs_tag_index_scan(lfs, index, offset, dir->offset, etag)) {
+
+                lfs_tag_index_reset(index);
+                return;
+            }
+
+            lfs_tag_index_finish(lfs, index, dir);
+            return;
+        }
+    }
+}
+
+// Forget the index of a block that is about to be erased
+void lfs_tag_index_drop(lfs_t* lfs, lfs_block_t block) {
+
+    if (!lfs->tag_indexes) {
+
+        return;
+    }
+
+    for (lfs_size_t i = 0; i < lfs->cfg->tag_index_count; i++) {
+
+        if (lfs->tag_indexes[i].block == block) {
+
+            lfs_tag_index_reset(&lfs->tag_indexes[i]);
+        }
+    }
+}
+
+// Index the whole log of a dir into an index the caller owns
+int lfs_tag_index_build(lfs_t* lfs, lfs_tag_index_t* index, const lfs_metadata_dir_t* dir) {
+
+    lfs_tag_index_reset(index);
+    index->block = dir->pair[0];
+
+    int err = lfs_tag_index_scan(lfs, index, sizeof(uint32_t), dir->offset, 0xffffffff);
+
+    if (err) {
+
+        lfs_tag_index_reset(index);
+        return err;
+    }
+
+    lfs_tag_index_finish(lfs, index, dir);
+
+    return LFS_ERR_OK;
+}
+
+void lfs_tag_index_clear(lfs_tag_index_t* index) {
+
+    free(index->ids);
+    free(index->records);
+
+    index->ids = NULL;
+    index->id_capacity = 0;
+    index->records = NULL;
+    index->record_capacity = 0;
+
+    lfs_tag_index_reset(index);
+}
+
+void lfs_tag_index_release(lfs_t* lfs) {
+
+    if (!lfs->tag_indexes) {
+
+        return;
+    }
+
+    for (lfs_size_t i = 0; i < lfs->cfg->tag_index_count; i++) {
+
+        lfs_tag_index_clear(&lfs->tag_indexes[i]);
+    }
+
+    free(lfs->tag_indexes);
+    lfs->tag_indexes = NULL;
+}
+
+// Index of the log of a dir for a lookup, NULL when the lookup can't be
+// answered by one. A log fetched while its index was evicted, or compacted
+// since, is indexed on the spot, which reads it once front to back
+lfs_tag_index_t* lfs_tag_index_find(lfs_t* lfs, const lfs_metadata_dir_t* dir, lfs_tag_t gmask, lfs_tag_t gtag) {
+
+    if (!lfs->tag_indexes || lfs_reader_current(lfs)) {
+
+        return NULL;
+    }
+
+    // only the name, struct or attributes of one entry are indexed
+    if (lfs_tag_id(gmask) != 0x3ff || lfs_tag_id(gtag) == 0x3ff ||
+        lfs_tag_type1(gmask) != LFS_TYPE_GLOBALS ||
+        lfs_tag_type1(gtag) >= LFS_TYPE_SPLICE) {
+
+        return NULL;
+    }
+
+    for (lfs_size_t i = 0; i < lfs->cfg->tag_index_count; i++) {
+
+        lfs_tag_index_t* index = &lfs->tag_indexes[i];
+
+        if (index->block == dir->pair[0] && index->offset != 0 &&
+            index->offset == dir->offset && index->etag == dir->etag &&
+            index->revision_count == dir->revision_count) {
+
+            index->tick = ++lfs->tag_index_tick;
+            lfs->tag_index_hits += 1;
+            return index;
+        }
+    }
+
+    lfs->tag_index_misses += 1;
+
+    lfs_tag_index_t* index = lfs_tag_index_begin(lfs, dir);
+
+    if (lfs_tag_index_build(lfs, index, dir)) {
+
+        return NULL;
+    }
+
+    return (index->offset != 0) ? index : NULL;
+}
+
+// Newest tag of an entry matching a lookup, with the entry's current id
+lfs_stag_t lfs_tag_index_get(const lfs_tag_index_t* index, lfs_tag_t gmask, lfs_tag_t gtag, lfs_off_t* offset) {
+
+    uint32_t id = lfs_tag_id(gtag);
+    lfs_tag_t mask = gmask & ~LFS_MKTAG(0, 0x3ff, 0);
+
+    if (id >= index->id_count) {
+
+        return LFS_ERR_NOENT;
+    }
+
+    for (uint32_t i = index->ids[id]; i != LFS_TAG_RECORD_NULL; i = index->records[i].next) {
+
+        const lfs_tag_record_t* record = &index->records[i];
+
+        if ((mask & record->tag) == (mask & gtag)) {
+
+            *offset = record->offset;
+            return (record->tag & ~LFS_MKTAG(0, 0x3ff, 0)) | LFS_MKTAG(0, id, 0);
+        }
+    }
+
+    return LFS_ERR_NOENT;
+}
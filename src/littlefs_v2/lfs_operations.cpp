@@ -66,6 +66,16 @@ int lfs_fs_rawtraverse(lfs_t* lfs, int (*cb)(void* data, lfs_block_t block), voi
                 }
 
             }
+            else if (lfs_tag_type3(tag) == LFS_TYPE_EXTSTRUCT) {
+
+                // extents and their tables, data blocks are never read
+                err = lfs_extent_disk_traverse(lfs, &dir, id, cb, data);
+
+                if (err) {
+
+                    return err;
+                }
+            }
             else if (includeorphans && lfs_tag_type3(tag) == LFS_TYPE_DIRSTRUCT) {
 
                 for (int i = 0; i < 2; i++) {
@@ -88,6 +98,42 @@ int lfs_fs_rawtraverse(lfs_t* lfs, int (*cb)(void* data, lfs_block_t block), voi
             continue;
         }
 
+        // blocks set aside for the file are in use until written or given back
+        for (lfs_size_t j = 0; j < entry->reserved.count; j++) {
+
+            int err = cb(data, entry->reserved.start + j);
+
+            if (err) {
+
+                return err;
+            }
+        }
+
+        if (entry->flags & LFS_F_EXTENT) {
+
+            if (entry->flags & LFS_F_DIRTY) {
+
+                int err = lfs_extent_traverse(lfs, &entry->extents, cb, data);
+
+                if (err) {
+
+                    return err;
+                }
+            }
+
+            if (entry->flags & LFS_F_WRITING) {
+
+                int err = lfs_extent_traverse(lfs, &entry->wextents, cb, data);
+
+                if (err) {
+
+                    return err;
+                }
+            }
+
+            continue;
+        }
+
         if ((entry->flags & LFS_F_DIRTY) && !(entry->flags & LFS_F_INLINE)) {
 
             int err = lfs_ctz_traverse(lfs, &entry->cache, &lfs->read_cache, entry->ctz.head, entry->ctz.size, cb, data);
@@ -100,7 +146,12 @@ int lfs_fs_rawtraverse(lfs_t* lfs, int (*cb)(void* data, lfs_block_t block), voi
 
         if ((entry->flags & LFS_F_WRITING) && !(entry->flags & LFS_F_INLINE)) {
 
-            int err = lfs_ctz_traverse(lfs, &entry->cache, &lfs->read_cache, entry->block, entry->pos, cb, data);
+            // the block being written holds pos itself unless it is full, a
+            // block just extended onto has its pointers written but nothing
+            // past them yet
+            lfs_size_t size = (entry->offset < lfs->block_size) ? entry->pos + 1 : entry->pos;
+
+            int err = lfs_ctz_traverse(lfs, &entry->cache, &lfs->read_cache, entry->block, size, cb, data);
 
             if (err) {
 
@@ -109,6 +160,17 @@ int lfs_fs_rawtraverse(lfs_t* lfs, int (*cb)(void* data, lfs_block_t block), voi
         }
     }
 
+    // the free map checkpointed in the superblock
+    if (lfs->free.map.size) {
+
+        int err = lfs_ctz_traverse(lfs, NULL, &lfs->read_cache, lfs->free.map.head, lfs->free.map.size, cb, data);
+
+        if (err) {
+
+            return err;
+        }
+    }
+
     return LFS_ERR_OK;
 }
 
@@ -413,7 +475,26 @@ restart:
 
 int lfs_fs_forceconsistency(lfs_t* lfs) {
 
-    int err = lfs_fs_demove(lfs);
+    // the checkpointed free map is out of date once anything is committed
+    int err = lfs_alloc_release(lfs);
+
+    if (err) {
+        return err;
+    }
+
+    // nothing is half committed yet, a growth due can commit the superblock
+    lfs_alloc_growahead(lfs);
+
+    if (lfs->free.grown) {
+
+        err = lfs_fs_rawgrow(lfs, lfs->block_count);
+
+        if (err) {
+            return err;
+        }
+    }
+
+    err = lfs_fs_demove(lfs);
 
     if (err) {
         return err;
@@ -466,53 +547,266 @@ int lfs_fs_rawstat(lfs_t* lfs, struct lfs_fsinfo* fsinfo) {
     fsinfo->name_max = lfs->name_max_length;
     fsinfo->file_max = lfs->file_max_size;
     fsinfo->attr_max = lfs->attr_max_size;
+    fsinfo->cache_hits = lfs->read_hits;
+    fsinfo->cache_misses = lfs->read_misses;
+    fsinfo->dentry_hits = lfs->dentry_hits;
+    fsinfo->dentry_misses = lfs->dentry_misses;
+
+    for (lfs_size_t i = 0; lfs->readers && i < lfs->cfg->reader_count; i++) {
+
+        fsinfo->cache_hits += lfs->readers[i].hits;
+        fsinfo->cache_misses += lfs->readers[i].misses;
+    }
 
     return LFS_ERR_OK;
 }
 
+lfs_size_t lfs_fs_growsize(lfs_t* lfs) {
+
+    lfs_size_t step = lfs->cfg->grow_min ? lfs->cfg->grow_min : 10;
+
+    // room for a run of blocks being set aside
+    step = lfs_max(step, lfs->free.want);
+
+    if (lfs->cfg->grow_percent) {
+
+        step = lfs_max(step, lfs->block_count / 100 * lfs->cfg->grow_percent +
+            lfs->block_count % 100 * lfs->cfg->grow_percent / 100);
+    }
+
+    return lfs->block_count + step;
+}
+
 int lfs_fs_rawgrow(lfs_t* lfs, lfs_size_t block_count) {
 
     // shrinking is not supported
     LFS_ASSERT(block_count >= lfs->block_count);
 
     if (block_count > lfs->block_count) {
+
         lfs->block_count = block_count;
         lfs->cfg->block_count = block_count;
-        // fetch the root
-        lfs_metadata_dir_t root;
-        int err = lfs_dir_fetch(lfs, &root, lfs->root);
+        lfs->free.grown = true;
+    }
+
+    // grown from within an allocation, the commit it is for may be half
+    // written, the superblock is told at the start of the next operation
+    if (!lfs->free.grown || lfs->free.growing) {
+
+        return LFS_ERR_OK;
+    }
+
+    int err = lfs_alloc_release(lfs);
+
+    if (err) {
+
+        return err;
+    }
+
+    // fetch the root
+    lfs_metadata_dir_t root;
+    err = lfs_dir_fetch(lfs, &root, lfs->root);
+
+    if (err) {
+
+        return err;
+    }
+
+    // update the superblock
+    lfs_superblock_t superblock;
+    lfs_stag_t tag = lfs_dir_get(lfs, &root, LFS_MKTAG(LFS_TYPE_MOVESTATE, 0x3ff, 0),
+        LFS_MKTAG(LFS_TYPE_INLINESTRUCT, 0, sizeof(superblock)), &superblock);
+
+    if (tag < 0) {
+
+        return tag;
+    }
+
+    lfs_superblock_fromle64(&superblock);
+
+    superblock.block_count = lfs->block_count;
+    
+    lfs_superblock_tole64(&superblock);
+
+    lfs_metadata_attribute_t attr[] = {
+        { (lfs_tag_t)tag, &superblock }
+    };
+
+    err = lfs_dir_commit(lfs, &root, attr, _countof(attr));
+
+    if (err) {
+        return err;
+    }
+
+    lfs->free.grown = false;
+
+    return LFS_ERR_OK;
+}
+
+// raise the superblock's version before anything that needs it is
+// committed, an image left at the new version with nothing using it yet
+// is still valid
+int lfs_fs_raiseversion(lfs_t* lfs, uint32_t version) {
+
+    if (lfs->disk_version >= version) {
+
+        return LFS_ERR_OK;
+    }
+
+    int err = lfs_alloc_release(lfs);
+
+    if (err) {
+
+        return err;
+    }
+
+    // fetch the root
+    lfs_metadata_dir_t root;
+    err = lfs_dir_fetch(lfs, &root, lfs->root);
+
+    if (err) {
+
+        return err;
+    }
+
+    // update the superblock
+    lfs_superblock_t superblock;
+    lfs_stag_t tag = lfs_dir_get(lfs, &root, LFS_MKTAG(LFS_TYPE_MOVESTATE, 0x3ff, 0),
+        LFS_MKTAG(LFS_TYPE_INLINESTRUCT, 0, sizeof(superblock)), &superblock);
+
+    if (tag < 0) {
+
+        return tag;
+    }
+
+    lfs_superblock_fromle64(&superblock);
+
+    superblock.version = lfs_max(superblock.version, version);
+
+    lfs_superblock_tole64(&superblock);
+
+    lfs_metadata_attribute_t attr[] = {
+        { (lfs_tag_t)tag, &superblock }
+    };
+
+    err = lfs_dir_commit(lfs, &root, attr, _countof(attr));
+
+    if (err) {
+        return err;
+    }
+
+    lfs->disk_version = version;
+
+    return LFS_ERR_OK;
+}
+
+int lfs_fs_rawgcstep(lfs_t* lfs) {
+
+    // a move or removal left half done is finished first, as a commit would
+    if (lfs_gstate_hasmove(&lfs->gdisk) || lfs_gstate_hasorphans(&lfs->gstate)) {
+
+        int err = lfs_fs_forceconsistency(lfs);
 
         if (err) {
 
             return err;
         }
+    }
+
+    // pairs may have moved since the last step, start over from the root
+    if (lfs->gc_stamp != lfs->commit_stamp) {
 
-        // update the superblock
-        lfs_superblock_t superblock;
-        lfs_stag_t tag = lfs_dir_get(lfs, &root, LFS_MKTAG(LFS_TYPE_MOVESTATE, 0x3ff, 0),
-            LFS_MKTAG(LFS_TYPE_INLINESTRUCT, 0, sizeof(superblock)), &superblock);
+        lfs->gc_pair[0] = 0;
+        lfs->gc_pair[1] = 1;
+        lfs->gc_stamp = lfs->commit_stamp;
+    }
 
-        if (tag < 0) {
+    // a threshold that doesn't leave a program's worth of room can't be
+    // compacted below
+    lfs_size_t size = lfs->cfg->metadata_max ? lfs->cfg->metadata_max : lfs->block_size;
+    lfs_size_t thresh = lfs->cfg->compact_thresh ? lfs->cfg->compact_thresh : size - size / 8;
 
-            return tag;
+    if (thresh >= size - lfs->cfg->write_size) {
+
+        lfs->gc_pair[0] = LFS_BLOCK_NULL;
+        lfs->gc_pair[1] = LFS_BLOCK_NULL;
+    }
+
+    while (!lfs_pair_isnull(lfs->gc_pair)) {
+
+        lfs_metadata_dir_t dir;
+        int err = lfs_dir_fetch(lfs, &dir, lfs->gc_pair);
+
+        if (err) {
+
+            return err;
         }
 
-        lfs_superblock_fromle64(&superblock);
+        lfs->gc_pair[0] = dir.tail[0];
+        lfs->gc_pair[1] = dir.tail[1];
 
-        superblock.block_count = lfs->block_count;
-        
-        lfs_superblock_tole64(&superblock);
+        if (dir.erased && dir.offset <= thresh) {
 
-        lfs_metadata_attribute_t attr[] = {
-            { tag, &superblock }
-        };
+            continue;
+        }
 
-        err = lfs_dir_commit(lfs, &root, attr, _countof(attr));
+        // the free map is out of date once anything is committed
+        err = lfs_alloc_release(lfs);
 
         if (err) {
+
             return err;
         }
+
+        // which may have moved this pair
+        if (lfs->gc_stamp != lfs->commit_stamp) {
+
+            return true;
+        }
+
+        // an empty commit to a pair that can't be appended to compacts it
+        uint32_t stamp = lfs->commit_stamp;
+
+        dir.erased = false;
+        err = lfs_dir_commit(lfs, &dir, NULL, 0);
+
+        if (err) {
+
+            return err;
+        }
+
+        // a pair split off by the compaction is looked at next, unless the
+        // pair was relocated, the commits that took may have dropped pairs
+        // further on
+        if (lfs->commit_stamp == stamp + 1) {
+
+            lfs->gc_pair[0] = dir.tail[0];
+            lfs->gc_pair[1] = dir.tail[1];
+            lfs->gc_stamp = lfs->commit_stamp;
+        }
+
+        return true;
     }
 
-    return LFS_ERR_OK;
-}
\ No newline at end of file
+    int err = lfs_alloc_fill(lfs);
+
+    if (err) {
+
+        return err;
+    }
+
+    return false;
+}
+
+int lfs_fs_rawgc(lfs_t* lfs) {
+
+    while (true) {
+
+        int res = lfs_fs_rawgcstep(lfs);
+
+        if (res <= 0) {
+
+            return res;
+        }
+    }
+}
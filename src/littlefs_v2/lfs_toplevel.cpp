@@ -8,9 +8,54 @@
 #ifdef LFS_THREADSAFE
 #define LFS_LOCK(cfg)   cfg->lock(cfg)
 #define LFS_UNLOCK(cfg) cfg->unlock(cfg)
+#define LFS_LOCK_SHARED(lfs, reader, exclusive) lfs_lock_shared(lfs, reader, exclusive)
+#define LFS_UNLOCK_SHARED(lfs, reader)          lfs_unlock_shared(lfs, reader)
+
+// Read-only operations take the shared lock along with a private read cache,
+// or the exclusive lock when shared locking isn't configured, the operation
+// may have to write, or every private cache is taken
+static int lfs_lock_shared(lfs_t* lfs, lfs_reader_t** reader, bool exclusive) {
+
+    *reader = NULL;
+
+    if (!exclusive && lfs->cfg->lock_shared && lfs->readers) {
+
+        int err = lfs->cfg->lock_shared(lfs->cfg);
+
+        if (err) {
+
+            return err;
+        }
+
+        *reader = lfs_reader_begin(lfs);
+
+        if (*reader) {
+
+            return LFS_ERR_OK;
+        }
+
+        lfs->cfg->unlock_shared(lfs->cfg);
+    }
+
+    return lfs->cfg->lock(lfs->cfg);
+}
+
+static void lfs_unlock_shared(lfs_t* lfs, lfs_reader_t* reader) {
+
+    if (reader) {
+
+        lfs_reader_end(lfs, reader);
+        lfs->cfg->unlock_shared(lfs->cfg);
+        return;
+    }
+
+    lfs->cfg->unlock(lfs->cfg);
+}
 #else
 #define LFS_LOCK(cfg)   ((void)cfg, 0)
 #define LFS_UNLOCK(cfg) ((void)cfg)
+#define LFS_LOCK_SHARED(lfs, reader, exclusive) ((void)lfs, *(reader) = NULL, 0)
+#define LFS_UNLOCK_SHARED(lfs, reader)          ((void)lfs, (void)reader)
 #endif
 
 // Public API
@@ -133,7 +178,8 @@ int lfs_rename(lfs_t* lfs, const char* oldpath, const char* newpath) {
 
 int lfs_stat(lfs_t* lfs, const char* path, struct lfs_info* info) {
 
-    int err = LFS_LOCK(lfs->cfg);
+    lfs_reader_t* reader;
+    int err = LFS_LOCK_SHARED(lfs, &reader, false);
 
     if (err) {
 
@@ -145,13 +191,14 @@ int lfs_stat(lfs_t* lfs, const char* path, struct lfs_info* info) {
     err = lfs_raw_stat(lfs, path, info);
 
     LFS_TRACE("lfs_stat -> %d", err);
-    LFS_UNLOCK(lfs->cfg);
+    LFS_UNLOCK_SHARED(lfs, reader);
     return err;
 }
 
 lfs_ssize_t lfs_get_attribute(lfs_t* lfs, const char* path, uint8_t type, void* buffer, lfs_size_t size) {
 
-    int err = LFS_LOCK(lfs->cfg);
+    lfs_reader_t* reader;
+    int err = LFS_LOCK_SHARED(lfs, &reader, false);
 
     if (err) {
 
@@ -164,7 +211,7 @@ lfs_ssize_t lfs_get_attribute(lfs_t* lfs, const char* path, uint8_t type, void*
     lfs_ssize_t res = lfs_raw_get_attribute(lfs, path, type, buffer, size);
 
     LFS_TRACE("lfs_getattr -> %"PRId32, res);
-    LFS_UNLOCK(lfs->cfg);
+    LFS_UNLOCK_SHARED(lfs, reader);
     return res;
 }
 
@@ -283,7 +330,9 @@ int lfs_file_sync(lfs_t* lfs, lfs_file_t* file) {
 
 lfs_ssize_t lfs_file_read(lfs_t* lfs, lfs_file_t* file, void* buffer, lfs_size_t size) {
 
-    int err = LFS_LOCK(lfs->cfg);
+    // pending writes are flushed first, which needs the exclusive lock
+    lfs_reader_t* reader;
+    int err = LFS_LOCK_SHARED(lfs, &reader, (file->flags & LFS_F_WRITING) != 0);
 
     if (err) {
         return err;
@@ -296,7 +345,7 @@ lfs_ssize_t lfs_file_read(lfs_t* lfs, lfs_file_t* file, void* buffer, lfs_size_t
     lfs_ssize_t res = lfs_file_rawread(lfs, file, buffer, size);
 
     LFS_TRACE("lfs_file_read -> %"PRId32, res);
-    LFS_UNLOCK(lfs->cfg);
+    LFS_UNLOCK_SHARED(lfs, reader);
     return res;
 }
 
@@ -318,6 +367,45 @@ lfs_ssize_t lfs_file_write(lfs_t* lfs, lfs_file_t* file, const void* buffer, lfs
     return res;
 }
 
+lfs_ssize_t lfs_file_readv(lfs_t* lfs, lfs_file_t* file, const lfs_iovec_t* iov, lfs_size_t count) {
+
+    // pending writes are flushed first, which needs the exclusive lock
+    lfs_reader_t* reader;
+    int err = LFS_LOCK_SHARED(lfs, &reader, (file->flags & LFS_F_WRITING) != 0);
+
+    if (err) {
+        return err;
+    }
+
+    LFS_TRACE("lfs_file_readv(%p, %p, %p, %"PRIu32")",
+        (void*)lfs, (void*)file, (void*)iov, count);
+    LFS_ASSERT(lfs_mlist_isopen(lfs->metadata_list, (lfs_metadata_list_t*)file));
+
+    lfs_ssize_t res = lfs_file_rawreadv(lfs, file, iov, count);
+
+    LFS_TRACE("lfs_file_readv -> %"PRId32, res);
+    LFS_UNLOCK_SHARED(lfs, reader);
+    return res;
+}
+
+lfs_ssize_t lfs_file_writev(lfs_t* lfs, lfs_file_t* file, const lfs_iovec_t* iov, lfs_size_t count) {
+
+    int err = LFS_LOCK(lfs->cfg);
+
+    if (err) {
+        return err;
+    }
+
+    LFS_TRACE("lfs_file_writev(%p, %p, %p, %"PRIu32")", (void*)lfs, (void*)file, (void*)iov, count);
+    LFS_ASSERT(lfs_mlist_isopen(lfs->metadata_list, (lfs_metadata_list_t*)file));
+
+    lfs_ssize_t res = lfs_file_rawwritev(lfs, file, iov, count);
+
+    LFS_TRACE("lfs_file_writev -> %"PRId32, res);
+    LFS_UNLOCK(lfs->cfg);
+    return res;
+}
+
 lfs_soff_t lfs_file_seek(lfs_t* lfs, lfs_file_t* file, lfs_soff_t off, int whence) {
 
     int err = LFS_LOCK(lfs->cfg);
@@ -354,6 +442,24 @@ lfs_soff_t lfs_file_truncate(lfs_t* lfs, lfs_file_t* file, lfs_off_t size) {
     return err;
 }
 
+int lfs_file_fallocate(lfs_t* lfs, lfs_file_t* file, lfs_off_t offset, lfs_off_t size) {
+
+    int err = LFS_LOCK(lfs->cfg);
+
+    if (err) {
+        return err;
+    }
+
+    LFS_TRACE("lfs_file_fallocate(%p, %p, %"PRIu32", %"PRIu32")", (void*)lfs, (void*)file, offset, size);
+    LFS_ASSERT(lfs_mlist_isopen(lfs->metadata_list, (lfs_metadata_list_t*)file));
+
+    err = lfs_file_rawfallocate(lfs, file, offset, size);
+
+    LFS_TRACE("lfs_file_fallocate -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+
 lfs_soff_t lfs_file_tell(lfs_t* lfs, lfs_file_t* file) {
 
     lfs_soff_t err = LFS_LOCK(lfs->cfg);
@@ -461,7 +567,8 @@ int lfs_dir_close(lfs_t* lfs, lfs_dir_t* dir) {
 
 int lfs_dir_read(lfs_t* lfs, lfs_dir_t* dir, struct lfs_info* info) {
 
-    int err = LFS_LOCK(lfs->cfg);
+    lfs_reader_t* reader;
+    int err = LFS_LOCK_SHARED(lfs, &reader, false);
 
     if (err) {
         return err;
@@ -473,10 +580,29 @@ int lfs_dir_read(lfs_t* lfs, lfs_dir_t* dir, struct lfs_info* info) {
     err = lfs_dir_rawread(lfs, dir, info);
 
     LFS_TRACE("lfs_dir_read -> %d", err);
-    LFS_UNLOCK(lfs->cfg);
+    LFS_UNLOCK_SHARED(lfs, reader);
     return err;
 }
 
+lfs_ssize_t lfs_dir_readbatch(lfs_t* lfs, lfs_dir_t* dir, struct lfs_info* info, lfs_size_t count) {
+
+    lfs_reader_t* reader;
+    int err = LFS_LOCK_SHARED(lfs, &reader, false);
+
+    if (err) {
+        return err;
+    }
+
+    LFS_TRACE("lfs_dir_readbatch(%p, %p, %p, %"PRIu32")",
+        (void*)lfs, (void*)dir, (void*)info, count);
+
+    lfs_ssize_t res = lfs_dir_rawreadbatch(lfs, dir, info, count);
+
+    LFS_TRACE("lfs_dir_readbatch -> %"PRId32, res);
+    LFS_UNLOCK_SHARED(lfs, reader);
+    return res;
+}
+
 int lfs_dir_seek(lfs_t* lfs, lfs_dir_t* dir, lfs_off_t off) {
 
     int err = LFS_LOCK(lfs->cfg);
@@ -590,3 +716,175 @@ int lfs_fs_grow(lfs_t* lfs, lfs_size_t block_count) {
     LFS_UNLOCK(lfs->cfg);
     return err;
 }
+
+int lfs_fs_checkpoint(lfs_t* lfs) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_fs_checkpoint(%p)", (void*)lfs);
+
+    err = lfs_alloc_checkpoint(lfs);
+
+    LFS_TRACE("lfs_fs_checkpoint -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+
+int lfs_fs_gc(lfs_t* lfs) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_fs_gc(%p)", (void*)lfs);
+
+    err = lfs_fs_rawgc(lfs);
+
+    LFS_TRACE("lfs_fs_gc -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+
+int lfs_fs_gcstep(lfs_t* lfs) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_fs_gcstep(%p)", (void*)lfs);
+
+    err = lfs_fs_rawgcstep(lfs);
+
+    LFS_TRACE("lfs_fs_gcstep -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+
+int lfs_fs_sync(lfs_t* lfs) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_fs_sync(%p)", (void*)lfs);
+
+    err = lfs_bd_syncpending(lfs);
+
+    LFS_TRACE("lfs_fs_sync -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+
+int lfs_batch_begin(lfs_t* lfs) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_batch_begin(%p)", (void*)lfs);
+
+    err = lfs_batch_rawbegin(lfs);
+
+    LFS_TRACE("lfs_batch_begin -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+
+int lfs_batch_end(lfs_t* lfs) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_batch_end(%p)", (void*)lfs);
+
+    err = lfs_batch_rawend(lfs);
+
+    LFS_TRACE("lfs_batch_end -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+
+int lfs_tx_begin(lfs_t* lfs, lfs_tx_t* tx) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_tx_begin(%p, %p)", (void*)lfs, (void*)tx);
+
+    err = lfs_tx_rawbegin(lfs, tx);
+
+    LFS_TRACE("lfs_tx_begin -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+
+int lfs_tx_write(lfs_t* lfs, lfs_tx_t* tx, const char* path,
+    const void* buffer, lfs_size_t size) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_tx_write(%p, %p, \"%s\", %p, %"PRIu32")",
+        (void*)lfs, (void*)tx, path, buffer, size);
+
+    err = lfs_tx_rawwrite(lfs, tx, path, buffer, size);
+
+    LFS_TRACE("lfs_tx_write -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+
+int lfs_tx_set_attribute(lfs_t* lfs, lfs_tx_t* tx, const char* path,
+    uint8_t type, const void* buffer, lfs_size_t size) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_tx_setattr(%p, %p, \"%s\", %"PRIu8", %p, %"PRIu32")",
+        (void*)lfs, (void*)tx, path, type, buffer, size);
+
+    err = lfs_tx_raw_set_attribute(lfs, tx, path, type, buffer, size);
+
+    LFS_TRACE("lfs_tx_setattr -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+
+int lfs_tx_remove(lfs_t* lfs, lfs_tx_t* tx, const char* path) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_tx_remove(%p, %p, \"%s\")", (void*)lfs, (void*)tx, path);
+
+    err = lfs_tx_rawremove(lfs, tx, path);
+
+    LFS_TRACE("lfs_tx_remove -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+
+int lfs_tx_commit(lfs_t* lfs, lfs_tx_t* tx) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_tx_commit(%p, %p)", (void*)lfs, (void*)tx);
+
+    err = lfs_tx_rawcommit(lfs, tx);
+
+    LFS_TRACE("lfs_tx_commit -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+
+int lfs_tx_abort(lfs_t* lfs, lfs_tx_t* tx) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_tx_abort(%p, %p)", (void*)lfs, (void*)tx);
+
+    err = lfs_tx_rawabort(lfs, tx);
+
+    LFS_TRACE("lfs_tx_abort -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
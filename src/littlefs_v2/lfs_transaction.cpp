@@ -0,0 +1,770 @@
+#include "lfs.h"
+
+/// Transactions ///
+
+// An operation queued on one path, the operations on a path are merged into
+// one. Its data is written out as it is queued, into blocks or kept for the
+// inline struct, and the file holding it goes on the list of open files like
+// a file held by a batch, so its blocks stay in use. The entry is only looked
+// up when the transaction is committed, from the list it then follows the
+// commits made to its pair. The normalized path follows it in the same
+// allocation.
+struct lfs_tx_entry_t {
+
+    lfs_file_t file;
+    lfs_file_config_t cfg;
+
+    lfs_tx_entry_t* next;
+    const char* path;
+    uint32_t hash;
+
+    // name of the entry in its directory, once looked up
+    const char* name;
+    lfs_size_t nlen;
+
+    uint32_t flags;
+};
+
+enum lfs_tx_flags {
+    LFS_TX_WRITE = 0x01, // Replaces the data of the file, creating it
+    LFS_TX_REMOVE = 0x02, // Removes what is on disk first
+    LFS_TX_FOUND = 0x04, // Was on disk when queued
+    LFS_TX_DIR = 0x08, // Was a directory when queued
+    LFS_TX_EXISTS = 0x10, // Is on disk as looked up by the commit
+    LFS_TX_LISTED = 0x20, // On the list of open files
+    LFS_TX_QUEUED = 0x40, // On the list of the transaction
+    LFS_TX_DONE = 0x80, // Committed, or nothing to commit
+};
+
+// Set a file up as a new one truncated to nothing, without an entry
+static void lfs_tx_initfile(lfs_file_t* file, const lfs_file_config_t* cfg) {
+
+    *file = {};
+    file->type = LFS_TYPE_REG;
+    file->id = 0x3ff;
+    file->metadata.pair[0] = LFS_BLOCK_NULL;
+    file->metadata.pair[1] = LFS_BLOCK_NULL;
+    file->flags = LFS_O_WRONLY | LFS_F_INLINE;
+    file->ctz.head = LFS_BLOCK_INLINE;
+    file->cfg = cfg;
+}
+
+static void lfs_tx_releasefile(lfs_t* lfs, lfs_file_t* file) {
+
+    lfs_alloc_unreserve(lfs, &file->reserved);
+    free(file->cache.buffer);
+    lfs_index_cache_release(lfs, &file->index);
+    lfs_extent_release(&file->extents);
+    lfs_extent_release(&file->wextents);
+    free(file->readahead.buffer);
+}
+
+// Let go of the data queued for an entry, its blocks are free again once the
+// allocator next looks
+static void lfs_tx_dropdata(lfs_t* lfs, lfs_tx_entry_t* entry) {
+
+    if (entry->flags & LFS_TX_LISTED) {
+
+        lfs_mlist_remove(lfs, (lfs_metadata_list_t*)&entry->file);
+        entry->flags &= ~LFS_TX_LISTED;
+    }
+
+    lfs_tx_releasefile(lfs, &entry->file);
+    lfs_tx_initfile(&entry->file, &entry->cfg);
+
+    entry->flags &= ~LFS_TX_WRITE;
+}
+
+static void lfs_tx_dropattrs(lfs_tx_entry_t* entry) {
+
+    for (lfs_size_t i = 0; i < entry->cfg.attr_count; i++) {
+
+        free(entry->cfg.attrs[i].buffer);
+    }
+
+    free(entry->cfg.attrs);
+
+    entry->cfg.attrs = NULL;
+    entry->cfg.attr_count = 0;
+}
+
+// Normalize a path into out, which has room for it. Empty components and
+// "." are left out, ".." takes the component before it with it. Returns
+// the length.
+static lfs_size_t lfs_tx_normalize(const char* path, char* out) {
+
+    lfs_size_t len = 0;
+
+    while (true) {
+
+        path += strspn(path, "/");
+        lfs_size_t n = (lfs_size_t)strcspn(path, "/");
+
+        if (n == 0) {
+            break;
+        }
+
+        if (n == 2 && memcmp(path, "..", 2) == 0) {
+
+            while (len > 0 && out[len - 1] != '/') {
+                len -= 1;
+            }
+
+            len -= (len > 0) ? 1 : 0;
+        }
+        else if (!(n == 1 && path[0] == '.')) {
+
+            if (len > 0) {
+                out[len++] = '/';
+            }
+
+            memcpy(&out[len], path, n);
+            len += n;
+        }
+
+        path += n;
+    }
+
+    out[len] = '\0';
+
+    return len;
+}
+
+// Find the entry queued for a path, or set up a new one, looked up as the
+// filesystem is now. A new entry is only queued once its operation went
+// through, see lfs_tx_queue.
+static int lfs_tx_find(lfs_t* lfs, lfs_tx_t* tx, const char* path, lfs_tx_entry_t** result) {
+
+    lfs_tx_entry_t* entry = (lfs_tx_entry_t*)malloc(sizeof(lfs_tx_entry_t) + strlen(path) + 1);
+
+    if (!entry) {
+        return LFS_ERR_NOMEM;
+    }
+
+    char* normal = (char*)(entry + 1);
+    lfs_size_t len = lfs_tx_normalize(path, normal);
+    uint32_t hash = lfs_crc(0xffffffff, normal, len);
+
+    for (lfs_tx_entry_t* queued = tx->entries; queued; queued = queued->next) {
+
+        if (queued->hash == hash && strcmp(queued->path, normal) == 0) {
+
+            free(entry);
+            *result = queued;
+            return LFS_ERR_OK;
+        }
+    }
+
+    // the root has no entry of its own to change
+    if (len == 0) {
+
+        free(entry);
+        return LFS_ERR_INVAL;
+    }
+
+    lfs_metadata_dir_t cwd;
+    const char* name = normal;
+    uint16_t id;
+    lfs_stag_t tag = lfs_dir_find(lfs, &cwd, &name, &id);
+
+    if (tag < 0 && !(tag == LFS_ERR_NOENT && id != 0x3ff)) {
+
+        free(entry);
+        return tag;
+    }
+
+    if (tag == LFS_ERR_NOENT && strlen(name) > lfs->name_max_length) {
+
+        free(entry);
+        return LFS_ERR_NAMETOOLONG;
+    }
+
+    entry->cfg = {};
+    lfs_tx_initfile(&entry->file, &entry->cfg);
+
+    entry->next = NULL;
+    entry->path = normal;
+    entry->hash = hash;
+    entry->name = NULL;
+    entry->nlen = 0;
+    entry->flags = 0;
+
+    if (tag >= 0) {
+
+        entry->flags |= LFS_TX_FOUND;
+        entry->flags |= (lfs_tag_type3(tag) == LFS_TYPE_DIR) ? LFS_TX_DIR : 0;
+    }
+
+    *result = entry;
+    return LFS_ERR_OK;
+}
+
+// Queue a new entry its operation went through, or free it if it failed
+static int lfs_tx_queue(lfs_tx_t* tx, lfs_tx_entry_t* entry, int err) {
+
+    if (entry->flags & LFS_TX_QUEUED) {
+        return err;
+    }
+
+    if (err) {
+
+        free(entry);
+        return err;
+    }
+
+    entry->flags |= LFS_TX_QUEUED;
+
+    if (tx->last) {
+        tx->last->next = entry;
+    }
+    else {
+        tx->entries = entry;
+    }
+
+    tx->last = entry;
+    tx->count += 1;
+
+    return LFS_ERR_OK;
+}
+
+// An entry is there for the operations after it if it was on disk and not
+// removed since, or the transaction writes it
+static bool lfs_tx_exists(const lfs_tx_entry_t* entry) {
+
+    return (entry->flags & LFS_TX_WRITE) ||
+        ((entry->flags & LFS_TX_FOUND) && !(entry->flags & LFS_TX_REMOVE));
+}
+
+int lfs_tx_rawbegin(lfs_t* lfs, lfs_tx_t* tx) {
+
+    (void)lfs;
+
+    tx->entries = NULL;
+    tx->last = NULL;
+    tx->count = 0;
+
+    return LFS_ERR_OK;
+}
+
+// Write the whole file out as a new one, the data queued before is only let
+// go of once this went through
+static int lfs_tx_writedata(lfs_t* lfs, lfs_tx_entry_t* entry, const void* buffer, lfs_size_t size) {
+
+    if (entry->flags & LFS_TX_DIR) {
+        return LFS_ERR_ISDIR;
+    }
+
+    if (size > lfs->file_max_size) {
+        return LFS_ERR_FBIG;
+    }
+
+    lfs_file_t file;
+    lfs_tx_initfile(&file, &entry->cfg);
+
+    file.cache.buffer = (uint8_t*)malloc(lfs->cfg->cache_size);
+
+    if (!file.cache.buffer) {
+        return LFS_ERR_NOMEM;
+    }
+
+    // zero to avoid information leak
+    lfs_cache_zero(lfs, &file.cache);
+    file.cache.block = LFS_BLOCK_INLINE;
+    file.cache.offset = 0;
+    file.cache.size = lfs->cfg->cache_size;
+
+    // listed while written, the blocks it takes are in use for a traversal
+    // the allocator makes in between
+    lfs_mlist_append(lfs, (lfs_metadata_list_t*)&file);
+
+    lfs_ssize_t res = lfs_file_flushedwrite(lfs, &file, buffer, size);
+    int err = (res < 0) ? (int)res : lfs_file_flush(lfs, &file);
+
+    lfs_mlist_remove(lfs, (lfs_metadata_list_t*)&file);
+
+    if (err) {
+
+        lfs_tx_releasefile(lfs, &file);
+        return err;
+    }
+
+    lfs_tx_dropdata(lfs, entry);
+
+    // the commit only needs what is inlined of the cache, and a written out
+    // file none of it
+    lfs_index_cache_release(lfs, &file.index);
+    lfs_extent_release(&file.wextents);
+
+    if (!(file.flags & LFS_F_INLINE) || file.ctz.size == 0) {
+
+        free(file.cache.buffer);
+        file.cache.buffer = NULL;
+        lfs_cache_drop(lfs, &file.cache);
+    }
+    else {
+
+        uint8_t* data = (uint8_t*)realloc(file.cache.buffer, file.ctz.size);
+        file.cache.buffer = data ? data : file.cache.buffer;
+    }
+
+    entry->file = file;
+    entry->file.flags |= LFS_F_DIRTY;
+    entry->flags |= LFS_TX_WRITE | LFS_TX_LISTED;
+
+    lfs_mlist_append(lfs, (lfs_metadata_list_t*)&entry->file);
+
+    return LFS_ERR_OK;
+}
+
+int lfs_tx_rawwrite(lfs_t* lfs, lfs_tx_t* tx, const char* path, const void* buffer, lfs_size_t size) {
+
+    int err = lfs_fs_forceconsistency(lfs);
+
+    if (err) {
+        return err;
+    }
+
+    lfs_tx_entry_t* entry;
+
+    err = lfs_tx_find(lfs, tx, path, &entry);
+
+    if (err) {
+        return err;
+    }
+
+    return lfs_tx_queue(tx, entry, lfs_tx_writedata(lfs, entry, buffer, size));
+}
+
+static int lfs_tx_setattr(lfs_t* lfs, lfs_tx_entry_t* entry, uint8_t type, const void* buffer, lfs_size_t size) {
+
+    if (size > lfs->attr_max_size) {
+        return LFS_ERR_NOSPC;
+    }
+
+    if (!lfs_tx_exists(entry)) {
+        return LFS_ERR_NOENT;
+    }
+
+    void* data = malloc(lfs_max(size, 1));
+
+    if (!data) {
+        return LFS_ERR_NOMEM;
+    }
+
+    memcpy(data, buffer, size);
+
+    // an attribute set again replaces the one before
+    lfs_size_t i = 0;
+
+    while (i < entry->cfg.attr_count && entry->cfg.attrs[i].type != type) {
+        i += 1;
+    }
+
+    if (i == entry->cfg.attr_count) {
+
+        lfs_user_attribute_t* attrs = (lfs_user_attribute_t*)realloc(entry->cfg.attrs,
+            (entry->cfg.attr_count + 1) * sizeof(lfs_user_attribute_t));
+
+        if (!attrs) {
+
+            free(data);
+            return LFS_ERR_NOMEM;
+        }
+
+        entry->cfg.attrs = attrs;
+        entry->cfg.attr_count += 1;
+        entry->cfg.attrs[i].buffer = NULL;
+    }
+
+    free(entry->cfg.attrs[i].buffer);
+
+    entry->cfg.attrs[i].type = type;
+    entry->cfg.attrs[i].buffer = data;
+    entry->cfg.attrs[i].size = size;
+
+    return LFS_ERR_OK;
+}
+
+int lfs_tx_raw_set_attribute(lfs_t* lfs, lfs_tx_t* tx, const char* path,
+    uint8_t type, const void* buffer, lfs_size_t size) {
+
+    int err = lfs_fs_forceconsistency(lfs);
+
+    if (err) {
+        return err;
+    }
+
+    lfs_tx_entry_t* entry;
+
+    err = lfs_tx_find(lfs, tx, path, &entry);
+
+    if (err) {
+        return err;
+    }
+
+    return lfs_tx_queue(tx, entry, lfs_tx_setattr(lfs, entry, type, buffer, size));
+}
+
+static int lfs_tx_removeentry(lfs_t* lfs, lfs_tx_entry_t* entry) {
+
+    if (entry->flags & LFS_TX_DIR) {
+        return LFS_ERR_ISDIR;
+    }
+
+    if (!lfs_tx_exists(entry)) {
+        return LFS_ERR_NOENT;
+    }
+
+    lfs_tx_dropdata(lfs, entry);
+    lfs_tx_dropattrs(entry);
+
+    // a file only the transaction wrote is left with nothing to do
+    if (entry->flags & LFS_TX_FOUND) {
+        entry->flags |= LFS_TX_REMOVE;
+    }
+
+    return LFS_ERR_OK;
+}
+
+int lfs_tx_rawremove(lfs_t* lfs, lfs_tx_t* tx, const char* path) {
+
+    int err = lfs_fs_forceconsistency(lfs);
+
+    if (err) {
+        return err;
+    }
+
+    lfs_tx_entry_t* entry;
+
+    err = lfs_tx_find(lfs, tx, path, &entry);
+
+    if (err) {
+        return err;
+    }
+
+    return lfs_tx_queue(tx, entry, lfs_tx_removeentry(lfs, entry));
+}
+
+int lfs_tx_rawabort(lfs_t* lfs, lfs_tx_t* tx) {
+
+    lfs_tx_entry_t* entry = tx->entries;
+
+    while (entry) {
+
+        lfs_tx_entry_t* next = entry->next;
+
+        lfs_tx_dropdata(lfs, entry);
+        lfs_tx_dropattrs(entry);
+        free(entry);
+
+        entry = next;
+    }
+
+    return lfs_tx_rawbegin(lfs, tx);
+}
+
+// Look an entry up for the commit, into the pair and id its file follows
+// from here on. Errors before anything is committed if it can't be made.
+static int lfs_tx_resolve(lfs_t* lfs, lfs_tx_entry_t* entry) {
+
+    entry->flags &= ~LFS_TX_EXISTS;
+
+    if (!(entry->flags & (LFS_TX_WRITE | LFS_TX_REMOVE)) && !entry->cfg.attr_count) {
+
+        entry->flags |= LFS_TX_DONE;
+        return LFS_ERR_OK;
+    }
+
+    const char* name = entry->path;
+    lfs_stag_t tag = lfs_dir_find(lfs, &entry->file.metadata, &name, &entry->file.id);
+
+    if (tag < 0 && !(tag == LFS_ERR_NOENT && entry->file.id != 0x3ff)) {
+        return tag;
+    }
+
+    entry->name = name;
+    entry->nlen = (lfs_size_t)strlen(name);
+
+    if (tag >= 0) {
+
+        if (lfs_tag_type3(tag) != LFS_TYPE_REG && (entry->flags & (LFS_TX_WRITE | LFS_TX_REMOVE))) {
+            return LFS_ERR_ISDIR;
+        }
+
+        entry->flags |= LFS_TX_EXISTS;
+    }
+    else if (!(entry->flags & LFS_TX_WRITE)) {
+
+        // attributes need the entry, a removed one is gone already
+        if (entry->cfg.attr_count) {
+            return LFS_ERR_NOENT;
+        }
+
+        entry->flags |= LFS_TX_DONE;
+        return LFS_ERR_OK;
+    }
+    else if (entry->nlen > lfs->name_max_length) {
+
+        return LFS_ERR_NAMETOOLONG;
+    }
+
+    if (!(entry->flags & LFS_TX_LISTED)) {
+
+        lfs_mlist_append(lfs, (lfs_metadata_list_t*)&entry->file);
+        entry->flags |= LFS_TX_LISTED;
+    }
+
+    return LFS_ERR_OK;
+}
+
+static int lfs_tx_namecmp(const lfs_tx_entry_t* a, const lfs_tx_entry_t* b) {
+
+    int res = memcmp(a->name, b->name, lfs_min(a->nlen, b->nlen));
+
+    if (res) {
+        return res;
+    }
+
+    // names sort before the names they are a prefix of, see
+    // lfs_dir_find_match
+    return (int)b->nlen - (int)a->nlen;
+}
+
+// Order the entries of a pair are committed in. Going down the ids, an id is
+// taken by what comes after it before the ids below it are. The entry on
+// disk at an id goes first, then the names created in front of it, from the
+// last of them in order, so each ends up where lfs_dir_find would put it.
+static int lfs_tx_order(const void* pa, const void* pb) {
+
+    const lfs_tx_entry_t* a = *(const lfs_tx_entry_t* const*)pa;
+    const lfs_tx_entry_t* b = *(const lfs_tx_entry_t* const*)pb;
+
+    if (a->file.id != b->file.id) {
+        return (a->file.id > b->file.id) ? -1 : 1;
+    }
+
+    if ((a->flags & LFS_TX_EXISTS) != (b->flags & LFS_TX_EXISTS)) {
+        return (a->flags & LFS_TX_EXISTS) ? -1 : 1;
+    }
+
+    return -lfs_tx_namecmp(a, b);
+}
+
+static bool lfs_tx_pending(const lfs_tx_entry_t* entry, const lfs_block_t pair[2]) {
+
+    return !(entry->flags & LFS_TX_DONE) && lfs_pair_cmp(entry->file.metadata.pair, pair) == 0;
+}
+
+// Commit every entry of the transaction on the pair of the first one with
+// one commit. Only a pair running out of ids takes more than one, the
+// entries left over are looked up again for the next.
+static int lfs_tx_commitpair(lfs_t* lfs, lfs_tx_t* tx, lfs_tx_entry_t* first) {
+
+    lfs_block_t pair[2] = { first->file.metadata.pair[0], first->file.metadata.pair[1] };
+
+    lfs_size_t count = 0;
+    lfs_size_t extent_count = 0;
+
+    for (lfs_tx_entry_t* entry = tx->entries; entry; entry = entry->next) {
+
+        if (lfs_tx_pending(entry, pair)) {
+
+            count += 1;
+            extent_count += ((entry->flags & LFS_TX_WRITE) && (entry->file.flags & LFS_F_EXTENT)) ? 1 : 0;
+        }
+    }
+
+    // the entries, at most five attributes each and the room to build their
+    // structs in
+    lfs_tx_entry_t** group = (lfs_tx_entry_t**)malloc(count * (sizeof(lfs_tx_entry_t*) +
+        5 * sizeof(lfs_metadata_attribute_t) + sizeof(lfs_ctz_t)) + extent_count * 0x3fe);
+
+    if (!group) {
+        return LFS_ERR_NOMEM;
+    }
+
+    lfs_metadata_attribute_t* attrs = (lfs_metadata_attribute_t*)&group[count];
+    lfs_ctz_t* ctzs = (lfs_ctz_t*)&attrs[5 * count];
+    uint8_t* extents = (uint8_t*)&ctzs[count];
+
+    lfs_size_t n = 0;
+
+    for (lfs_tx_entry_t* entry = tx->entries; entry; entry = entry->next) {
+
+        if (lfs_tx_pending(entry, pair)) {
+            group[n++] = entry;
+        }
+    }
+
+    qsort(group, count, sizeof(lfs_tx_entry_t*), lfs_tx_order);
+
+    // ids of the tags stop short of 0x3ff
+    lfs_size_t room = 0x3fe - lfs_min(group[0]->file.metadata.count, 0x3fe);
+    lfs_size_t creates = 0;
+    int attrcount = 0;
+    int err = LFS_ERR_OK;
+
+    for (n = 0; n < count; n++) {
+
+        lfs_tx_entry_t* entry = group[n];
+        uint16_t id = entry->file.id;
+
+        if ((entry->flags & LFS_TX_WRITE) && !(entry->flags & LFS_TX_EXISTS)) {
+
+            if (n > 0 && creates == room) {
+                break;
+            }
+
+            creates += 1;
+        }
+
+        if ((entry->flags & LFS_TX_EXISTS) && (entry->flags & LFS_TX_REMOVE)) {
+
+            attrs[attrcount++] = { LFS_MKTAG(LFS_TYPE_DELETE, id, 0), NULL };
+        }
+
+        if (entry->flags & LFS_TX_WRITE) {
+
+            if (!(entry->flags & LFS_TX_EXISTS) || (entry->flags & LFS_TX_REMOVE)) {
+
+                attrs[attrcount++] = { LFS_MKTAG(LFS_TYPE_CREATE, id, 0), NULL };
+                attrs[attrcount++] = { LFS_MKTAG(LFS_TYPE_REG, id, entry->nlen), entry->name };
+            }
+
+            uint16_t type;
+            const void* buffer;
+            lfs_size_t size;
+
+            err = lfs_file_commitstruct(lfs, &entry->file, &type, &buffer, &size, &ctzs[n], extents);
+
+            if (err) {
+                goto done;
+            }
+
+            if (entry->file.flags & LFS_F_EXTENT) {
+                extents += 0x3fe;
+            }
+
+            attrs[attrcount++] = { LFS_MKTAG(type, id, size), buffer };
+        }
+
+        if (entry->cfg.attr_count) {
+
+            attrs[attrcount++] = { LFS_MKTAG(LFS_FROM_USERATTRS, id, entry->cfg.attr_count), entry->cfg.attrs };
+        }
+    }
+
+    err = lfs_dir_commit(lfs, &group[0]->file.metadata, attrs, attrcount);
+
+    if (err) {
+        goto done;
+    }
+
+    for (lfs_size_t i = 0; i < n; i++) {
+
+        group[i]->flags |= LFS_TX_DONE;
+    }
+
+    // the ids of the names left over may have been taken, they are put
+    // where they now belong
+    for (lfs_size_t i = n; i < count; i++) {
+
+        err = lfs_tx_resolve(lfs, group[i]);
+
+        if (err) {
+            goto done;
+        }
+    }
+
+done:
+    free(group);
+
+    return err;
+}
+
+// Commit the entries once all of them are looked up, so a transaction that
+// can't be made fails before any of it is committed
+static int lfs_tx_apply(lfs_t* lfs, lfs_tx_t* tx) {
+
+    int err = lfs_fs_forceconsistency(lfs);
+
+    if (err) {
+        return err;
+    }
+
+    // what an open batch holds back was synced before
+    if (lfs->batch_depth) {
+
+        err = lfs_batch_flush(lfs);
+
+        if (err) {
+            return err;
+        }
+    }
+
+    err = lfs_alloc_release(lfs);
+
+    if (err) {
+        return err;
+    }
+
+    // the superblock is raised before the ids of the entries are taken, the
+    // commit could move them
+    for (lfs_tx_entry_t* entry = tx->entries; entry; entry = entry->next) {
+
+        if ((entry->flags & LFS_TX_WRITE) && (entry->file.flags & LFS_F_EXTENT)) {
+
+            err = lfs_fs_raiseversion(lfs, LFS_DISK_VERSION_EXTENTS);
+
+            if (err) {
+                return err;
+            }
+
+            break;
+        }
+    }
+
+    for (lfs_tx_entry_t* entry = tx->entries; entry; entry = entry->next) {
+
+        err = lfs_tx_resolve(lfs, entry);
+
+        if (err) {
+            return err;
+        }
+    }
+
+    // the commits sync the device once, at the end
+    lfs_batch_rawbegin(lfs);
+
+    while (true) {
+
+        lfs_tx_entry_t* first = tx->entries;
+
+        while (first && (first->flags & LFS_TX_DONE)) {
+            first = first->next;
+        }
+
+        if (!first) {
+            break;
+        }
+
+        err = lfs_tx_commitpair(lfs, tx, first);
+
+        if (err) {
+            break;
+        }
+    }
+
+    int res = lfs_batch_rawend(lfs);
+
+    return err ? err : res;
+}
+
+int lfs_tx_rawcommit(lfs_t* lfs, lfs_tx_t* tx) {
+
+    int err = lfs_tx_apply(lfs, tx);
+
+    lfs_tx_rawabort(lfs, tx);
+
+    return err;
+}
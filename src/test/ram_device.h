@@ -0,0 +1,275 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <cstring>
+
+#include "lfs.h"
+
+// Block device kept in one buffer. Programs only go onto erased bytes, as on
+// flash, so a block handed out while still in use shows up as a failed
+// program instead of silently mixed data. Every call is counted, the counts
+// are reported next to the timings of the tests.
+static const uint8_t test_ram_erased = 0xff;
+
+struct test_ram_t {
+
+    std::vector<uint8_t> image;
+
+    // filesystem grown through allocate_block, and how far it may grow, no
+    // growth when zero
+    lfs_t* lfs = nullptr;
+    lfs_size_t grow_limit = 0;
+
+    // atomic, reads come from several threads under lock_shared
+    std::atomic<uint64_t> reads{ 0 };
+    std::atomic<uint64_t> progs{ 0 };
+    std::atomic<uint64_t> erases{ 0 };
+    std::atomic<uint64_t> syncs{ 0 };
+    std::atomic<uint64_t> grows{ 0 };
+    std::atomic<uint64_t> locks{ 0 };
+
+    // calls of the optional callbacks, each also counted as what it stands
+    // in for
+    std::atomic<uint64_t> batches{ 0 };
+    std::atomic<uint64_t> maps{ 0 };
+    std::atomic<uint64_t> copies{ 0 };
+    std::atomic<uint64_t> crcs{ 0 };
+
+    // programs onto bytes that weren't erased
+    std::atomic<uint64_t> violations{ 0 };
+
+    // a worn block, programs to it flip a bit of what they write without
+    // failing, and how many did so
+    lfs_block_t bad_block = LFS_BLOCK_NULL;
+    std::atomic<uint64_t> bad_progs{ 0 };
+
+    // programs that go through before the device acts as if it lost power
+    // and fails every one after them, no limit when zero
+    uint64_t prog_limit = 0;
+};
+
+static inline int test_ram_read(const lfs_config_t* config, lfs_block_t block,
+    lfs_off_t off, void* buffer, lfs_size_t size) {
+
+    test_ram_t* ram = (test_ram_t*)config->context;
+
+    if (block >= config->block_count || off + size > config->block_size) {
+        return LFS_ERR_IO;
+    }
+
+    memcpy(buffer, &ram->image[(size_t)block * config->block_size + off], size);
+    ram->reads += 1;
+
+    return LFS_ERR_OK;
+}
+
+// Reads each region of a batch in turn
+static inline int test_ram_read_batch(const lfs_config_t* config,
+    const lfs_bd_request_t* requests, lfs_size_t count) {
+
+    ((test_ram_t*)config->context)->batches += 1;
+
+    for (lfs_size_t i = 0; i < count; i++) {
+
+        int err = test_ram_read(config, requests[i].block, requests[i].offset,
+            requests[i].buffer, requests[i].size);
+
+        if (err) {
+            return err;
+        }
+    }
+
+    return LFS_ERR_OK;
+}
+
+// Lends out the image itself, which moves when the device grows, as the
+// map callback allows. Counted as a read.
+static inline const void* test_ram_map(const lfs_config_t* config, lfs_block_t block,
+    lfs_off_t off, lfs_size_t size) {
+
+    test_ram_t* ram = (test_ram_t*)config->context;
+
+    if (block >= config->block_count || off + size > config->block_size) {
+        return NULL;
+    }
+
+    ram->reads += 1;
+    ram->maps += 1;
+
+    return &ram->image[(size_t)block * config->block_size + off];
+}
+
+static inline int test_ram_prog(const lfs_config_t* config, lfs_block_t block,
+    lfs_off_t off, const void* buffer, lfs_size_t size) {
+
+    test_ram_t* ram = (test_ram_t*)config->context;
+
+    if (block >= config->block_count || off + size > config->block_size) {
+        return LFS_ERR_IO;
+    }
+
+    if (ram->prog_limit && ram->progs >= ram->prog_limit) {
+        return LFS_ERR_IO;
+    }
+
+    uint8_t* data = &ram->image[(size_t)block * config->block_size + off];
+
+    for (lfs_size_t i = 0; i < size; i++) {
+
+        if (data[i] != test_ram_erased) {
+            ram->violations += 1;
+            return LFS_ERR_IO;
+        }
+    }
+
+    memcpy(data, buffer, size);
+    ram->progs += 1;
+
+    if (block == ram->bad_block && size) {
+        data[size / 2] ^= 0x10;
+        ram->bad_progs += 1;
+    }
+
+    return LFS_ERR_OK;
+}
+
+// Copies within the image, onto erased bytes only like a program, and
+// counted as one
+static inline int test_ram_copy(const lfs_config_t* config, lfs_block_t block,
+    lfs_off_t off, lfs_block_t src_block, lfs_off_t src_off, lfs_size_t size) {
+
+    test_ram_t* ram = (test_ram_t*)config->context;
+
+    if (src_block >= config->block_count || src_off + size > config->block_size) {
+        return LFS_ERR_IO;
+    }
+
+    ram->copies += 1;
+
+    return test_ram_prog(config, block, off,
+        &ram->image[(size_t)src_block * config->block_size + src_off], size);
+}
+
+// Crcs a region as the image holds it, for LFS_VERIFY_CRC. Counted as a
+// read.
+static inline int test_ram_crc(const lfs_config_t* config, lfs_block_t block,
+    lfs_off_t off, lfs_size_t size, uint32_t* crc) {
+
+    test_ram_t* ram = (test_ram_t*)config->context;
+
+    if (block >= config->block_count || off + size > config->block_size) {
+        return LFS_ERR_IO;
+    }
+
+    *crc = lfs_crc(*crc, &ram->image[(size_t)block * config->block_size + off], size);
+    ram->reads += 1;
+    ram->crcs += 1;
+
+    return LFS_ERR_OK;
+}
+
+static inline int test_ram_erase(const lfs_config_t* config, lfs_block_t block) {
+
+    test_ram_t* ram = (test_ram_t*)config->context;
+
+    if (block >= config->block_count) {
+        return LFS_ERR_IO;
+    }
+
+    memset(&ram->image[(size_t)block * config->block_size], test_ram_erased, config->block_size);
+    ram->erases += 1;
+
+    return LFS_ERR_OK;
+}
+
+static inline int test_ram_sync(const lfs_config_t* config) {
+
+    test_ram_t* ram = (test_ram_t*)config->context;
+
+    ram->syncs += 1;
+
+    return LFS_ERR_OK;
+}
+
+// Grows the image by what lfs_fs_growsize asks for, up to grow_limit
+static inline int test_ram_allocate_block(lfs_config_t* config) {
+
+    test_ram_t* ram = (test_ram_t*)config->context;
+
+    if (config->on_grow || !ram->lfs) {
+        return LFS_ERR_NOSPC;
+    }
+
+    lfs_size_t block_count = lfs_fs_growsize(ram->lfs);
+
+    if (block_count > ram->grow_limit) {
+        return LFS_ERR_NOSPC;
+    }
+
+    config->on_grow = true;
+
+    ram->image.resize((size_t)block_count * config->block_size, test_ram_erased);
+
+    int err = lfs_fs_grow(ram->lfs, block_count);
+
+    config->on_grow = false;
+
+    if (!err) {
+        ram->grows += 1;
+    }
+
+    return err;
+}
+
+// The tests are single threaded, the locks are only there for builds with
+// LFS_THREADSAFE, and counted to tell them apart
+static inline int test_ram_lock(const lfs_config_t* config) {
+
+    ((test_ram_t*)config->context)->locks += 1;
+
+    return LFS_ERR_OK;
+}
+
+static inline int test_ram_unlock(const lfs_config_t*) {
+    return LFS_ERR_OK;
+}
+
+// Sets up a config for the device, everything optional left off
+static inline void test_ram_config(lfs_config_t* config, test_ram_t* ram,
+    lfs_size_t block_size, lfs_size_t block_count) {
+
+    memset(config, 0, sizeof(lfs_config_t));
+
+    config->context = ram;
+    config->read = test_ram_read;
+    config->write = test_ram_prog;
+    config->erase = test_ram_erase;
+    config->sync = test_ram_sync;
+    config->lock = test_ram_lock;
+    config->unlock = test_ram_unlock;
+
+    config->read_size = 16;
+    config->write_size = 16;
+    config->block_size = block_size;
+    config->block_count = block_count;
+    config->erase_size = block_size;
+    config->cache_size = 64;
+    config->lookahead_size = 16;
+    config->block_cycles = 500;
+
+    ram->image.assign((size_t)block_size * block_count, test_ram_erased);
+}
+
+// Whether littlefs takes the locks of the config, that is whether it was
+// built with LFS_THREADSAFE
+static inline bool test_ram_threadsafe() {
+
+    test_ram_t ram;
+    lfs_config_t config;
+    lfs_t lfs = {};
+
+    test_ram_config(&config, &ram, 512, 16);
+
+    return lfs_format(&lfs, &config) == LFS_ERR_OK && ram.locks != 0;
+}
@@ -0,0 +1,21 @@
+#include "test.h"
+
+#pragma comment(lib, "littlefs_v2.lib")
+
+int main() {
+
+    int failed = 0;
+
+    failed += test_crc();
+    failed += test_fs();
+    failed += test_threads();
+    failed += test_vfs();
+
+    if (failed) {
+        printf("%d failed\n", failed);
+        return 1;
+    }
+
+    printf("all passed\n");
+    return 0;
+}
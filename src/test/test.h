@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+
+// Fails the test it is used in, with where and what didn't hold
+#define TEST_CHECK(x) do { \
+        if (!(x)) { \
+            printf("    %s:%d: %s\n", __FILE__, __LINE__, #x); \
+            return false; \
+        } \
+    } while (0)
+
+// Same for a littlefs call, negative results fail
+#define TEST_CHECK_OK(x) do { \
+        long long _res = (long long)(x); \
+        if (_res < 0) { \
+            printf("    %s:%d: %s -> %lld\n", __FILE__, __LINE__, #x, _res); \
+            return false; \
+        } \
+    } while (0)
+
+// Each returns the number of its tests that failed
+int test_crc();
+int test_fs();
+int test_threads();
+int test_vfs();
@@ -0,0 +1,119 @@
+#include <vector>
+#include <random>
+#include <chrono>
+
+#include "test.h"
+#include "lfs.h"
+
+// lfs_crc picks between table slicing and carry-less multiplication by size
+// and cpu. Whatever it picks has to match the nibble table version, checked
+// here over sizes, alignments and starting crcs, also when a buffer is crced
+// in two parts. The checks are done with TEST_CHECK, so they still run in
+// builds without asserts.
+static const int test_crc_rounds = 20000;
+static const size_t test_crc_max = 66000;
+
+static uint32_t test_crc_nibble(uint32_t crc, const uint8_t* data, size_t size) {
+
+    static const uint32_t rtable[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+        0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+        0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+    };
+
+    for (size_t i = 0; i < size; i++) {
+
+        crc = (crc >> 4) ^ rtable[(crc ^ (data[i] >> 0)) & 0xf];
+        crc = (crc >> 4) ^ rtable[(crc ^ (data[i] >> 4)) & 0xf];
+    }
+
+    return crc;
+}
+
+static bool test_crc_check() {
+
+    // the usual check value, without the final xor littlefs leaves off
+    const char check[] = "123456789";
+    TEST_CHECK(lfs_crc(0xffffffff, check, 9) == ~0xcbf43926u);
+    TEST_CHECK(lfs_crc(0x12345678, check, 0) == 0x12345678);
+
+    std::mt19937 rng(1);
+    std::vector<uint8_t> data(test_crc_max + 64);
+
+    for (uint8_t& byte : data) {
+        byte = (uint8_t)rng();
+    }
+
+    // every size up to a few blocks of the widest implementation, at every
+    // alignment of a cache line
+    for (size_t size = 0; size <= 1024; size++) {
+
+        size_t off = size % 64;
+        uint32_t seed = rng();
+
+        TEST_CHECK(lfs_crc(seed, &data[off], size) == test_crc_nibble(seed, &data[off], size));
+    }
+
+    for (int round = 0; round < test_crc_rounds; round++) {
+
+        size_t off = rng() % 64;
+        size_t size = (rng() % 4 == 0) ? rng() % test_crc_max : rng() % 600;
+        size_t split = rng() % (size + 1);
+        uint32_t seed = rng();
+
+        uint32_t crc = test_crc_nibble(seed, &data[off], size);
+
+        TEST_CHECK(lfs_crc(seed, &data[off], size) == crc);
+        TEST_CHECK(lfs_crc(lfs_crc(seed, &data[off], split), &data[off + split], size - split) == crc);
+    }
+
+    return true;
+}
+
+// Throughput of block sized crcs, next to the reference for comparison
+static double test_crc_speed(uint32_t (*crc)(uint32_t, const void*, size_t), size_t size) {
+
+    std::vector<uint8_t> data(size, 0xa5);
+    uint32_t res = 0xffffffff;
+    size_t total = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    double ms = 0;
+
+    while (ms < 50) {
+
+        for (int i = 0; i < 64; i++) {
+            res = crc(res, data.data(), size);
+        }
+
+        total += 64 * size;
+        ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // keep the result alive
+    if (res == 0x5a5a5a5a) {
+        printf(" ");
+    }
+
+    return (double)total / (ms * 1000.0);
+}
+
+static uint32_t test_crc_reference(uint32_t crc, const void* data, size_t size) {
+    return test_crc_nibble(crc, (const uint8_t*)data, size);
+}
+
+int test_crc() {
+
+    bool ok = test_crc_check();
+
+    printf("crc %-20s %s\n", "cross-check", ok ? "ok    " : "FAILED");
+
+    for (size_t size : { (size_t)16, (size_t)512, (size_t)4096 }) {
+
+        printf("crc %-20zu MB/s %8.1f  reference %8.1f\n", size,
+            test_crc_speed(lfs_crc, size), test_crc_speed(test_crc_reference, size));
+    }
+
+    return ok ? 0 : 1;
+}
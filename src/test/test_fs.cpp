@@ -0,0 +1,2312 @@
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <initializer_list>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+
+#include "test.h"
+#include "ram_device.h"
+
+// Random operations on a few files in two directories, checked against a
+// model of what each file should hold, with remounts in between. Every row
+// runs the same seeds over a config of its own and reports how long they
+// took and what they cost the device.
+static const lfs_size_t test_fs_block_size = 512;
+static const lfs_size_t test_fs_block_count = 128;
+static const int test_fs_seeds = 32;
+static const int test_fs_ops = 1500;
+
+static const char* const test_fs_names[] = {
+    "a", "b", "c", "d/x", "d/y", "d/z", "e", "f"
+};
+
+struct test_fs_run_t;
+
+struct test_fs_row_t {
+    const char* name;
+    void (*setup)(lfs_config_t* config, test_ram_t* ram);
+
+    // opens and ends sync batches between the operations
+    bool batches;
+
+    // sets blocks aside with lfs_file_fallocate before some of the writes
+    bool fallocates;
+
+    // runs a gc step every few operations and a whole gc before remounts
+    bool gcs;
+
+    // checks once all seeds ran that what the row sets up was used, when
+    // passing the model checks alone wouldn't show it
+    bool (*check)(test_fs_run_t* run);
+};
+
+// What the seeds of a row made use of, counted across all of them
+struct test_fs_stats_t {
+
+    // lfs_fs_stat of each mount before it was unmounted
+    uint64_t cache_hits;
+    uint64_t dentry_hits;
+    uint64_t tag_index_hits;
+
+    // lookups of read files the block index cache answered, files read
+    // back as extents and that had read ahead of their position
+    uint64_t index_hits;
+    uint32_t extent_files;
+    uint32_t readaheads;
+
+    // runs lfs_file_fallocate set aside, and gc steps that compacted
+    uint32_t reserves;
+    uint32_t gc_steps;
+
+    // mounts of an image left as it was, without an unmount, and those of
+    // them that found a free map
+    uint32_t crashes;
+    uint32_t crash_maps;
+};
+
+struct test_fs_run_t {
+    lfs_t lfs;
+    lfs_config_t config;
+    test_ram_t ram;
+    std::mt19937 rng;
+
+    // what each file should hold
+    std::map<std::string, std::vector<uint8_t>> model;
+
+    // the device filled up, which ends the run
+    bool full;
+
+    // a sync batch is open, files closed in it are still held back
+    bool batch;
+
+    // see test_fs_row_t
+    bool fallocates;
+    bool gcs;
+
+    // mounts that found a free map checkpointed by the last unmount
+    uint32_t maps;
+
+    // directories listed so far
+    uint32_t lists;
+
+    test_fs_stats_t stats;
+
+    // the image mounted as left after a crash
+    lfs_t crash_lfs;
+    lfs_config_t crash_config;
+    test_ram_t crash_ram;
+};
+
+// A full device ends the run. What the file being changed holds is unknown
+// then, it is left out of the checks from there on.
+static bool test_fs_full(test_fs_run_t* run, const std::string& name) {
+
+    run->model.erase(name);
+    run->full = true;
+
+    return true;
+}
+
+static std::string test_fs_name(test_fs_run_t* run) {
+    return test_fs_names[run->rng() % _countof(test_fs_names)];
+}
+
+static int test_fs_inuse(void* data, lfs_block_t block) {
+
+    lfs_t* lfs = (lfs_t*)data;
+    lfs_block_t off = (block + lfs->block_count - lfs->free.offset) % lfs->block_count;
+
+    if (off >= lfs->free.i && off < lfs->free.size &&
+        !(lfs->free.buffer[off / 64] & ((uint64_t)1U << (off % 64)))) {
+
+        printf("    block %u is in use but free at %u of the window\n", (unsigned)block, (unsigned)off);
+        return LFS_ERR_CORRUPT;
+    }
+
+    return LFS_ERR_OK;
+}
+
+// Every block the filesystem uses has to be marked in what is left of the
+// allocation window, or it may be handed out again. Right after a mount
+// that is the whole free map it loaded.
+static bool test_fs_check_window(lfs_t* lfs) {
+
+    TEST_CHECK_OK(lfs_fs_traverse(lfs, test_fs_inuse, lfs));
+
+    return true;
+}
+
+// Mounts a copy of the image as it is, as if the device lost power, which
+// has to leave the allocator a window that agrees with a traversal. A free
+// map only ever referenced while up to date passes the same as none.
+static bool test_fs_crash(test_fs_run_t* run) {
+
+    run->crash_ram.image = run->ram.image;
+    run->crash_ram.grow_limit = run->ram.grow_limit;
+    run->crash_ram.lfs = &run->crash_lfs;
+    run->crash_config = run->config;
+    run->crash_config.context = &run->crash_ram;
+    run->crash_config.block_count = run->lfs.block_count;
+    run->crash_lfs = {};
+
+    TEST_CHECK_OK(lfs_mount(&run->crash_lfs, &run->crash_config));
+
+    run->stats.crashes += 1;
+    run->stats.crash_maps += run->crash_lfs.free.map.size ? 1 : 0;
+
+    TEST_CHECK(test_fs_check_window(&run->crash_lfs));
+    TEST_CHECK_OK(lfs_unmount(&run->crash_lfs));
+
+    return true;
+}
+
+static bool test_fs_unmount(test_fs_run_t* run) {
+
+    struct lfs_fsinfo info;
+
+    TEST_CHECK_OK(lfs_fs_stat(&run->lfs, &info));
+
+    run->stats.cache_hits += info.cache_hits;
+    run->stats.dentry_hits += info.dentry_hits;
+    run->stats.tag_index_hits += run->lfs.tag_index_hits;
+
+    TEST_CHECK_OK(lfs_unmount(&run->lfs));
+
+    return true;
+}
+
+// Splits a buffer into a few iovecs one after the other, some of them empty
+static std::vector<lfs_iovec_t> test_fs_iovecs(test_fs_run_t* run, uint8_t* buffer, lfs_size_t size) {
+
+    std::vector<lfs_iovec_t> iov;
+    lfs_size_t off = 0;
+
+    do {
+        lfs_size_t len = (run->rng() % 4 == 0) ? 0 : std::min(size - off, 1 + run->rng() % 700);
+
+        iov.push_back({ buffer + off, len });
+        off += len;
+    } while (off < size);
+
+    return iov;
+}
+
+static bool test_fs_write(test_fs_run_t* run, const std::string& name) {
+
+    std::vector<uint8_t>& data = run->model[name];
+    lfs_file_t file = {};
+
+    int err = lfs_file_open(&run->lfs, &file, name.c_str(), LFS_O_RDWR | LFS_O_CREAT);
+
+    if (err == LFS_ERR_NOSPC) {
+        return test_fs_full(run, name);
+    }
+
+    TEST_CHECK_OK(err);
+
+    lfs_ssize_t res = 0;
+    int count = 1 + run->rng() % 3;
+
+    for (int i = 0; i < count && res >= 0; i++) {
+
+        // appends, overwrites in place and writes anywhere, past the end
+        // leaving a hole
+        lfs_size_t pos = (lfs_size_t)data.size();
+        lfs_size_t size = (run->rng() % 4 == 0) ? run->rng() % 5000 : run->rng() % 300;
+
+        switch (run->rng() % 3) {
+        case 1: {
+            pos = run->rng() % (pos + 1);
+            size = std::min(size, (lfs_size_t)data.size() - pos);
+            break;
+        }
+        case 2: {
+            pos = run->rng() % (pos + 3000);
+            break;
+        }
+        }
+
+        std::vector<uint8_t> buffer(size);
+
+        for (uint8_t& byte : buffer) {
+            byte = (uint8_t)run->rng();
+        }
+
+        // for the write or for more than it, taken or not the file holds
+        // the same. No run of free blocks that long only means nothing is
+        // set aside, the write allocates as it goes.
+        if (run->fallocates && run->rng() % 2 == 0) {
+
+            res = lfs_file_fallocate(&run->lfs, &file, pos, 1 + size + run->rng() % 3000);
+
+            if (res == LFS_ERR_NOSPC) {
+                res = 0;
+            }
+            else if (res >= 0) {
+                run->stats.reserves += 1;
+            }
+        }
+
+        if (res >= 0) {
+            res = lfs_file_seek(&run->lfs, &file, pos, LFS_SEEK_SET);
+        }
+
+        // gathered from a few buffers half of the time
+        if (res >= 0 && run->rng() % 2) {
+
+            std::vector<lfs_iovec_t> iov = test_fs_iovecs(run, buffer.data(), size);
+
+            res = lfs_file_writev(&run->lfs, &file, iov.data(), (lfs_size_t)iov.size());
+        }
+        else if (res >= 0) {
+
+            res = lfs_file_write(&run->lfs, &file, buffer.data(), size);
+        }
+
+        if (res >= 0) {
+            TEST_CHECK(res == (lfs_ssize_t)size);
+
+            data.resize(std::max(data.size(), (size_t)pos + size), 0);
+            std::copy(buffer.begin(), buffer.end(), data.begin() + pos);
+        }
+
+        // read some of it back through the same handle, before it is synced
+        if (res >= 0 && run->rng() % 3 == 0) {
+
+            pos = data.empty() ? 0 : run->rng() % (lfs_size_t)data.size();
+            size = std::min(run->rng() % 2000, (lfs_size_t)data.size() - pos);
+            buffer.resize(size);
+
+            res = lfs_file_seek(&run->lfs, &file, pos, LFS_SEEK_SET);
+
+            if (res >= 0) {
+                res = lfs_file_read(&run->lfs, &file, buffer.data(), size);
+            }
+
+            if (res >= 0) {
+                TEST_CHECK(res == (lfs_ssize_t)size);
+                TEST_CHECK(std::equal(buffer.begin(), buffer.begin() + size, data.begin() + pos));
+            }
+        }
+    }
+
+    err = lfs_file_close(&run->lfs, &file);
+
+    if (res == LFS_ERR_NOSPC || err == LFS_ERR_NOSPC) {
+        return test_fs_full(run, name);
+    }
+
+    TEST_CHECK_OK(res);
+    TEST_CHECK_OK(err);
+
+    return true;
+}
+
+static bool test_fs_read(test_fs_run_t* run, const std::string& name) {
+
+    auto it = run->model.find(name);
+    lfs_file_t file = {};
+
+    int err = lfs_file_open(&run->lfs, &file, name.c_str(), LFS_O_RDONLY);
+
+    if (it == run->model.end()) {
+        TEST_CHECK(err == LFS_ERR_NOENT);
+        return true;
+    }
+
+    TEST_CHECK_OK(err);
+
+    std::vector<uint8_t> buffer(it->second.size() + 16);
+    lfs_size_t chunk = 1 + run->rng() % 700;
+    lfs_size_t size = 0;
+
+    while (true) {
+
+        // scattered into a few buffers half of the time
+        lfs_size_t len = std::min(chunk, (lfs_size_t)buffer.size() - size);
+        std::vector<lfs_iovec_t> iov = test_fs_iovecs(run, &buffer[size], len);
+
+        lfs_ssize_t res = (run->rng() % 2)
+            ? lfs_file_readv(&run->lfs, &file, iov.data(), (lfs_size_t)iov.size())
+            : lfs_file_read(&run->lfs, &file, &buffer[size], len);
+
+        TEST_CHECK_OK(res);
+
+        if (!res) {
+            break;
+        }
+
+        size += (lfs_size_t)res;
+    }
+
+    run->stats.index_hits += file.index.hits;
+    run->stats.extent_files += (file.flags & LFS_F_EXTENT) ? 1 : 0;
+    run->stats.readaheads += file.readahead.window ? 1 : 0;
+
+    TEST_CHECK_OK(lfs_file_close(&run->lfs, &file));
+
+    TEST_CHECK(size == it->second.size());
+    TEST_CHECK(std::equal(it->second.begin(), it->second.end(), buffer.begin()));
+
+    return true;
+}
+
+static bool test_fs_truncate(test_fs_run_t* run, const std::string& name) {
+
+    std::vector<uint8_t>& data = run->model[name];
+    lfs_file_t file = {};
+
+    int err = lfs_file_open(&run->lfs, &file, name.c_str(), LFS_O_RDWR | LFS_O_CREAT);
+
+    if (err == LFS_ERR_NOSPC) {
+        return test_fs_full(run, name);
+    }
+
+    TEST_CHECK_OK(err);
+
+    // down to what fits inline half of the time
+    lfs_size_t size = (run->rng() % 2) ? run->rng() % 64 :
+        run->rng() % ((lfs_size_t)data.size() + 4000);
+
+    err = lfs_file_truncate(&run->lfs, &file, size);
+
+    if (!err) {
+        data.resize(size, 0);
+    }
+
+    int res = lfs_file_close(&run->lfs, &file);
+
+    if (err == LFS_ERR_NOSPC || res == LFS_ERR_NOSPC) {
+        return test_fs_full(run, name);
+    }
+
+    TEST_CHECK_OK(err);
+    TEST_CHECK_OK(res);
+
+    return true;
+}
+
+static bool test_fs_remove(test_fs_run_t* run, const std::string& name) {
+
+    int err = lfs_remove(&run->lfs, name.c_str());
+
+    if (!run->model.count(name)) {
+        TEST_CHECK(err == LFS_ERR_NOENT);
+        return true;
+    }
+
+    if (err == LFS_ERR_NOSPC) {
+        return test_fs_full(run, name);
+    }
+
+    TEST_CHECK_OK(err);
+    run->model.erase(name);
+
+    return true;
+}
+
+static bool test_fs_rename(test_fs_run_t* run, const std::string& name) {
+
+    std::string to = test_fs_name(run);
+
+    if (!run->model.count(name) || name == to) {
+        return true;
+    }
+
+    int err = lfs_rename(&run->lfs, name.c_str(), to.c_str());
+
+    if (err == LFS_ERR_NOSPC) {
+        run->model.erase(to);
+        return test_fs_full(run, name);
+    }
+
+    TEST_CHECK_OK(err);
+
+    run->model[to] = run->model[name];
+    run->model.erase(name);
+
+    return true;
+}
+
+// Stats every name and lists both directories
+static bool test_fs_list(test_fs_run_t* run) {
+
+    for (const char* name : test_fs_names) {
+
+        struct lfs_info info;
+        int err = lfs_stat(&run->lfs, name, &info);
+        auto it = run->model.find(name);
+
+        if (it == run->model.end()) {
+            TEST_CHECK(err == LFS_ERR_NOENT);
+            continue;
+        }
+
+        TEST_CHECK_OK(err);
+        TEST_CHECK(run->batch || info.size == it->second.size());
+    }
+
+    for (const char* path : { "/", "d" }) {
+
+        lfs_dir_t dir = {};
+        std::set<std::string> listed;
+
+        TEST_CHECK_OK(lfs_dir_open(&run->lfs, &dir, path));
+
+        // every other listing reads batches of 1 to 4 entries
+        run->lists += 1;
+
+        lfs_size_t batch = (run->lists % 2) ? 1 + (run->lists / 2) % 4 : 0;
+
+        while (true) {
+
+            // entries read as LFS_ERR_OK, the end as LFS_ERR_NOENT, and
+            // batches as their count, the end as 0
+            struct lfs_info infos[4];
+            lfs_ssize_t res;
+
+            if (batch) {
+                res = lfs_dir_readbatch(&run->lfs, &dir, infos, batch);
+            }
+            else {
+                res = lfs_dir_read(&run->lfs, &dir, &infos[0]);
+                res = (res == LFS_ERR_NOENT) ? 0 : (res == LFS_ERR_OK) ? 1 : res;
+            }
+
+            TEST_CHECK_OK(res);
+            TEST_CHECK(res <= (lfs_ssize_t)std::max(batch, (lfs_size_t)1));
+
+            if (res == 0) {
+                break;
+            }
+
+            for (lfs_ssize_t i = 0; i < res; i++) {
+
+                const struct lfs_info& info = infos[i];
+
+                if (info.type != LFS_TYPE_REG) {
+                    continue;
+                }
+
+                std::string name = (path[0] == '/') ? info.name : std::string(path) + "/" + info.name;
+                auto it = run->model.find(name);
+
+                TEST_CHECK(it != run->model.end());
+                TEST_CHECK(run->batch || info.size == it->second.size());
+                TEST_CHECK(listed.insert(name).second);
+            }
+        }
+
+        TEST_CHECK_OK(lfs_dir_close(&run->lfs, &dir));
+
+        TEST_CHECK(listed.size() == (size_t)std::count_if(run->model.begin(), run->model.end(),
+            [&](const std::pair<const std::string, std::vector<uint8_t>>& entry) {
+                return (entry.first.compare(0, 2, "d/") == 0) == (path[0] == 'd');
+            }));
+    }
+
+    return true;
+}
+
+// Opens a sync batch or ends the open one
+static bool test_fs_batch(test_fs_run_t* run) {
+
+    if (!run->batch) {
+
+        TEST_CHECK_OK(lfs_batch_begin(&run->lfs));
+        run->batch = true;
+
+        return true;
+    }
+
+    int err = lfs_batch_end(&run->lfs);
+    run->batch = false;
+
+    // what the held back files hold is unknown then
+    if (err == LFS_ERR_NOSPC) {
+
+        run->model.clear();
+        run->full = true;
+
+        return true;
+    }
+
+    TEST_CHECK_OK(err);
+
+    return true;
+}
+
+// Compacts what has grown past compact_thresh, after which there is nothing
+// left for a step to do. Gc only moves what is already there, a device too
+// full for it is left as it is.
+static bool test_fs_gc(test_fs_run_t* run) {
+
+    int err = lfs_fs_gc(&run->lfs);
+
+    if (err == LFS_ERR_NOSPC) {
+        return true;
+    }
+
+    TEST_CHECK_OK(err);
+    TEST_CHECK(lfs_fs_gcstep(&run->lfs) == 0);
+
+    return true;
+}
+
+static bool test_fs_remount(test_fs_run_t* run) {
+
+    if (run->batch) {
+
+        TEST_CHECK(test_fs_batch(run));
+
+        if (run->full) {
+            return true;
+        }
+    }
+
+    if (run->gcs) {
+        TEST_CHECK(test_fs_gc(run));
+    }
+
+    // a crash before the unmount, or one right after the mount while the
+    // free map it loaded is still referenced
+    if (run->config.free_map) {
+        TEST_CHECK(test_fs_crash(run));
+    }
+
+    TEST_CHECK(test_fs_unmount(run));
+    TEST_CHECK_OK(lfs_mount(&run->lfs, &run->config));
+
+    if (run->lfs.free.map.size) {
+        run->maps += 1;
+    }
+
+    if (run->config.free_map) {
+        TEST_CHECK(test_fs_crash(run));
+    }
+
+    return test_fs_check_window(&run->lfs);
+}
+
+static bool test_fs_random(test_fs_run_t* run, const test_fs_row_t* row, uint32_t seed) {
+
+    run->rng.seed(seed);
+    run->model.clear();
+    run->full = false;
+    run->batch = false;
+    run->fallocates = row->fallocates;
+    run->gcs = row->gcs;
+    run->lfs = {};
+
+    test_ram_config(&run->config, &run->ram, test_fs_block_size, test_fs_block_count);
+    run->ram.lfs = &run->lfs;
+
+    row->setup(&run->config, &run->ram);
+
+    TEST_CHECK_OK(lfs_format(&run->lfs, &run->config));
+    TEST_CHECK_OK(lfs_mount(&run->lfs, &run->config));
+    TEST_CHECK_OK(lfs_mkdir(&run->lfs, "d"));
+
+    for (int op = 0; op < test_fs_ops && !run->full; op++) {
+
+        std::string name = test_fs_name(run);
+        bool ok = true;
+
+        switch (run->rng() % (row->batches ? 13 : 12)) {
+        case 0: case 1: case 2: case 3: case 4: {
+            ok = test_fs_write(run, name); break;
+        }
+        case 5: case 6: {
+            ok = test_fs_read(run, name); break;
+        }
+        case 7: {
+            ok = test_fs_truncate(run, name); break;
+        }
+        case 8: {
+            ok = test_fs_remove(run, name); break;
+        }
+        case 9: {
+            ok = test_fs_rename(run, name); break;
+        }
+        case 10: {
+            ok = test_fs_list(run); break;
+        }
+        case 12: {
+            ok = test_fs_batch(run); break;
+        }
+        default: {
+            ok = test_fs_remount(run); break;
+        }
+        }
+
+        if (ok && run->gcs && op % 8 == 0) {
+
+            int res = lfs_fs_gcstep(&run->lfs);
+
+            if (res < 0 && res != LFS_ERR_NOSPC) {
+                printf("    lfs_fs_gcstep -> %d\n", res);
+                ok = false;
+            }
+
+            run->stats.gc_steps += (res > 0) ? 1 : 0;
+        }
+
+        if (ok && op % 64 == 0) {
+            ok = test_fs_check_window(&run->lfs);
+        }
+
+        if (!ok) {
+            printf("    seed %u, op %d\n", seed, op);
+            return false;
+        }
+    }
+
+    // everything left in the model survives a remount
+    TEST_CHECK(test_fs_remount(run));
+
+    for (auto& entry : run->model) {
+        TEST_CHECK(test_fs_read(run, entry.first));
+    }
+
+    TEST_CHECK(test_fs_unmount(run));
+    TEST_CHECK(run->ram.violations == 0);
+
+    return true;
+}
+
+// Free blocks left in what is left of the allocation window
+static lfs_block_t test_fs_window_left(lfs_t* lfs) {
+
+    lfs_block_t left = 0;
+
+    for (lfs_block_t off = lfs->free.i; off < lfs->free.size; off++) {
+
+        left += (lfs->free.buffer[off / 64] & ((uint64_t)1U << (off % 64))) ? 0 : 1;
+    }
+
+    return left;
+}
+
+// Checkpoints the free map from a nearly used up window, with a file still
+// being written, so the map's own blocks are allocated where the window runs
+// out. What the next mount loads has to hold up against a traversal.
+static bool test_fs_checkpoint(test_fs_run_t* run, lfs_block_t left) {
+
+    run->lfs = {};
+
+    test_ram_config(&run->config, &run->ram, test_fs_block_size, test_fs_block_count);
+    run->config.free_map = true;
+
+    std::vector<uint8_t> data(2 * test_fs_block_size, 0x5a);
+    lfs_file_t file = {};
+    int count = 0;
+
+    TEST_CHECK_OK(lfs_format(&run->lfs, &run->config));
+    TEST_CHECK_OK(lfs_mount(&run->lfs, &run->config));
+
+    // fill the device, then free every third file so the free blocks are
+    // spread between the ones in use
+    for (;; count++) {
+
+        std::string name = "f" + std::to_string(count);
+
+        if (lfs_file_open(&run->lfs, &file, name.c_str(), LFS_O_RDWR | LFS_O_CREAT)) {
+            break;
+        }
+
+        lfs_ssize_t res = lfs_file_write(&run->lfs, &file, data.data(), (lfs_size_t)data.size());
+        int err = lfs_file_close(&run->lfs, &file);
+
+        if (res < 0 || err) {
+            lfs_remove(&run->lfs, name.c_str());
+            break;
+        }
+    }
+
+    for (int i = 0; i < count; i += 3) {
+
+        TEST_CHECK_OK(lfs_remove(&run->lfs, ("f" + std::to_string(i)).c_str()));
+    }
+
+    TEST_CHECK_OK(lfs_file_open(&run->lfs, &file, "open", LFS_O_RDWR | LFS_O_CREAT));
+
+    do {
+        TEST_CHECK(lfs_file_write(&run->lfs, &file, data.data(), test_fs_block_size) >= 0);
+    } while (test_fs_window_left(&run->lfs) > left);
+
+    int err = lfs_fs_checkpoint(&run->lfs);
+
+    TEST_CHECK(err == LFS_ERR_OK || err == LFS_ERR_NOSPC);
+    TEST_CHECK_OK(lfs_file_close(&run->lfs, &file));
+
+    TEST_CHECK(test_fs_remount(run));
+    TEST_CHECK_OK(lfs_unmount(&run->lfs));
+    TEST_CHECK(run->ram.violations == 0);
+
+    return true;
+}
+
+// Starts the device at a quarter of the size and lets it grow through
+// allocate_block up to twice the size, across remounts
+static void test_fs_growth(lfs_config_t* config, test_ram_t* ram) {
+
+    config->block_count = test_fs_block_count / 4;
+    config->allocate_block = test_ram_allocate_block;
+    config->grow_min = 8;
+    config->grow_percent = 25;
+    config->grow_watermark = 75;
+
+    ram->image.resize((size_t)config->block_count * config->block_size);
+    ram->grow_limit = test_fs_block_count * 2;
+}
+
+// Lists a directory while removing entries around where it reads, the one
+// just read and every so often the one it reads next. Every entry not
+// removed before it is reached has to be listed once.
+static bool test_fs_dir_remove(test_fs_run_t* run) {
+
+    run->lfs = {};
+
+    test_ram_config(&run->config, &run->ram, test_fs_block_size, test_fs_block_count);
+
+    TEST_CHECK_OK(lfs_format(&run->lfs, &run->config));
+    TEST_CHECK_OK(lfs_mount(&run->lfs, &run->config));
+
+    for (int i = 0; i < 30; i++) {
+
+        char name[16];
+        lfs_file_t file = {};
+
+        snprintf(name, sizeof(name), "f%02d", i);
+
+        TEST_CHECK_OK(lfs_file_open(&run->lfs, &file, name, LFS_O_WRONLY | LFS_O_CREAT));
+        TEST_CHECK_OK(lfs_file_close(&run->lfs, &file));
+    }
+
+    lfs_dir_t dir = {};
+    struct lfs_info info;
+    std::string listed;
+    std::string expected;
+    int err;
+
+    TEST_CHECK_OK(lfs_dir_open(&run->lfs, &dir, "/"));
+
+    while ((err = lfs_dir_read(&run->lfs, &dir, &info)) == LFS_ERR_OK) {
+
+        if (info.type != LFS_TYPE_REG) {
+            continue;
+        }
+
+        int i = atoi(&info.name[1]);
+        char next[16];
+
+        listed += info.name;
+        snprintf(next, sizeof(next), "f%02d", i + 1);
+
+        TEST_CHECK_OK(lfs_remove(&run->lfs, info.name));
+
+        if (i % 3 == 0 && i + 1 < 30) {
+            TEST_CHECK_OK(lfs_remove(&run->lfs, next));
+        }
+    }
+
+    TEST_CHECK(err == LFS_ERR_NOENT);
+    TEST_CHECK_OK(lfs_dir_close(&run->lfs, &dir));
+
+    for (int i = 0; i < 30; i++) {
+
+        char name[16];
+        snprintf(name, sizeof(name), "f%02d", i);
+
+        expected += (i % 3 == 1) ? "" : name;
+    }
+
+    TEST_CHECK(listed == expected);
+    TEST_CHECK_OK(lfs_unmount(&run->lfs));
+
+    return true;
+}
+
+// Writes a few bytes far apart in an extent file several times the size of
+// the device, which only fits while the gaps between them stay holes. The
+// holes read back as zeros, also after a remount.
+static bool test_fs_sparse(test_fs_run_t* run) {
+
+    const lfs_off_t size = 64 * test_fs_block_count * test_fs_block_size;
+    const lfs_off_t offs[] = { 100, size / 3, size / 2 + 7, size - 40 };
+
+    run->lfs = {};
+
+    test_ram_config(&run->config, &run->ram, test_fs_block_size, test_fs_block_count);
+    run->config.file_layout = LFS_LAYOUT_EXTENT;
+
+    TEST_CHECK_OK(lfs_format(&run->lfs, &run->config));
+    TEST_CHECK_OK(lfs_mount(&run->lfs, &run->config));
+
+    lfs_file_t file = {};
+    uint8_t data[40];
+
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)(i + 1);
+    }
+
+    TEST_CHECK_OK(lfs_file_open(&run->lfs, &file, "s", LFS_O_RDWR | LFS_O_CREAT));
+    TEST_CHECK_OK(lfs_file_truncate(&run->lfs, &file, size / 4));
+
+    for (lfs_off_t off : offs) {
+
+        TEST_CHECK_OK(lfs_file_seek(&run->lfs, &file, off, LFS_SEEK_SET));
+        TEST_CHECK(lfs_file_write(&run->lfs, &file, data, sizeof(data)) == sizeof(data));
+    }
+
+    TEST_CHECK_OK(lfs_file_close(&run->lfs, &file));
+
+    TEST_CHECK_OK(lfs_unmount(&run->lfs));
+    TEST_CHECK_OK(lfs_mount(&run->lfs, &run->config));
+
+    struct lfs_info info;
+
+    TEST_CHECK_OK(lfs_stat(&run->lfs, "s", &info));
+    TEST_CHECK(info.size == size);
+
+    lfs_ssize_t used = lfs_fs_size(&run->lfs);
+
+    TEST_CHECK_OK(used);
+    TEST_CHECK(used < 16);
+
+    // each write and the bytes on either side of it, and some of the holes
+    std::vector<uint8_t> buffer(3 * test_fs_block_size);
+
+    TEST_CHECK_OK(lfs_file_open(&run->lfs, &file, "s", LFS_O_RDONLY));
+
+    for (lfs_off_t off : offs) {
+
+        lfs_off_t pos = std::max(off, test_fs_block_size) - test_fs_block_size;
+        lfs_size_t len = std::min((lfs_size_t)buffer.size(), size - pos);
+
+        TEST_CHECK_OK(lfs_file_seek(&run->lfs, &file, pos, LFS_SEEK_SET));
+        TEST_CHECK(lfs_file_read(&run->lfs, &file, buffer.data(), len) == (lfs_ssize_t)len);
+
+        for (lfs_size_t i = 0; i < len; i++) {
+
+            lfs_off_t at = pos + i;
+            uint8_t expected = (at >= off && at < off + sizeof(data)) ? data[at - off] : 0;
+
+            TEST_CHECK(buffer[i] == expected);
+        }
+    }
+
+    TEST_CHECK_OK(lfs_file_close(&run->lfs, &file));
+    TEST_CHECK_OK(lfs_remove(&run->lfs, "s"));
+    TEST_CHECK_OK(lfs_unmount(&run->lfs));
+    TEST_CHECK(run->ram.violations == 0);
+
+    return true;
+}
+
+static bool test_fs_vectored_check(test_fs_run_t* run, const char* name, const std::vector<uint8_t>& data) {
+
+    std::vector<uint8_t> buffer(data.size() + 100, 0);
+    lfs_file_t file = {};
+
+    // odd sizes over block boundaries, the end of the file halfway through
+    // the last iovec and empty ones in between
+    lfs_iovec_t iov[] = {
+        { &buffer[0], 0 },
+        { &buffer[0], 700 },
+        { &buffer[700], 0 },
+        { &buffer[700], 1 },
+        { &buffer[701], 333 },
+        { &buffer[1034], (lfs_size_t)buffer.size() - 1034 },
+        { &buffer[0], 0 },
+    };
+
+    TEST_CHECK_OK(lfs_file_open(&run->lfs, &file, name, LFS_O_RDONLY));
+    TEST_CHECK(lfs_file_readv(&run->lfs, &file, iov, _countof(iov)) == (lfs_ssize_t)data.size());
+    TEST_CHECK(std::equal(data.begin(), data.end(), buffer.begin()));
+    TEST_CHECK(lfs_file_readv(&run->lfs, &file, iov, _countof(iov)) == 0);
+
+    // and from partway, short of the end
+    TEST_CHECK(lfs_file_seek(&run->lfs, &file, (lfs_soff_t)data.size() - 300, LFS_SEEK_SET) >= 0);
+    TEST_CHECK(lfs_file_readv(&run->lfs, &file, &iov[3], 3) == 300);
+    TEST_CHECK(std::equal(data.end() - 300, data.end(), buffer.begin() + 700));
+    TEST_CHECK(lfs_file_readv(&run->lfs, &file, &iov[0], 1) == 0);
+    TEST_CHECK_OK(lfs_file_close(&run->lfs, &file));
+
+    return true;
+}
+
+// Files written with lfs_file_writev out of their inline data into blocks,
+// with either layout, through iovecs crossing block boundaries and empty
+// ones, and read back with lfs_file_readv running into the end of the file
+static bool test_fs_vectored(test_fs_run_t* run) {
+
+    std::vector<uint8_t> data(3 * test_fs_block_size + 123);
+
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = (uint8_t)(i * 7 + i / 251);
+    }
+
+    for (int layout = LFS_LAYOUT_CTZ; layout <= LFS_LAYOUT_EXTENT; layout++) {
+
+        run->lfs = {};
+
+        test_ram_config(&run->config, &run->ram, test_fs_block_size, test_fs_block_count);
+        run->config.file_layout = (lfs_file_layout)layout;
+
+        TEST_CHECK_OK(lfs_format(&run->lfs, &run->config));
+        TEST_CHECK_OK(lfs_mount(&run->lfs, &run->config));
+
+        lfs_file_t file = {};
+        lfs_iovec_t empty[] = { { data.data(), 0 }, { data.data(), 0 } };
+        lfs_iovec_t small[] = { { &data[0], 10 }, { &data[10], 0 }, { &data[10], 6 } };
+        lfs_iovec_t large[] = {
+            { &data[16], 0 },
+            { &data[16], test_fs_block_size - 20 },
+            { &data[test_fs_block_size - 4], 9 },
+            { &data[test_fs_block_size + 5], 0 },
+            { &data[test_fs_block_size + 5], (lfs_size_t)data.size() - test_fs_block_size - 5 },
+        };
+
+        TEST_CHECK_OK(lfs_file_open(&run->lfs, &file, "v", LFS_O_RDWR | LFS_O_CREAT));
+        TEST_CHECK(lfs_file_writev(&run->lfs, &file, empty, _countof(empty)) == 0);
+        TEST_CHECK(lfs_file_writev(&run->lfs, &file, small, _countof(small)) == 16);
+        TEST_CHECK_OK(lfs_file_sync(&run->lfs, &file));
+        TEST_CHECK(file.flags & LFS_F_INLINE);
+
+        TEST_CHECK(lfs_file_writev(&run->lfs, &file, large, _countof(large)) == (lfs_ssize_t)data.size() - 16);
+        TEST_CHECK_OK(lfs_file_sync(&run->lfs, &file));
+        TEST_CHECK(!(file.flags & LFS_F_INLINE));
+        TEST_CHECK(!(file.flags & LFS_F_EXTENT) == (layout == LFS_LAYOUT_CTZ));
+        TEST_CHECK(lfs_file_size(&run->lfs, &file) == (lfs_soff_t)data.size());
+        TEST_CHECK_OK(lfs_file_close(&run->lfs, &file));
+
+        TEST_CHECK(test_fs_vectored_check(run, "v", data));
+
+        TEST_CHECK_OK(lfs_unmount(&run->lfs));
+        TEST_CHECK_OK(lfs_mount(&run->lfs, &run->config));
+        TEST_CHECK(test_fs_vectored_check(run, "v", data));
+        TEST_CHECK_OK(lfs_unmount(&run->lfs));
+        TEST_CHECK(run->ram.violations == 0);
+    }
+
+    run->config.file_layout = LFS_LAYOUT_CTZ;
+
+    return true;
+}
+
+// Version the superblock on the device is at
+static uint32_t test_fs_disk_version(lfs_t* lfs) {
+
+    lfs_metadata_dir_t root;
+    lfs_superblock_t superblock;
+
+    if (lfs_dir_fetch(lfs, &root, lfs->root) ||
+        lfs_dir_get(lfs, &root, LFS_MKTAG(LFS_TYPE_MOVESTATE, 0x3ff, 0),
+            LFS_MKTAG(LFS_TYPE_INLINESTRUCT, 0, sizeof(superblock)), &superblock) < 0) {
+
+        return 0;
+    }
+
+    lfs_superblock_fromle64(&superblock);
+
+    return superblock.version;
+}
+
+static bool test_fs_version_write(test_fs_run_t* run, const char* name) {
+
+    std::vector<uint8_t> data(3 * test_fs_block_size, 0x3c);
+    lfs_file_t file = {};
+
+    TEST_CHECK_OK(lfs_file_open(&run->lfs, &file, name, LFS_O_WRONLY | LFS_O_CREAT));
+    TEST_CHECK(lfs_file_write(&run->lfs, &file, data.data(), (lfs_size_t)data.size()) == (lfs_ssize_t)data.size());
+    TEST_CHECK_OK(lfs_file_close(&run->lfs, &file));
+
+    return true;
+}
+
+// Images stay at v2.0 until an extent list is committed, and a free map
+// dropped again goes back to the version the files need
+static bool test_fs_version(test_fs_run_t* run) {
+
+    run->lfs = {};
+
+    test_ram_config(&run->config, &run->ram, test_fs_block_size, test_fs_block_count);
+
+    TEST_CHECK_OK(lfs_format(&run->lfs, &run->config));
+    TEST_CHECK_OK(lfs_mount(&run->lfs, &run->config));
+    TEST_CHECK(test_fs_version_write(run, "ctz"));
+    TEST_CHECK(test_fs_disk_version(&run->lfs) == LFS_DISK_VERSION);
+    TEST_CHECK_OK(lfs_unmount(&run->lfs));
+
+    // extents raise it on their first commit, in and out of a batch
+    for (int batch = 0; batch < 2; batch++) {
+
+        TEST_CHECK_OK(lfs_format(&run->lfs, &run->config));
+
+        run->config.file_layout = LFS_LAYOUT_EXTENT;
+
+        TEST_CHECK_OK(lfs_mount(&run->lfs, &run->config));
+        TEST_CHECK(test_fs_disk_version(&run->lfs) == LFS_DISK_VERSION);
+
+        if (batch) {
+            TEST_CHECK_OK(lfs_batch_begin(&run->lfs));
+        }
+
+        TEST_CHECK(test_fs_version_write(run, "ext"));
+
+        if (batch) {
+            TEST_CHECK_OK(lfs_batch_end(&run->lfs));
+        }
+
+        TEST_CHECK(test_fs_disk_version(&run->lfs) == LFS_DISK_VERSION_EXTENTS);
+        TEST_CHECK_OK(lfs_unmount(&run->lfs));
+
+        run->config.file_layout = LFS_LAYOUT_CTZ;
+    }
+
+    // formats with extents start out raised, and a free map is above both
+    run->config.file_layout = LFS_LAYOUT_EXTENT;
+    run->config.free_map = true;
+
+    TEST_CHECK_OK(lfs_format(&run->lfs, &run->config));
+    TEST_CHECK_OK(lfs_mount(&run->lfs, &run->config));
+    TEST_CHECK(test_fs_disk_version(&run->lfs) == LFS_DISK_VERSION_EXTENTS);
+    TEST_CHECK_OK(lfs_unmount(&run->lfs));
+    TEST_CHECK_OK(lfs_mount(&run->lfs, &run->config));
+    TEST_CHECK(test_fs_disk_version(&run->lfs) == LFS_DISK_VERSION_FREE_MAP);
+    TEST_CHECK(test_fs_version_write(run, "ext"));
+    TEST_CHECK(test_fs_disk_version(&run->lfs) == LFS_DISK_VERSION_EXTENTS);
+    TEST_CHECK_OK(lfs_unmount(&run->lfs));
+
+    run->config.file_layout = LFS_LAYOUT_CTZ;
+    run->config.free_map = false;
+
+    return true;
+}
+
+static int test_fs_collect(void* data, lfs_block_t block) {
+
+    ((std::vector<lfs_block_t>*)data)->push_back(block);
+
+    return LFS_ERR_OK;
+}
+
+// Writes a file of count blocks, after setting them aside first if asked,
+// and tells whether the blocks it was written to follow one another
+static bool test_fs_fallocate_write(test_fs_run_t* run, const char* name, lfs_size_t count,
+    bool fallocate, bool* contiguous) {
+
+    lfs_file_t file = {};
+    std::vector<uint8_t> data(count * test_fs_block_size - 2 * count * sizeof(lfs_block_t), 0x3c);
+    std::vector<lfs_block_t> blocks;
+
+    TEST_CHECK_OK(lfs_file_open(&run->lfs, &file, name, LFS_O_RDWR | LFS_O_CREAT));
+
+    if (fallocate) {
+        TEST_CHECK_OK(lfs_file_fallocate(&run->lfs, &file, 0, (lfs_off_t)data.size()));
+        TEST_CHECK(file.reserved.count > 0);
+    }
+
+    TEST_CHECK(lfs_file_write(&run->lfs, &file, data.data(), (lfs_size_t)data.size()) == (lfs_ssize_t)data.size());
+    TEST_CHECK_OK(lfs_file_sync(&run->lfs, &file));
+
+    if (file.flags & LFS_F_EXTENT) {
+        TEST_CHECK_OK(lfs_extent_traverse(&run->lfs, &file.extents, test_fs_collect, &blocks));
+    }
+    else {
+        TEST_CHECK_OK(lfs_ctz_traverse(&run->lfs, NULL, &run->lfs.read_cache,
+            file.ctz.head, file.ctz.size, test_fs_collect, &blocks));
+    }
+
+    TEST_CHECK_OK(lfs_file_close(&run->lfs, &file));
+
+    // the skip-list of a CTZ file reaches some blocks more than once
+    std::sort(blocks.begin(), blocks.end());
+    blocks.erase(std::unique(blocks.begin(), blocks.end()), blocks.end());
+
+    *contiguous = !blocks.empty() && blocks.back() - blocks.front() + 1 == blocks.size();
+
+    return true;
+}
+
+// A run set aside with lfs_file_fallocate is what the file is written to,
+// one after another, where the same write without it takes the free blocks
+// left between the files of a fragmented device
+static bool test_fs_fallocate(test_fs_run_t* run) {
+
+    for (lfs_file_layout layout : { LFS_LAYOUT_CTZ, LFS_LAYOUT_EXTENT }) {
+
+        run->lfs = {};
+
+        test_ram_config(&run->config, &run->ram, test_fs_block_size, test_fs_block_count);
+        run->config.file_layout = layout;
+        run->config.free_map = (layout == LFS_LAYOUT_EXTENT);
+
+        TEST_CHECK_OK(lfs_format(&run->lfs, &run->config));
+        TEST_CHECK_OK(lfs_mount(&run->lfs, &run->config));
+
+        // a block each until the device is nearly full, then every other
+        // one removed again but for a run of them taken out together
+        std::vector<uint8_t> block(test_fs_block_size, 0xa5);
+        char name[16];
+        int count = 0;
+
+        while (lfs_fs_size(&run->lfs) < (lfs_ssize_t)test_fs_block_count - 8) {
+
+            lfs_file_t file = {};
+
+            snprintf(name, sizeof(name), "f%d", count++);
+
+            TEST_CHECK_OK(lfs_file_open(&run->lfs, &file, name, LFS_O_WRONLY | LFS_O_CREAT));
+            TEST_CHECK(lfs_file_write(&run->lfs, &file, block.data(), test_fs_block_size) == test_fs_block_size);
+            TEST_CHECK_OK(lfs_file_close(&run->lfs, &file));
+        }
+
+        for (int i = 0; i < count; i++) {
+
+            if (i % 2 == 0 || (i >= count / 2 && i < count / 2 + 16)) {
+
+                snprintf(name, sizeof(name), "f%d", i);
+                TEST_CHECK_OK(lfs_remove(&run->lfs, name));
+            }
+        }
+
+        TEST_CHECK_OK(lfs_unmount(&run->lfs));
+        TEST_CHECK_OK(lfs_mount(&run->lfs, &run->config));
+
+        bool contiguous = false;
+
+        TEST_CHECK(test_fs_fallocate_write(run, "reserved", 8, true, &contiguous));
+        TEST_CHECK(contiguous);
+
+        TEST_CHECK(test_fs_fallocate_write(run, "scattered", 8, false, &contiguous));
+        TEST_CHECK(!contiguous);
+
+        TEST_CHECK(test_fs_check_window(&run->lfs));
+        TEST_CHECK_OK(lfs_unmount(&run->lfs));
+    }
+
+    run->config.file_layout = LFS_LAYOUT_CTZ;
+    run->config.free_map = false;
+
+    return true;
+}
+
+// Reads a file in small sequential pieces and counts the device reads they
+// took, and whether the file read ahead
+static bool test_fs_readahead_read(test_fs_run_t* run, const std::vector<uint8_t>& data,
+    uint64_t* reads, bool* ahead) {
+
+    lfs_file_t file = {};
+    std::vector<uint8_t> buffer(data.size());
+
+    TEST_CHECK_OK(lfs_file_open(&run->lfs, &file, "r", LFS_O_RDONLY));
+
+    uint64_t before = run->ram.reads;
+
+    for (lfs_size_t off = 0; off < data.size(); off += 32) {
+
+        TEST_CHECK(lfs_file_read(&run->lfs, &file, &buffer[off], 32) == 32);
+    }
+
+    *reads = run->ram.reads - before;
+    *ahead = file.readahead.window > 0;
+
+    TEST_CHECK_OK(lfs_file_close(&run->lfs, &file));
+    TEST_CHECK(buffer == data);
+
+    return true;
+}
+
+// Small sequential reads go to the device a block ahead at a time with
+// read-ahead, rather than a cache at a time
+static bool test_fs_readahead(test_fs_run_t* run) {
+
+    for (lfs_file_layout layout : { LFS_LAYOUT_CTZ, LFS_LAYOUT_EXTENT }) {
+
+        run->lfs = {};
+
+        test_ram_config(&run->config, &run->ram, test_fs_block_size, test_fs_block_count);
+        run->config.file_layout = layout;
+        run->config.read_batch = test_ram_read_batch;
+
+        TEST_CHECK_OK(lfs_format(&run->lfs, &run->config));
+        TEST_CHECK_OK(lfs_mount(&run->lfs, &run->config));
+
+        std::vector<uint8_t> data(16 * test_fs_block_size);
+        lfs_file_t file = {};
+
+        for (size_t i = 0; i < data.size(); i++) {
+            data[i] = (uint8_t)(i * 7 + i / 251);
+        }
+
+        TEST_CHECK_OK(lfs_file_open(&run->lfs, &file, "r", LFS_O_WRONLY | LFS_O_CREAT));
+        TEST_CHECK(lfs_file_write(&run->lfs, &file, data.data(), (lfs_size_t)data.size()) == (lfs_ssize_t)data.size());
+        TEST_CHECK_OK(lfs_file_close(&run->lfs, &file));
+        TEST_CHECK_OK(lfs_unmount(&run->lfs));
+
+        uint64_t reads = 0;
+        uint64_t plain = 0;
+        bool ahead = false;
+
+        TEST_CHECK_OK(lfs_mount(&run->lfs, &run->config));
+        TEST_CHECK(test_fs_readahead_read(run, data, &plain, &ahead));
+        TEST_CHECK(!ahead);
+        TEST_CHECK_OK(lfs_unmount(&run->lfs));
+
+        run->config.readahead_size = 4 * test_fs_block_size;
+
+        uint64_t batches = run->ram.batches;
+
+        TEST_CHECK_OK(lfs_mount(&run->lfs, &run->config));
+        TEST_CHECK(test_fs_readahead_read(run, data, &reads, &ahead));
+        TEST_CHECK(ahead);
+        TEST_CHECK(run->ram.batches > batches);
+        TEST_CHECK(2 * reads < plain);
+        TEST_CHECK_OK(lfs_unmount(&run->lfs));
+    }
+
+    run->config.file_layout = LFS_LAYOUT_CTZ;
+    run->config.read_batch = NULL;
+    run->config.readahead_size = 0;
+
+    return true;
+}
+
+// Blocks the read slot checks read behind the filesystem's back, the first
+// half of each holds a pattern and the rest is left erased
+static const lfs_block_t test_fs_slot_blocks[] = { 100, 101, 102, 103, 104, 105 };
+
+static bool test_fs_slots_mount(test_fs_run_t* run, lfs_size_t count, lfs_size_t metadata, bool batch) {
+
+    run->lfs = {};
+
+    test_ram_config(&run->config, &run->ram, test_fs_block_size, test_fs_block_count);
+    run->config.read_cache_count = count;
+    run->config.read_cache_metadata = metadata;
+    run->config.read_batch = batch ? test_ram_read_batch : NULL;
+
+    TEST_CHECK_OK(lfs_format(&run->lfs, &run->config));
+    TEST_CHECK_OK(lfs_mount(&run->lfs, &run->config));
+
+    for (lfs_block_t block : test_fs_slot_blocks) {
+        for (lfs_size_t i = 0; i < test_fs_block_size / 2; i++) {
+            run->ram.image[(size_t)block * test_fs_block_size + i] = (uint8_t)(block + i * 7);
+        }
+    }
+
+    return true;
+}
+
+// Reads the start of each block through the shared read cache, checked
+// against the device, and checks how many device reads that took
+static bool test_fs_slot_reads(test_fs_run_t* run, std::initializer_list<lfs_block_t> blocks, uint64_t reads) {
+
+    uint64_t before = run->ram.reads;
+
+    for (lfs_block_t block : blocks) {
+
+        uint8_t buffer[64];
+
+        TEST_CHECK_OK(lfs_bd_read(&run->lfs, NULL, &run->lfs.read_cache, test_fs_block_size,
+            block, 0, buffer, sizeof(buffer)));
+        TEST_CHECK(memcmp(buffer, &run->ram.image[(size_t)block * test_fs_block_size], sizeof(buffer)) == 0);
+    }
+
+    TEST_CHECK(run->ram.reads - before == reads);
+
+    return true;
+}
+
+// A block one of the extra slots holds, those past the first are the ones
+// the slots drop themselves when a block changes
+static lfs_block_t test_fs_slot_held(test_fs_run_t* run) {
+
+    for (lfs_block_t block : test_fs_slot_blocks) {
+        for (lfs_size_t i = 1; i < run->config.read_cache_count; i++) {
+            if (run->lfs.read_slots[i].cache.block == block) {
+                return block;
+            }
+        }
+    }
+
+    return LFS_BLOCK_NULL;
+}
+
+// The read cache slots replace the least recently used first, keep metadata
+// pairs when slots are set aside for them, forget blocks that are erased or
+// programmed, and take prefetches and batches in one device call
+static bool test_fs_read_slots(test_fs_run_t* run) {
+
+    const lfs_block_t a = 100, b = 101, c = 102, d = 103, e = 104, f = 105;
+
+    TEST_CHECK(test_fs_slots_mount(run, 4, 0, false));
+    TEST_CHECK(test_fs_slot_reads(run, { a, b, c, d }, 4));
+    TEST_CHECK(test_fs_slot_reads(run, { a, b, c, d }, 0));
+    TEST_CHECK(test_fs_slot_reads(run, { a, e }, 1));
+    TEST_CHECK(test_fs_slot_reads(run, { a, c, d, e }, 0));
+    TEST_CHECK(test_fs_slot_reads(run, { b }, 1));
+
+    lfs_block_t block = test_fs_slot_held(run);
+    TEST_CHECK(block != LFS_BLOCK_NULL);
+    TEST_CHECK_OK(lfs_bd_erase(&run->lfs, block));
+    TEST_CHECK(test_fs_slot_reads(run, { block }, 1));
+
+    // programs go past the pattern, onto what is still erased
+    uint8_t data[16];
+    memset(data, 0x5a, sizeof(data));
+
+    block = test_fs_slot_held(run);
+    TEST_CHECK(block != LFS_BLOCK_NULL);
+    TEST_CHECK_OK(lfs_bd_write(&run->lfs, &run->lfs.write_cache, &run->lfs.read_cache, false,
+        block, 48, data, sizeof(data)));
+    TEST_CHECK_OK(lfs_bd_flush(&run->lfs, &run->lfs.write_cache, &run->lfs.read_cache, false));
+    TEST_CHECK(test_fs_slot_reads(run, { block }, 1));
+    TEST_CHECK(run->ram.image[(size_t)block * test_fs_block_size + 48] == 0x5a);
+    TEST_CHECK_OK(lfs_unmount(&run->lfs));
+
+    // data reads go around the pair only when slots are set aside for it
+    for (bool pinned : { false, true }) {
+
+        TEST_CHECK(test_fs_slots_mount(run, 4, pinned ? 2 : 0, false));
+
+        run->lfs.read_pair[0] = a;
+        run->lfs.read_pair[1] = b;
+
+        TEST_CHECK(test_fs_slot_reads(run, { a, b }, 2));
+        TEST_CHECK(test_fs_slot_reads(run, { c, d, e, f }, 4));
+        TEST_CHECK(test_fs_slot_reads(run, { a, b }, pinned ? 0 : 2));
+        TEST_CHECK_OK(lfs_unmount(&run->lfs));
+    }
+
+    // a prefetch needs a device that takes batches
+    const lfs_block_t pair[2] = { e, f };
+
+    for (bool batch : { false, true }) {
+
+        TEST_CHECK(test_fs_slots_mount(run, 4, 0, batch));
+
+        uint64_t batches = run->ram.batches;
+        uint64_t reads = run->ram.reads;
+
+        TEST_CHECK_OK(lfs_bd_prefetch(&run->lfs, pair, 2, 64));
+        TEST_CHECK(run->ram.batches - batches == (batch ? 1 : 0));
+        TEST_CHECK(run->ram.reads - reads == (batch ? 2 : 0));
+        TEST_CHECK(test_fs_slot_reads(run, { e, f }, batch ? 0 : 2));
+
+        batches = run->ram.batches;
+
+        TEST_CHECK_OK(lfs_bd_prefetch(&run->lfs, pair, 2, 64));
+        TEST_CHECK(run->ram.batches == batches);
+        TEST_CHECK_OK(lfs_unmount(&run->lfs));
+    }
+
+    // a batch goes around the caches, more than LFS_READ_BATCH_MAX regions
+    // take more than one call
+    TEST_CHECK(test_fs_slots_mount(run, 4, 0, true));
+
+    std::vector<uint8_t> buffer(2 * LFS_READ_BATCH_MAX * 16);
+    std::vector<lfs_bd_request_t> requests;
+
+    for (lfs_size_t i = 0; i < 2 * LFS_READ_BATCH_MAX; i++) {
+        requests.push_back({ test_fs_slot_blocks[i % 6], (i / 6) * 16, &buffer[i * 16], 16 });
+    }
+
+    uint64_t batches = run->ram.batches;
+    uint64_t reads = run->ram.reads;
+
+    TEST_CHECK_OK(lfs_bd_readbatch(&run->lfs, requests.data(), (lfs_size_t)requests.size()));
+    TEST_CHECK(run->ram.batches - batches == 2);
+    TEST_CHECK(run->ram.reads - reads == requests.size());
+
+    for (const lfs_bd_request_t& request : requests) {
+        TEST_CHECK(memcmp(request.buffer,
+            &run->ram.image[(size_t)request.block * test_fs_block_size + request.offset], request.size) == 0);
+    }
+
+    TEST_CHECK_OK(lfs_unmount(&run->lfs));
+
+    run->config.read_cache_count = 0;
+    run->config.read_batch = NULL;
+
+    return true;
+}
+
+// What a file holds, the error opening it if it can't be read
+static int test_fs_tx_get(lfs_t* lfs, const std::string& name, std::vector<uint8_t>* data) {
+
+    lfs_file_t file = {};
+    int err = lfs_file_open(lfs, &file, name.c_str(), LFS_O_RDONLY);
+
+    if (err) {
+        return err;
+    }
+
+    data->resize((size_t)lfs_file_size(lfs, &file));
+
+    lfs_ssize_t res = lfs_file_read(lfs, &file, data->data(), (lfs_size_t)data->size());
+    err = lfs_file_close(lfs, &file);
+
+    return (res != (lfs_ssize_t)data->size()) ? LFS_ERR_CORRUPT : err;
+}
+
+static std::vector<uint8_t> test_fs_tx_data(uint32_t seed, lfs_size_t size) {
+
+    std::vector<uint8_t> data(size);
+
+    for (lfs_size_t i = 0; i < size; i++) {
+        data[i] = (uint8_t)(seed * 31 + i * 7 + i / 251);
+    }
+
+    return data;
+}
+
+static bool test_fs_tx_put(lfs_t* lfs, const std::string& name, const std::vector<uint8_t>& data) {
+
+    lfs_file_t file = {};
+
+    TEST_CHECK_OK(lfs_file_open(lfs, &file, name.c_str(), LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC));
+    TEST_CHECK(lfs_file_write(lfs, &file, data.data(), (lfs_size_t)data.size()) == (lfs_ssize_t)data.size());
+    TEST_CHECK_OK(lfs_file_close(lfs, &file));
+
+    return true;
+}
+
+// A directory t with four files in it, the third with an attribute
+static bool test_fs_tx_setup(test_fs_run_t* run, lfs_file_layout layout) {
+
+    run->lfs = {};
+
+    test_ram_config(&run->config, &run->ram, test_fs_block_size, test_fs_block_count);
+    run->config.file_layout = layout;
+
+    TEST_CHECK_OK(lfs_format(&run->lfs, &run->config));
+    TEST_CHECK_OK(lfs_mount(&run->lfs, &run->config));
+    TEST_CHECK_OK(lfs_mkdir(&run->lfs, "t"));
+
+    for (uint32_t i = 0; i < 4; i++) {
+        TEST_CHECK(test_fs_tx_put(&run->lfs, "t/old" + std::to_string(i), test_fs_tx_data(100 + i, 30)));
+    }
+
+    TEST_CHECK_OK(lfs_set_attribute(&run->lfs, "t/old2", 2, "keep", 4));
+
+    return true;
+}
+
+// Creates inline and in blocks, a rewrite, a removal, a removal written
+// again, attributes with and without data, and a file written and removed
+// again, along with the operations refused as they are queued
+static bool test_fs_tx_queue(test_fs_run_t* run, lfs_tx_t* tx) {
+
+    lfs_t* lfs = &run->lfs;
+    std::vector<uint8_t> data;
+
+    TEST_CHECK_OK(lfs_tx_begin(lfs, tx));
+
+    data = test_fs_tx_data(99, 10);
+    TEST_CHECK_OK(lfs_tx_write(lfs, tx, "t/new0", data.data(), (lfs_size_t)data.size()));
+    TEST_CHECK_OK(lfs_tx_write(lfs, tx, "t/new1", data.data(), (lfs_size_t)data.size()));
+
+    for (uint32_t i = 0; i < 8; i++) {
+
+        std::string name = (i == 1) ? "/t/./z/../new1" : "t/new" + std::to_string(i);
+
+        data = test_fs_tx_data(i, 20 + 3 * i);
+        TEST_CHECK_OK(lfs_tx_write(lfs, tx, name.c_str(), data.data(), (lfs_size_t)data.size()));
+    }
+
+    data = test_fs_tx_data(50, 3 * test_fs_block_size + 7);
+    TEST_CHECK_OK(lfs_tx_write(lfs, tx, "t/big", data.data(), (lfs_size_t)data.size()));
+
+    data = test_fs_tx_data(200, 40);
+    TEST_CHECK_OK(lfs_tx_write(lfs, tx, "t/old0", data.data(), (lfs_size_t)data.size()));
+    TEST_CHECK_OK(lfs_tx_set_attribute(lfs, tx, "t/old0", 1, "x1", 2));
+
+    TEST_CHECK_OK(lfs_tx_remove(lfs, tx, "t/old1"));
+    TEST_CHECK(lfs_tx_set_attribute(lfs, tx, "t/old1", 1, "x1", 2) == LFS_ERR_NOENT);
+    TEST_CHECK(lfs_tx_remove(lfs, tx, "t/old1") == LFS_ERR_NOENT);
+
+    data = test_fs_tx_data(202, 12);
+    TEST_CHECK_OK(lfs_tx_remove(lfs, tx, "t/old2"));
+    TEST_CHECK_OK(lfs_tx_write(lfs, tx, "t/old2", data.data(), (lfs_size_t)data.size()));
+
+    TEST_CHECK_OK(lfs_tx_set_attribute(lfs, tx, "t/old3", 3, "a3", 2));
+
+    TEST_CHECK_OK(lfs_tx_write(lfs, tx, "t/tmp", data.data(), (lfs_size_t)data.size()));
+    TEST_CHECK_OK(lfs_tx_remove(lfs, tx, "t/tmp"));
+
+    TEST_CHECK(lfs_tx_remove(lfs, tx, "t/none") == LFS_ERR_NOENT);
+    TEST_CHECK(lfs_tx_write(lfs, tx, "u/new", data.data(), 1) == LFS_ERR_NOENT);
+    TEST_CHECK(lfs_tx_write(lfs, tx, "t", data.data(), 1) == LFS_ERR_ISDIR);
+    TEST_CHECK(lfs_tx_remove(lfs, tx, "t/..") == LFS_ERR_INVAL);
+    TEST_CHECK(lfs_tx_set_attribute(lfs, tx, "t/new3", 1, data.data(), lfs->attr_max_size + 1) == LFS_ERR_NOSPC);
+
+    // new0 to new7, big, old0 to old3 and tmp
+    TEST_CHECK(tx->count == 14);
+
+    return true;
+}
+
+// 0 if none of the transaction is on disk, 1 if all of it is, -1 otherwise
+static int test_fs_tx_state(lfs_t* lfs) {
+
+    bool was = true;
+    bool now = true;
+    std::vector<uint8_t> data;
+    uint8_t attr[8];
+
+    for (uint32_t i = 0; i < 8; i++) {
+
+        int err = test_fs_tx_get(lfs, "t/new" + std::to_string(i), &data);
+
+        was = was && err == LFS_ERR_NOENT;
+        now = now && err == LFS_ERR_OK && data == test_fs_tx_data(i, 20 + 3 * i);
+    }
+
+    int err = test_fs_tx_get(lfs, "t/big", &data);
+
+    was = was && err == LFS_ERR_NOENT;
+    now = now && err == LFS_ERR_OK && data == test_fs_tx_data(50, 3 * test_fs_block_size + 7);
+
+    for (uint32_t i = 0; i < 4; i++) {
+
+        err = test_fs_tx_get(lfs, "t/old" + std::to_string(i), &data);
+
+        was = was && err == LFS_ERR_OK && data == test_fs_tx_data(100 + i, 30);
+        now = now && ((i == 1) ? err == LFS_ERR_NOENT : err == LFS_ERR_OK && data ==
+            ((i == 0) ? test_fs_tx_data(200, 40) : (i == 2) ? test_fs_tx_data(202, 12) : test_fs_tx_data(103, 30)));
+    }
+
+    lfs_ssize_t res = lfs_get_attribute(lfs, "t/old0", 1, attr, sizeof(attr));
+
+    was = was && res == LFS_ERR_NOATTR;
+    now = now && res == 2 && memcmp(attr, "x1", 2) == 0;
+
+    res = lfs_get_attribute(lfs, "t/old2", 2, attr, sizeof(attr));
+
+    was = was && res == 4 && memcmp(attr, "keep", 4) == 0;
+    now = now && res == LFS_ERR_NOATTR;
+
+    res = lfs_get_attribute(lfs, "t/old3", 3, attr, sizeof(attr));
+
+    was = was && res == LFS_ERR_NOATTR;
+    now = now && res == 2 && memcmp(attr, "a3", 2) == 0;
+
+    err = test_fs_tx_get(lfs, "t/tmp", &data);
+
+    was = was && err == LFS_ERR_NOENT;
+    now = now && err == LFS_ERR_NOENT;
+
+    return now ? 1 : was ? 0 : -1;
+}
+
+// Names of a directory in the order lfs_dir_find keeps them, a name before
+// the longer names it is a prefix of
+static bool test_fs_tx_sorted(lfs_t* lfs, const char* path, size_t count) {
+
+    lfs_dir_t dir = {};
+    struct lfs_info info;
+    std::vector<std::string> names;
+
+    TEST_CHECK_OK(lfs_dir_open(lfs, &dir, path));
+
+    while (lfs_dir_read(lfs, &dir, &info) == LFS_ERR_OK) {
+
+        if (strcmp(info.name, ".") != 0 && strcmp(info.name, "..") != 0) {
+            names.push_back(info.name);
+        }
+    }
+
+    TEST_CHECK_OK(lfs_dir_close(lfs, &dir));
+    TEST_CHECK(names.size() == count);
+
+    for (size_t i = 1; i < names.size(); i++) {
+
+        const std::string& a = names[i - 1];
+        const std::string& b = names[i];
+        int res = memcmp(a.data(), b.data(), std::min(a.size(), b.size()));
+
+        TEST_CHECK(res < 0 || (res == 0 && a.size() > b.size()));
+    }
+
+    return true;
+}
+
+// Nothing queued is seen before the commit, which makes all of it with one
+// commit to the pair of t and one sync, with either layout. Aborting gives
+// the blocks written back.
+static bool test_fs_tx_commit(test_fs_run_t* run) {
+
+    for (int layout = LFS_LAYOUT_CTZ; layout <= LFS_LAYOUT_EXTENT; layout++) {
+
+        lfs_tx_t tx;
+
+        TEST_CHECK(test_fs_tx_setup(run, (lfs_file_layout)layout));
+
+        lfs_ssize_t size = lfs_fs_size(&run->lfs);
+
+        TEST_CHECK(test_fs_tx_queue(run, &tx));
+        TEST_CHECK(test_fs_tx_state(&run->lfs) == 0);
+        TEST_CHECK(lfs_fs_size(&run->lfs) > size);
+        TEST_CHECK_OK(lfs_tx_abort(&run->lfs, &tx));
+        TEST_CHECK(tx.count == 0);
+        TEST_CHECK(lfs_fs_size(&run->lfs) == size);
+        TEST_CHECK(test_fs_tx_state(&run->lfs) == 0);
+
+        TEST_CHECK(test_fs_tx_queue(run, &tx));
+
+        uint64_t syncs = run->ram.syncs;
+        uint32_t commits = run->lfs.commit_stamp;
+
+        TEST_CHECK_OK(lfs_tx_commit(&run->lfs, &tx));
+        TEST_CHECK(run->ram.syncs == syncs + 1);
+        TEST_CHECK(run->lfs.commit_stamp == commits + 1);
+        TEST_CHECK(test_fs_tx_state(&run->lfs) == 1);
+        TEST_CHECK(test_fs_tx_sorted(&run->lfs, "t", 12));
+
+        TEST_CHECK_OK(lfs_unmount(&run->lfs));
+        TEST_CHECK_OK(lfs_mount(&run->lfs, &run->config));
+        TEST_CHECK(test_fs_tx_state(&run->lfs) == 1);
+        TEST_CHECK(test_fs_check_window(&run->lfs));
+        TEST_CHECK_OK(lfs_unmount(&run->lfs));
+        TEST_CHECK(run->ram.violations == 0);
+    }
+
+    run->config.file_layout = LFS_LAYOUT_CTZ;
+
+    return true;
+}
+
+// The device loses power after every number of programs the commit makes in
+// turn, the image left has to hold all of the transaction or none of it
+static bool test_fs_tx_crash(test_fs_run_t* run) {
+
+    uint32_t old = 0;
+
+    for (uint64_t limit = 0; ; limit++) {
+
+        lfs_tx_t tx;
+
+        TEST_CHECK(limit < 10000);
+        TEST_CHECK(test_fs_tx_setup(run, LFS_LAYOUT_CTZ));
+        TEST_CHECK(test_fs_tx_queue(run, &tx));
+
+        run->ram.prog_limit = run->ram.progs + limit;
+
+        int err = lfs_tx_commit(&run->lfs, &tx);
+
+        run->ram.prog_limit = 0;
+        lfs_unmount(&run->lfs);
+
+        run->crash_ram.image = run->ram.image;
+        run->crash_config = run->config;
+        run->crash_config.context = &run->crash_ram;
+        run->crash_lfs = {};
+
+        TEST_CHECK_OK(lfs_mount(&run->crash_lfs, &run->crash_config));
+
+        int state = test_fs_tx_state(&run->crash_lfs);
+
+        TEST_CHECK(state == 1 || (state == 0 && err));
+        TEST_CHECK(test_fs_check_window(&run->crash_lfs));
+        TEST_CHECK_OK(lfs_unmount(&run->crash_lfs));
+
+        old += (state == 0) ? 1 : 0;
+
+        if (!err) {
+            break;
+        }
+    }
+
+    TEST_CHECK(old > 0);
+
+    return true;
+}
+
+// More names created in one directory than a pair has ids for, the commit
+// goes on with the names left over once the first is made
+static bool test_fs_tx_large(test_fs_run_t* run) {
+
+    static const uint32_t count = 1100;
+
+    run->lfs = {};
+
+    test_ram_config(&run->config, &run->ram, test_fs_block_size, 4 * test_fs_block_count);
+
+    TEST_CHECK_OK(lfs_format(&run->lfs, &run->config));
+    TEST_CHECK_OK(lfs_mount(&run->lfs, &run->config));
+    TEST_CHECK_OK(lfs_mkdir(&run->lfs, "d"));
+
+    char name[16];
+
+    for (uint32_t i = 0; i < count; i += 100) {
+
+        snprintf(name, sizeof(name), "d/f%04u", (unsigned)i);
+        TEST_CHECK(test_fs_tx_put(&run->lfs, name, test_fs_tx_data(i, 5)));
+    }
+
+    lfs_tx_t tx;
+
+    TEST_CHECK_OK(lfs_tx_begin(&run->lfs, &tx));
+
+    for (uint32_t i = 0; i < count; i++) {
+
+        std::vector<uint8_t> data = test_fs_tx_data(i, i % 3);
+
+        snprintf(name, sizeof(name), "d/f%04u", (unsigned)i);
+        TEST_CHECK_OK(lfs_tx_write(&run->lfs, &tx, name, data.data(), (lfs_size_t)data.size()));
+    }
+
+    uint64_t syncs = run->ram.syncs;
+
+    TEST_CHECK_OK(lfs_tx_commit(&run->lfs, &tx));
+    TEST_CHECK(run->ram.syncs == syncs + 1);
+
+    for (int mount = 0; mount < 2; mount++) {
+
+        std::vector<uint8_t> data;
+        lfs_dir_t dir = {};
+        struct lfs_info info;
+        uint32_t found = 0;
+
+        for (uint32_t i = 0; i < count; i++) {
+
+            snprintf(name, sizeof(name), "d/f%04u", (unsigned)i);
+            TEST_CHECK_OK(test_fs_tx_get(&run->lfs, name, &data));
+            TEST_CHECK(data == test_fs_tx_data(i, i % 3));
+        }
+
+        TEST_CHECK_OK(lfs_dir_open(&run->lfs, &dir, "d"));
+
+        while (lfs_dir_read(&run->lfs, &dir, &info) == LFS_ERR_OK) {
+            found += (info.name[0] == 'f') ? 1 : 0;
+        }
+
+        TEST_CHECK_OK(lfs_dir_close(&run->lfs, &dir));
+        TEST_CHECK(found == count);
+
+        TEST_CHECK_OK(lfs_unmount(&run->lfs));
+
+        if (mount == 0) {
+            TEST_CHECK_OK(lfs_mount(&run->lfs, &run->config));
+        }
+    }
+
+    TEST_CHECK(run->ram.violations == 0);
+
+    return true;
+}
+
+// Small files ingested into one directory, each written and closed on its
+// own, then all of them in one transaction, compacted by the nested
+// traversal and by the compact table
+struct test_fs_ingest_t {
+    double ms;
+    uint64_t syncs;
+    uint64_t progs;
+    uint32_t commits;
+};
+
+static bool test_fs_tx_ingest(test_fs_run_t* run, test_fs_ingest_t* each, test_fs_ingest_t* tx, test_fs_ingest_t* table) {
+
+    static const uint32_t count = 200;
+
+    for (int pass = 0; pass < 3; pass++) {
+
+        test_fs_ingest_t* result = pass == 0 ? each : pass == 1 ? tx : table;
+        lfs_tx_t ingest;
+
+        run->lfs = {};
+
+        test_ram_config(&run->config, &run->ram, test_fs_block_size, 4 * test_fs_block_count);
+
+        run->config.compact_table = pass == 2;
+
+        TEST_CHECK_OK(lfs_format(&run->lfs, &run->config));
+        TEST_CHECK_OK(lfs_mount(&run->lfs, &run->config));
+        TEST_CHECK_OK(lfs_mkdir(&run->lfs, "i"));
+
+        uint64_t syncs = run->ram.syncs;
+        uint64_t progs = run->ram.progs;
+        uint32_t commits = run->lfs.commit_stamp;
+        auto start = std::chrono::steady_clock::now();
+
+        if (pass) {
+            TEST_CHECK_OK(lfs_tx_begin(&run->lfs, &ingest));
+        }
+
+        for (uint32_t i = 0; i < count; i++) {
+
+            std::string name = "i/" + std::to_string(i);
+            std::vector<uint8_t> data = test_fs_tx_data(i, 48);
+
+            if (pass) {
+                TEST_CHECK_OK(lfs_tx_write(&run->lfs, &ingest, name.c_str(), data.data(), (lfs_size_t)data.size()));
+            }
+            else {
+                TEST_CHECK(test_fs_tx_put(&run->lfs, name, data));
+            }
+        }
+
+        if (pass) {
+            TEST_CHECK_OK(lfs_tx_commit(&run->lfs, &ingest));
+        }
+
+        result->ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        result->syncs = run->ram.syncs - syncs;
+        result->progs = run->ram.progs - progs;
+        result->commits = run->lfs.commit_stamp - commits;
+
+        TEST_CHECK(test_fs_tx_sorted(&run->lfs, "i", count));
+        TEST_CHECK_OK(lfs_unmount(&run->lfs));
+    }
+
+    TEST_CHECK(tx->syncs == 1 && tx->syncs < each->syncs);
+    TEST_CHECK(tx->commits * 10 < each->commits);
+    TEST_CHECK(table->syncs == tx->syncs && table->progs == tx->progs);
+
+    return true;
+}
+
+// Transactions committed, aborted, cut off by a power loss and too large
+// for one commit
+static bool test_fs_transactions(test_fs_run_t* run) {
+
+    TEST_CHECK(test_fs_tx_commit(run));
+    TEST_CHECK(test_fs_tx_crash(run));
+    TEST_CHECK(test_fs_tx_large(run));
+
+    return true;
+}
+
+static const test_fs_row_t test_fs_rows[] = {
+    { "ctz", [](lfs_config_t*, test_ram_t*) {} },
+    { "free map", [](lfs_config_t* config, test_ram_t*) {
+        config->free_map = true;
+    }, false, false, false, [](test_fs_run_t* run) {
+        TEST_CHECK(run->maps > 0 && run->stats.crash_maps > 0);
+        return true;
+    } },
+    { "extents", [](lfs_config_t* config, test_ram_t*) {
+        config->file_layout = LFS_LAYOUT_EXTENT;
+    }, false, false, false, [](test_fs_run_t* run) {
+        TEST_CHECK(run->stats.extent_files > 0);
+        return true;
+    } },
+    { "extents free map", [](lfs_config_t* config, test_ram_t*) {
+        config->file_layout = LFS_LAYOUT_EXTENT;
+        config->free_map = true;
+    }, false, false, false, [](test_fs_run_t* run) {
+        TEST_CHECK(run->stats.extent_files > 0);
+        TEST_CHECK(run->maps > 0 && run->stats.crash_maps > 0);
+        return true;
+    } },
+    { "growth", [](lfs_config_t* config, test_ram_t* ram) {
+        test_fs_growth(config, ram);
+    }, false, false, false, [](test_fs_run_t* run) {
+        TEST_CHECK(run->ram.grows > 0);
+        return true;
+    } },
+    { "growth free map", [](lfs_config_t* config, test_ram_t* ram) {
+        test_fs_growth(config, ram);
+        config->free_map = true;
+    }, false, false, false, [](test_fs_run_t* run) {
+        TEST_CHECK(run->ram.grows > 0);
+        TEST_CHECK(run->maps > 0 && run->stats.crash_maps > 0);
+        return true;
+    } },
+    { "batches", [](lfs_config_t*, test_ram_t*) {}, true },
+    { "batches grouped", [](lfs_config_t* config, test_ram_t*) {
+        config->sync_group = 4;
+        config->free_map = true;
+    }, true },
+    { "index cache", [](lfs_config_t* config, test_ram_t*) {
+        config->index_cache_size = 1024;
+    }, false, false, false, [](test_fs_run_t* run) {
+        TEST_CHECK(run->stats.index_hits > 0);
+        return true;
+    } },
+    { "copy", [](lfs_config_t* config, test_ram_t*) {
+        config->copy = test_ram_copy;
+    }, false, false, false, [](test_fs_run_t* run) {
+        TEST_CHECK(run->ram.copies > 0);
+        return true;
+    } },
+    { "extents copy", [](lfs_config_t* config, test_ram_t*) {
+        config->file_layout = LFS_LAYOUT_EXTENT;
+        config->copy = test_ram_copy;
+    }, false, false, false, [](test_fs_run_t* run) {
+        TEST_CHECK(run->ram.copies > 0 && run->stats.extent_files > 0);
+        return true;
+    } },
+    { "small caches", [](lfs_config_t* config, test_ram_t*) {
+        config->read_size = 4;
+        config->write_size = 4;
+        config->cache_size = 16;
+    } },
+    { "block caches", [](lfs_config_t* config, test_ram_t*) {
+        config->cache_size = test_fs_block_size;
+    } },
+    { "read slots", [](lfs_config_t* config, test_ram_t*) {
+        config->read_cache_count = 4;
+    }, false, false, false, [](test_fs_run_t* run) {
+        TEST_CHECK(run->stats.cache_hits > 0);
+        return true;
+    } },
+    { "read slots metadata", [](lfs_config_t* config, test_ram_t*) {
+        config->read_cache_count = 4;
+        config->read_cache_metadata = 2;
+        config->read_batch = test_ram_read_batch;
+    }, false, false, false, [](test_fs_run_t* run) {
+        TEST_CHECK(run->stats.cache_hits > 0 && run->ram.batches > 0);
+        return true;
+    } },
+    { "read slots small", [](lfs_config_t* config, test_ram_t*) {
+        config->cache_size = 16;
+        config->read_cache_count = 3;
+        config->read_cache_metadata = 1;
+    }, false, false, false, [](test_fs_run_t* run) {
+        TEST_CHECK(run->stats.cache_hits > 0);
+        return true;
+    } },
+    { "mapped", [](lfs_config_t* config, test_ram_t*) {
+        config->map = test_ram_map;
+    }, false, false, false, [](test_fs_run_t* run) {
+        TEST_CHECK(run->ram.maps > 0);
+        return true;
+    } },
+    { "mapped growth", [](lfs_config_t* config, test_ram_t* ram) {
+        test_fs_growth(config, ram);
+        config->map = test_ram_map;
+    }, false, false, false, [](test_fs_run_t* run) {
+        TEST_CHECK(run->ram.maps > 0 && run->ram.grows > 0);
+        return true;
+    } },
+    { "read batch", [](lfs_config_t* config, test_ram_t*) {
+        config->read_batch = test_ram_read_batch;
+    }, false, false, false, [](test_fs_run_t* run) {
+        TEST_CHECK(run->ram.batches > 0);
+        return true;
+    } },
+    { "extents read batch", [](lfs_config_t* config, test_ram_t*) {
+        config->file_layout = LFS_LAYOUT_EXTENT;
+        config->read_batch = test_ram_read_batch;
+    }, false, false, false, [](test_fs_run_t* run) {
+        TEST_CHECK(run->ram.batches > 0 && run->stats.extent_files > 0);
+        return true;
+    } },
+    { "readahead", [](lfs_config_t* config, test_ram_t*) {
+        config->readahead_size = 4 * test_fs_block_size;
+    }, false, false, false, [](test_fs_run_t* run) {
+        TEST_CHECK(run->stats.readaheads > 0);
+        return true;
+    } },
+    { "readahead read batch", [](lfs_config_t* config, test_ram_t*) {
+        config->readahead_size = 4 * test_fs_block_size;
+        config->read_batch = test_ram_read_batch;
+    }, false, false, false, [](test_fs_run_t* run) {
+        TEST_CHECK(run->stats.readaheads > 0 && run->ram.batches > 0);
+        return true;
+    } },
+    { "extents readahead", [](lfs_config_t* config, test_ram_t*) {
+        config->file_layout = LFS_LAYOUT_EXTENT;
+        config->readahead_size = 4 * test_fs_block_size;
+        config->read_batch = test_ram_read_batch;
+    }, false, false, false, [](test_fs_run_t* run) {
+        TEST_CHECK(run->stats.readaheads > 0 && run->stats.extent_files > 0);
+        return true;
+    } },
+    { "fallocate", [](lfs_config_t*, test_ram_t*) {}, false, true, false, [](test_fs_run_t* run) {
+        TEST_CHECK(run->stats.reserves > 0);
+        return true;
+    } },
+    { "fallocate free map", [](lfs_config_t* config, test_ram_t*) {
+        config->free_map = true;
+    }, false, true, false, [](test_fs_run_t* run) {
+        TEST_CHECK(run->stats.reserves > 0 && run->stats.crash_maps > 0);
+        return true;
+    } },
+    { "extents fallocate", [](lfs_config_t* config, test_ram_t*) {
+        config->file_layout = LFS_LAYOUT_EXTENT;
+        config->free_map = true;
+    }, false, true, false, [](test_fs_run_t* run) {
+        TEST_CHECK(run->stats.reserves > 0 && run->stats.extent_files > 0);
+        return true;
+    } },
+    { "dentry cache", [](lfs_config_t* config, test_ram_t*) {
+        config->dentry_cache_size = 4;
+    }, false, false, false, [](test_fs_run_t* run) {
+        TEST_CHECK(run->stats.dentry_hits > 0);
+        return true;
+    } },
+    { "dentry cache batches", [](lfs_config_t* config, test_ram_t*) {
+        config->dentry_cache_size = 16;
+        config->free_map = true;
+    }, true, false, false, [](test_fs_run_t* run) {
+        TEST_CHECK(run->stats.dentry_hits > 0);
+        return true;
+    } },
+    { "tag index", [](lfs_config_t* config, test_ram_t*) {
+        config->tag_index_count = 2;
+    }, false, false, false, [](test_fs_run_t* run) {
+        TEST_CHECK(run->stats.tag_index_hits > 0);
+        return true;
+    } },
+    { "tag index growth", [](lfs_config_t* config, test_ram_t* ram) {
+        test_fs_growth(config, ram);
+        config->tag_index_count = 8;
+        config->dentry_cache_size = 16;
+    }, false, false, false, [](test_fs_run_t* run) {
+        TEST_CHECK(run->stats.tag_index_hits > 0 && run->ram.grows > 0);
+        return true;
+    } },
+    { "gc", [](lfs_config_t*, test_ram_t*) {}, false, false, true, [](test_fs_run_t* run) {
+        TEST_CHECK(run->stats.gc_steps > 0);
+        return true;
+    } },
+    { "gc extents batches", [](lfs_config_t* config, test_ram_t*) {
+        config->file_layout = LFS_LAYOUT_EXTENT;
+        config->free_map = true;
+        config->compact_thresh = test_fs_block_size / 2;
+    }, true, false, true, [](test_fs_run_t* run) {
+        TEST_CHECK(run->stats.gc_steps > 0 && run->stats.extent_files > 0);
+        return true;
+    } },
+    // a worn block only the verification of programs keeps data off
+    { "verify worn block", [](lfs_config_t*, test_ram_t* ram) {
+        ram->bad_block = 40;
+    }, false, false, false, [](test_fs_run_t* run) {
+        TEST_CHECK(run->ram.bad_progs > 0);
+        return true;
+    } },
+    { "verify sampled", [](lfs_config_t* config, test_ram_t*) {
+        config->verify = LFS_VERIFY_SAMPLED;
+        config->verify_interval = 4;
+    } },
+    { "verify crc", [](lfs_config_t* config, test_ram_t* ram) {
+        config->verify = LFS_VERIFY_CRC;
+        config->crc = test_ram_crc;
+        ram->bad_block = 40;
+    }, false, false, false, [](test_fs_run_t* run) {
+        TEST_CHECK(run->ram.crcs > 0 && run->ram.bad_progs > 0);
+        return true;
+    } },
+    { "verify crc read back", [](lfs_config_t* config, test_ram_t* ram) {
+        config->verify = LFS_VERIFY_CRC;
+        ram->bad_block = 40;
+    }, false, false, false, [](test_fs_run_t* run) {
+        TEST_CHECK(run->ram.crcs == 0 && run->ram.bad_progs > 0);
+        return true;
+    } },
+};
+
+// Table compaction has to write what the nested traversal writes, so the
+// same seeds have to leave the same image with it and without it
+static bool test_fs_compact_table(test_fs_run_t* run, test_fs_run_t* table) {
+
+    static const test_fs_row_t rows[][2] = {
+        {
+            { "nested", [](lfs_config_t*, test_ram_t*) {} },
+            { "table", [](lfs_config_t* config, test_ram_t*) {
+                config->compact_table = true;
+            } },
+        },
+        {
+            { "nested", [](lfs_config_t* config, test_ram_t*) {
+                config->file_layout = LFS_LAYOUT_EXTENT;
+                config->free_map = true;
+            } },
+            { "table", [](lfs_config_t* config, test_ram_t*) {
+                config->file_layout = LFS_LAYOUT_EXTENT;
+                config->free_map = true;
+                config->compact_table = true;
+            } },
+        },
+    };
+
+    for (uint32_t seed = 1; seed <= 8; seed++) {
+
+        for (const auto& pair : rows) {
+
+            TEST_CHECK(test_fs_random(run, &pair[0], seed));
+            TEST_CHECK(test_fs_random(table, &pair[1], seed));
+
+            TEST_CHECK(run->full == table->full);
+            TEST_CHECK(run->ram.image == table->ram.image);
+        }
+    }
+
+    return true;
+}
+
+// The same seeds program the same with every verify mode, sampled checks
+// reading back fewer of the programs than full checks and more than none
+static bool test_fs_verify() {
+
+    static const test_fs_row_t rows[] = {
+        { "never", [](lfs_config_t* config, test_ram_t*) {
+            config->verify = LFS_VERIFY_NEVER;
+        } },
+        { "sampled", [](lfs_config_t* config, test_ram_t*) {
+            config->verify = LFS_VERIFY_SAMPLED;
+            config->verify_interval = 4;
+        } },
+        { "always", [](lfs_config_t*, test_ram_t*) {} },
+    };
+
+    uint64_t reads[3] = {};
+    uint64_t progs[3] = {};
+
+    for (int i = 0; i < 3; i++) {
+
+        test_fs_run_t* run = new test_fs_run_t();
+        bool ok = true;
+
+        for (uint32_t seed = 1; seed <= 4 && ok; seed++) {
+            ok = test_fs_random(run, &rows[i], seed);
+        }
+
+        reads[i] = run->ram.reads;
+        progs[i] = run->ram.progs;
+        delete run;
+
+        TEST_CHECK(ok);
+    }
+
+    TEST_CHECK(progs[0] == progs[1] && progs[1] == progs[2]);
+    TEST_CHECK(reads[0] < reads[1] && reads[1] < reads[2]);
+
+    return true;
+}
+
+int test_fs() {
+
+    int failed = 0;
+
+    for (const test_fs_row_t& row : test_fs_rows) {
+
+        test_fs_run_t* run = new test_fs_run_t();
+        uint32_t full = 0;
+        bool ok = true;
+
+        auto start = std::chrono::steady_clock::now();
+
+        for (uint32_t seed = 1; seed <= test_fs_seeds && ok; seed++) {
+
+            ok = test_fs_random(run, &row, seed);
+            full += run->full ? 1 : 0;
+        }
+
+        if (ok && row.check) {
+            ok = row.check(run);
+        }
+
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        printf("fs %-21s %s %8.1f ms  reads %8llu  progs %8llu  erases %6llu  syncs %6llu  grows %3llu  maps %3u  full %u\n",
+            row.name, ok ? "ok    " : "FAILED", ms,
+            (unsigned long long)run->ram.reads, (unsigned long long)run->ram.progs,
+            (unsigned long long)run->ram.erases, (unsigned long long)run->ram.syncs,
+            (unsigned long long)run->ram.grows, run->maps, full);
+
+        failed += ok ? 0 : 1;
+        delete run;
+    }
+
+    test_fs_run_t* run = new test_fs_run_t();
+    bool ok = true;
+
+    for (lfs_block_t left = 0; left < 4 && ok; left++) {
+
+        ok = test_fs_checkpoint(run, left);
+    }
+
+    printf("fs %-21s %s maps %u\n", "checkpoint", ok ? "ok    " : "FAILED", run->maps);
+
+    failed += ok ? 0 : 1;
+
+    ok = test_fs_dir_remove(run);
+
+    printf("fs %-21s %s\n", "dir remove", ok ? "ok    " : "FAILED");
+
+    failed += ok ? 0 : 1;
+
+    ok = test_fs_sparse(run);
+
+    printf("fs %-21s %s\n", "sparse", ok ? "ok    " : "FAILED");
+
+    failed += ok ? 0 : 1;
+
+    ok = test_fs_vectored(run);
+
+    printf("fs %-21s %s\n", "vectored", ok ? "ok    " : "FAILED");
+
+    failed += ok ? 0 : 1;
+
+    ok = test_fs_version(run);
+
+    printf("fs %-21s %s\n", "version", ok ? "ok    " : "FAILED");
+
+    failed += ok ? 0 : 1;
+
+    ok = test_fs_fallocate(run);
+
+    printf("fs %-21s %s\n", "fallocate runs", ok ? "ok    " : "FAILED");
+
+    failed += ok ? 0 : 1;
+
+    ok = test_fs_readahead(run);
+
+    printf("fs %-21s %s\n", "readahead reads", ok ? "ok    " : "FAILED");
+
+    failed += ok ? 0 : 1;
+
+    ok = test_fs_read_slots(run);
+
+    printf("fs %-21s %s\n", "read slot caching", ok ? "ok    " : "FAILED");
+
+    failed += ok ? 0 : 1;
+
+    ok = test_fs_transactions(run);
+
+    printf("fs %-21s %s\n", "transactions", ok ? "ok    " : "FAILED");
+
+    failed += ok ? 0 : 1;
+
+    test_fs_ingest_t each = {};
+    test_fs_ingest_t tx = {};
+    test_fs_ingest_t tx_table = {};
+
+    ok = test_fs_tx_ingest(run, &each, &tx, &tx_table);
+
+    printf("fs %-21s %s files %8.1f ms  syncs %4llu  commits %4u  progs %6llu  tx %8.1f ms  syncs %4llu  commits %4u  progs %6llu  table %8.1f ms\n",
+        "tx ingest", ok ? "ok    " : "FAILED",
+        each.ms, (unsigned long long)each.syncs, each.commits, (unsigned long long)each.progs,
+        tx.ms, (unsigned long long)tx.syncs, tx.commits, (unsigned long long)tx.progs,
+        tx_table.ms);
+
+    failed += ok ? 0 : 1;
+
+    ok = test_fs_verify();
+
+    printf("fs %-21s %s\n", "verify modes", ok ? "ok    " : "FAILED");
+
+    failed += ok ? 0 : 1;
+
+    test_fs_run_t* table = new test_fs_run_t();
+
+    ok = test_fs_compact_table(run, table);
+
+    printf("fs %-21s %s\n", "compact table", ok ? "ok    " : "FAILED");
+
+    failed += ok ? 0 : 1;
+    delete table;
+    delete run;
+
+    return failed;
+}
@@ -0,0 +1,265 @@
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <shared_mutex>
+
+#include "test.h"
+#include "ram_device.h"
+
+// Readers going through files, stats and listings under lock_shared while a
+// writer creates, rewrites and removes files next to them, so the pairs
+// the readers fetch from are committed to, compacted and relocated under
+// them. The files read are written once up front and have to read back the
+// same every time.
+static const lfs_size_t test_threads_block_size = 512;
+static const lfs_size_t test_threads_block_count = 256;
+static const int test_threads_readers = 4;
+static const int test_threads_files = 6;
+static const int test_threads_rounds = 300;
+
+struct test_threads_ram_t : test_ram_t {
+
+    // the writer holds this exclusively, lfs_fs_grow from allocate_block
+    // isn't used here so it needn't be recursive
+    std::shared_mutex lock;
+
+    std::atomic<uint64_t> shared{ 0 };
+};
+
+static int test_threads_lock(const lfs_config_t* config) {
+
+    test_threads_ram_t* ram = (test_threads_ram_t*)config->context;
+
+    ram->lock.lock();
+    ram->locks += 1;
+
+    return LFS_ERR_OK;
+}
+
+static int test_threads_unlock(const lfs_config_t* config) {
+
+    ((test_threads_ram_t*)config->context)->lock.unlock();
+
+    return LFS_ERR_OK;
+}
+
+static int test_threads_lock_shared(const lfs_config_t* config) {
+
+    test_threads_ram_t* ram = (test_threads_ram_t*)config->context;
+
+    ram->lock.lock_shared();
+    ram->shared += 1;
+
+    return LFS_ERR_OK;
+}
+
+static int test_threads_unlock_shared(const lfs_config_t* config) {
+
+    ((test_threads_ram_t*)config->context)->lock.unlock_shared();
+
+    return LFS_ERR_OK;
+}
+
+static std::string test_threads_name(int i) {
+    return "r" + std::to_string(i);
+}
+
+static std::vector<uint8_t> test_threads_data(int i) {
+
+    std::vector<uint8_t> data(700 + i * 1300);
+
+    for (size_t j = 0; j < data.size(); j++) {
+        data[j] = (uint8_t)(j * 7 + i * 31);
+    }
+
+    return data;
+}
+
+static bool test_threads_reader(lfs_t* lfs, uint32_t seed) {
+
+    uint32_t rng = seed;
+
+    auto next = [&]() {
+        rng = rng * 1103515245 + 12345;
+        return rng >> 8;
+    };
+
+    for (int round = 0; round < test_threads_rounds; round++) {
+
+        int i = next() % test_threads_files;
+        std::vector<uint8_t> data = test_threads_data(i);
+
+        switch (next() % 3) {
+        case 0: {
+
+            struct lfs_info info;
+
+            TEST_CHECK_OK(lfs_stat(lfs, test_threads_name(i).c_str(), &info));
+            TEST_CHECK(info.size == data.size());
+
+            break;
+        }
+        case 1: {
+
+            lfs_dir_t dir = {};
+            struct lfs_info info;
+            int count = 0;
+
+            TEST_CHECK_OK(lfs_dir_open(lfs, &dir, "/"));
+
+            int err;
+
+            while ((err = lfs_dir_read(lfs, &dir, &info)) == LFS_ERR_OK) {
+                count += (info.name[0] == 'r') ? 1 : 0;
+            }
+
+            TEST_CHECK(err == LFS_ERR_NOENT);
+            TEST_CHECK_OK(lfs_dir_close(lfs, &dir));
+            TEST_CHECK(count == test_threads_files);
+
+            break;
+        }
+        default: {
+
+            lfs_file_t file = {};
+            std::vector<uint8_t> buffer(data.size() + 16);
+            lfs_size_t size = 0;
+            lfs_size_t chunk = 1 + next() % 1500;
+
+            TEST_CHECK_OK(lfs_file_open(lfs, &file, test_threads_name(i).c_str(), LFS_O_RDONLY));
+
+            while (true) {
+
+                lfs_ssize_t res = lfs_file_read(lfs, &file, &buffer[size],
+                    std::min(chunk, (lfs_size_t)buffer.size() - size));
+
+                TEST_CHECK_OK(res);
+
+                if (!res) {
+                    break;
+                }
+
+                size += (lfs_size_t)res;
+            }
+
+            TEST_CHECK_OK(lfs_file_close(lfs, &file));
+            TEST_CHECK(size == data.size());
+            TEST_CHECK(std::equal(data.begin(), data.end(), buffer.begin()));
+
+            break;
+        }
+        }
+    }
+
+    return true;
+}
+
+static bool test_threads_writer(lfs_t* lfs, std::atomic<bool>* done) {
+
+    std::vector<uint8_t> data(3000, 0x3c);
+
+    for (uint32_t round = 0; !*done; round++) {
+
+        std::string name = "w" + std::to_string(round % 8);
+        lfs_file_t file = {};
+
+        TEST_CHECK_OK(lfs_file_open(lfs, &file, name.c_str(), LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC));
+        TEST_CHECK_OK(lfs_file_write(lfs, &file, data.data(), 100 + (round * 397) % 2900));
+        TEST_CHECK_OK(lfs_file_close(lfs, &file));
+
+        if (round % 3 == 0) {
+            TEST_CHECK_OK(lfs_remove(lfs, name.c_str()));
+        }
+    }
+
+    return true;
+}
+
+static bool test_threads_setup(lfs_t* lfs, lfs_config_t* config) {
+
+    TEST_CHECK_OK(lfs_format(lfs, config));
+    TEST_CHECK_OK(lfs_mount(lfs, config));
+
+    for (int i = 0; i < test_threads_files; i++) {
+
+        std::vector<uint8_t> data = test_threads_data(i);
+        lfs_file_t file = {};
+
+        TEST_CHECK_OK(lfs_file_open(lfs, &file, test_threads_name(i).c_str(), LFS_O_WRONLY | LFS_O_CREAT));
+        TEST_CHECK_OK(lfs_file_write(lfs, &file, data.data(), (lfs_size_t)data.size()));
+        TEST_CHECK_OK(lfs_file_close(lfs, &file));
+    }
+
+    return true;
+}
+
+int test_threads() {
+
+    test_threads_ram_t* ram = new test_threads_ram_t();
+    lfs_config_t config;
+    lfs_t lfs = {};
+
+    test_ram_config(&config, ram, test_threads_block_size, test_threads_block_count);
+
+    config.lock = test_threads_lock;
+    config.unlock = test_threads_unlock;
+    config.lock_shared = test_threads_lock_shared;
+    config.unlock_shared = test_threads_unlock_shared;
+    config.reader_count = test_threads_readers / 2;
+
+    auto start = std::chrono::steady_clock::now();
+
+    bool ok = test_threads_setup(&lfs, &config);
+
+    // without LFS_THREADSAFE nothing is locked and the threads would race
+    if (ok && !ram->locks) {
+
+        printf("threads %-16s skipped, built without LFS_THREADSAFE\n", "");
+        lfs_unmount(&lfs);
+        delete ram;
+
+        return 0;
+    }
+
+    std::atomic<bool> done{ false };
+    std::atomic<int> failed{ 0 };
+
+    if (ok) {
+
+        std::vector<std::thread> readers;
+
+        std::thread writer([&]() {
+            failed += test_threads_writer(&lfs, &done) ? 0 : 1;
+        });
+
+        for (int i = 0; i < test_threads_readers; i++) {
+
+            readers.emplace_back([&, i]() {
+                failed += test_threads_reader(&lfs, 1 + i) ? 0 : 1;
+            });
+        }
+
+        for (std::thread& reader : readers) {
+            reader.join();
+        }
+
+        done = true;
+        writer.join();
+    }
+
+    ok = ok && !failed;
+    ok = ok && lfs_unmount(&lfs) == LFS_ERR_OK;
+    ok = ok && ram->violations == 0;
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    printf("threads %-16s %s %8.1f ms  locks %8llu  shared %8llu\n", "readers", ok ? "ok    " : "FAILED", ms,
+        (unsigned long long)ram->locks, (unsigned long long)ram->shared);
+
+    delete ram;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,279 @@
+#include <map>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <cstdio>
+#include <algorithm>
+
+#include "test.h"
+#include "ram_device.h"
+#include "../example/lfs_interface.h"
+
+// The example filesystem over each of its backends, with the config it sets
+// up: files written in chunks from a few threads sharing syncs, some inside
+// a batch, some whole in a transaction, read back, listed and removed, and
+// the image grown from its first two blocks. Backends with an
+// image file are opened again afterwards and have to read back the same.
+// Backends not in the build are skipped, and without LFS_THREADSAFE the
+// example has to refuse to run at all.
+static const char* test_vfs_image = "test_vfs.fs";
+static const wchar_t* test_vfs_wimage = L"test_vfs.fs";
+static const int test_vfs_files = 12;
+static const int test_vfs_writers = 3;
+
+struct test_vfs_backend_t {
+    const char* name;
+    fs::lfsVFS::Backend backend;
+    bool persistent;
+};
+
+static const test_vfs_backend_t test_vfs_backends[] = {
+    { "memory", fs::lfsVFS::kMemoryBackend, false },
+    { "memory hugepage", fs::lfsVFS::kMemoryHugepageBackend, false },
+    { "file", fs::lfsVFS::kFileBackend, true },
+    { "posix", fs::lfsVFS::kPosixBackend, true },
+    { "posix direct", fs::lfsVFS::kPosixDirectBackend, true },
+    { "mmap", fs::lfsVFS::kMmapBackend, true },
+    { "uring", fs::lfsVFS::kUringBackend, true },
+};
+
+typedef std::map<std::string, std::vector<uint8_t>> test_vfs_model_t;
+
+static bool test_vfs_write(fs::IFileSystemDevice* filesystem, std::mt19937& rng,
+    const std::string& name, const std::vector<uint8_t>& data) {
+
+    std::shared_ptr<fs::IFileObject> file;
+
+    TEST_CHECK(filesystem->openFile(file, name,
+        fs::kFileWrite | fs::kFileCreateIfNotExists | fs::kFileTruncate) == fs::kCodeOK);
+
+    size_t off = 0;
+
+    while (off < data.size()) {
+
+        size_t chunk = std::min((size_t)(1 + rng() % 20000), data.size() - off);
+
+        TEST_CHECK(file->write(&data[off], chunk) == (int64_t)chunk);
+        off += chunk;
+    }
+
+    TEST_CHECK(file->size() == (int64_t)data.size());
+
+    return true;
+}
+
+static bool test_vfs_read(fs::IFileSystemDevice* filesystem, std::mt19937& rng,
+    const std::string& name, const std::vector<uint8_t>& data) {
+
+    std::shared_ptr<fs::IFileObject> file;
+    std::vector<uint8_t> buffer(data.size() + 16);
+    size_t size = 0;
+
+    TEST_CHECK(filesystem->openFile(file, name, fs::kFileRead) == fs::kCodeOK);
+
+    while (true) {
+
+        size_t chunk = std::min((size_t)(1 + rng() % 30000), buffer.size() - size);
+        int64_t res = file->read(&buffer[size], chunk);
+
+        TEST_CHECK(res >= 0);
+
+        if (!res) {
+            break;
+        }
+
+        size += (size_t)res;
+    }
+
+    TEST_CHECK(size == data.size());
+    TEST_CHECK(std::equal(data.begin(), data.end(), buffer.begin()));
+
+    return true;
+}
+
+static bool test_vfs_check(fs::IFileSystemDevice* filesystem, std::mt19937& rng,
+    const test_vfs_model_t& model) {
+
+    std::vector<fs::Entry> entries = filesystem->dir("/");
+
+    TEST_CHECK(entries.size() == model.size());
+
+    for (const fs::Entry& entry : entries) {
+
+        auto it = model.find(entry.getPath());
+
+        TEST_CHECK(it != model.end());
+        TEST_CHECK(entry.getType() == fs::Entry::kEntryFile);
+        TEST_CHECK(entry.getSize() == it->second.size());
+    }
+
+    for (const auto& file : model) {
+        TEST_CHECK(test_vfs_read(filesystem, rng, file.first, file.second));
+    }
+
+    return true;
+}
+
+// Writes every writers-th file from first on, those with an odd index
+// inside a batch and every fourth in a transaction of its own
+static bool test_vfs_writer(fs::lfsVFS* vfs, int first, int writers,
+    const std::vector<std::vector<uint8_t>>* files) {
+
+    std::mt19937 rng(100 + first);
+
+    for (int i = first; i < test_vfs_files; i += writers) {
+
+        bool batch = (i % 2 == 1);
+        std::string name = "v" + std::to_string(i);
+
+        if (batch) {
+            TEST_CHECK(vfs->beginBatch() == fs::kCodeOK);
+        }
+
+        if (i % 4 == 3) {
+
+            lfs_tx_t tx;
+
+            TEST_CHECK(vfs->beginTransaction(tx) == fs::kCodeOK);
+            TEST_CHECK(vfs->writeFile(tx, name, (*files)[i].data(), (*files)[i].size()) == fs::kCodeOK);
+            TEST_CHECK(vfs->commitTransaction(tx) == fs::kCodeOK);
+        }
+        else {
+            TEST_CHECK(test_vfs_write(vfs, rng, name, (*files)[i]));
+        }
+
+        if (batch) {
+            TEST_CHECK(vfs->endBatch() == fs::kCodeOK);
+        }
+    }
+
+    return true;
+}
+
+static bool test_vfs_run(const test_vfs_backend_t* backend, std::mt19937& rng, test_vfs_model_t& model) {
+
+    std::shared_ptr<fs::IFileSystemDevice> filesystem;
+
+    TEST_CHECK(fs::createVFS(test_vfs_wimage, filesystem, backend->backend) == fs::kCodeOK);
+
+    fs::lfsVFS* vfs = (fs::lfsVFS*)filesystem.get();
+    std::vector<std::vector<uint8_t>> files(test_vfs_files);
+
+    for (std::vector<uint8_t>& data : files) {
+
+        data.resize((rng() % 3 == 0) ? rng() % 300000 : rng() % 3000);
+
+        for (uint8_t& byte : data) {
+            byte = (uint8_t)rng();
+        }
+    }
+
+    // the writers share syncs and leave the background gc short idle times
+    int count = test_vfs_writers;
+
+    vfs->startGroupCommit(std::chrono::microseconds(500), count);
+    vfs->startBackgroundGC(std::chrono::milliseconds(1));
+
+    std::vector<std::thread> writers;
+    std::atomic<int> failed{ 0 };
+
+    for (int i = 0; i < count; i++) {
+
+        writers.emplace_back([&, i]() {
+            failed += test_vfs_writer(vfs, i, count, &files) ? 0 : 1;
+        });
+    }
+
+    for (std::thread& writer : writers) {
+        writer.join();
+    }
+
+    vfs->stopBackgroundGC();
+    vfs->stopGroupCommit();
+
+    TEST_CHECK(!failed);
+
+    for (int i = 0; i < test_vfs_files; i++) {
+        model["v" + std::to_string(i)] = files[i];
+    }
+
+    TEST_CHECK(test_vfs_check(filesystem.get(), rng, model));
+
+    for (int i = 0; i < test_vfs_files; i += 3) {
+
+        std::string name = "v" + std::to_string(i);
+
+        TEST_CHECK(filesystem->deleteFile(name) == fs::kCodeOK);
+        TEST_CHECK(filesystem->existsFile(name) != fs::kCodeOK);
+
+        model.erase(name);
+    }
+
+    TEST_CHECK(vfs->gc() == fs::kCodeOK);
+    TEST_CHECK(test_vfs_check(filesystem.get(), rng, model));
+
+    if (!backend->persistent) {
+        return true;
+    }
+
+    filesystem.reset();
+
+    TEST_CHECK(fs::openVFS(test_vfs_wimage, filesystem, backend->backend) == fs::kCodeOK);
+    TEST_CHECK(test_vfs_check(filesystem.get(), rng, model));
+
+    return true;
+}
+
+int test_vfs() {
+
+    int failed = 0;
+
+    // lfsVFS has to refuse a filesystem it can't share between threads
+    if (!test_ram_threadsafe()) {
+
+        std::shared_ptr<fs::IFileSystemDevice> filesystem;
+
+        bool ok = fs::createVFS(test_vfs_wimage, filesystem) == fs::kCodeObjectNotCompatible && !filesystem;
+
+        printf("vfs %-20s %s refused, built without LFS_THREADSAFE\n", "", ok ? "ok    " : "FAILED");
+
+        return ok ? 0 : 1;
+    }
+
+    for (const test_vfs_backend_t& backend : test_vfs_backends) {
+
+        std::shared_ptr<fs::IFileSystemDevice> filesystem;
+
+        // the backends a platform doesn't have aren't compiled in, and not
+        // every filesystem the image is on takes O_DIRECT
+        fs::ErrorCode code = fs::createVFS(test_vfs_wimage, filesystem, backend.backend);
+        filesystem.reset();
+
+        if (code == fs::kCodeObjectNotCompatible ||
+            (code == fs::kCodeFileNotFound && backend.backend == fs::lfsVFS::kPosixDirectBackend)) {
+
+            printf("vfs %-20s skipped, not available here\n", backend.name);
+            std::remove(test_vfs_image);
+            continue;
+        }
+
+        std::mt19937 rng(1);
+        test_vfs_model_t model;
+
+        auto start = std::chrono::steady_clock::now();
+
+        bool ok = test_vfs_run(&backend, rng, model);
+
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        printf("vfs %-20s %s %8.1f ms  files %2zu\n", backend.name, ok ? "ok    " : "FAILED", ms, model.size());
+
+        std::remove(test_vfs_image);
+        failed += ok ? 0 : 1;
+    }
+
+    return failed;
+}